@@ -0,0 +1,41 @@
+#!/bin/bash
+# Runs the native benchmark suites (mklbenchmark, openclbenchmark, arrayfirebenchmark) that are on the PATH or in
+# BENCHMARK_DIR and writes Google Benchmark JSON to RESULTS_DIR/<host>/<engine>[-threads<N>].json.  
+# mklbenchmark sweeps thread counts itself, POCL and the ArrayFire CPU backend read theirs from the environment 
+# when they load, so they run once per count in THREADS.
+
+BENCHMARK_DIR=${BENCHMARK_DIR:-}
+RESULTS_DIR=${RESULTS_DIR:-"./benchmark-results"}
+THREADS=${THREADS:-"1 2 4 8"}
+
+OUT_DIR="$RESULTS_DIR/$(hostname)"
+mkdir -p "$OUT_DIR"
+
+find_benchmark() {
+    if [[ -n "$BENCHMARK_DIR" && -x "$BENCHMARK_DIR/$1" ]]; then
+        echo "$BENCHMARK_DIR/$1"
+    else
+        which "$1" 2> /dev/null
+    fi
+}
+
+MKL=$(find_benchmark mklbenchmark)
+if [[ -n "$MKL" ]]; then
+    "$MKL" --benchmark_format=json --benchmark_out="$OUT_DIR/mkl.json" "$@"
+fi
+
+OPENCL=$(find_benchmark openclbenchmark)
+if [[ -n "$OPENCL" ]]; then
+    for t in $THREADS; do
+        POCL_MAX_PTHREAD_COUNT=$t "$OPENCL" --benchmark_format=json --benchmark_out="$OUT_DIR/opencl-threads$t.json" "$@"
+    done
+fi
+
+ARRAYFIRE=$(find_benchmark arrayfirebenchmark)
+if [[ -n "$ARRAYFIRE" ]]; then
+    for t in $THREADS; do
+        MKL_NUM_THREADS=$t OMP_NUM_THREADS=$t "$ARRAYFIRE" --benchmark_format=json --benchmark_out="$OUT_DIR/arrayfire-threads$t.json" "$@"
+    done
+fi
+
+echo "results in $OUT_DIR"
@@ -1,12 +1,194 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include "arrayfiredecon.h"
 
 #include <arrayfire.h>
 #include <af/util.h>
 
+/*
+Logging, progress and cancellation (see setLogLevel in arrayfiredecon.h), the defaults print errors only.
+*/
+static std::atomic<int> logLevel(LOG_ERROR);
+static std::atomic<int> cancelled(0);
+static ProgressCallback progressCallback = NULL;
+static void * progressUser = NULL;
+static std::mutex progressMutex;
+
+static bool logEnabled(int level) {
+  return level <= logLevel;
+}
+
+static void logMessage(int level, const char * format, ...) {
+  if (!logEnabled(level)) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+  va_end(args);
+}
+
+// reports iteration of iterations finished, returns false if the run should stop.  ArrayFire queues the work
+// asynchronously, so with a callback it syncs first and the callback sees the iterations that really finished.
+static bool continueIterating(unsigned int iteration, unsigned int iterations) {
+  ProgressCallback callback;
+  void * user;
+
+  {
+    std::lock_guard<std::mutex> lock(progressMutex);
+    callback = progressCallback;
+    user = progressUser;
+  }
+
+  if (callback != NULL) {
+    af::sync();
+
+    if (callback((int)iteration, (int)iterations, user) != 0) {
+      return false;
+    }
+  }
+
+  return !cancelled;
+}
+
+void setLogLevel(int level) {
+  logLevel = level;
+}
+
+// callback (NULL for none) is called from the thread running the deconvolution, user is passed through
+void setProgressCallback(ProgressCallback callback, void * user) {
+  std::lock_guard<std::mutex> lock(progressMutex);
+  progressCallback = callback;
+  progressUser = user;
+}
+
+// non zero stops running and later deconvolutions after their current iteration, until it is set back to 0
+void setCancelled(int value) {
+  cancelled = value;
+}
+
+/*
+Backend and device selection.  Only the library linked to the unified backend (arrayfiredecon) can switch 
+backends at run time, the per backend libraries (arrayfiredecon_cpu, _cuda, _opencl) report just their own 
+backend and setBackend fails for the others.  Arrays belong to the backend and device that were active when 
+they were created, every entry point creates its own so the selection can change between calls.  
+
+The setters return 0 or the ArrayFire error code.
+*/
+int getBackends() {
+  return af::getAvailableBackends();
+}
+
+int getActiveBackend() {
+  return (int)af::getActiveBackend();
+}
+
+int setBackend(int backend) {
+  try {
+    af::setBackend((af_backend)backend);
+    logMessage(LOG_INFO, "ArrayFire backend %d\n", (int)af::getActiveBackend());
+  }
+  catch (af::exception & e) {
+    logMessage(LOG_ERROR, "ArrayFire setBackend %d failed: %s\n", backend, e.what());
+    return e.err();
+  }
+
+  return 0;
+}
+
+// devices of the active backend
+int getDeviceCount() {
+  return af::getDeviceCount();
+}
+
+int setDevice(int device) {
+  try {
+    af::setDevice(device);
+  }
+  catch (af::exception & e) {
+    logMessage(LOG_ERROR, "ArrayFire setDevice %d failed: %s\n", device, e.what());
+    return e.err();
+  }
+
+  return 0;
+}
+
+/*
+Statistics (see enableStats in arrayfiredecon.h), each call collects its own in a CallStats and adds them to the 
+totals when it returns.  The peak is the getPeakMemoryBatch figure of the call, as in the MKL engine.
+*/
+static std::atomic<int> statsLevel(STATS_OFF);
+static double stats[STATS_COUNT];
+static std::mutex statsMutex;
+
+static double statsClock() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct CallStats {
+  int level;
+  double start, last;
+  double values[STATS_COUNT];
+
+  CallStats(bool active = true) : level(active ? (int)statsLevel : STATS_OFF), start(0), last(0) {
+    memset(values, 0, sizeof(values));
+    if (level) start = last = statsClock();
+  }
+
+  // charges the time since the last phase to values[index], after the device finished the work queued in it
+  void phase(int index) {
+    if (level < STATS_PHASES) return;
+    af::sync();
+    double now = statsClock();
+    values[index] += now - last;
+    last = now;
+  }
+
+  void add(int index, double n) {
+    if (level) values[index] += n;
+  }
+
+  ~CallStats() {
+    if (!level) return;
+    values[STATS_TOTAL_SECONDS] = statsClock() - start;
+    values[STATS_CALLS] = 1;
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    for (int i = 0; i < STATS_COUNT; i++) {
+      stats[i] = i == STATS_PEAK_BYTES ? std::max(stats[i], values[i]) : stats[i] + values[i];
+    }
+  }
+};
+
+void enableStats(int level) {
+  statsLevel = level;
+}
+
+void resetStats() {
+  std::lock_guard<std::mutex> lock(statsMutex);
+  memset(stats, 0, sizeof(stats));
+}
+
+// copies min(n, STATS_COUNT) of the statistics into stats_out, returns the number copied
+int getStats(double * stats_out, int n) {
+  n = std::min(n, STATS_COUNT);
+
+  std::lock_guard<std::mutex> lock(statsMutex);
+  for (int i = 0; i < n; i++) {
+    stats_out[i] = stats[i];
+  }
+  return n;
+}
+
 void test() {
-  printf("Test arrayfire entry point\n");
+  logMessage(LOG_INFO, "Test arrayfire entry point\n");
 }
 
 void arrayTest( int n, float * f) {
@@ -14,25 +196,27 @@ void arrayTest( int n, float * f) {
     af::array a = af::array(n,f);
     // Sum the values and copy the result to the CPU:
     double sum = af::sum<float>(a);
-    printf("sum: %g\n", sum);
+    logMessage(LOG_INFO, "sum: %g\n", sum);
 
 }
 
 int conv(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out) {
-  printf("\nEntering Convolution");
+  logMessage(LOG_INFO, "Entering Convolution\n");
 
   af::array a_image = af::array(N1, N2, N3, h_image);
   af::array a_psf = af::array(N1, N2, N3, h_psf);
   
-  float sum_image = af::sum<float>(a_image);
-  float sum_psf = af::sum<float>(a_psf);
-  
-  printf("sum image: %g\n", sum_image);
-  printf("sum psf: %g\n", sum_psf);
+  // the sums are reductions (and a sync each), only worth it when they are printed
+  if (logEnabled(LOG_DEBUG)) {
+    logMessage(LOG_DEBUG, "sum image: %g\n", af::sum<float>(a_image));
+    logMessage(LOG_DEBUG, "sum psf: %g\n", af::sum<float>(a_psf));
+  }
  
   af::array convolved=af::fftConvolve3(a_image, a_psf);
-  float sum_convolved = af::sum<float>(convolved);
-  printf("sum convolved: %g\n", sum_convolved);
+
+  if (logEnabled(LOG_DEBUG)) {
+    logMessage(LOG_DEBUG, "sum convolved: %g\n", af::sum<float>(convolved));
+  }
  
   convolved.host(h_out);
   
@@ -40,16 +224,15 @@ int conv(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h
 }
 
 int conv2(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out) {
-  printf("\nEntering Convolution 2\n");
+  logMessage(LOG_INFO, "Entering Convolution 2\n");
 
   af::array a_image = af::array(N1, N2, N3, h_image);
   af::array a_psf = af::array(N1, N2, N3, h_psf);
   
-  float sum_image = af::sum<float>(a_image);
-  float sum_psf = af::sum<float>(a_psf);
-  
-  printf("sum image: %g\n", sum_image);
-  printf("sum psf: %g\n", sum_psf);
+  if (logEnabled(LOG_DEBUG)) {
+    logMessage(LOG_DEBUG, "sum image: %g\n", af::sum<float>(a_image));
+    logMessage(LOG_DEBUG, "sum psf: %g\n", af::sum<float>(a_psf));
+  }
   
   af::array fft1=af::fftR2C<3>(a_image);
   af::array fft2=af::fftR2C<3>(a_psf);
@@ -60,44 +243,146 @@ int conv2(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *
   return 0;
 }
 
-int deconv(unsigned int iter, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_object, float * h_normal) {
-    printf("\nEntering Decon\n");
+/*
+Richardson Lucy on device arrays.  otf is the FFT of the PSF scaled by 1/N (see makeOTF), so the inverse 
+transforms run with a norm_factor of 1 (ArrayFire's default is 1/N) and the scale costs no pass of its own.  normal
+is optional (NULL), the estimate is divided by it where it is > 0 and set to 0 where it is not.
 
-    af::array a_image = af::array(N1, N2, N3, h_image);
-    af::array a_object = af::array(N1, N2, N3, h_object);
-    af::array a_psf = af::array(N1, N2, N3, h_psf);
-  
-    af::array fft2=af::fftR2C<3>(a_psf);
-    af::array fft2_ = af::conjg(fft2); 
+image and object can be a batch of volumes along dim 3, the transforms are rank 3 so ArrayFire batches them 
+over dim 3, and the single volume otf and normal are tiled to the batch inside the fused kernels.
+
+Returns false if the progress callback or setCancelled stopped it (object then holds the last finished iteration), 
+the progress is only reported if reportProgress is set.
 
-    printf("fft dims %d %d %d\n",fft2.dims()[0], fft2.dims()[1], fft2.dims()[2]);
+ArrayFire arrays are reference counted and freed buffers go back to its memory manager, so assigning each FFT
+result to the same array (spectrum, reblurred, update) hands the previous buffer of the same size back to the
+next transform, and after the first iteration no device memory is allocated.  The elementwise steps are left to
+the JIT, which fuses each chain into one kernel when the next transform (or af::eval) reads it: 
+  spectrum*otf, image/reblurred and estimate*update/normal
+af::eval at the end of the iteration bounds the JIT graph of the estimate to one iteration. 
+*/
+static bool richardsonLucy(unsigned int iter, const af::array & image, const af::array & otf, af::array & object, const af::array * normal, CallStats & callStats, bool reportProgress) {
+    // the R2C transform halves the first dimension, the inverse needs to know if it was odd 
+    const bool odd = object.dims(0) % 2 == 1;
 
-    printf("fft2 is complex %d\n",fft2.iscomplex());
-    //printf("fft2 is complex %d\n",fft2.);
+    // tile is a JIT node, it is evaluated inside the kernels that read it instead of copying the OTF per volume
+    const unsigned int batch = (unsigned int)object.dims(3);
+    const af::array otfBatch = batch > 1 ? af::tile(otf, 1, 1, 1, batch) : otf;
+    af::array normalBatch;
+    if (normal != NULL) {
+      normalBatch = batch > 1 ? af::tile(*normal, 1, 1, 1, batch) : *normal;
+    }
+
+    af::array spectrum, reblurred, update;
     
     for (int i=0;i<iter;i++) {
-      printf("Array fire RL iteration %d\n", i);
-      
-      // reblur current estimate 
-      af::array fft1=af::fftR2C<3>(a_object);
-      fft1 = fft1*fft2;
-      af::array reblurred = af::fftC2R<3>(fft1,false,1./(double)(N1*N2*N3));
+      // reblur current estimate, the multiply by the OTF is evaluated by the inverse transform
+      spectrum = af::fftR2C<3>(object);
+      reblurred = af::fftC2R<3>(spectrum*otfBatch, odd, 1.0);
 
-      // divide observed image by reblurred
-      af::array div = a_image/reblurred;
+      // divide observed image by reblurred (0 where reblurred is not positive, as the MKL version), fused into 
+      // the input of the forward transform
+      spectrum = af::fftR2C<3>(af::select(reblurred > 0, image/reblurred, 0.0f));
       
       // correlate with PSF to get update factor
-      fft1=af::fftR2C<3>(div);
-      fft1= fft1*fft2_;
-      af::array update = af::fftC2R<3>(fft1,false, 1./(double)(N1*N2*N3));
+      update = af::fftC2R<3>(spectrum*af::conjg(otfBatch), odd, 1.0);
+      callStats.phase(STATS_FFT_SECONDS);
       
-      // update object 
-      a_object=update*a_object;
+      // update object, and divide by the normal, in one kernel (0 where the normal is not positive, as the CUDA
+      // and CPU engines)
+      if (normal != NULL) {
+        object = af::select(normalBatch > 0, object*update/normalBatch, 0.0f);
+      }
+      else {
+        object = object*update;
+      }
+      
+      af::eval(object);
+      callStats.phase(STATS_POINTWISE_SECONDS);
+
+      callStats.add(STATS_ITERATIONS, 1);
+      callStats.add(STATS_FFTS, 4);
+
+      logMessage(LOG_DEBUG, "Array fire RL iteration %d\n", i);
+
+      if (reportProgress && !continueIterating(i + 1, iter)) {
+        logMessage(LOG_INFO, "cancelled after %d iterations\n", i + 1);
+        return false;
+      }
+    }
+
+    return true;
+}
+
+// FFT of the PSF with the 1/N normalization of both inverse transforms folded in (N the voxels of one volume), 
+// richardsonLucy passes a norm_factor of 1 to the inverses
+static af::array makeOTF(const af::array & psf) {
+    af::array otf = af::fftR2C<3>(psf, 1./(double)psf.elements());
+    af::eval(otf);
+
+    return otf;
+}
+
+int deconv(unsigned int iter, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_object, float * h_normal) {
+    return deconv_batch(iter, N1, N2, N3, 1, h_image, h_psf, h_object, h_normal);
+}
+
+/*
+Batched deconv of M N1 x N2 x N3 volumes (time points, tiles) with one PSF.  h_image and h_object hold the 
+volumes one after the other (dims N1, N2, N3, M, in numpy a contiguous (M, N3, N2, N1) array), h_psf and the 
+optional h_normal are a single volume shared by all of them.  All volumes run the iterations together, so for 
+small tiles the kernel launches and JIT compiles of an iteration are paid once per batch instead of per volume.
+*/
+int deconv_batch(unsigned int iter, size_t N1, size_t N2, size_t N3, size_t M, float *h_image, float *h_psf, float *h_object, float * h_normal) {
+    logMessage(LOG_INFO, "Entering batched Decon, %zu volumes\n", M);
+
+    CallStats callStats;
+    callStats.add(STATS_PEAK_BYTES, (double)getPeakMemoryBatch(N1, N2, N3, M, h_normal != NULL));
+
+    const size_t bytes = N1*N2*N3*sizeof(float);
+
+    af::array a_image = af::array(N1, N2, N3, M, h_image);
+    af::array a_object = af::array(N1, N2, N3, M, h_object);
+    af::array a_psf = af::array(N1, N2, N3, h_psf);
+    af::array a_normal;
+    if (h_normal != NULL) {
+      a_normal = af::array(N1, N2, N3, h_normal);
     }
+
+    // ArrayFire plans (and caches) the transforms on their first use, so plan time is part of the OTF and FFT time
+    callStats.phase(STATS_TRANSFER_SECONDS);
+    callStats.add(STATS_BYTES_TO_DEVICE, (2*M + (h_normal != NULL ? 2 : 1)) * bytes);
+
+    af::array a_otf = makeOTF(a_psf);
+    callStats.phase(STATS_OTF_SECONDS);
+    callStats.add(STATS_FFTS, 1);
+    
+    bool finished = richardsonLucy(iter, a_image, a_otf, a_object, h_normal != NULL ? &a_normal : NULL, callStats, true);
     
     a_object.host(h_object);
+    callStats.phase(STATS_TRANSFER_SECONDS);
+    callStats.add(STATS_BYTES_FROM_DEVICE, M * bytes);
     
-    return 0;
+    return finished ? 0 : DECONV_CANCELLED;
 }
 
-  
+/*
+Peak device bytes of deconv_batch for M N1 x N2 x N3 volumes (with a normal if normal is not 0), M 1 is deconv.
+
+Counted from the arrays richardsonLucy holds when the estimate is updated: the image, the estimate and the new 
+estimate, the reblurred image and the update (M volumes each), the spectrum (M half spectra), the OTF and the 
+normal.  While a transform is assigned its previous result is still held, which at most matches the new estimate 
+of the update step, plus the product with the OTF the inverse reads (M half spectra).  The rounding of ArrayFire's 
+memory manager and the FFT library's plan work area (cuFFT, clFFT) are not included.
+*/
+long long getPeakMemoryBatch(size_t N1, size_t N2, size_t N3, size_t M, int normal) {
+    const long long volumeBytes = (long long)N1*N2*N3*sizeof(float);
+    const long long spectrumBytes = (long long)(N1/2+1)*N2*N3*2*sizeof(float);
+
+    return 5*(long long)M*volumeBytes + (2*(long long)M + 1)*spectrumBytes + (normal ? volumeBytes : 0);
+}
+
+// peak device bytes of deconv, see getPeakMemoryBatch
+long long getPeakMemory(size_t N1, size_t N2, size_t N3, int normal) {
+    return getPeakMemoryBatch(N1, N2, N3, 1, normal);
+}
@@ -1,11 +1,72 @@
 #pragma once
 
+// backends for setBackend and the bits of getBackends (the values of af_backend)
+#define BACKEND_DEFAULT 0
+#define BACKEND_CPU 1
+#define BACKEND_CUDA 2
+#define BACKEND_OPENCL 4
+
+// levels for enableStats, the statistics cover deconv and deconv_batch
+// no statistics, the default (the calls only test a flag)
+#define STATS_OFF 0
+// counters and the total time of each call, no extra synchronization
+#define STATS_COUNTERS 1
+// also the time of each phase, af::sync after every phase so the phase times add up.  The JIT fuses the 
+// elementwise steps into the transforms that read them, so those are counted as FFT time. 
+#define STATS_PHASES 2
+
+// indices into the array getStats fills, sums over the calls since resetStats
+// (except STATS_PEAK_BYTES, the largest of any call)
+#define STATS_PLAN_SECONDS 0
+#define STATS_OTF_SECONDS 1
+#define STATS_FFT_SECONDS 2
+#define STATS_POINTWISE_SECONDS 3
+#define STATS_TRANSFER_SECONDS 4
+#define STATS_TOTAL_SECONDS 5
+#define STATS_CALLS 6
+#define STATS_ITERATIONS 7
+#define STATS_FFTS 8
+#define STATS_BYTES_TO_DEVICE 9
+#define STATS_BYTES_FROM_DEVICE 10
+#define STATS_PEAK_BYTES 11
+#define STATS_COUNT 12
+
+// levels for setLogLevel, a message is printed if its level is at most the set level (errors go to stderr)
+#define LOG_NONE 0
+// errors only, the default
+#define LOG_ERROR 1
+// a line per call
+#define LOG_INFO 2
+// a line per iteration (and the sums of the conv inputs)
+#define LOG_DEBUG 3
+
+// returned by deconv and deconv_batch when the run was cancelled, h_object holds the last finished iteration
+// (outside the ArrayFire error codes)
+#define DECONV_CANCELLED -2000
+
+// called after every RL iteration with the number of finished iterations, returning non zero cancels the run
+typedef int (*ProgressCallback)(int iteration, int iterations, void * user);
+
 #ifdef _WIN64
   __declspec(dllexport) void test();
   __declspec(dllexport) void arrayTest( int n, float * a);
   __declspec(dllexport) int conv(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out);
   __declspec(dllexport)int conv2(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out);
   __declspec(dllexport) int deconv(unsigned int iter, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_object, float * h_normal);
+  __declspec(dllexport) int deconv_batch(unsigned int iter, size_t N1, size_t N2, size_t N3, size_t M, float *h_image, float *h_psf, float *h_object, float * h_normal);
+  __declspec(dllexport) long long getPeakMemory(size_t N1, size_t N2, size_t N3, int normal);
+  __declspec(dllexport) long long getPeakMemoryBatch(size_t N1, size_t N2, size_t N3, size_t M, int normal);
+  __declspec(dllexport) int getBackends();
+  __declspec(dllexport) int getActiveBackend();
+  __declspec(dllexport) int setBackend(int backend);
+  __declspec(dllexport) int getDeviceCount();
+  __declspec(dllexport) int setDevice(int device);
+  __declspec(dllexport) void enableStats(int level);
+  __declspec(dllexport) void resetStats();
+  __declspec(dllexport) int getStats(double * stats, int n);
+  __declspec(dllexport) void setLogLevel(int level);
+  __declspec(dllexport) void setProgressCallback(ProgressCallback callback, void * user);
+  __declspec(dllexport) void setCancelled(int cancelled);
 #else
   extern "C" {
     void test();
@@ -13,6 +74,20 @@
     int conv(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out);
     int conv2(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out);
     int deconv(unsigned int iter, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_object, float * h_normal);
+    int deconv_batch(unsigned int iter, size_t N1, size_t N2, size_t N3, size_t M, float *h_image, float *h_psf, float *h_object, float * h_normal);
+    long long getPeakMemory(size_t N1, size_t N2, size_t N3, int normal);
+    long long getPeakMemoryBatch(size_t N1, size_t N2, size_t N3, size_t M, int normal);
+    int getBackends();
+    int getActiveBackend();
+    int setBackend(int backend);
+    int getDeviceCount();
+    int setDevice(int device);
+    void enableStats(int level);
+    void resetStats();
+    int getStats(double * stats, int n);
+    void setLogLevel(int level);
+    void setProgressCallback(ProgressCallback callback, void * user);
+    void setCancelled(int cancelled);
 }
 #endif
 
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <arrayfire.h>
+#include "arrayfiredecon.h"
+
+// License: BSD
+
+// Google Benchmark suite of the ArrayFire CPU engine: fftR2C/fftC2R on device arrays, and the conv2 and deconv
+// entry points (host arrays in and out, as they are called).  Run with 
+//   arrayfirebenchmark --benchmark_format=json --benchmark_out=arrayfire.json
+// The CPU backend has no thread count API, its FFTs and BLAS use the threads of the library it was built with 
+// (MKL_NUM_THREADS or OMP_NUM_THREADS), so thread sweeps are separate runs (see benchmark.sh in the repository 
+// root) and the thread count is in the context of the output.
+
+// RL iterations per benchmark iteration
+#define RL_ITERATIONS 10
+
+// {nx, ny, nz}, powers of two and sizes with a large prime factor
+static const int64_t sizes[][3] = {
+  {128, 128, 64}, {256, 256, 64}, {512, 512, 64},
+  {127, 127, 61}, {251, 251, 61}, {509, 509, 61}
+};
+
+static void allSizes(benchmark::internal::Benchmark * b) {
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    b->Args({sizes[s][0], sizes[s][1], sizes[s][2]});
+  }
+
+  b->ArgNames({"nx", "ny", "nz"});
+}
+
+static std::vector<float> randomVolume(size_t n, float scale) {
+  std::vector<float> volume(n);
+
+  for (size_t i = 0; i < n; i++) {
+    volume[i] = scale * rand() / RAND_MAX;
+  }
+
+  return volume;
+}
+
+static void BM_ArrayFire_FFTForward(benchmark::State & state) {
+  const dim_t nx = state.range(0), ny = state.range(1), nz = state.range(2);
+
+  af::array image = af::randu(nx, ny, nz);
+  af::array spectrum;
+  af::eval(image);
+
+  for (auto _ : state) {
+    spectrum = af::fftR2C<3>(image);
+    af::sync();
+  }
+
+  state.SetItemsProcessed(state.iterations() * nx * ny * nz);
+}
+
+static void BM_ArrayFire_FFTInverse(benchmark::State & state) {
+  const dim_t nx = state.range(0), ny = state.range(1), nz = state.range(2);
+
+  af::array spectrum = af::fftR2C<3>(af::randu(nx, ny, nz));
+  af::array image;
+  af::eval(spectrum);
+
+  for (auto _ : state) {
+    image = af::fftC2R<3>(spectrum, nx % 2 == 1);
+    af::sync();
+  }
+
+  state.SetItemsProcessed(state.iterations() * nx * ny * nz);
+}
+
+static void BM_ArrayFire_Convolve(benchmark::State & state) {
+  const size_t nx = state.range(0), ny = state.range(1), nz = state.range(2);
+  const size_t n = nx * ny * nz;
+
+  std::vector<float> image = randomVolume(n, 1);
+  std::vector<float> psf = randomVolume(n, 1.0f / n);
+  std::vector<float> out(n);
+
+  for (auto _ : state) {
+    conv2(nx, ny, nz, image.data(), psf.data(), out.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_ArrayFire_RichardsonLucy(benchmark::State & state) {
+  const size_t nx = state.range(0), ny = state.range(1), nz = state.range(2);
+  const size_t n = nx * ny * nz;
+
+  std::vector<float> image = randomVolume(n, 1);
+  std::vector<float> psf = randomVolume(n, 1.0f / n);
+  std::vector<float> estimate(n);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    estimate = image;
+    state.ResumeTiming();
+
+    deconv(RL_ITERATIONS, nx, ny, nz, image.data(), psf.data(), estimate.data(), NULL);
+  }
+
+  state.SetItemsProcessed(state.iterations() * n * RL_ITERATIONS);
+  state.counters["rl_iterations"] = benchmark::Counter(RL_ITERATIONS, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_ArrayFire_FFTForward)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ArrayFire_FFTInverse)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ArrayFire_Convolve)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_ArrayFire_RichardsonLucy)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char ** argv) {
+  benchmark::Initialize(&argc, argv);
+
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  char name[256] = "", platform[256] = "", toolkit[256] = "", compute[256] = "";
+  af::deviceInfo(name, platform, toolkit, compute);
+
+  const char * threads = getenv("MKL_NUM_THREADS") != NULL ? getenv("MKL_NUM_THREADS") : getenv("OMP_NUM_THREADS");
+
+  benchmark::AddCustomContext("engine", "arrayfire-cpu");
+  benchmark::AddCustomContext("device", name);
+  benchmark::AddCustomContext("threads", threads != NULL ? threads : "default");
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  return 0;
+}
@@ -6,10 +6,12 @@ import org.bytedeco.javacpp.Loader;
 import org.bytedeco.javacpp.annotation.Platform;
 import org.bytedeco.javacpp.annotation.Properties;
 
+// linked to the unified backend (arrayfiredecon), which loads afcpu, afcuda or afopencl at run time, so
+// setBackend can switch between them
 @Properties(value = { @Platform(include = "arrayfiredecon.h", linkpath = {"/opt/arrayfire/lib64/"}, link = {
-	"arrayfiredecon_cpu" },
+	"arrayfiredecon" },
 //preload = {"iomp5", "mkl_avx", "mkl_avx2", "mkl_avx512", "mkl_def", "mkl_mc", "mkl_mc3", "mkl_core", "mkl_gnu_thread", "mkl_intel_lp64"}) 
-preload = { "afcpu", "mkl_avx", "mkl_avx2", "mkl_avx512", "mkl_def", "mkl_mc", "mkl_mc3", "mkl_core", "mkl_gnu_thread", "mkl_intel_lp64"}) 
+preload = { "af", "afcpu", "mkl_avx", "mkl_avx2", "mkl_avx512", "mkl_def", "mkl_mc", "mkl_mc3", "mkl_core", "mkl_gnu_thread", "mkl_intel_lp64"}) 
 })
 public class ArrayFireWrapper {
 
@@ -20,6 +22,56 @@ public class ArrayFireWrapper {
 	public static native int conv2(long N1, long N2, long N3,
 		FloatPointer h_image, FloatPointer h_psf, FloatPointer h_out);
 
+	// h_normal can be null
+	public static native int deconv(int iter, long N1, long N2, long N3,
+		FloatPointer h_image, FloatPointer h_psf, FloatPointer h_object,
+		FloatPointer h_normal);
+
+	// peak device bytes of deconv, counted from the arrays of the iterations
+	// (normal 1 with a normal)
+	public static native long getPeakMemory(long N1, long N2, long N3,
+		int normal);
+
+	// M volumes one after the other in h_image and h_object, one PSF and
+	// (optional) normal for all of them
+	public static native int deconv_batch(int iter, long N1, long N2, long N3,
+		long M, FloatPointer h_image, FloatPointer h_psf, FloatPointer h_object,
+		FloatPointer h_normal);
+
+	public static native long getPeakMemoryBatch(long N1, long N2, long N3,
+		long M, int normal);
+
+	// backends, the values of af_backend, getBackends returns a bit mask of them
+	public static final int BACKEND_DEFAULT = 0;
+	public static final int BACKEND_CPU = 1;
+	public static final int BACKEND_CUDA = 2;
+	public static final int BACKEND_OPENCL = 4;
+
+	// the setters return 0 or the ArrayFire error code
+	public static native int getBackends();
+
+	public static native int getActiveBackend();
+
+	public static native int setBackend(int backend);
+
+	public static native int getDeviceCount();
+
+	public static native int setDevice(int device);
+
+	// engine statistics, levels and indices are the STATS_ defines of the native header
+	// (0 off, 1 counters, 2 per phase times), getStats returns the number of values copied
+	public static native void enableStats(int level);
+
+	public static native void resetStats();
+
+	public static native int getStats(double[] stats, int n);
+
+	// log level (0 none, 1 errors, the default, 2 info, 3 debug) and cancellation, a cancelled run returns
+	// DECONV_CANCELLED (-2000) after its current iteration, until set back to 0
+	public static native void setLogLevel(int level);
+
+	public static native void setCancelled(int cancelled);
+
 	public static void load() {
 		Loader.load();
 	};
@@ -28,6 +28,15 @@ public class Convolve extends AbstractCLIJPlugin implements CLIJMacroPlugin, CLI
     }
 
     static boolean convolveWithCustomKernel(CLIJ clij, ClearCLBuffer src, ClearCLBuffer kernel, ClearCLBuffer dst) {
+        // float images with an odd sized kernel use the local memory tiled kernel
+        if (TiledConvolve.canConvolveTiled(src, kernel, dst)) {
+            return TiledConvolve.convolveTiled(clij, src, kernel, dst);
+        }
+
+        return convolveWithCustomKernelDirect(clij, src, kernel, dst);
+    }
+
+    static boolean convolveWithCustomKernelDirect(CLIJ clij, ClearCLBuffer src, ClearCLBuffer kernel, ClearCLBuffer dst) {
         HashMap<String, Object> parameters = new HashMap<>();
         parameters.put("src", src);
         parameters.put("kernelImage", kernel);
@@ -0,0 +1,163 @@
+package net.haesleinhuepf.clij.customconvolutionplugin;
+
+import net.haesleinhuepf.clij.CLIJ;
+import net.haesleinhuepf.clij.clearcl.ClearCLBuffer;
+import net.haesleinhuepf.clij.clearcl.ClearCLContext;
+import net.haesleinhuepf.clij.clearcl.ClearCLKernel;
+import net.haesleinhuepf.clij.clearcl.ClearCLProgram;
+import net.haesleinhuepf.clij.coremem.enums.NativeTypeEnum;
+
+import java.io.IOException;
+import java.nio.FloatBuffer;
+import java.util.HashMap;
+
+/**
+ * Local memory tiled and separable convolution (see tiledConvolution.cl).
+ *
+ * The kernels need an explicit work group size, which clij.execute does not
+ * set, so the programs are built here with ClearCL, one per kernel size, and
+ * cached per context.
+ */
+public class TiledConvolve {
+
+    // work group size, each work group stages a TILE_X x TILE_Y tile plus the kernel halo in local memory
+    static final int TILE_X = 16;
+    static final int TILE_Y = 16;
+
+    // kernels up to this size are passed in __constant memory (the minimum the OpenCL spec guarantees is 64 kB)
+    static final long MAX_CONSTANT_PSF_BYTES = 60 * 1024;
+
+    // largest halo tile that fits the 32 kB of local memory the OpenCL spec guarantees
+    static final long MAX_LOCAL_TILE_BYTES = 32 * 1024;
+
+    private static final HashMap<String, ClearCLProgram> programs = new HashMap<>();
+
+    /**
+     * true if src, kernel and dst can use the tiled kernel (float buffers, odd kernel size and the halo tile fits
+     * in local memory), otherwise use Convolve.convolveWithCustomKernel
+     */
+    public static boolean canConvolveTiled(ClearCLBuffer src, ClearCLBuffer kernel, ClearCLBuffer dst) {
+        if (src.getNativeType() != NativeTypeEnum.Float || kernel.getNativeType() != NativeTypeEnum.Float || dst.getNativeType() != NativeTypeEnum.Float) {
+            return false;
+        }
+
+        if (kernel.getWidth() % 2 == 0 || kernel.getHeight() % 2 == 0 || (src.getDimension() > 2 && kernel.getDepth() % 2 == 0)) {
+            return false;
+        }
+
+        long haloTile = (TILE_X + kernel.getWidth() - 1) * (TILE_Y + kernel.getHeight() - 1) * 4;
+        return haloTile <= MAX_LOCAL_TILE_BYTES;
+    }
+
+    public static boolean convolveTiled(CLIJ clij, ClearCLBuffer src, ClearCLBuffer kernel, ClearCLBuffer dst) {
+        int radiusX = (int) kernel.getWidth() / 2;
+        int radiusY = (int) kernel.getHeight() / 2;
+        int radiusZ = src.getDimension() > 2 ? (int) kernel.getDepth() / 2 : 0;
+
+        boolean constantPsf = kernel.getSizeInBytes() <= MAX_CONSTANT_PSF_BYTES;
+
+        ClearCLKernel clKernel = getProgram(clij, radiusX, radiusY, radiusZ, constantPsf).createKernel("convolution_tiled");
+        return run(clKernel, src, kernel, dst);
+    }
+
+    /**
+     * Convolve with the outer product of three 1D kernels (odd lengths) in three passes, pass null as kernelZ for 2D
+     */
+    public static boolean convolveSeparable(CLIJ clij, ClearCLBuffer src, float[] kernelX, float[] kernelY, float[] kernelZ, ClearCLBuffer dst) {
+        boolean threeD = src.getDimension() > 2 && kernelZ != null;
+
+        int radiusX = kernelX.length / 2;
+        int radiusY = kernelY.length / 2;
+        int radiusZ = threeD ? kernelZ.length / 2 : 0;
+
+        ClearCLProgram program = getProgram(clij, radiusX, radiusY, radiusZ, false);
+
+        ClearCLBuffer weightsX = pushWeights(clij, kernelX);
+        ClearCLBuffer weightsY = pushWeights(clij, kernelY);
+        ClearCLBuffer temp = clij.createCLBuffer(src);
+
+        boolean result;
+
+        if (threeD) {
+            ClearCLBuffer weightsZ = pushWeights(clij, kernelZ);
+            ClearCLBuffer temp2 = clij.createCLBuffer(src);
+
+            result = run(program.createKernel("convolution_separable_x"), src, weightsX, temp) &&
+                    run(program.createKernel("convolution_separable_y"), temp, weightsY, temp2) &&
+                    run(program.createKernel("convolution_separable_z"), temp2, weightsZ, dst);
+
+            temp2.close();
+            weightsZ.close();
+        } else {
+            result = run(program.createKernel("convolution_separable_x"), src, weightsX, temp) &&
+                    run(program.createKernel("convolution_separable_y"), temp, weightsY, dst);
+        }
+
+        temp.close();
+        weightsX.close();
+        weightsY.close();
+
+        return result;
+    }
+
+    private static ClearCLProgram getProgram(CLIJ clij, int radiusX, int radiusY, int radiusZ, boolean constantPsf) {
+        ClearCLContext context = clij.getClearCLContext();
+
+        String key = System.identityHashCode(context) + "_" + radiusX + "_" + radiusY + "_" + radiusZ + "_" + constantPsf;
+
+        synchronized (programs) {
+            ClearCLProgram program = programs.get(key);
+
+            if (program == null) {
+                try {
+                    program = context.createProgram(TiledConvolve.class, "tiledConvolution.cl");
+                } catch (IOException e) {
+                    throw new RuntimeException(e);
+                }
+
+                program.addDefine("RADIUS_X", radiusX);
+                program.addDefine("RADIUS_Y", radiusY);
+                program.addDefine("RADIUS_Z", radiusZ);
+                program.addDefine("TILE_X", TILE_X);
+                program.addDefine("TILE_Y", TILE_Y);
+                if (constantPsf) {
+                    program.addDefine("PSF_CONSTANT");
+                }
+
+                program.buildAndLog();
+                programs.put(key, program);
+            }
+
+            return program;
+        }
+    }
+
+    private static ClearCLBuffer pushWeights(CLIJ clij, float[] weights) {
+        ClearCLBuffer buffer = clij.createCLBuffer(new long[]{weights.length}, NativeTypeEnum.Float);
+        buffer.readFrom(FloatBuffer.wrap(weights), true);
+        return buffer;
+    }
+
+    private static boolean run(ClearCLKernel clKernel, ClearCLBuffer src, ClearCLBuffer weights, ClearCLBuffer dst) {
+        long depth = src.getDimension() > 2 ? src.getDepth() : 1;
+
+        clKernel.setArgument(0, src);
+        clKernel.setArgument(1, weights);
+        clKernel.setArgument(2, dst);
+        clKernel.setArgument(3, (int) src.getWidth());
+        clKernel.setArgument(4, (int) src.getHeight());
+        clKernel.setArgument(5, (int) depth);
+
+        // global size rounded up to whole tiles, the kernels skip the writes past the edge
+        clKernel.setGlobalSizes(roundUp(src.getWidth(), TILE_X), roundUp(src.getHeight(), TILE_Y), depth);
+        clKernel.setLocalSizes(TILE_X, TILE_Y, 1);
+        clKernel.run(true);
+        clKernel.close();
+
+        return true;
+    }
+
+    private static long roundUp(long size, long tile) {
+        return ((size + tile - 1) / tile) * tile;
+    }
+}
@@ -0,0 +1,190 @@
+// Tiled direct convolution on float buffers.  The program is built for one kernel size with the defines
+//   RADIUS_X, RADIUS_Y, RADIUS_Z - half size of the convolution kernel, which is (2*RADIUS+1) wide in each dimension
+//   TILE_X, TILE_Y - work group size in x and y, work groups are TILE_X x TILE_Y x 1
+//   PSF_CONSTANT - (optional) read the kernel weights from __constant memory
+// so the tap loops have compile time bounds.  Like custom_convolution_3d in customConvolution.cl the kernel
+// is not flipped, and reads outside the image are clamped to the edge.
+
+#ifdef PSF_CONSTANT
+#define PSF_SPACE __constant
+#else
+#define PSF_SPACE __global const
+#endif
+
+#define KERNEL_WIDTH (2*RADIUS_X + 1)
+#define KERNEL_HEIGHT (2*RADIUS_Y + 1)
+
+#define HALO_TILE_X (TILE_X + 2*RADIUS_X)
+#define HALO_TILE_Y (TILE_Y + 2*RADIUS_Y)
+
+// load the (TILE_X + 2*hx) x (TILE_Y + 2*hy) neighbourhood of this work group in plane z into local memory,
+// every work item of the group takes part
+inline void loadTile(__global const float * src, __local float * tile, const int hx, const int hy, const int z,
+                     const int width, const int height, const int depth)
+{
+  const int lx = get_local_id(0);
+  const int ly = get_local_id(1);
+
+  const int x0 = get_group_id(0) * TILE_X - hx;
+  const int y0 = get_group_id(1) * TILE_Y - hy;
+
+  const int tileWidth = TILE_X + 2 * hx;
+  const int tileHeight = TILE_Y + 2 * hy;
+
+  const long plane = (long)clamp(z, 0, depth - 1) * width * height;
+
+  for (int ty = ly; ty < tileHeight; ty += TILE_Y) {
+    const long row = plane + (long)clamp(y0 + ty, 0, height - 1) * width;
+
+    for (int tx = lx; tx < tileWidth; tx += TILE_X) {
+      tile[ty * tileWidth + tx] = src[row + clamp(x0 + tx, 0, width - 1)];
+    }
+  }
+}
+
+// 2D (depth 1, RADIUS_Z 0) and 3D convolution with a full kernel.  Each plane of the kernel is applied to an
+// xy tile staged in local memory, so every image value is read from global memory once per kernel plane
+// instead of once per tap.
+__kernel __attribute__((reqd_work_group_size(TILE_X, TILE_Y, 1)))
+void convolution_tiled(
+    __global const float * src,
+    PSF_SPACE float * psf,
+    __global float * dst,
+    const int width,
+    const int height,
+    const int depth
+) {
+  __local float tile[HALO_TILE_X * HALO_TILE_Y];
+
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int z = get_global_id(2);
+
+  const int lx = get_local_id(0);
+  const int ly = get_local_id(1);
+
+  float sum = 0;
+
+  for (int kz = 0; kz <= 2 * RADIUS_Z; kz++) {
+    loadTile(src, tile, RADIUS_X, RADIUS_Y, z + kz - RADIUS_Z, width, height, depth);
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    PSF_SPACE float * psfPlane = psf + kz * KERNEL_WIDTH * KERNEL_HEIGHT;
+
+    #pragma unroll
+    for (int ky = 0; ky < KERNEL_HEIGHT; ky++) {
+      #pragma unroll
+      for (int kx = 0; kx < KERNEL_WIDTH; kx++) {
+        sum += psfPlane[ky * KERNEL_WIDTH + kx] * tile[(ly + ky) * HALO_TILE_X + lx + kx];
+      }
+    }
+
+    // the next plane overwrites the tile
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  // work items past the edge (global size is rounded up to the tile size) only help load the tile
+  if (x < width && y < height) {
+    dst[((long)z * height + y) * width + x] = sum;
+  }
+}
+
+// Separable convolution, three passes with 1D kernels of (2*RADIUS_X+1), (2*RADIUS_Y+1) and (2*RADIUS_Z+1) weights.
+
+__kernel __attribute__((reqd_work_group_size(TILE_X, TILE_Y, 1)))
+void convolution_separable_x(
+    __global const float * src,
+    __constant float * weights,
+    __global float * dst,
+    const int width,
+    const int height,
+    const int depth
+) {
+  __local float tile[HALO_TILE_X * TILE_Y];
+
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int z = get_global_id(2);
+
+  const int lx = get_local_id(0);
+  const int ly = get_local_id(1);
+
+  loadTile(src, tile, RADIUS_X, 0, z, width, height, depth);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  float sum = 0;
+
+  #pragma unroll
+  for (int k = 0; k <= 2 * RADIUS_X; k++) {
+    sum += weights[k] * tile[ly * HALO_TILE_X + lx + k];
+  }
+
+  if (x < width && y < height) {
+    dst[((long)z * height + y) * width + x] = sum;
+  }
+}
+
+__kernel __attribute__((reqd_work_group_size(TILE_X, TILE_Y, 1)))
+void convolution_separable_y(
+    __global const float * src,
+    __constant float * weights,
+    __global float * dst,
+    const int width,
+    const int height,
+    const int depth
+) {
+  __local float tile[TILE_X * HALO_TILE_Y];
+
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int z = get_global_id(2);
+
+  const int lx = get_local_id(0);
+  const int ly = get_local_id(1);
+
+  loadTile(src, tile, 0, RADIUS_Y, z, width, height, depth);
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  float sum = 0;
+
+  #pragma unroll
+  for (int k = 0; k <= 2 * RADIUS_Y; k++) {
+    sum += weights[k] * tile[(ly + k) * TILE_X + lx];
+  }
+
+  if (x < width && y < height) {
+    dst[((long)z * height + y) * width + x] = sum;
+  }
+}
+
+// the z pass reads global memory directly, neighbouring work items read neighbouring x values so the reads
+// are coalesced and a z tile would only add a barrier
+__kernel __attribute__((reqd_work_group_size(TILE_X, TILE_Y, 1)))
+void convolution_separable_z(
+    __global const float * src,
+    __constant float * weights,
+    __global float * dst,
+    const int width,
+    const int height,
+    const int depth
+) {
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+  const int z = get_global_id(2);
+
+  if (x >= width || y >= height) {
+    return;
+  }
+
+  const long planeSize = (long)width * height;
+  const long xy = (long)y * width + x;
+
+  float sum = 0;
+
+  #pragma unroll
+  for (int k = 0; k <= 2 * RADIUS_Z; k++) {
+    sum += weights[k] * src[clamp(z + k - RADIUS_Z, 0, depth - 1) * planeSize + xy];
+  }
+
+  dst[z * planeSize + xy] = sum;
+}
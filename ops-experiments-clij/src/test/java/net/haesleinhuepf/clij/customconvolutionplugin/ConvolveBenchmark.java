@@ -0,0 +1,185 @@
+package net.haesleinhuepf.clij.customconvolutionplugin;
+
+import net.haesleinhuepf.clij.CLIJ;
+import net.haesleinhuepf.clij.clearcl.ClearCLBuffer;
+import net.haesleinhuepf.clij.coremem.enums.NativeTypeEnum;
+import net.imagej.ops.experiments.filter.deconvolve.OpenCLFFTUtility;
+import org.junit.Test;
+
+import java.nio.FloatBuffer;
+
+import static org.junit.Assert.assertEquals;
+
+/**
+ * Compares the direct (customConvolution.cl), local memory tiled and separable
+ * (tiledConvolution.cl) convolutions with the clFFT based convolution in
+ * opencldeconv, for Gaussian kernels of increasing size.  The unit test checks
+ * the tiled and separable results against the direct convolution, main prints
+ * the timings.
+ */
+public class ConvolveBenchmark {
+
+    // FFT friendly size so the clFFT path doesn't need padding
+    private static final int WIDTH = 128;
+    private static final int HEIGHT = 128;
+    private static final int DEPTH = 64;
+
+    private static final int REPEATS = 5;
+
+    // the image is in [0, 100) and the kernels sum to 1, so float rounding stays well below this
+    private static final float TOLERANCE = 1e-3f;
+
+    private static final int[] RADII = {1, 3, 5, 7, 10};
+
+    /**
+     * The tiled and separable convolutions have to match the direct convolution.
+     */
+    @Test
+    public void testTiledAndSeparableMatchDirect() {
+        CLIJ clij = CLIJ.getInstance();
+
+        ClearCLBuffer src = push(clij, randomImage(), WIDTH, HEIGHT, DEPTH);
+        ClearCLBuffer reference = clij.createCLBuffer(src);
+        ClearCLBuffer dst = clij.createCLBuffer(src);
+
+        for (int radius : RADII) {
+            float[] kernel1D = gaussian(radius);
+            int size = kernel1D.length;
+
+            ClearCLBuffer kernel = push(clij, outerProduct(kernel1D), size, size, size);
+
+            Convolve.convolveWithCustomKernelDirect(clij, src, kernel, reference);
+
+            TiledConvolve.convolveTiled(clij, src, kernel, dst);
+            assertEquals("tiled, radius " + radius, 0, maxDifference(reference, dst), TOLERANCE);
+
+            TiledConvolve.convolveSeparable(clij, src, kernel1D, kernel1D, kernel1D, dst);
+            assertEquals("separable, radius " + radius, 0, maxDifference(reference, dst), TOLERANCE);
+
+            kernel.close();
+        }
+
+        src.close();
+        reference.close();
+        dst.close();
+    }
+
+    /**
+     * Times the direct, tiled, separable and FFT convolutions (not part of the unit tests).
+     */
+    public static void main(String[] args) {
+        CLIJ clij = CLIJ.getInstance();
+
+        ClearCLBuffer src = push(clij, randomImage(), WIDTH, HEIGHT, DEPTH);
+        ClearCLBuffer dst = clij.createCLBuffer(src);
+
+        for (int radius : RADII) {
+            float[] kernel1D = gaussian(radius);
+            int size = kernel1D.length;
+
+            ClearCLBuffer kernel = push(clij, outerProduct(kernel1D), size, size, size);
+
+            System.out.println("kernel " + size + "x" + size + "x" + size);
+
+            time("direct", () -> Convolve.convolveWithCustomKernelDirect(clij, src, kernel, dst));
+            time("tiled", () -> TiledConvolve.convolveTiled(clij, src, kernel, dst));
+            time("separable", () -> TiledConvolve.convolveSeparable(clij, src, kernel1D, kernel1D, kernel1D, dst));
+
+            // the FFT path takes the kernel extended to the image size with its center shifted to 0,0,0 (and is
+            // circular at the edges, so it is only compared for time)
+            ClearCLBuffer extendedKernel = push(clij, extendAndShift(outerProduct(kernel1D), size), WIDTH, HEIGHT, DEPTH);
+            time("fft", () -> OpenCLFFTUtility.runConvolve(clij, src, extendedKernel, dst));
+
+            extendedKernel.close();
+            kernel.close();
+        }
+
+        src.close();
+        dst.close();
+    }
+
+    private static void time(String name, Runnable convolution) {
+        // first call includes the program build
+        convolution.run();
+
+        long start = System.nanoTime();
+        for (int i = 0; i < REPEATS; i++) {
+            convolution.run();
+        }
+        long finish = System.nanoTime();
+
+        System.out.println("  " + name + " took " + (finish - start) / 1e6 / REPEATS + " msec");
+    }
+
+    private static float[] randomImage() {
+        float[] image = new float[WIDTH * HEIGHT * DEPTH];
+        java.util.Random random = new java.util.Random(42);
+        for (int i = 0; i < image.length; i++) {
+            image[i] = random.nextFloat() * 100;
+        }
+        return image;
+    }
+
+    private static float[] gaussian(int radius) {
+        float[] kernel = new float[2 * radius + 1];
+        float sigma = Math.max(radius / 2.0f, 0.5f);
+        float sum = 0;
+        for (int i = 0; i < kernel.length; i++) {
+            float x = i - radius;
+            kernel[i] = (float) Math.exp(-x * x / (2 * sigma * sigma));
+            sum += kernel[i];
+        }
+        for (int i = 0; i < kernel.length; i++) {
+            kernel[i] /= sum;
+        }
+        return kernel;
+    }
+
+    private static float[] outerProduct(float[] kernel1D) {
+        int n = kernel1D.length;
+        float[] kernel = new float[n * n * n];
+        for (int z = 0; z < n; z++) {
+            for (int y = 0; y < n; y++) {
+                for (int x = 0; x < n; x++) {
+                    kernel[(z * n + y) * n + x] = kernel1D[x] * kernel1D[y] * kernel1D[z];
+                }
+            }
+        }
+        return kernel;
+    }
+
+    private static float[] extendAndShift(float[] kernel, int size) {
+        float[] extended = new float[WIDTH * HEIGHT * DEPTH];
+        int c = size / 2;
+        for (int z = 0; z < size; z++) {
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    int ex = (x - c + WIDTH) % WIDTH;
+                    int ey = (y - c + HEIGHT) % HEIGHT;
+                    int ez = (z - c + DEPTH) % DEPTH;
+                    extended[(ez * HEIGHT + ey) * WIDTH + ex] = kernel[(z * size + y) * size + x];
+                }
+            }
+        }
+        return extended;
+    }
+
+    private static ClearCLBuffer push(CLIJ clij, float[] data, long width, long height, long depth) {
+        ClearCLBuffer buffer = clij.createCLBuffer(new long[]{width, height, depth}, NativeTypeEnum.Float);
+        buffer.readFrom(FloatBuffer.wrap(data), true);
+        return buffer;
+    }
+
+    private static float maxDifference(ClearCLBuffer a, ClearCLBuffer b) {
+        float[] arrayA = new float[(int) a.getLength()];
+        float[] arrayB = new float[(int) b.getLength()];
+        a.writeTo(FloatBuffer.wrap(arrayA), true);
+        b.writeTo(FloatBuffer.wrap(arrayB), true);
+
+        float max = 0;
+        for (int i = 0; i < arrayA.length; i++) {
+            max = Math.max(max, Math.abs(arrayA[i] - arrayB[i]));
+        }
+        return max;
+    }
+}
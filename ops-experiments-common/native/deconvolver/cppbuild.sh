@@ -0,0 +1,31 @@
+#!/usr/bin/env bash
+# Scripts to build and install native C++ libraries
+# Adapted from https://github.com/bytedeco/javacpp-presets
+set -eu
+
+if [[ -z "$PLATFORM" ]]; then
+    pushd ..
+    bash cppbuild.sh "$@" deconvolver
+    popd
+    exit
+fi
+
+# no engine is linked, so the same build works on every platform
+case $PLATFORM in
+    linux-*|macosx-*)
+        $CMAKE -DCMAKE_BUILD_TYPE=Release \
+               -DCMAKE_INSTALL_PREFIX="../.." ..
+        make
+        make install
+        ;;
+    windows-x86_64)
+        $CMAKE -G"NMake Makefiles" \
+               -DCMAKE_BUILD_TYPE=Release \
+               -DCMAKE_INSTALL_PREFIX="../.." ..
+        nmake
+        nmake install
+        ;;
+    *)
+        echo "Error: Platform \"$PLATFORM\" is not supported"
+        ;;
+esac
@@ -0,0 +1,251 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "deconvolvercore.h"
+
+// License: BSD
+
+// the backend registry and the C API of deconvolver.h
+
+static std::atomic<int> logLevel(LOG_ERROR);
+
+void deconvolverLog(int level, const char * format, ...) {
+  if (level > logLevel) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+  va_end(args);
+}
+
+void * loadEngineLibrary(const char * name) {
+  static std::mutex libraryMutex;
+  static std::map<std::string, void *> libraries;
+
+  std::lock_guard<std::mutex> lock(libraryMutex);
+
+  if (libraries.count(name)) {
+    return libraries[name];
+  }
+
+#ifdef _WIN32
+  std::string file = std::string(name) + ".dll";
+  void * library = (void *)LoadLibraryA(file.c_str());
+#else
+#ifdef __APPLE__
+  std::string file = "lib" + std::string(name) + ".dylib";
+#else
+  std::string file = "lib" + std::string(name) + ".so";
+#endif
+  void * library = dlopen(file.c_str(), RTLD_NOW | RTLD_LOCAL);
+
+  if (library == NULL) {
+    deconvolverLog(LOG_INFO, "%s not loaded: %s\n", file.c_str(), dlerror());
+  }
+#endif
+
+  libraries[name] = library;
+
+  return library;
+}
+
+void * engineSymbol(void * library, const char * name) {
+  if (library == NULL) {
+    return NULL;
+  }
+
+#ifdef _WIN32
+  return (void *)GetProcAddress((HMODULE)library, name);
+#else
+  return dlsym(library, name);
+#endif
+}
+
+// the registered backends, highest rank first, and whether they were probed and found
+struct RegisteredBackend {
+  DeconvolverBackend backend;
+  bool probed;
+  bool available;
+};
+
+static std::recursive_mutex registryMutex;
+
+static std::vector<RegisteredBackend> & registry() {
+  static std::vector<RegisteredBackend> backends;
+  static bool builtins = false;
+
+  // registerBuiltinBackends calls back into registerDeconvolverBackend, hence the recursive mutex
+  if (!builtins) {
+    builtins = true;
+    registerBuiltinBackends();
+  }
+
+  return backends;
+}
+
+void registerDeconvolverBackend(const DeconvolverBackend & backend) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+
+  std::vector<RegisteredBackend> & backends = registry();
+
+  RegisteredBackend registered = {backend, false, false};
+
+  for (size_t i = 0; i < backends.size(); i++) {
+    if (backends[i].backend.name == backend.name) {
+      backends.erase(backends.begin() + i);
+      break;
+    }
+  }
+
+  std::vector<RegisteredBackend>::iterator it = backends.begin();
+
+  while (it != backends.end() && it->backend.rank >= backend.rank) {
+    ++it;
+  }
+
+  backends.insert(it, registered);
+}
+
+// the registry lock is held
+static bool isAvailable(RegisteredBackend & registered) {
+  if (!registered.probed) {
+    registered.probed = true;
+    registered.available = registered.backend.probe();
+
+    deconvolverLog(LOG_INFO, "deconvolver backend %s %s\n", registered.backend.name.c_str(),
+        registered.available ? "available" : "not available");
+  }
+
+  return registered.available;
+}
+
+int getNumDeconvolverBackends() {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+
+  return (int)registry().size();
+}
+
+const char * getDeconvolverBackendName(int backend) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+
+  std::vector<RegisteredBackend> & backends = registry();
+
+  if (backend < 0 || backend >= (int)backends.size()) {
+    return NULL;
+  }
+
+  return backends[backend].backend.name.c_str();
+}
+
+int isDeconvolverBackendAvailable(int backend) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+
+  std::vector<RegisteredBackend> & backends = registry();
+
+  if (backend < 0 || backend >= (int)backends.size()) {
+    return 0;
+  }
+
+  return isAvailable(backends[backend]) ? 1 : 0;
+}
+
+void * createDeconvolver(const char * backend) {
+  std::lock_guard<std::recursive_mutex> lock(registryMutex);
+
+  std::vector<RegisteredBackend> & backends = registry();
+
+  if (backend == NULL || backend[0] == 0) {
+    backend = getenv("OPS_DECONVOLVER");
+  }
+
+  for (size_t i = 0; i < backends.size(); i++) {
+    bool named = (backend != NULL && backend[0] != 0);
+
+    if (named && backends[i].backend.name != backend) {
+      continue;
+    }
+
+    if (isAvailable(backends[i])) {
+      deconvolverLog(LOG_INFO, "deconvolver on %s\n", backends[i].backend.name.c_str());
+      return backends[i].backend.create();
+    }
+
+    if (named) {
+      break;
+    }
+  }
+
+  deconvolverLog(LOG_ERROR, "no deconvolver backend %s available\n", backend != NULL ? backend : "");
+
+  return NULL;
+}
+
+void releaseDeconvolver(void * deconvolver) {
+  delete (Deconvolver *)deconvolver;
+}
+
+const char * getDeconvolverName(void * deconvolver) {
+  return ((Deconvolver *)deconvolver)->name();
+}
+
+int deconvolverPlan(void * deconvolver, size_t N0, size_t N1, size_t N2) {
+  return ((Deconvolver *)deconvolver)->plan(N0, N1, N2);
+}
+
+int deconvolverSetPSF(void * deconvolver, float * psf) {
+  return ((Deconvolver *)deconvolver)->setPSF(psf);
+}
+
+int deconvolverRun(void * deconvolver, int iterations, float * image, float * estimate, float * normal) {
+  return ((Deconvolver *)deconvolver)->run(iterations, image, estimate, normal);
+}
+
+int deconvolverConvolve(void * deconvolver, float * image, float * out, int correlate) {
+  return ((Deconvolver *)deconvolver)->convolve(image, out, correlate != 0);
+}
+
+long long deconvolverGetPeakMemory(void * deconvolver, int normal) {
+  return ((Deconvolver *)deconvolver)->getPeakMemory(normal != 0);
+}
+
+void deconvolverSetLogLevel(void * deconvolver, int level) {
+  ((Deconvolver *)deconvolver)->setLogLevel(level);
+}
+
+void deconvolverSetProgressCallback(void * deconvolver, ProgressCallback callback, void * user) {
+  ((Deconvolver *)deconvolver)->setProgressCallback(callback, user);
+}
+
+void deconvolverSetCancelled(void * deconvolver, int cancelled) {
+  ((Deconvolver *)deconvolver)->setCancelled(cancelled);
+}
+
+void deconvolverEnableStats(void * deconvolver, int level) {
+  ((Deconvolver *)deconvolver)->enableStats(level);
+}
+
+void deconvolverResetStats(void * deconvolver) {
+  ((Deconvolver *)deconvolver)->resetStats();
+}
+
+int deconvolverGetStats(void * deconvolver, double * stats, int n) {
+  return ((Deconvolver *)deconvolver)->getStats(stats, n);
+}
+
+void setDeconvolverLogLevel(int level) {
+  logLevel = level;
+}
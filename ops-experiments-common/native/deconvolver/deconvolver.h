@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stddef.h>
+
+// License: BSD
+
+// One C API over the native engines (YacuDecu and its CPU build, opencldeconv, arrayfiredecon, MKLFFTW).  The
+// engine libraries are loaded at run time, createDeconvolver picks the fastest one available on the machine
+// (or the one named), and every engine takes the same arguments in the same order.  Sizes are in numpy order,
+// N0 (z) the slowest and N2 (x) the fastest dimension.  All names are prefixed because the engines export the
+// same unprefixed names (deconv, setLogLevel...) and an export of this library would replace theirs.
+
+#if defined(_MSC_VER)
+  #define DECONVOLVER_EXPORT __declspec(dllexport)
+#elif defined(__GNUC__)
+  #define DECONVOLVER_EXPORT __attribute__((visibility("default")))
+#else
+  #define DECONVOLVER_EXPORT
+#endif
+
+// return codes, otherwise the error code of the engine (CUDA, OpenCL, ArrayFire)
+#define DECONVOLVER_SUCCESS 0
+// no backend of that name, or none is available
+#define DECONVOLVER_NO_BACKEND -1001
+// deconvolverPlan wasn't called
+#define DECONVOLVER_NOT_PLANNED -1002
+// deconvolverSetPSF wasn't called after the last deconvolverPlan
+#define DECONVOLVER_NO_PSF -1003
+// a size of 0, or too large for the engine (MKLFFTW takes up to 2^31 voxels)
+#define DECONVOLVER_BAD_SIZE -1004
+// the engine couldn't make its plan and OTF in deconvolverSetPSF (out of memory), set the PSF again
+#define DECONVOLVER_PLAN_FAILED -1005
+
+// same levels, indices and codes as the engine headers
+
+// levels for deconvolverSetLogLevel and setDeconvolverLogLevel
+#define LOG_NONE 0
+// errors only, the default
+#define LOG_ERROR 1
+// a line per call (and which backends were found)
+#define LOG_INFO 2
+// a line per iteration
+#define LOG_DEBUG 3
+
+// levels for deconvolverEnableStats
+#define STATS_OFF 0
+#define STATS_COUNTERS 1
+#define STATS_PHASES 2
+
+// indices into the array deconvolverGetStats fills
+#define STATS_PLAN_SECONDS 0
+#define STATS_OTF_SECONDS 1
+#define STATS_FFT_SECONDS 2
+#define STATS_POINTWISE_SECONDS 3
+#define STATS_TRANSFER_SECONDS 4
+#define STATS_TOTAL_SECONDS 5
+#define STATS_CALLS 6
+#define STATS_ITERATIONS 7
+#define STATS_FFTS 8
+#define STATS_BYTES_TO_DEVICE 9
+#define STATS_BYTES_FROM_DEVICE 10
+#define STATS_PEAK_BYTES 11
+#define STATS_COUNT 12
+
+// returned by deconvolverRun when the run was cancelled, the estimate holds the last finished iteration
+#define DECONV_CANCELLED -2000
+
+// called after every RL iteration with the number of finished iterations, returning non zero cancels the run
+typedef int (*ProgressCallback)(int iteration, int iterations, void * user);
+
+extern "C" {
+  // backends in the order they are tried (fastest first), whether or not their library and device are found
+  DECONVOLVER_EXPORT int getNumDeconvolverBackends();
+  DECONVOLVER_EXPORT const char * getDeconvolverBackendName(int backend);
+  // 1 if the backend's library loads and it finds a device, probed once
+  DECONVOLVER_EXPORT int isDeconvolverBackendAvailable(int backend);
+
+  /*
+  A deconvolver on the named backend, or on the first available one if backend is NULL or empty (the
+  OPS_DECONVOLVER environment variable overrides that choice).  NULL if the backend isn't available.
+  A deconvolver is used by one thread at a time, release it with releaseDeconvolver.
+  */
+  DECONVOLVER_EXPORT void * createDeconvolver(const char * backend);
+  DECONVOLVER_EXPORT void releaseDeconvolver(void * deconvolver);
+  DECONVOLVER_EXPORT const char * getDeconvolverName(void * deconvolver);
+
+  // size of the volumes of the following calls, a new size needs a new deconvolverSetPSF
+  DECONVOLVER_EXPORT int deconvolverPlan(void * deconvolver, size_t N0, size_t N1, size_t N2);
+  // the PSF at the planned size with its center at the origin (shifted), it is copied.  mkl and yacudecu-cpu
+  // compute the OTF and plan the FFTs here, once for the following runs and convolutions
+  DECONVOLVER_EXPORT int deconvolverSetPSF(void * deconvolver, float * psf);
+
+  /*
+  Richardson Lucy of image, estimate holds the first guess and is updated in place.  normal is the optional
+  non-circulant normalization factor (NULL for circulant RL).  The engines only read image and normal.
+  */
+  DECONVOLVER_EXPORT int deconvolverRun(void * deconvolver, int iterations, float * image, float * estimate, float * normal);
+  // circular convolution (or correlation if correlate is non zero) of image with the PSF
+  DECONVOLVER_EXPORT int deconvolverConvolve(void * deconvolver, float * image, float * out, int correlate);
+  // peak host or device bytes of deconvolverRun at the planned size, -1 if the engine can't tell
+  DECONVOLVER_EXPORT long long deconvolverGetPeakMemory(void * deconvolver, int normal);
+
+  // logging, progress, cancellation and statistics of the deconvolver's engine library, so they apply to all
+  // deconvolvers on the same library (and to its own entry points)
+  DECONVOLVER_EXPORT void deconvolverSetLogLevel(void * deconvolver, int level);
+  DECONVOLVER_EXPORT void deconvolverSetProgressCallback(void * deconvolver, ProgressCallback callback, void * user);
+  DECONVOLVER_EXPORT void deconvolverSetCancelled(void * deconvolver, int cancelled);
+  DECONVOLVER_EXPORT void deconvolverEnableStats(void * deconvolver, int level);
+  DECONVOLVER_EXPORT void deconvolverResetStats(void * deconvolver);
+  DECONVOLVER_EXPORT int deconvolverGetStats(void * deconvolver, double * stats, int n);
+
+  // messages of this library itself (probing and selecting backends)
+  DECONVOLVER_EXPORT void setDeconvolverLogLevel(int level);
+}
@@ -0,0 +1,659 @@
+#include <ctype.h>
+#include <limits.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "deconvolvercore.h"
+
+// License: BSD
+
+/*
+The built in backends, adapters over the C APIs of the engine libraries.  Each engine takes its own argument
+order (YacuDecu and MKLFFTW numpy order, opencldeconv and arrayfiredecon x first), the adapters keep the PSF
+and reorder the sizes.  MKLFFTW and the CPU build of YacuDecu export plans, so their adapters make the FFT plans
+and the OTF once in setPSF and run and convolve reuse them.  The other engines plan and transform the PSF on
+every call, for them plan and setPSF only keep the size and the PSF.
+
+Ranks: the GPU engines first (CUDA ahead of OpenCL), then MKL, FFTW (the CPU build of YacuDecu) and the
+ArrayFire CPU backend.  The OpenCL engine can also be a CPU runtime (POCL), set OPS_DECONVOLVER to choose.
+*/
+
+typedef void (*SetIntFunction)(int);
+typedef void (*VoidFunction)();
+typedef void (*SetProgressFunction)(ProgressCallback, void *);
+typedef int (*GetStatsFunction)(double *, int);
+
+// the controls every engine library exports, unprefixed or with a prefix (mklSetLogLevel...)
+struct EngineControls {
+  SetIntFunction setLogLevel;
+  SetProgressFunction setProgressCallback;
+  SetIntFunction setCancelled;
+  SetIntFunction enableStats;
+  VoidFunction resetStats;
+  GetStatsFunction getStats;
+};
+
+template<typename T>
+static bool resolve(void * library, const std::string & name, T * function) {
+  *function = (T)engineSymbol(library, name.c_str());
+
+  if (*function == NULL && library != NULL) {
+    deconvolverLog(LOG_INFO, "engine library has no %s\n", name.c_str());
+  }
+
+  return *function != NULL;
+}
+
+static std::string prefixed(const char * prefix, const char * name) {
+  if (prefix[0] == 0) {
+    return name;
+  }
+
+  return std::string(prefix) + (char)toupper(name[0]) + (name + 1);
+}
+
+static bool resolveControls(void * library, const char * prefix, EngineControls * controls) {
+  return resolve(library, prefixed(prefix, "setLogLevel"), &controls->setLogLevel) &&
+    resolve(library, prefixed(prefix, "setProgressCallback"), &controls->setProgressCallback) &&
+    resolve(library, prefixed(prefix, "setCancelled"), &controls->setCancelled) &&
+    resolve(library, prefixed(prefix, "enableStats"), &controls->enableStats) &&
+    resolve(library, prefixed(prefix, "resetStats"), &controls->resetStats) &&
+    resolve(library, prefixed(prefix, "getStats"), &controls->getStats);
+}
+
+/*
+Size, PSF and controls of the adapters.  The engines take non const pointers but only read the image, PSF
+and normal.
+*/
+class EngineDeconvolver : public Deconvolver {
+public:
+
+  EngineDeconvolver(const char * backendName, const EngineControls & controls) :
+    backendName(backendName), controls(controls), planned(false) {
+  }
+
+  const char * name() const {
+    return backendName.c_str();
+  }
+
+  int plan(size_t N0, size_t N1, size_t N2) {
+    if (N0 == 0 || N1 == 0 || N2 == 0) {
+      return DECONVOLVER_BAD_SIZE;
+    }
+
+    N[0] = N0;
+    N[1] = N1;
+    N[2] = N2;
+
+    psf.clear();
+    flipped.clear();
+    planned = true;
+
+    return DECONVOLVER_SUCCESS;
+  }
+
+  int setPSF(const float * h_psf) {
+    if (!planned) {
+      return DECONVOLVER_NOT_PLANNED;
+    }
+
+    psf.assign(h_psf, h_psf + size());
+    flipped.clear();
+
+    return DECONVOLVER_SUCCESS;
+  }
+
+  int run(int iterations, const float * image, float * estimate, const float * normal) {
+    int ret = ready();
+
+    if (ret != DECONVOLVER_SUCCESS) {
+      return ret;
+    }
+
+    return deconv(iterations, (float *)image, estimate, (float *)normal);
+  }
+
+  int convolve(const float * image, float * out, bool correlate) {
+    int ret = ready();
+
+    if (ret != DECONVOLVER_SUCCESS) {
+      return ret;
+    }
+
+    return conv((float *)image, out, correlate);
+  }
+
+  void setLogLevel(int level) {
+    controls.setLogLevel(level);
+  }
+
+  void setProgressCallback(ProgressCallback callback, void * user) {
+    controls.setProgressCallback(callback, user);
+  }
+
+  void setCancelled(int cancelled) {
+    controls.setCancelled(cancelled);
+  }
+
+  void enableStats(int level) {
+    controls.enableStats(level);
+  }
+
+  void resetStats() {
+    controls.resetStats();
+  }
+
+  int getStats(double * stats, int n) {
+    return controls.getStats(stats, n);
+  }
+
+protected:
+
+  virtual int deconv(int iterations, float * image, float * estimate, float * normal) = 0;
+  virtual int conv(float * image, float * out, bool correlate) = 0;
+
+  // for an engine plan that failed, so run and convolve return DECONVOLVER_NO_PSF
+  void clearPSF() {
+    psf.clear();
+    flipped.clear();
+  }
+
+  size_t size() const {
+    return N[0]*N[1]*N[2];
+  }
+
+  // the PSF, or for correlation the PSF mirrored around the origin (circularly), for the engines without
+  // a correlate flag
+  float * kernel(bool correlate) {
+    if (!correlate) {
+      return psf.data();
+    }
+
+    if (flipped.empty()) {
+      flipped.resize(size());
+
+      for (size_t z = 0; z < N[0]; z++) {
+        for (size_t y = 0; y < N[1]; y++) {
+          for (size_t x = 0; x < N[2]; x++) {
+            size_t from = (((N[0] - z) % N[0])*N[1] + (N[1] - y) % N[1])*N[2] + (N[2] - x) % N[2];
+            flipped[(z*N[1] + y)*N[2] + x] = psf[from];
+          }
+        }
+      }
+    }
+
+    return flipped.data();
+  }
+
+  // numpy order z, y, x
+  size_t N[3];
+
+private:
+
+  int ready() const {
+    if (!planned) {
+      return DECONVOLVER_NOT_PLANNED;
+    }
+
+    return psf.empty() ? DECONVOLVER_NO_PSF : DECONVOLVER_SUCCESS;
+  }
+
+  std::string backendName;
+  EngineControls controls;
+  bool planned;
+  std::vector<float> psf, flipped;
+};
+
+// YacuDecu (CUDA) and YacuDecuCPU (FFTW) build the same libYacuDecu, the CPU build also exports setMemoryBudget
+// and the plans of deconv_cpu.h
+
+struct YacuDecuLibrary {
+  bool loaded, cpu, plans;
+  EngineControls controls;
+  int (*deconv_device)(unsigned int, size_t, size_t, size_t, float *, float *, float *, float *);
+  int (*conv_device)(size_t, size_t, size_t, float *, float *, float *, unsigned int);
+  long long (*getPeakMemory)(size_t, size_t, size_t, int);
+  int (*getDeviceCount)();
+  void * (*createDeconvPlan)(size_t, size_t, size_t, float *);
+  int (*deconv_plan)(void *, unsigned int, float *, float *, float *);
+  int (*conv_plan)(void *, float *, float *, unsigned int);
+  void (*destroyDeconvPlan)(void *);
+};
+
+// the getPeakMemory mode of a plan (PEAK_DECONV_PLAN of deconv_cpu.h)
+static const int YACUDECU_PEAK_PLAN = 4;
+
+static YacuDecuLibrary & yacuDecu() {
+  static YacuDecuLibrary lib;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initialized = true;
+
+    void * library = loadEngineLibrary("YacuDecu");
+
+    lib.loaded = resolveControls(library, "", &lib.controls) &&
+      resolve(library, "deconv_device", &lib.deconv_device) &&
+      resolve(library, "conv_device", &lib.conv_device) &&
+      resolve(library, "getPeakMemory", &lib.getPeakMemory) &&
+      resolve(library, "getDeviceCount", &lib.getDeviceCount);
+    lib.cpu = engineSymbol(library, "setMemoryBudget") != NULL;
+    lib.plans = lib.cpu &&
+      resolve(library, "createDeconvPlan", &lib.createDeconvPlan) &&
+      resolve(library, "deconv_plan", &lib.deconv_plan) &&
+      resolve(library, "conv_plan", &lib.conv_plan) &&
+      resolve(library, "destroyDeconvPlan", &lib.destroyDeconvPlan);
+  }
+
+  return lib;
+}
+
+class YacuDecuDeconvolver : public EngineDeconvolver {
+public:
+
+  YacuDecuDeconvolver(const char * name) : EngineDeconvolver(name, yacuDecu().controls), enginePlan(NULL) {
+  }
+
+  ~YacuDecuDeconvolver() {
+    releasePlan();
+  }
+
+  int plan(size_t N0, size_t N1, size_t N2) {
+    releasePlan();
+
+    return EngineDeconvolver::plan(N0, N1, N2);
+  }
+
+  // the CPU build computes the OTF and plans the FFTs here, once for the following runs
+  int setPSF(const float * h_psf) {
+    int ret = EngineDeconvolver::setPSF(h_psf);
+
+    if (ret != DECONVOLVER_SUCCESS || !yacuDecu().plans) {
+      return ret;
+    }
+
+    releasePlan();
+    enginePlan = yacuDecu().createDeconvPlan(N[0], N[1], N[2], kernel(false));
+
+    if (enginePlan == NULL) {
+      clearPSF();
+      return DECONVOLVER_PLAN_FAILED;
+    }
+
+    return DECONVOLVER_SUCCESS;
+  }
+
+  long long getPeakMemory(bool normal) {
+    return yacuDecu().getPeakMemory(N[0], N[1], N[2], yacuDecu().plans ? YACUDECU_PEAK_PLAN : normal ? 1 : 0);
+  }
+
+protected:
+
+  int deconv(int iterations, float * image, float * estimate, float * normal) {
+    if (enginePlan != NULL) {
+      return yacuDecu().deconv_plan(enginePlan, iterations, image, estimate, normal);
+    }
+
+    return yacuDecu().deconv_device(iterations, N[0], N[1], N[2], image, kernel(false), estimate, normal);
+  }
+
+  int conv(float * image, float * out, bool correlate) {
+    if (enginePlan != NULL) {
+      return yacuDecu().conv_plan(enginePlan, image, out, correlate ? 1 : 0);
+    }
+
+    return yacuDecu().conv_device(N[0], N[1], N[2], image, kernel(false), out, correlate ? 1 : 0);
+  }
+
+private:
+
+  void releasePlan() {
+    if (enginePlan != NULL) {
+      yacuDecu().destroyDeconvPlan(enginePlan);
+      enginePlan = NULL;
+    }
+  }
+
+  // the CPU build's DeconvPlan, NULL without one
+  void * enginePlan;
+};
+
+static bool probeYacuDecu() {
+  return yacuDecu().loaded && !yacuDecu().cpu && yacuDecu().getDeviceCount() > 0;
+}
+
+static Deconvolver * createYacuDecu() {
+  return new YacuDecuDeconvolver("yacudecu");
+}
+
+static bool probeYacuDecuCPU() {
+  return yacuDecu().loaded && yacuDecu().cpu;
+}
+
+static Deconvolver * createYacuDecuCPU() {
+  return new YacuDecuDeconvolver("yacudecu-cpu");
+}
+
+// opencldeconv, sizes x first
+
+struct OpenCLLibrary {
+  bool loaded;
+  EngineControls controls;
+  int (*deconv)(int, size_t, size_t, size_t, float *, float *, float *, float *);
+  int (*conv)(size_t, size_t, size_t, float *, float *, float *);
+  long long (*getPeakMemory)(size_t, size_t, size_t, int);
+  int (*getNumOpenCLDevices)();
+};
+
+static OpenCLLibrary & openCL() {
+  static OpenCLLibrary lib;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initialized = true;
+
+    void * library = loadEngineLibrary("opencldeconv");
+
+    lib.loaded = resolveControls(library, "", &lib.controls) &&
+      resolve(library, "deconv", &lib.deconv) &&
+      resolve(library, "conv", &lib.conv) &&
+      resolve(library, "getPeakMemory", &lib.getPeakMemory) &&
+      resolve(library, "getNumOpenCLDevices", &lib.getNumOpenCLDevices);
+  }
+
+  return lib;
+}
+
+class OpenCLDeconvolver : public EngineDeconvolver {
+public:
+
+  OpenCLDeconvolver() : EngineDeconvolver("opencl", openCL().controls) {
+  }
+
+  long long getPeakMemory(bool normal) {
+    // PEAK_NORMAL of opencldeconv.h
+    return openCL().getPeakMemory(N[2], N[1], N[0], normal ? 1 : 0);
+  }
+
+protected:
+
+  int deconv(int iterations, float * image, float * estimate, float * normal) {
+    return openCL().deconv(iterations, N[2], N[1], N[0], image, kernel(false), estimate, normal);
+  }
+
+  int conv(float * image, float * out, bool correlate) {
+    return openCL().conv(N[2], N[1], N[0], image, kernel(correlate), out);
+  }
+};
+
+static bool probeOpenCL() {
+  return openCL().loaded && openCL().getNumOpenCLDevices() > 0;
+}
+
+static Deconvolver * createOpenCL() {
+  return new OpenCLDeconvolver();
+}
+
+// arrayfiredecon (the unified build), one backend per ArrayFire backend, sizes x first
+
+struct ArrayFireLibrary {
+  bool loaded;
+  EngineControls controls;
+  int (*deconv)(unsigned int, size_t, size_t, size_t, float *, float *, float *, float *);
+  int (*conv2)(size_t, size_t, size_t, float *, float *, float *);
+  long long (*getPeakMemory)(size_t, size_t, size_t, int);
+  int (*getBackends)();
+  int (*setBackend)(int);
+};
+
+static ArrayFireLibrary & arrayFire() {
+  static ArrayFireLibrary lib;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initialized = true;
+
+    void * library = loadEngineLibrary("arrayfiredecon");
+
+    lib.loaded = resolveControls(library, "", &lib.controls) &&
+      resolve(library, "deconv", &lib.deconv) &&
+      resolve(library, "conv2", &lib.conv2) &&
+      resolve(library, "getPeakMemory", &lib.getPeakMemory) &&
+      resolve(library, "getBackends", &lib.getBackends) &&
+      resolve(library, "setBackend", &lib.setBackend);
+  }
+
+  return lib;
+}
+
+// the BACKEND_ values of arrayfiredecon.h
+static const int ARRAYFIRE_CPU = 1;
+static const int ARRAYFIRE_CUDA = 2;
+static const int ARRAYFIRE_OPENCL = 4;
+
+/*
+The ArrayFire backend is a setting of the library, so each call selects the deconvolver's backend first
+(a no op if it is active already).  The selection and the call hold arrayFireLock, so deconvolvers on
+different backends in different threads don't switch the backend under each other's calls.
+*/
+static std::mutex arrayFireLock;
+
+class ArrayFireDeconvolver : public EngineDeconvolver {
+public:
+
+  ArrayFireDeconvolver(const char * name, int backend) : EngineDeconvolver(name, arrayFire().controls), backend(backend) {
+  }
+
+  long long getPeakMemory(bool normal) {
+    std::lock_guard<std::mutex> lock(arrayFireLock);
+
+    if (arrayFire().setBackend(backend) != 0) {
+      return -1;
+    }
+
+    return arrayFire().getPeakMemory(N[2], N[1], N[0], normal ? 1 : 0);
+  }
+
+protected:
+
+  int deconv(int iterations, float * image, float * estimate, float * normal) {
+    std::lock_guard<std::mutex> lock(arrayFireLock);
+
+    int ret = arrayFire().setBackend(backend);
+
+    if (ret != 0) {
+      return ret;
+    }
+
+    return arrayFire().deconv(iterations, N[2], N[1], N[0], image, kernel(false), estimate, normal);
+  }
+
+  int conv(float * image, float * out, bool correlate) {
+    std::lock_guard<std::mutex> lock(arrayFireLock);
+
+    int ret = arrayFire().setBackend(backend);
+
+    if (ret != 0) {
+      return ret;
+    }
+
+    return arrayFire().conv2(N[2], N[1], N[0], image, kernel(correlate), out);
+  }
+
+private:
+
+  int backend;
+};
+
+static bool probeArrayFire(int backend) {
+  std::lock_guard<std::mutex> lock(arrayFireLock);
+
+  return arrayFire().loaded && (arrayFire().getBackends() & backend) && arrayFire().setBackend(backend) == 0;
+}
+
+static bool probeArrayFireCUDA() {
+  return probeArrayFire(ARRAYFIRE_CUDA);
+}
+
+static Deconvolver * createArrayFireCUDA() {
+  return new ArrayFireDeconvolver("arrayfire-cuda", ARRAYFIRE_CUDA);
+}
+
+static bool probeArrayFireOpenCL() {
+  return probeArrayFire(ARRAYFIRE_OPENCL);
+}
+
+static Deconvolver * createArrayFireOpenCL() {
+  return new ArrayFireDeconvolver("arrayfire-opencl", ARRAYFIRE_OPENCL);
+}
+
+static bool probeArrayFireCPU() {
+  return probeArrayFire(ARRAYFIRE_CPU);
+}
+
+static Deconvolver * createArrayFireCPU() {
+  return new ArrayFireDeconvolver("arrayfire-cpu", ARRAYFIRE_CPU);
+}
+
+// MKLFFTW, numpy order with int sizes, mkl prefixed controls
+
+struct MKLLibrary {
+  bool loaded, plans;
+  EngineControls controls;
+  int (*mklRichardsonLucy3D)(int, float *, float *, float *, const int, const int, const int, float *);
+  void (*mklConvolve3D)(float *, float *, float *, const int, const int, const int, bool);
+  long long (*mklGetPeakMemory)(const int, const int, const int);
+  void * (*mklCreatePlan)(float *, const int, const int, const int);
+  int (*mklRichardsonLucyPlan)(void *, int, float *, float *, float *);
+  void (*mklConvolvePlan)(void *, float *, float *, bool);
+  void (*mklFreePlan)(void *);
+};
+
+static MKLLibrary & mkl() {
+  static MKLLibrary lib;
+  static bool initialized = false;
+
+  if (!initialized) {
+    initialized = true;
+
+    void * library = loadEngineLibrary("MKLFFTW");
+
+    lib.loaded = resolveControls(library, "mkl", &lib.controls) &&
+      resolve(library, "mklRichardsonLucy3D", &lib.mklRichardsonLucy3D) &&
+      resolve(library, "mklConvolve3D", &lib.mklConvolve3D) &&
+      resolve(library, "mklGetPeakMemory", &lib.mklGetPeakMemory);
+    lib.plans = lib.loaded &&
+      resolve(library, "mklCreatePlan", &lib.mklCreatePlan) &&
+      resolve(library, "mklRichardsonLucyPlan", &lib.mklRichardsonLucyPlan) &&
+      resolve(library, "mklConvolvePlan", &lib.mklConvolvePlan) &&
+      resolve(library, "mklFreePlan", &lib.mklFreePlan);
+  }
+
+  return lib;
+}
+
+class MKLDeconvolver : public EngineDeconvolver {
+public:
+
+  MKLDeconvolver() : EngineDeconvolver("mkl", mkl().controls), enginePlan(NULL) {
+  }
+
+  ~MKLDeconvolver() {
+    releasePlan();
+  }
+
+  int plan(size_t N0, size_t N1, size_t N2) {
+    if ((double)N0*N1*N2 > INT_MAX) {
+      return DECONVOLVER_BAD_SIZE;
+    }
+
+    releasePlan();
+
+    return EngineDeconvolver::plan(N0, N1, N2);
+  }
+
+  // MKLFFTW computes the OTF and plans the FFTs here, once for the following runs
+  int setPSF(const float * h_psf) {
+    int ret = EngineDeconvolver::setPSF(h_psf);
+
+    if (ret != DECONVOLVER_SUCCESS || !mkl().plans) {
+      return ret;
+    }
+
+    releasePlan();
+    enginePlan = mkl().mklCreatePlan(kernel(false), (int)N[0], (int)N[1], (int)N[2]);
+
+    if (enginePlan == NULL) {
+      clearPSF();
+      return DECONVOLVER_PLAN_FAILED;
+    }
+
+    return DECONVOLVER_SUCCESS;
+  }
+
+  // the normal is the caller's array, MKLFFTW allocates nothing for it.  A plan also holds an estimate.
+  long long getPeakMemory(bool) {
+    long long plan = mkl().plans ? (long long)size() * sizeof(float) : 0;
+
+    return mkl().mklGetPeakMemory((int)N[0], (int)N[1], (int)N[2]) + plan;
+  }
+
+protected:
+
+  int deconv(int iterations, float * image, float * estimate, float * normal) {
+    if (enginePlan != NULL) {
+      return mkl().mklRichardsonLucyPlan(enginePlan, iterations, image, estimate, normal);
+    }
+
+    return mkl().mklRichardsonLucy3D(iterations, image, kernel(false), estimate, (int)N[0], (int)N[1], (int)N[2], normal);
+  }
+
+  int conv(float * image, float * out, bool correlate) {
+    if (enginePlan != NULL) {
+      mkl().mklConvolvePlan(enginePlan, image, out, correlate);
+
+      return DECONVOLVER_SUCCESS;
+    }
+
+    mkl().mklConvolve3D(image, kernel(false), out, (int)N[0], (int)N[1], (int)N[2], correlate);
+
+    return DECONVOLVER_SUCCESS;
+  }
+
+private:
+
+  void releasePlan() {
+    if (enginePlan != NULL) {
+      mkl().mklFreePlan(enginePlan);
+      enginePlan = NULL;
+    }
+  }
+
+  // MKLFFTW's MKLDeconvPlan, NULL without one
+  void * enginePlan;
+};
+
+static bool probeMKL() {
+  return mkl().loaded;
+}
+
+static Deconvolver * createMKL() {
+  return new MKLDeconvolver();
+}
+
+void registerBuiltinBackends() {
+  DeconvolverBackend builtins[] = {
+    {"yacudecu", 100, &probeYacuDecu, &createYacuDecu},
+    {"arrayfire-cuda", 90, &probeArrayFireCUDA, &createArrayFireCUDA},
+    {"opencl", 80, &probeOpenCL, &createOpenCL},
+    {"arrayfire-opencl", 70, &probeArrayFireOpenCL, &createArrayFireOpenCL},
+    {"mkl", 50, &probeMKL, &createMKL},
+    {"yacudecu-cpu", 40, &probeYacuDecuCPU, &createYacuDecuCPU},
+    {"arrayfire-cpu", 30, &probeArrayFireCPU, &createArrayFireCPU}
+  };
+
+  for (size_t i = 0; i < sizeof(builtins)/sizeof(builtins[0]); i++) {
+    registerDeconvolverBackend(builtins[i]);
+  }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "deconvolver.h"
+
+// License: BSD
+
+// The C++ side of deconvolver.h: the engine interface the C API dispatches to, and the backend registry.
+// A new engine implements Deconvolver and registers a DeconvolverBackend, the C API and the callers don't change.
+
+/*
+One engine.  plan fixes the size, setPSF the PSF (copied, the engine may transform it once and keep the OTF),
+then run and convolve take volumes of that size.  Of the built in engines mkl and yacudecu-cpu keep the plans
+and the OTF, the others plan and transform the PSF on every call.  Sizes are numpy order (N0 slowest), the
+engines reorder them for their own APIs.  Not thread safe, each thread uses its own.
+*/
+class Deconvolver {
+public:
+  virtual ~Deconvolver() {}
+
+  // backend name, as registered
+  virtual const char * name() const = 0;
+
+  virtual int plan(size_t N0, size_t N1, size_t N2) = 0;
+  virtual int setPSF(const float * psf) = 0;
+  virtual int run(int iterations, const float * image, float * estimate, const float * normal) = 0;
+  virtual int convolve(const float * image, float * out, bool correlate) = 0;
+  virtual long long getPeakMemory(bool normal) = 0;
+
+  // the engine library's controls (see deconvolver.h)
+  virtual void setLogLevel(int level) = 0;
+  virtual void setProgressCallback(ProgressCallback callback, void * user) = 0;
+  virtual void setCancelled(int cancelled) = 0;
+  virtual void enableStats(int level) = 0;
+  virtual void resetStats() = 0;
+  virtual int getStats(double * stats, int n) = 0;
+};
+
+/*
+A registered engine.  rank orders the backends (higher is tried first when no backend is named).  probe is
+called once, the first time the backend is listed or selected, and tells if its library loads and it finds a
+device.  create is only called after a successful probe.
+*/
+struct DeconvolverBackend {
+  std::string name;
+  int rank;
+  bool (*probe)();
+  Deconvolver * (*create)();
+};
+
+// adds a backend (replacing one of the same name), the built in ones are registered on first use
+void registerDeconvolverBackend(const DeconvolverBackend & backend);
+
+// the built in backends (deconvolverbackends.cpp)
+void registerBuiltinBackends();
+
+// messages of the dispatcher, at most the level set with setDeconvolverLogLevel
+void deconvolverLog(int level, const char * format, ...);
+
+/*
+The engine libraries, loaded by name (libYacuDecu.so, YacuDecu.dll...) from the library path and never unloaded.
+They are loaded privately (RTLD_LOCAL) so the engines' identical exports stay apart.  NULL if the library
+doesn't load.
+*/
+void * loadEngineLibrary(const char * name);
+void * engineSymbol(void * library, const char * name);
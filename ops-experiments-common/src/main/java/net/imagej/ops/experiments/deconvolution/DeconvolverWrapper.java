@@ -0,0 +1,79 @@
+package net.imagej.ops.experiments.deconvolution;
+
+import org.bytedeco.javacpp.BytePointer;
+import org.bytedeco.javacpp.FloatPointer;
+import org.bytedeco.javacpp.Loader;
+import org.bytedeco.javacpp.Pointer;
+import org.bytedeco.javacpp.annotation.Cast;
+import org.bytedeco.javacpp.annotation.Platform;
+import org.bytedeco.javacpp.annotation.Properties;
+
+/**
+ * JavaCPP wrapper of the deconvolver library (native/deconvolver), one API over
+ * the YacuDecu, OpenCL, ArrayFire and MKL engines. The engine libraries are
+ * loaded by the native library at run time from the library path, so this
+ * wrapper links none of them. Sizes are in numpy order, n0 (z) the slowest.
+ */
+@Properties(value = { @Platform(include = "deconvolver.h", link = "deconvolver") })
+public class DeconvolverWrapper {
+
+	static {
+		Loader.load();
+	}
+
+	// return codes, otherwise the error code of the engine
+	public static final int DECONVOLVER_SUCCESS = 0;
+	public static final int DECONVOLVER_NO_BACKEND = -1001;
+	public static final int DECONVOLVER_NOT_PLANNED = -1002;
+	public static final int DECONVOLVER_NO_PSF = -1003;
+	public static final int DECONVOLVER_BAD_SIZE = -1004;
+	public static final int DECONVOLVER_PLAN_FAILED = -1005;
+	public static final int DECONV_CANCELLED = -2000;
+
+	// backends in the order they are tried, available if the library loads and
+	// finds a device
+	public static native int getNumDeconvolverBackends();
+
+	public static native @Cast("const char *") BytePointer getDeconvolverBackendName(int backend);
+
+	public static native int isDeconvolverBackendAvailable(int backend);
+
+	// a deconvolver on the named backend, or the first available one if backend
+	// is null, null if none is available
+	public static native Pointer createDeconvolver(String backend);
+
+	public static native void releaseDeconvolver(Pointer deconvolver);
+
+	public static native @Cast("const char *") BytePointer getDeconvolverName(Pointer deconvolver);
+
+	public static native int deconvolverPlan(Pointer deconvolver, @Cast("size_t") long n0, @Cast("size_t") long n1, @Cast("size_t") long n2);
+
+	// the PSF at the planned size, shifted so its center is at the origin
+	public static native int deconvolverSetPSF(Pointer deconvolver, FloatPointer psf);
+
+	// normal can be null (circulant RL)
+	public static native int deconvolverRun(Pointer deconvolver, int iterations, FloatPointer image, FloatPointer estimate, FloatPointer normal);
+
+	public static native int deconvolverConvolve(Pointer deconvolver, FloatPointer image, FloatPointer out, int correlate);
+
+	public static native long deconvolverGetPeakMemory(Pointer deconvolver, int normal);
+
+	// controls of the deconvolver's engine library (levels and indices as in
+	// the native header)
+	public static native void deconvolverSetLogLevel(Pointer deconvolver, int level);
+
+	public static native void deconvolverSetCancelled(Pointer deconvolver, int cancelled);
+
+	public static native void deconvolverEnableStats(Pointer deconvolver, int level);
+
+	public static native void deconvolverResetStats(Pointer deconvolver);
+
+	public static native int deconvolverGetStats(Pointer deconvolver, double[] stats, int n);
+
+	public static native void setDeconvolverLogLevel(int level);
+
+	public static void load() {
+		Loader.load();
+	}
+
+}
@@ -0,0 +1,172 @@
+package net.imagej.ops.experiments.deconvolution;
+
+import net.imagej.ops.Op;
+import net.imagej.ops.OpService;
+import net.imagej.ops.special.computer.AbstractUnaryComputerOp;
+import net.imagej.ops.special.computer.Computers;
+import net.imagej.ops.special.computer.UnaryComputerOp;
+import net.imglib2.Dimensions;
+import net.imglib2.RandomAccessibleInterval;
+import net.imglib2.type.numeric.RealType;
+
+import org.bytedeco.javacpp.FloatPointer;
+import org.bytedeco.javacpp.Pointer;
+import org.scijava.log.LogService;
+import org.scijava.plugin.Parameter;
+import org.scijava.plugin.Plugin;
+
+/**
+ * Richardson Lucy on any engine through the deconvolver library
+ * (DeconvolverWrapper), in place of a wrapper per engine. The backend is the
+ * fastest available one, or the one named ("yacudecu", "opencl", "mkl"...).
+ * The non-circulant normal is computed by the same engine.
+ */
+@Plugin(type = Op.class)
+public class UnaryComputerDeconvolver<I extends RealType<I>, O extends RealType<O>, K extends RealType<K>>
+	extends
+	AbstractUnaryComputerOp<RandomAccessibleInterval<I>, RandomAccessibleInterval<O>>
+	implements NativeRichardsonLucy
+{
+
+	@Parameter
+	OpService ops;
+
+	@Parameter
+	LogService log;
+
+	@Parameter
+	RandomAccessibleInterval<K> psf;
+
+	@Parameter
+	int iterations;
+
+	@Parameter(required = false)
+	boolean nonCirculant = true;
+
+	@Parameter(required = false)
+	long[] extendedSize = null;
+
+	@Parameter(required = false)
+	String backend = null;
+
+	Pointer deconvolver;
+
+	@SuppressWarnings("unchecked")
+	@Override
+	public void compute(final RandomAccessibleInterval<I> input,
+		final RandomAccessibleInterval<O> output)
+	{
+		final UnaryComputerOp<RandomAccessibleInterval<I>, RandomAccessibleInterval<O>> rl =
+			(UnaryComputerOp) Computers.unary(ops,
+				UnaryComputerNativeRichardsonLucy.class, RandomAccessibleInterval.class,
+				input, psf, iterations, nonCirculant, extendedSize, this);
+
+		try {
+			rl.compute(input, output);
+		}
+		finally {
+			if (deconvolver != null) {
+				DeconvolverWrapper.releaseDeconvolver(deconvolver);
+				deconvolver = null;
+			}
+		}
+	}
+
+	@Override
+	public void loadLibrary() {
+		DeconvolverWrapper.load();
+
+		if (deconvolver == null) {
+			deconvolver = DeconvolverWrapper.createDeconvolver(backend);
+
+			if (deconvolver == null) {
+				throw new IllegalStateException("no deconvolver backend " +
+					(backend == null ? "is available" : backend));
+			}
+
+			log.info("deconvolver backend " + DeconvolverWrapper
+				.getDeconvolverName(deconvolver).getString());
+		}
+	}
+
+	// plans the padded size (numpy order) and sets the PSF
+	private int plan(Dimensions padded, FloatPointer fpPSF) {
+		int ret = DeconvolverWrapper.deconvolverPlan(deconvolver, padded.dimension(
+			2), padded.dimension(1), padded.dimension(0));
+
+		if (ret == DeconvolverWrapper.DECONVOLVER_SUCCESS) {
+			ret = DeconvolverWrapper.deconvolverSetPSF(deconvolver, fpPSF);
+		}
+
+		return ret;
+	}
+
+	@Override
+	public FloatPointer createNormal(Dimensions paddedDimensions,
+		Dimensions originalDimensions, FloatPointer fpPSF)
+	{
+		if (!nonCirculant) {
+			return null;
+		}
+
+		final int ret = plan(paddedDimensions, fpPSF);
+
+		if (ret != DeconvolverWrapper.DECONVOLVER_SUCCESS) {
+			throw new IllegalStateException("deconvolver returned error code " +
+				ret);
+		}
+
+		// ones in the original image, centered as DefaultPadInputFFT pads it
+		final long[] padded = new long[3];
+		final long[] offset = new long[3];
+
+		for (int d = 0; d < 3; d++) {
+			padded[d] = paddedDimensions.dimension(d);
+			offset[d] = (padded[d] - originalDimensions.dimension(d)) / 2;
+		}
+
+		final long size = padded[0] * padded[1] * padded[2];
+		final FloatPointer mask = new FloatPointer(size);
+		mask.zero();
+
+		for (long z = 0; z < originalDimensions.dimension(2); z++) {
+			for (long y = 0; y < originalDimensions.dimension(1); y++) {
+				final long row = ((offset[2] + z) * padded[1] + offset[1] + y) *
+					padded[0] + offset[0];
+
+				for (long x = 0; x < originalDimensions.dimension(0); x++) {
+					mask.put(row + x, 1f);
+				}
+			}
+		}
+
+		// correlate with the PSF, ~0 values far outside the image become 1
+		final FloatPointer normal = new FloatPointer(size);
+		DeconvolverWrapper.deconvolverConvolve(deconvolver, mask, normal, 1);
+		mask.deallocate();
+
+		for (long i = 0; i < size; i++) {
+			if (normal.get(i) < 0.00001) {
+				normal.put(i, 1f);
+			}
+		}
+
+		return normal;
+	}
+
+	@Override
+	public int callRichardsonLucy(int numIterations, Dimensions paddedInput,
+		FloatPointer fpInput, FloatPointer fpPSF, FloatPointer fpOutput,
+		FloatPointer normalFP)
+	{
+		int ret = plan(paddedInput, fpPSF);
+
+		if (ret == DeconvolverWrapper.DECONVOLVER_SUCCESS) {
+			ret = DeconvolverWrapper.deconvolverRun(deconvolver, numIterations,
+				fpInput, fpOutput, normalFP);
+		}
+
+		return ret;
+	}
+
+}
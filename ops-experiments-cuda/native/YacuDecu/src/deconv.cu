@@ -16,6 +16,7 @@
 */
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <iostream>
 #include <cuda_runtime.h>
 #include <cuda_profiler_api.h>
@@ -23,6 +24,11 @@
 #include <cublas.h>
 #include <cuComplex.h>
 #include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include "deconv.h"
 
 __global__ void ComplexMul(cuComplex *A, cuComplex *B, cuComplex *C)
@@ -95,6 +101,108 @@ static float devFloatMean(float *a_dev, int N) {
     return m;
 }
 
+/*
+Statistics (see enableStats in deconv.h).  Each call collects its own in a CallStats and adds them
+to the totals when it returns, so with the level at STATS_OFF a call only copies the level.
+*/
+static std::atomic<int> statsLevel(STATS_OFF);
+static double stats[STATS_COUNT];
+static std::mutex statsMutex;
+
+static double statsClock() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct CallStats {
+	int level;
+	double start, last;
+	double values[STATS_COUNT];
+
+	CallStats() : level(statsLevel), start(0), last(0) {
+		memset(values, 0, sizeof(values));
+		if (level) start = last = statsClock();
+	}
+
+	// restarts the phase clock without charging the time to a phase (allocation)
+	void mark() {
+		if (level < STATS_PHASES) return;
+		cudaDeviceSynchronize();
+		last = statsClock();
+	}
+
+	// charges the time since the last phase to values[index], after the work launched in it finished
+	void phase(int index) {
+		if (level < STATS_PHASES) return;
+		cudaDeviceSynchronize();
+		double now = statsClock();
+		values[index] += now - last;
+		last = now;
+	}
+
+	void add(int index, double n) {
+		if (level) values[index] += n;
+	}
+
+	~CallStats() {
+		if (!level) return;
+		values[STATS_TOTAL_SECONDS] = statsClock() - start;
+		values[STATS_CALLS] = 1;
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (int i = 0; i < STATS_COUNT; i++) {
+			stats[i] = i == STATS_PEAK_BYTES ? std::max(stats[i], values[i]) : stats[i] + values[i];
+		}
+	}
+};
+
+/*
+Logging, progress and cancellation (see setLogLevel in deconv.h).  The defaults print errors only, and an
+iteration costs a flag test unless a progress callback is set.
+*/
+static std::atomic<int> logLevel(LOG_ERROR);
+static std::atomic<int> cancelled(0);
+static ProgressCallback progressCallback = NULL;
+static void * progressUser = NULL;
+static std::mutex progressMutex;
+
+static void logMessage(int level, const char * format, ...) {
+	if (level > logLevel) return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+	va_end(args);
+}
+
+// free device memory after an allocation, only queried at LOG_INFO
+static void logMemory(const char * what) {
+	if (logLevel < LOG_INFO) return;
+
+	size_t freeMem, totalMem;
+	cudaMemGetInfo(&freeMem, &totalMem);
+	logMessage(LOG_INFO, "%f G free out of %f total (%s)\n", (float)freeMem / (float)(1024 * 1024 * 1024), (float)totalMem / (float)(1024 * 1024 * 1024), what);
+}
+
+// reports iteration of iterations finished, returns false if the run should stop.  The launches are asynchronous,
+// so with a callback the device is synchronized first and the callback sees the iterations that really finished.
+static bool continueIterating(unsigned int iteration, unsigned int iterations) {
+	ProgressCallback callback;
+	void * user;
+
+	{
+		std::lock_guard<std::mutex> lock(progressMutex);
+		callback = progressCallback;
+		user = progressUser;
+	}
+
+	if (callback != NULL) {
+		cudaDeviceSynchronize();
+		if (callback((int)iteration, (int)iterations, user) != 0) return false;
+	}
+
+	return !cancelled;
+}
+
 /* h_normal is the non-circulant normalization factor described here
 	http://bigwww.epfl.ch/deconvolution/challenge/index.html?p=documentation/theory/richardsonlucyi
 */
@@ -104,8 +212,10 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
     cufftResult r;
     cudaError_t err;
     cufftHandle planR2C, planC2R;
+    CallStats callStats;
+    bool stopped = false;
 
-	std::cout<<"Starting Cuda deconvolution N1="<<N1<<" N2="<<N2<<" N3="<<N3<<"\n";
+	logMessage(LOG_INFO, "Starting Cuda deconvolution N1=%zu N2=%zu N3=%zu\n", N1, N2, N3);
 
     float *image = 0; // convolved image (constant)
     float *object = 0; // estimated object
@@ -135,7 +245,6 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
 
     //printf("N: %ld, M: %ld\n", nSpatial, mSpatial);
     //printf("Blocks: %d x %d x %d, Threads: %d x %d x %d\n", spatialBlocks.x, spatialBlocks.y, spatialBlocks.z, spatialThreadsPerBlock.x, spatialThreadsPerBlock.y, spatialThreadsPerBlock.z);
-	fflush(stdin);
 
 	cudaDeviceReset();
     cudaProfilerStart();
@@ -143,22 +252,17 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
     err = cudaMalloc(&image, mSpatial);
     if(err) goto cudaErr;
 
-	size_t freeMem, totalMem;
-
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc image)\n";
+	logMemory("malloc image");
 
     err = cudaMalloc(&object, mSpatial);
     if(err) goto cudaErr;
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc object)\n";
+	logMemory("malloc object");
 
 	err = cudaMalloc(&psf, mSpatial);
     if(err) goto cudaErr;
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc PSF)\n";
+	logMemory("malloc PSF");
 
 	//err = cudaMalloc(&temp, mSpatial);
     //if(err) goto cudaErr;
@@ -167,8 +271,7 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
 		err = cudaMalloc(&normal, mSpatial);
 		if (err) goto cudaErr;
 
-		cudaMemGetInfo(&freeMem, &totalMem);
-		std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc normal)\n";
+		logMemory("malloc normal");
 
 	}
 	else {
@@ -178,14 +281,12 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
     err = cudaMalloc(&otf, mFreq);
     if(err) goto cudaErr;
     
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc OTF)\n";
+	logMemory("malloc OTF");
 
 	err = cudaMalloc(&buf, mFreq); // mFreq > mSpatial
     if(err) goto cudaErr;
 	
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc buf)\n";
+	logMemory("malloc buf");
 
     err = cudaMemset(image, 0, mSpatial);
     if(err) goto cudaErr;
@@ -198,6 +299,8 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
 		if (err) goto cudaErr;
 	}
 
+    callStats.mark();
+
     err = cudaMemcpy(image, h_image, nSpatial*sizeof(float), cudaMemcpyHostToDevice);
     if(err) goto cudaErr;
 
@@ -212,48 +315,57 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
 		if (err) goto cudaErr;
 	}
 
+	callStats.phase(STATS_TRANSFER_SECONDS);
+	callStats.add(STATS_BYTES_TO_DEVICE, (h_normal != NULL ? 4 : 3) * nSpatial * sizeof(float));
+
     // BN it looks like this function was originall written for the array organization used in matlab.  I Changed the order of the dimensions
     // to be compatible with imglib2 (java). TODO - add param for array organization 
     r = createPlans(N1, N2, N3, &planR2C, &planC2R, &workArea, &workSize);
     	
 	if(r) goto cufftError;
 
+	callStats.phase(STATS_PLAN_SECONDS);
+	callStats.add(STATS_PEAK_BYTES, (normal != NULL ? 4 : 3) * mSpatial + 2 * mFreq + workSize);
+
     //printf("Plans created.\n");
 
     r = cufftExecR2C(planR2C, psf, otf);
     if(r) goto cufftError;
 
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
 	// since we don't the psf anymore (we just used it to get the OTF) use the psf buffer
 	// as the temp buffer
 	temp = psf;
 
-	std::cout << "Running " <<iter<<" iterations of Cuda RL\n"<< std::flush;
+	logMessage(LOG_INFO, "Running %u iterations of Cuda RL\n", iter);
 
     for(unsigned int i=0; i < iter; i++) {
-        // BN flush the buffer for debugging in Java.
-        fflush(stdout);
-
-		if (remainder(i, 10) == 0) {
-			std::cout << i << " " << std::flush;
-		}
-	
 		r = cufftExecR2C(planR2C, object, (cufftComplex*)buf);
         if(r) goto cufftError;
+		callStats.phase(STATS_FFT_SECONDS);
         
 		ComplexMul<<<freqBlocks, freqThreadsPerBlock>>>((cuComplex*)buf, otf, (cuComplex*)buf);
+		callStats.phase(STATS_POINTWISE_SECONDS);
         r = cufftExecC2R(planC2R, (cufftComplex*)buf, (float*)temp);
         if(r) goto cufftError;
+		callStats.phase(STATS_FFT_SECONDS);
 		FloatDivByConstant<<<spatialBlocks, spatialThreadsPerBlock>>>((float*)temp,(float)nSpatial);
 		
         FloatDiv<<<spatialBlocks, spatialThreadsPerBlock>>>(image, (float*)temp, (float*)temp);
+		callStats.phase(STATS_POINTWISE_SECONDS);
         
 		r = cufftExecR2C(planR2C, (float*)temp, (cufftComplex*)buf);
         if(r) goto cufftError;
+		callStats.phase(STATS_FFT_SECONDS);
 
 		// BN 2018 Changed to complex conjugate multiply
         ComplexConjugateMul<<<freqBlocks, freqThreadsPerBlock>>>((cuComplex*)buf, otf, (cuComplex*)buf);
+		callStats.phase(STATS_POINTWISE_SECONDS);
 		r = cufftExecC2R(planC2R, (cufftComplex*)buf, (float*)temp);
 		if(r) goto cufftError;
+		callStats.phase(STATS_FFT_SECONDS);
 
 		FloatDivByConstant<<<spatialBlocks, spatialThreadsPerBlock>>>((float*)temp,(float)nSpatial);
 		
@@ -262,28 +374,37 @@ int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
 		if (normal != NULL) {
 			FloatDiv<<<spatialBlocks, spatialThreadsPerBlock >>>((float*)object, normal, object);
 		}
-		
-    }
+		callStats.phase(STATS_POINTWISE_SECONDS);
+
+		callStats.add(STATS_ITERATIONS, 1);
+		callStats.add(STATS_FFTS, 4);
+
+		logMessage(LOG_DEBUG, "iteration %u\n", i);
 
-	std::cout << "\n" << std::flush;
-	//std::cout << "\nFinished " << iter << " iterations of Cuda RL\n" << std::flush;
+		if (!continueIterating(i + 1, iter)) {
+			logMessage(LOG_INFO, "cancelled after %u iterations\n", i + 1);
+			stopped = true;
+			break;
+		}
+    }
 
 	err = cudaMemcpy(h_object, object, nSpatial*sizeof(float), cudaMemcpyDeviceToHost);
     if(err) goto cudaErr;
 
-    retval = 0;
+	callStats.phase(STATS_TRANSFER_SECONDS);
+	callStats.add(STATS_BYTES_FROM_DEVICE, nSpatial * sizeof(float));
+
+    retval = stopped ? DECONV_CANCELLED : 0;
     goto cleanup;
 
 cudaErr:
-    fprintf(stderr, "CUDA error: %d\n", err);
-	std::cout << "CUDA error: " << err << std::endl;
+    logMessage(LOG_ERROR, "CUDA error: %d\n", err);
 	
     retval = err;
     goto cleanup;
 
 cufftError:
-    fprintf(stderr, "CuFFT error IS: %d\n", r);
-	std::cout << "CuFFT error is: " << r << std::endl;
+    logMessage(LOG_ERROR, "CuFFT error: %d\n", r);
 
     retval = r;
     goto cleanup;
@@ -305,6 +426,8 @@ extern "C" int deconv_host(unsigned int iter, size_t N1, size_t N2, size_t N3,
     cufftResult r;
     cudaError_t err;
     cufftHandle planR2C, planC2R;
+    CallStats callStats;
+    bool stopped = false;
 
     float *image = 0; // convolved image (constant)
     float *object = 0; // estimated object
@@ -383,14 +506,23 @@ extern "C" int deconv_host(unsigned int iter, size_t N1, size_t N2, size_t N3,
     if(err) goto cudaErr;
     //printf("PSF transferred.\n");
 
+    callStats.mark();
+
     r = createPlans(N1, N2, N3, &planR2C, &planC2R, &workArea, &workSize);
     if(r) goto cufftError;
 
+    // the buffers are mapped host memory, only the work area is on the device
+    callStats.phase(STATS_PLAN_SECONDS);
+    callStats.add(STATS_PEAK_BYTES, workSize);
+
     //printf("Plans created.\n");
 
     r = cufftExecR2C(planR2C, (float*)otf, otf);
     if(r) goto cufftError;
 
+    callStats.phase(STATS_OTF_SECONDS);
+    callStats.add(STATS_FFTS, 1);
+
     for(unsigned int i=0; i < iter; i++) {
         //printf("Iteration %d\n", i);
         r = cufftExecR2C(planR2C, object, (cufftComplex*)buf);
@@ -407,6 +539,17 @@ extern "C" int deconv_host(unsigned int iter, size_t N1, size_t N2, size_t N3,
         r = cufftExecC2R(planC2R, (cufftComplex*)buf, (float*)buf);
         if(r) goto cufftError;
         FloatMul<<<spatialBlocks, spatialThreadsPerBlock>>>((float*)buf, object, object);
+
+        callStats.add(STATS_ITERATIONS, 1);
+        callStats.add(STATS_FFTS, 4);
+
+        logMessage(LOG_DEBUG, "iteration %u\n", i);
+
+        if (!continueIterating(i + 1, iter)) {
+            logMessage(LOG_INFO, "cancelled after %u iterations\n", i + 1);
+            stopped = true;
+            break;
+        }
     }
 
     //printf("object: m = %f\n", devFloatMean((float*)object, nSpatial));
@@ -414,21 +557,21 @@ extern "C" int deconv_host(unsigned int iter, size_t N1, size_t N2, size_t N3,
     err = cudaMemcpy(h_object, object, nSpatial*sizeof(float), cudaMemcpyDeviceToHost);
     if(err) goto cudaErr;
 
-    retval = 0;
+    retval = stopped ? DECONV_CANCELLED : 0;
     goto cleanup;
 
 cudaErr:
-    fprintf(stderr, "CUDA error: %d\n", err);
+    logMessage(LOG_ERROR, "CUDA error: %d\n", err);
     retval = err;
     goto cleanup;
 
 cufftError:
-    fprintf(stderr, "CuFFT error: %d\n", r);
+    logMessage(LOG_ERROR, "CuFFT error: %d\n", r);
     retval = r;
     goto cleanup;
 
 cleanup:
-    printf("h_image: %p, h_object: %p, h_psf: %p, h_buf: %p, h_otf: %p\n", h_image, h_object, h_psf, h_buf, h_otf);
+    logMessage(LOG_DEBUG, "h_image: %p, h_object: %p, h_psf: %p, h_buf: %p, h_otf: %p\n", h_image, h_object, h_psf, h_buf, h_otf);
     if(image) {
         if(h_image_pad) {
             cudaHostUnregister(h_image_pad);
@@ -465,6 +608,8 @@ int deconv_stream(unsigned int iter, size_t N1, size_t N2, size_t N3,
     cufftResult r;
     cudaError_t err;
     cufftHandle planR2C, planC2R;
+    CallStats callStats;
+    bool stopped = false;
 
     cudaStream_t fftStream = 0, memStream = 0;
 
@@ -522,9 +667,14 @@ int deconv_stream(unsigned int iter, size_t N1, size_t N2, size_t N3,
     err = cudaHostRegister(h_otf, nFreq*sizeof(cuComplex), 0);
     if(err) goto cudaErr;
 
+    callStats.mark();
+
     r = createPlans(N1, N2, N3, &planR2C, &planC2R, &workArea, &workSize);
     if(r) goto cufftError;
 
+    callStats.phase(STATS_PLAN_SECONDS);
+    callStats.add(STATS_PEAK_BYTES, 2 * mFreq + workSize);
+
     r = cufftSetStream(planR2C, fftStream);
     if(r) goto cufftError;
     r = cufftSetStream(planC2R, fftStream);
@@ -541,6 +691,11 @@ int deconv_stream(unsigned int iter, size_t N1, size_t N2, size_t N3,
     err = cudaStreamSynchronize(fftStream);
     if(err) goto cudaErr;
 
+    callStats.phase(STATS_OTF_SECONDS);
+    callStats.add(STATS_FFTS, 1);
+    callStats.add(STATS_BYTES_TO_DEVICE, nSpatial*sizeof(float) + nSpatial*sizeof(float));
+    callStats.add(STATS_BYTES_FROM_DEVICE, nFreq*sizeof(cuComplex));
+
     //printf("OTF generated.\n");
 
     err = cudaMemcpyAsync(result, h_object, nSpatial*sizeof(float), cudaMemcpyHostToDevice, fftStream);
@@ -594,20 +749,34 @@ int deconv_stream(unsigned int iter, size_t N1, size_t N2, size_t N3,
 
         err = cudaMemcpyAsync(h_object, result, nSpatial*sizeof(float), cudaMemcpyDeviceToHost, fftStream);
         if(err) goto cudaErr;
+
+        // the OTF twice, the image and the object up, the object down
+        callStats.add(STATS_ITERATIONS, 1);
+        callStats.add(STATS_FFTS, 4);
+        callStats.add(STATS_BYTES_TO_DEVICE, 2*nFreq*sizeof(cuComplex) + 2*nSpatial*sizeof(float));
+        callStats.add(STATS_BYTES_FROM_DEVICE, nSpatial*sizeof(float));
+
+        logMessage(LOG_DEBUG, "iteration %u\n", i);
+
+        if (!continueIterating(i + 1, iter)) {
+            logMessage(LOG_INFO, "cancelled after %u iterations\n", i + 1);
+            stopped = true;
+            break;
+        }
     }
 
     cudaDeviceSynchronize();
 
-    retval = 0;
+    retval = stopped ? DECONV_CANCELLED : 0;
     goto cleanup;
 
 cudaErr:
-    fprintf(stderr, "CUDA error: %d\n", err);
+    logMessage(LOG_ERROR, "CUDA error: %d\n", err);
     retval = err;
     goto cleanup;
 
 cufftError:
-    fprintf(stderr, "CuFFT error: %d\n", r);
+    logMessage(LOG_ERROR, "CuFFT error: %d\n", r);
     retval = r;
     goto cleanup;
 
@@ -662,39 +831,38 @@ cufftResult createPlans(size_t N1, size_t N2, size_t N3, cufftHandle *planR2C, c
     if(tmp > *workSize)
         *workSize = tmp;
 
-	std::cout << "Malloc work area of "<<(float)*workSize/(float)(1024 * 1024 * 1024)<<" GB\n";
+	logMessage(LOG_INFO, "Malloc work area of %f GB\n", (float)*workSize/(float)(1024 * 1024 * 1024));
 	
     cudaError_t err = cudaMalloc(workArea, *workSize);
     if(err) {
-		std::cout<<"cudaMalloc of workArea failed: "<<*workSize<<"\n";
+		logMessage(LOG_ERROR, "cudaMalloc of workArea failed: %zu\n", *workSize);
 		return CUFFT_ALLOC_FAILED;
 	}
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc work area)\n";
+	logMemory("malloc work area");
 
 
     r = cufftSetWorkArea(*planR2C, *workArea);
 	if (r) {
-		std::cout << "Error setting work area R2C\n";
+		logMessage(LOG_ERROR, "Error setting work area R2C\n");
 		goto error;
 	}
     r = cufftMakePlan3d(*planR2C, N1, N2, N3, CUFFT_R2C, &tmp);
     //r = cufftMakePlan2d(*planR2C, N1, N2, CUFFT_R2C, &tmp);
 	if (r) {
-		std::cout << "Error "<<r<<" when making plan R2C\n";
+		logMessage(LOG_ERROR, "Error %d when making plan R2C\n", r);
 		goto error;
 	}
 
     r = cufftSetWorkArea(*planC2R, *workArea);
 	if (r) {
-		std::cout << "Error setting work area C2R\n";
+		logMessage(LOG_ERROR, "Error setting work area C2R\n");
 		goto error;
 	}
     r = cufftMakePlan3d(*planC2R, N1, N2, N3, CUFFT_C2R, &tmp);
     //r = cufftMakePlan2d(*planC2R, N1, N2, CUFFT_C2R, &tmp);
 	if (r) {
-		std::cout << "Error making plan C2R\n";
+		logMessage(LOG_ERROR, "Error %d when making plan C2R\n", r);
 		goto error;
 	}
 
@@ -752,11 +920,9 @@ int conv_device(size_t N1, size_t N2, size_t N3,
     cufftResult r;
     cudaError_t err;
     cufftHandle planR2C, planC2R;
+    CallStats callStats;
 
-	// memroy information
-	size_t freeMem, totalMem;
-
-	std::cout<<"Starting Cuda convolution\n";
+	logMessage(LOG_INFO, "Starting Cuda convolution\n");
 	//printf("input size: %d %d %d", N1, N2, N3);
 
     float *image = 0; // convolved image (constant)
@@ -785,7 +951,6 @@ int conv_device(size_t N1, size_t N2, size_t N3,
 
     //printf("N: %ld, M: %ld\n", nSpatial, mSpatial);
     //printf("Blocks: %d x %d x %d, Threads: %d x %d x %d\n", spatialBlocks.x, spatialBlocks.y, spatialBlocks.z, spatialThreadsPerBlock.x, spatialThreadsPerBlock.y, spatialThreadsPerBlock.z);
-	fflush(stdin);
 
 	//std::cout<<"N spatial: "<<nSpatial<<" M spatial: "<<mSpatial<<"\n"<<std::flush;
 	//std::cout << "N freq: " << nFreq << " M freq: " << mFreq << "\n" << std::flush;
@@ -795,58 +960,54 @@ int conv_device(size_t N1, size_t N2, size_t N3,
 
     cudaProfilerStart();
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total at start of Convolution\n";
+	logMemory("at start of Convolution");
 
     err = cudaMalloc(&image, mSpatial);
     if(err)  {
-		std::cout<<"Error allocating image of size "<<mSpatial<<"\n";
+		logMessage(LOG_ERROR, "Error allocating image of size %zu\n", mSpatial);
 		goto cudaErr;
 	}
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc image)\n";
+	logMemory("malloc image");
 
 
     err = cudaMalloc(&out, mSpatial);
     if(err)  {
-		std::cout<<"Error allocating output of size "<<mSpatial<<"\n";
+		logMessage(LOG_ERROR, "Error allocating output of size %zu\n", mSpatial);
 		goto cudaErr;
 	}
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc out)\n";
+	logMemory("malloc out");
 
 	err = cudaMalloc(&psf, mSpatial);
     if(err)  {
-		std::cout<<"Error allocating psf of size "<<mSpatial<<"\n";
+		logMessage(LOG_ERROR, "Error allocating psf of size %zu\n", mSpatial);
 		goto cudaErr;
 	}
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc PSF)\n";
+	logMemory("malloc PSF");
 	
     err = cudaMalloc(&buf, mFreq); // mFreq > mSpatial
      if(err)  {
-		std::cout<<"Error allocating freq buffer of size "<<mFreq<<"\n";
+		logMessage(LOG_ERROR, "Error allocating freq buffer of size %zu\n", mFreq);
 		goto cudaErr;
 	}
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc buf)\n";
+	logMemory("malloc buf");
 
 	err = cudaMalloc(&otf, mFreq); // mFreq > mSpatial
     if(err)  {
-		std::cout<<"Error allocating otf of size "<<mFreq<<"\n";
+		logMessage(LOG_ERROR, "Error allocating otf of size %zu\n", mFreq);
 		goto cudaErr;
 	}
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (malloc OTF)\n";
+	logMemory("malloc OTF");
 
     err = cudaMemset(image, 0, mSpatial);
     if(err) goto cudaErr;
     err = cudaMemset(out, 0, mSpatial);
     if(err) goto cudaErr;
 
+    callStats.mark();
+
     err = cudaMemcpy(image, h_image, nSpatial*sizeof(float), cudaMemcpyHostToDevice);
     if(err) goto cudaErr;
     err = cudaMemcpy(out, h_out, nSpatial*sizeof(float), cudaMemcpyHostToDevice);
@@ -855,22 +1016,28 @@ int conv_device(size_t N1, size_t N2, size_t N3,
     err = cudaMemcpy(psf, h_psf, nSpatial*sizeof(float), cudaMemcpyHostToDevice);
     if(err) goto cudaErr;
 
+    callStats.phase(STATS_TRANSFER_SECONDS);
+    callStats.add(STATS_BYTES_TO_DEVICE, 3 * nSpatial * sizeof(float));
+
     // BN it looks like this function was originall written for the array organization used in matlab.  I Changed the order of the dimensions
     // to be compatible with imglib2 (java). TODO - add param for array organization 
     r = createPlans(N1, N2, N3, &planR2C, &planC2R, &workArea, &workSize);
     if(r) {
-		std::cout<<"Error creating plans"<<"\n";
+		logMessage(LOG_ERROR, "Error creating plans\n");
 		goto cufftError;
 	}
+
+    callStats.phase(STATS_PLAN_SECONDS);
+    callStats.add(STATS_PEAK_BYTES, 3 * mSpatial + 2 * mFreq + workSize);
 		
     r = cufftExecR2C(planR2C, psf, otf);
     if(r) goto cufftError;
 
-    // BN flush the buffer for debugging in Java.
-    fflush(stdout);
-    
+    callStats.phase(STATS_OTF_SECONDS);
+
 	r = cufftExecR2C(planR2C, image, (cufftComplex*)buf);
     if(r) goto cufftError;
+    callStats.phase(STATS_FFT_SECONDS);
     
 	if (correlate==1) {
 		ComplexConjugateMul<<<freqBlocks, freqThreadsPerBlock>>>((cuComplex*)buf, otf, (cuComplex*)buf);
@@ -878,25 +1045,31 @@ int conv_device(size_t N1, size_t N2, size_t N3,
 	else {
 		ComplexMul<<<freqBlocks, freqThreadsPerBlock>>>((cuComplex*)buf, otf, (cuComplex*)buf);
 	}        
+    callStats.phase(STATS_POINTWISE_SECONDS);
 
 	r = cufftExecC2R(planC2R, (cufftComplex*)buf, (float*)out);
     if(r) goto cufftError;
+    callStats.phase(STATS_FFT_SECONDS);
+    callStats.add(STATS_FFTS, 3);
 	
 
 		FloatDivByConstant<<<spatialBlocks, spatialThreadsPerBlock>>>((float*)out,(float)nSpatial);
+		callStats.phase(STATS_POINTWISE_SECONDS);
     
 		err = cudaMemcpy(h_out, out, nSpatial*sizeof(float), cudaMemcpyDeviceToHost);
+		callStats.phase(STATS_TRANSFER_SECONDS);
+		callStats.add(STATS_BYTES_FROM_DEVICE, nSpatial * sizeof(float));
     
 		retval = 0;
     goto cleanup;
 
 cudaErr:
-    fprintf(stderr, "CUDA error: %d\n", err);
+    logMessage(LOG_ERROR, "CUDA error: %d\n", err);
     retval = err;
     goto cleanup;
 
 cufftError:
-    fprintf(stderr, "CuFFT error: %d\n", r);
+    logMessage(LOG_ERROR, "CuFFT error: %d\n", r);
     retval = r;
     goto cleanup;
 
@@ -909,7 +1082,7 @@ cleanup:
     if(workArea) cudaFree(workArea);
     cudaProfilerStop();
     cudaDeviceReset();
-    std::cout<<"Finished Convolution\n\n";
+    logMessage(LOG_INFO, "Finished Convolution\n");
     return retval;
 }
 
@@ -945,16 +1118,12 @@ extern "C" long long getFreeMem() {
 
 extern "C" long long getWorkSize(size_t N1, size_t N2, size_t N3) {
 
-	size_t freeMem, totalMem;
-
 	cudaDeviceReset();
 
 	cudaProfilerStart();
 
-	cudaMemGetInfo(&freeMem, &totalMem);
-	std::cout << (float)freeMem / (float)(1024 * 1024 * 1024) << " G free out of " << (float)totalMem / (float)(1024 * 1024 * 1024) << " total (get work size)\n";
+	logMemory("get work size");
 
-  fflush(stdout);
 	cufftResult r;
 
 	cufftHandle planR2C, planC2R;
@@ -985,6 +1154,75 @@ extern "C" long long getWorkSize(size_t N1, size_t N2, size_t N3) {
 	return (long long)workSize;
 }
 
+// larger of the R2C and C2R work areas, the plans share one (see createPlans)
+static cufftResult cufftWorkSize(size_t N1, size_t N2, size_t N3, size_t * workSize) {
+	cufftHandle planR2C, planC2R;
+	size_t temp;
+
+	cufftResult r = cufftCreate(&planR2C);
+	if (r) return r;
+	r = cufftCreate(&planC2R);
+	if (r) {
+		cufftDestroy(planR2C);
+		return r;
+	}
+
+	cufftSetAutoAllocation(planR2C, 0);
+	cufftSetAutoAllocation(planC2R, 0);
+
+	r = cufftGetSize3d(planR2C, N1, N2, N3, CUFFT_R2C, workSize);
+	if (!r) {
+		r = cufftGetSize3d(planC2R, N1, N2, N3, CUFFT_C2R, &temp);
+	}
+
+	if (!r && temp > *workSize) {
+		*workSize = temp;
+	}
+
+	cufftDestroy(planR2C);
+	cufftDestroy(planC2R);
+
+	return r;
+}
+
+/*
+Peak device memory in bytes of deconv_device, conv_device or deconv_stream (see the PEAK_ modes in deconv.h),
+i.e. everything they cudaMalloc: the spatial buffers and frequency buffers rounded up to whole thread blocks, 
+and the cuFFT work area.  The CUDA context itself is not included (getFreeMem is measured after it exists). 
+Returns -1 on error.
+*/
+extern "C" long long getPeakMemory(size_t N1, size_t N2, size_t N3, int mode) {
+	size_t nSpatial = N1*N2*N3;
+	size_t nFreq = N1*N2*(N3/2+1);
+
+	dim3 freqThreadsPerBlock, spatialThreadsPerBlock, freqBlocks, spatialBlocks;
+
+	if (numBlocksThreads(nSpatial, &spatialBlocks, &spatialThreadsPerBlock)) return -1;
+	if (numBlocksThreads(nFreq, &freqBlocks, &freqThreadsPerBlock)) return -1;
+
+	long long mSpatial = (long long)spatialBlocks.x * spatialBlocks.y * spatialBlocks.z * spatialThreadsPerBlock.x * sizeof(float);
+	long long mFreq = (long long)freqBlocks.x * freqBlocks.y * freqBlocks.z * freqThreadsPerBlock.x * sizeof(cuComplex);
+
+	size_t workSize;
+	if (cufftWorkSize(N1, N2, N3, &workSize)) return -1;
+
+	switch (mode) {
+		case PEAK_DECONV:
+			// image, object, psf (reused as temp), otf, buf
+			return 3 * mSpatial + 2 * mFreq + (long long)workSize;
+		case PEAK_DECONV_NORMAL:
+			return 4 * mSpatial + 2 * mFreq + (long long)workSize;
+		case PEAK_CONV:
+			// image, out, psf, buf, otf
+			return 3 * mSpatial + 2 * mFreq + (long long)workSize;
+		case PEAK_DECONV_STREAM:
+			// result and buf, the rest is streamed from host memory
+			return 2 * mFreq + (long long)workSize;
+		default:
+			return -1;
+	}
+}
+
 void removeSmallValues(float *in, long long size) {
 	for (long long i=0;i<size;i++) {
 		if (in[i]<0.00001) {
@@ -993,3 +1231,39 @@ void removeSmallValues(float *in, long long size) {
 	}
 
 }
+
+extern "C" void enableStats(int level) {
+	statsLevel = level;
+}
+
+extern "C" void resetStats() {
+	std::lock_guard<std::mutex> lock(statsMutex);
+	memset(stats, 0, sizeof(stats));
+}
+
+// copies min(n, STATS_COUNT) of the statistics into stats, returns the number copied
+extern "C" int getStats(double * stats_out, int n) {
+	n = std::min(n, STATS_COUNT);
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	for (int i = 0; i < n; i++) {
+		stats_out[i] = stats[i];
+	}
+	return n;
+}
+
+extern "C" void setLogLevel(int level) {
+	logLevel = level;
+}
+
+// callback (NULL for none) is called from the thread running the deconvolution, user is passed through
+extern "C" void setProgressCallback(ProgressCallback callback, void * user) {
+	std::lock_guard<std::mutex> lock(progressMutex);
+	progressCallback = callback;
+	progressUser = user;
+}
+
+// non zero stops running and later deconvolutions after their current iteration, until it is set back to 0
+extern "C" void setCancelled(int value) {
+	cancelled = value;
+}
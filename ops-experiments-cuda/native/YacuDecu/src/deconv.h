@@ -1,5 +1,55 @@
 #pragma once
 
+// modes for getPeakMemory
+// deconv_device (and deconv_host) without a normal
+#define PEAK_DECONV 0
+// deconv_device with h_normal
+#define PEAK_DECONV_NORMAL 1
+// conv_device
+#define PEAK_CONV 2
+// deconv_stream
+#define PEAK_DECONV_STREAM 3
+
+// levels for enableStats
+// no statistics, the default (the calls only test a flag)
+#define STATS_OFF 0
+// counters and the total time of each call, no extra synchronization
+#define STATS_COUNTERS 1
+// also the time of each phase, the device is synchronized after every phase
+// so the phase times add up, which makes the calls a bit slower
+#define STATS_PHASES 2
+
+// indices into the array getStats fills, sums over the calls since resetStats
+// (except STATS_PEAK_BYTES, the largest of any call)
+#define STATS_PLAN_SECONDS 0
+#define STATS_OTF_SECONDS 1
+#define STATS_FFT_SECONDS 2
+#define STATS_POINTWISE_SECONDS 3
+#define STATS_TRANSFER_SECONDS 4
+#define STATS_TOTAL_SECONDS 5
+#define STATS_CALLS 6
+#define STATS_ITERATIONS 7
+#define STATS_FFTS 8
+#define STATS_BYTES_TO_DEVICE 9
+#define STATS_BYTES_FROM_DEVICE 10
+#define STATS_PEAK_BYTES 11
+#define STATS_COUNT 12
+
+// levels for setLogLevel, a message is printed if its level is at most the set level (errors go to stderr)
+#define LOG_NONE 0
+// errors only, the default
+#define LOG_ERROR 1
+// a few lines per call (sizes, device memory)
+#define LOG_INFO 2
+// a line per iteration
+#define LOG_DEBUG 3
+
+// returned by the deconv entry points when the run was cancelled, h_object holds the last finished iteration
+#define DECONV_CANCELLED -2000
+
+// called after every RL iteration with the number of finished iterations, returning non zero cancels the run
+typedef int (*ProgressCallback)(int iteration, int iterations, void * user);
+
 extern "C" {
 	int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_object, float * h_normal);
 	int deconv_host(unsigned int iter, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_object, float * h_normal);
@@ -8,7 +58,14 @@ extern "C" {
 	int setDevice(int device);
 	int getDeviceCount();
 	long long getWorkSize(size_t N1, size_t N2, size_t N3);
+	long long getPeakMemory(size_t N1, size_t N2, size_t N3, int mode);
 	long long getTotalMem();
 	long long getFreeMem();
 	void removeSmallValues(float * in, long long size);
+	void enableStats(int level);
+	void resetStats();
+	int getStats(double * stats, int n);
+	void setLogLevel(int level);
+	void setProgressCallback(ProgressCallback callback, void * user);
+	void setCancelled(int cancelled);
 }
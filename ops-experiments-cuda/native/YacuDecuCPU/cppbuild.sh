@@ -0,0 +1,24 @@
+#!/usr/bin/env bash
+# Scripts to build and install native C++ libraries
+# Adapted from https://github.com/bytedeco/javacpp-presets
+set -eu
+
+if [[ -z "$PLATFORM" ]]; then
+    pushd ..
+    bash cppbuild.sh "$@" YacuDecuCPU
+    popd
+    exit
+fi
+
+case $PLATFORM in
+    linux-x86_64)
+		cp ../Makefile Makefile
+		mkdir -p ../../lib
+		make clean
+        make
+        make install
+        ;;
+    *)
+        echo "Error: Platform \"$PLATFORM\" is not supported"
+        ;;
+esac
@@ -0,0 +1,1035 @@
+/*
+    deconv_cpu.cpp
+
+    CPU implementation of the YacuDecu API (deconv.h) on FFTW, so the YacuDecu wrappers (YacuDecuRichardsonLucyWrapper,
+    YacuDecuUtility.py) run on nodes without a GPU.  It builds a libYacuDecu with the same exports and the same
+    semantics as deconv.cu:
+        - Richardson Lucy with the correlation (conjugate OTF multiply) in the update step
+        - optional non-circulant normal, the estimate is divided by it each iteration (0 where the normal is 0)
+        - conv_device with the correlate flag
+        - host RAM reported as device memory by getTotalMem and getFreeMem
+        - plans (createDeconvPlan in deconv_cpu.h) keeping the OTF and the FFTW plans across calls
+
+    FFTs use the FFTW threads library and the pointwise steps use OpenMP.  The 1/N of the inverse FFT is folded
+    into the OTF once, so there are no separate scaling passes.
+
+    deconv_stream is the memory budgeted version (see setMemoryBudget in deconv_cpu.h).  Like deconv_stream in 
+    deconv.cu only the in place FFT buffer has to be resident, the OTF lives in a memory mapped scratch file if 
+    the budget doesn't fit it, and the OTF, image, object and normal are streamed through in row blocks with 
+    madvise prefetching the next block.
+
+    License: LGPL
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <fftw3.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
+
+#include <string>
+
+#include "deconv.h"
+#include "deconv_cpu.h"
+
+// return values, the same codes the CUDA version returns for the equivalent failures
+#define CPU_SUCCESS 0
+// cudaErrorMemoryAllocation
+#define CPU_ALLOC_FAILED 2
+// CUFFT_INVALID_PLAN
+#define CPU_PLAN_FAILED 1
+// cudaErrorInvalidDevice
+#define CPU_INVALID_DEVICE 101
+// cudaErrorInvalidValue
+#define CPU_INVALID_VALUE 11
+
+// statistics (see enableStats in deconv.h), everything runs on the host so the phases need no synchronization 
+// and there are no transfers, a call collects its own and adds them to the totals when it returns
+static std::atomic<int> statsLevel(STATS_OFF);
+static double stats[STATS_COUNT];
+static std::mutex statsMutex;
+
+static double statsClock() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct CallStats {
+	int level;
+	double start, last;
+	double values[STATS_COUNT];
+
+	CallStats() : level(statsLevel), start(0), last(0) {
+		memset(values, 0, sizeof(values));
+		if (level) start = last = statsClock();
+	}
+
+	// restarts the phase clock without charging the time to a phase (allocation)
+	void mark() {
+		if (level < STATS_PHASES) return;
+		last = statsClock();
+	}
+
+	// charges the time since the last phase to values[index]
+	void phase(int index) {
+		if (level < STATS_PHASES) return;
+		double now = statsClock();
+		values[index] += now - last;
+		last = now;
+	}
+
+	void add(int index, double n) {
+		if (level) values[index] += n;
+	}
+
+	~CallStats() {
+		if (!level) return;
+		values[STATS_TOTAL_SECONDS] = statsClock() - start;
+		values[STATS_CALLS] = 1;
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (int i = 0; i < STATS_COUNT; i++) {
+			stats[i] = i == STATS_PEAK_BYTES ? std::max(stats[i], values[i]) : stats[i] + values[i];
+		}
+	}
+};
+
+// logging, progress and cancellation (see setLogLevel in deconv.h), the defaults print errors only
+static std::atomic<int> logLevel(LOG_ERROR);
+static std::atomic<int> cancelled(0);
+static ProgressCallback progressCallback = NULL;
+static void * progressUser = NULL;
+static std::mutex progressMutex;
+
+static void logMessage(int level, const char * format, ...) {
+	if (level > logLevel) return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+	va_end(args);
+}
+
+// reports iteration of iterations finished, returns false if the run should stop
+static bool continueIterating(unsigned int iteration, unsigned int iterations) {
+	ProgressCallback callback;
+	void * user;
+
+	{
+		std::lock_guard<std::mutex> lock(progressMutex);
+		callback = progressCallback;
+		user = progressUser;
+	}
+
+	if (callback != NULL && callback((int)iteration, (int)iterations, user) != 0) return false;
+
+	return !cancelled;
+}
+
+// the FFTW planner is not thread safe
+static std::mutex plannerLock;
+
+static void initThreads() {
+	static bool initialized = false;
+
+	if (!initialized) {
+		fftwf_init_threads();
+		initialized = true;
+	}
+
+#ifdef _OPENMP
+	fftwf_plan_with_nthreads(omp_get_max_threads());
+#endif
+}
+
+// forward and inverse FFT of one volume, plans are made for the arrays they will run on (FFTW_ESTIMATE doesn't
+// touch the data)
+struct Plans {
+	fftwf_plan forward;
+	fftwf_plan inverse;
+};
+
+static bool createPlans(size_t N1, size_t N2, size_t N3, float * spatial, fftwf_complex * freq, float * inverseOut, Plans * plans) {
+	std::lock_guard<std::mutex> lock(plannerLock);
+
+	initThreads();
+
+	plans->forward = fftwf_plan_dft_r2c_3d((int)N1, (int)N2, (int)N3, spatial, freq, FFTW_ESTIMATE);
+	plans->inverse = fftwf_plan_dft_c2r_3d((int)N1, (int)N2, (int)N3, freq, inverseOut, FFTW_ESTIMATE);
+
+	return plans->forward != NULL && plans->inverse != NULL;
+}
+
+static void destroyPlans(Plans * plans) {
+	std::lock_guard<std::mutex> lock(plannerLock);
+
+	if (plans->forward) fftwf_destroy_plan(plans->forward);
+	if (plans->inverse) fftwf_destroy_plan(plans->inverse);
+}
+
+// OTF = FFT(psf)/N, so a multiply with the OTF and an inverse FFT is a normalized convolution
+static bool computeOTF(size_t N1, size_t N2, size_t N3, float * h_psf, fftwf_complex * otf) {
+	fftwf_plan plan;
+	{
+		std::lock_guard<std::mutex> lock(plannerLock);
+		initThreads();
+		plan = fftwf_plan_dft_r2c_3d((int)N1, (int)N2, (int)N3, h_psf, otf, FFTW_ESTIMATE);
+	}
+
+	if (plan == NULL) {
+		return false;
+	}
+
+	fftwf_execute(plan);
+
+	{
+		std::lock_guard<std::mutex> lock(plannerLock);
+		fftwf_destroy_plan(plan);
+	}
+
+	const long long nFreq = (long long)(N1*N2*(N3/2+1));
+	const float scale = 1.0f / (float)(N1*N2*N3);
+
+#pragma omp parallel for
+	for (long long i = 0; i < nFreq; i++) {
+		otf[i][0] *= scale;
+		otf[i][1] *= scale;
+	}
+
+	return true;
+}
+
+// A = A*B, or A*conj(B) if conjugate
+static void complexMul(fftwf_complex * A, const fftwf_complex * B, long long n, bool conjugate) {
+	const float sign = conjugate ? -1.0f : 1.0f;
+
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++) {
+		const float ar = A[i][0], ai = A[i][1];
+		const float br = B[i][0], bi = sign * B[i][1];
+		A[i][0] = ar * br - ai * bi;
+		A[i][1] = ar * bi + ai * br;
+	}
+}
+
+// C = A/B, 0 where B is 0 (FloatDiv in deconv.cu)
+static void floatDiv(const float * A, const float * B, float * C, long long n) {
+#pragma omp parallel for
+	for (long long i = 0; i < n; i++) {
+		C[i] = B[i] != 0 ? A[i] / B[i] : 0;
+	}
+}
+
+// object = object*update, then divided by the normal if there is one
+static void updateObject(float * object, const float * update, const float * normal, long long n) {
+	if (normal != NULL) {
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++) {
+			const float o = object[i] * update[i];
+			object[i] = normal[i] != 0 ? o / normal[i] : 0;
+		}
+	}
+	else {
+#pragma omp parallel for
+		for (long long i = 0; i < n; i++) {
+			object[i] *= update[i];
+		}
+	}
+}
+
+/*
+The RL iterations on h_object with the OTF, through buf and temp with the plans of the object (h_object to buf, buf
+to temp) and of temp (in place through buf).  Returns CPU_SUCCESS, or DECONV_CANCELLED if the run was cancelled.
+*/
+static int rlIterations(unsigned int iter, long long nSpatial, long long nFreq, float * h_image, float * h_object,
+                        float * h_normal, const fftwf_complex * otf, fftwf_complex * buf, float * temp,
+                        const Plans & objectPlans, const Plans & tempPlans, CallStats & callStats) {
+	logMessage(LOG_INFO, "Running %u iterations of CPU RL\n", iter);
+
+	for (unsigned int i = 0; i < iter; i++) {
+		// reblurred = object * psf
+		fftwf_execute(objectPlans.forward);
+		callStats.phase(STATS_FFT_SECONDS);
+		complexMul(buf, otf, nFreq, false);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+		fftwf_execute(objectPlans.inverse);
+		callStats.phase(STATS_FFT_SECONDS);
+
+		// ratio of the image to the reblurred
+		floatDiv(h_image, temp, temp, nSpatial);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+
+		// correlate the ratio with the psf
+		fftwf_execute(tempPlans.forward);
+		callStats.phase(STATS_FFT_SECONDS);
+		complexMul(buf, otf, nFreq, true);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+		fftwf_execute(tempPlans.inverse);
+		callStats.phase(STATS_FFT_SECONDS);
+
+		updateObject(h_object, temp, h_normal, nSpatial);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+
+		callStats.add(STATS_ITERATIONS, 1);
+		callStats.add(STATS_FFTS, 4);
+
+		logMessage(LOG_DEBUG, "iteration %u\n", i);
+
+		if (!continueIterating(i + 1, iter)) {
+			logMessage(LOG_INFO, "cancelled after %u iterations\n", i + 1);
+			return DECONV_CANCELLED;
+		}
+	}
+
+	return CPU_SUCCESS;
+}
+
+/* h_normal is the non-circulant normalization factor described here
+	http://bigwww.epfl.ch/deconvolution/challenge/index.html?p=documentation/theory/richardsonlucyi
+   The estimate is updated in place in h_object.
+*/
+int deconv_device(unsigned int iter, size_t N1, size_t N2, size_t N3,
+                  float *h_image, float *h_psf, float *h_object, float *h_normal) {
+
+	logMessage(LOG_INFO, "Starting CPU deconvolution N1=%zu N2=%zu N3=%zu\n", N1, N2, N3);
+
+	const long long nSpatial = (long long)(N1*N2*N3);
+	const long long nFreq = (long long)(N1*N2*(N3/2+1));
+
+	int retval = CPU_SUCCESS;
+	Plans objectPlans = {NULL, NULL};
+	Plans tempPlans = {NULL, NULL};
+	CallStats callStats;
+	bool planned;
+
+	fftwf_complex * otf = fftwf_alloc_complex(nFreq);
+	fftwf_complex * buf = fftwf_alloc_complex(nFreq);
+	float * temp = fftwf_alloc_real(nSpatial);
+
+	if (otf == NULL || buf == NULL || temp == NULL) {
+		logMessage(LOG_ERROR, "Error allocating %f GB\n", (float)(2*nFreq*sizeof(fftwf_complex) + nSpatial*sizeof(float)) / (float)(1024 * 1024 * 1024));
+		retval = CPU_ALLOC_FAILED;
+		goto cleanup;
+	}
+
+	callStats.mark();
+	callStats.add(STATS_PEAK_BYTES, getPeakMemory(N1, N2, N3, PEAK_DECONV));
+
+	planned = computeOTF(N1, N2, N3, h_psf, otf);
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	planned = planned &&
+	    createPlans(N1, N2, N3, h_object, buf, temp, &objectPlans) &&
+	    createPlans(N1, N2, N3, temp, buf, temp, &tempPlans);
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	if (!planned) {
+		logMessage(LOG_ERROR, "Error creating FFTW plans\n");
+		retval = CPU_PLAN_FAILED;
+		goto cleanup;
+	}
+
+	retval = rlIterations(iter, nSpatial, nFreq, h_image, h_object, h_normal, otf, buf, temp, objectPlans, tempPlans,
+	    callStats);
+
+cleanup:
+	destroyPlans(&objectPlans);
+	destroyPlans(&tempPlans);
+
+	if (otf) fftwf_free(otf);
+	if (buf) fftwf_free(buf);
+	if (temp) fftwf_free(temp);
+
+	return retval;
+}
+
+// host memory is the device memory here, so the host variant is the same as deconv_device
+extern "C" int deconv_host(unsigned int iter, size_t N1, size_t N2, size_t N3,
+                float *h_image, float *h_psf, float *h_object, float *h_normal) {
+	return deconv_device(iter, N1, N2, N3, h_image, h_psf, h_object, h_normal);
+}
+
+/*
+The OTF and FFTW plans of one size and PSF, made once by createDeconvPlan for any number of deconv_plan and 
+conv_plan calls (the deconvolver library keeps one per deconvolver).  The plans run on the plan's own object and 
+scratch, the caller's object is copied in and out.  One call runs on a plan at a time.
+*/
+struct DeconvPlan {
+	size_t N1, N2, N3;
+	fftwf_complex * otf;
+	fftwf_complex * buf;
+	float * temp;
+	float * object;
+	Plans objectPlans;
+	Plans tempPlans;
+	std::mutex lock;
+};
+
+DeconvPlan * createDeconvPlan(size_t N1, size_t N2, size_t N3, float * h_psf) {
+	logMessage(LOG_INFO, "Planning CPU deconvolution N1=%zu N2=%zu N3=%zu\n", N1, N2, N3);
+
+	const long long nSpatial = (long long)(N1*N2*N3);
+	const long long nFreq = (long long)(N1*N2*(N3/2+1));
+
+	CallStats callStats;
+	DeconvPlan * plan = new DeconvPlan();
+	bool planned;
+
+	plan->N1 = N1;
+	plan->N2 = N2;
+	plan->N3 = N3;
+	plan->otf = fftwf_alloc_complex(nFreq);
+	plan->buf = fftwf_alloc_complex(nFreq);
+	plan->temp = fftwf_alloc_real(nSpatial);
+	plan->object = fftwf_alloc_real(nSpatial);
+	plan->objectPlans.forward = plan->objectPlans.inverse = NULL;
+	plan->tempPlans.forward = plan->tempPlans.inverse = NULL;
+
+	if (plan->otf == NULL || plan->buf == NULL || plan->temp == NULL || plan->object == NULL) {
+		logMessage(LOG_ERROR, "Error allocating %f GB\n", (float)getPeakMemory(N1, N2, N3, PEAK_DECONV_PLAN) / (float)(1024 * 1024 * 1024));
+		destroyDeconvPlan(plan);
+		return NULL;
+	}
+
+	callStats.mark();
+	callStats.add(STATS_PEAK_BYTES, getPeakMemory(N1, N2, N3, PEAK_DECONV_PLAN));
+
+	planned = computeOTF(N1, N2, N3, h_psf, plan->otf);
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	planned = planned &&
+	    createPlans(N1, N2, N3, plan->object, plan->buf, plan->temp, &plan->objectPlans) &&
+	    createPlans(N1, N2, N3, plan->temp, plan->buf, plan->temp, &plan->tempPlans);
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	if (!planned) {
+		logMessage(LOG_ERROR, "Error creating FFTW plans\n");
+		destroyDeconvPlan(plan);
+		return NULL;
+	}
+
+	return plan;
+}
+
+// deconv_device with the plan's OTF
+int deconv_plan(DeconvPlan * plan, unsigned int iter, float *h_image, float *h_object, float *h_normal) {
+	std::lock_guard<std::mutex> lock(plan->lock);
+
+	const long long nSpatial = (long long)(plan->N1*plan->N2*plan->N3);
+	const long long nFreq = (long long)(plan->N1*plan->N2*(plan->N3/2+1));
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, getPeakMemory(plan->N1, plan->N2, plan->N3, PEAK_DECONV_PLAN));
+
+	memcpy(plan->object, h_object, nSpatial*sizeof(float));
+
+	int retval = rlIterations(iter, nSpatial, nFreq, h_image, plan->object, h_normal, plan->otf, plan->buf, plan->temp,
+	    plan->objectPlans, plan->tempPlans, callStats);
+
+	memcpy(h_object, plan->object, nSpatial*sizeof(float));
+	callStats.phase(STATS_POINTWISE_SECONDS);
+
+	return retval;
+}
+
+// conv_device with the plan's OTF
+int conv_plan(DeconvPlan * plan, float *h_image, float *h_out, unsigned int correlate) {
+	std::lock_guard<std::mutex> lock(plan->lock);
+
+	const long long nSpatial = (long long)(plan->N1*plan->N2*plan->N3);
+	const long long nFreq = (long long)(plan->N1*plan->N2*(plan->N3/2+1));
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, getPeakMemory(plan->N1, plan->N2, plan->N3, PEAK_DECONV_PLAN));
+
+	memcpy(plan->temp, h_image, nSpatial*sizeof(float));
+	fftwf_execute(plan->tempPlans.forward);
+	callStats.phase(STATS_FFT_SECONDS);
+	complexMul(plan->buf, plan->otf, nFreq, correlate == 1);
+	callStats.phase(STATS_POINTWISE_SECONDS);
+	fftwf_execute(plan->tempPlans.inverse);
+	callStats.phase(STATS_FFT_SECONDS);
+	callStats.add(STATS_FFTS, 2);
+
+	memcpy(h_out, plan->temp, nSpatial*sizeof(float));
+
+	return CPU_SUCCESS;
+}
+
+void destroyDeconvPlan(DeconvPlan * plan) {
+	if (plan == NULL) {
+		return;
+	}
+
+	destroyPlans(&plan->objectPlans);
+	destroyPlans(&plan->tempPlans);
+
+	if (plan->otf) fftwf_free(plan->otf);
+	if (plan->buf) fftwf_free(plan->buf);
+	if (plan->temp) fftwf_free(plan->temp);
+	if (plan->object) fftwf_free(plan->object);
+
+	delete plan;
+}
+
+// 0 means use the free memory at the time of the call
+static long long memoryBudget = 0;
+static std::string scratchDirectory;
+
+// the pointwise steps stream the arrays through in blocks of rows of about this size
+static const long long STREAM_BLOCK_BYTES = 32 * 1024 * 1024;
+
+int setMemoryBudget(long long bytes) {
+	if (bytes < 0) {
+		return CPU_INVALID_VALUE;
+	}
+
+	memoryBudget = bytes;
+
+	return CPU_SUCCESS;
+}
+
+int setScratchDirectory(const char * directory) {
+	scratchDirectory = directory != NULL ? directory : "";
+
+	return CPU_SUCCESS;
+}
+
+long long getStreamWorkSize(size_t N1, size_t N2, size_t N3) {
+	// the in place FFT buffer, rows padded to N3/2+1 complex numbers
+	return (long long)(N1*N2*(N3/2+1)) * (long long)sizeof(fftwf_complex);
+}
+
+#ifndef _WIN32
+
+// madvise needs page aligned addresses, the range is widened to whole pages
+static void adviseRange(const void * p, long long bytes, int advice) {
+	static const long long pageSize = sysconf(_SC_PAGE_SIZE);
+
+	if (p == NULL || bytes <= 0) {
+		return;
+	}
+
+	unsigned long long start = (unsigned long long)p & ~(unsigned long long)(pageSize - 1);
+	unsigned long long end = (unsigned long long)p + bytes;
+
+	madvise((void*)start, end - start, advice);
+}
+
+// unlinked scratch file of the given size, mapped shared so its pages can be dropped and read back
+static void * mapScratch(long long bytes) {
+	std::string dir = scratchDirectory;
+
+	if (dir.empty()) {
+		const char * tmp = getenv("TMPDIR");
+		dir = tmp != NULL ? tmp : "/tmp";
+	}
+
+	std::string path = dir + "/yacudecu-XXXXXX";
+	int fd = mkstemp(&path[0]);
+
+	if (fd < 0) {
+		logMessage(LOG_ERROR, "Error creating scratch file in %s\n", dir.c_str());
+		return NULL;
+	}
+
+	unlink(path.c_str());
+
+	void * map = NULL;
+
+	if (ftruncate(fd, bytes) == 0) {
+		map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		if (map == MAP_FAILED) {
+			map = NULL;
+		}
+	}
+
+	// the mapping keeps the file
+	close(fd);
+
+	return map;
+}
+
+#endif
+
+// the OTF and the in place FFT buffer share a layout of rows of N3/2+1 complex numbers (2*(N3/2+1) floats in the
+// spatial domain), the caller's arrays have rows of N3 floats
+struct StreamLayout {
+	long long rows;
+	long long n3;
+	long long paddedN3;
+	long long rowsPerBlock;
+	// OTF in the scratch file, its pages are dropped after each block
+	bool mappedOTF;
+};
+
+static void prefetchBlock(const StreamLayout & layout, const float * array, long long row, long long rowSize) {
+#ifndef _WIN32
+	if (array != NULL && row < layout.rows) {
+		long long rows = layout.rowsPerBlock < layout.rows - row ? layout.rowsPerBlock : layout.rows - row;
+		adviseRange(array + row * rowSize, rows * rowSize * (long long)sizeof(float), MADV_WILLNEED);
+	}
+#endif
+}
+
+static void releaseOTFBlock(const StreamLayout & layout, const fftwf_complex * otf, long long row, long long rows) {
+#ifndef _WIN32
+	// the OTF pages are clean (written back after the OTF was computed), so they can be dropped and read again
+	if (layout.mappedOTF) {
+		adviseRange(otf + row * (layout.paddedN3 / 2), rows * (layout.paddedN3 / 2) * (long long)sizeof(fftwf_complex), MADV_DONTNEED);
+	}
+#endif
+}
+
+// work = array in the padded layout
+static void streamToPadded(const StreamLayout & layout, const float * array, float * work) {
+	for (long long block = 0; block < layout.rows; block += layout.rowsPerBlock) {
+		long long end = block + layout.rowsPerBlock < layout.rows ? block + layout.rowsPerBlock : layout.rows;
+		prefetchBlock(layout, array, end, layout.n3);
+
+#pragma omp parallel for
+		for (long long r = block; r < end; r++) {
+			memcpy(work + r * layout.paddedN3, array + r * layout.n3, layout.n3 * sizeof(float));
+		}
+	}
+}
+
+// work = work * otf (or conj(otf))
+static void streamMultiplyOTF(const StreamLayout & layout, fftwf_complex * work, const fftwf_complex * otf, bool conjugate) {
+	const long long rowSize = layout.paddedN3 / 2;
+
+	for (long long block = 0; block < layout.rows; block += layout.rowsPerBlock) {
+		long long end = block + layout.rowsPerBlock < layout.rows ? block + layout.rowsPerBlock : layout.rows;
+		prefetchBlock(layout, (const float*)otf, end, 2 * rowSize);
+
+		complexMul(work + block * rowSize, otf + block * rowSize, (end - block) * rowSize, conjugate);
+
+		releaseOTFBlock(layout, otf, block, end - block);
+	}
+}
+
+// work = image/work, 0 where work is 0
+static void streamDivide(const StreamLayout & layout, const float * image, float * work) {
+	for (long long block = 0; block < layout.rows; block += layout.rowsPerBlock) {
+		long long end = block + layout.rowsPerBlock < layout.rows ? block + layout.rowsPerBlock : layout.rows;
+		prefetchBlock(layout, image, end, layout.n3);
+
+		// parallel over the rows, serial within a row (floatDiv would open a nested parallel region per row)
+#pragma omp parallel for
+		for (long long r = block; r < end; r++) {
+			const float * A = image + r * layout.n3;
+			float * C = work + r * layout.paddedN3;
+			for (long long i = 0; i < layout.n3; i++) {
+				C[i] = C[i] != 0 ? A[i] / C[i] : 0;
+			}
+		}
+	}
+}
+
+// object = object*work (/normal)
+static void streamUpdate(const StreamLayout & layout, float * object, const float * work, const float * normal) {
+	for (long long block = 0; block < layout.rows; block += layout.rowsPerBlock) {
+		long long end = block + layout.rowsPerBlock < layout.rows ? block + layout.rowsPerBlock : layout.rows;
+		prefetchBlock(layout, object, end, layout.n3);
+		prefetchBlock(layout, normal, end, layout.n3);
+
+		// parallel over the rows, serial within a row as in streamDivide
+#pragma omp parallel for
+		for (long long r = block; r < end; r++) {
+			float * o = object + r * layout.n3;
+			const float * u = work + r * layout.paddedN3;
+			if (normal != NULL) {
+				const float * nr = normal + r * layout.n3;
+				for (long long i = 0; i < layout.n3; i++) {
+					const float v = o[i] * u[i];
+					o[i] = nr[i] != 0 ? v / nr[i] : 0;
+				}
+			}
+			else {
+				for (long long i = 0; i < layout.n3; i++) {
+					o[i] *= u[i];
+				}
+			}
+		}
+	}
+}
+
+/*
+Memory budgeted RL.  The only resident buffer is the in place FFT buffer (getStreamWorkSize), the OTF is kept 
+in RAM as well if the budget fits both and in a memory mapped scratch file otherwise.  The image, object and 
+normal are read in row blocks with the next block prefetched, so if they are memory mapped by the caller 
+(e.g. numpy.memmap) they don't have to be resident either.
+*/
+int deconv_stream(unsigned int iter, size_t N1, size_t N2, size_t N3,
+                  float *h_image, float *h_psf, float *h_object, float *h_normal) {
+
+	const long long freqBytes = getStreamWorkSize(N1, N2, N3);
+	const long long nFreq = (long long)(N1*N2*(N3/2+1));
+
+	long long budget = memoryBudget > 0 ? memoryBudget : getFreeMem();
+
+	CallStats callStats;
+
+	logMessage(LOG_INFO, "Starting CPU stream deconvolution N1=%zu N2=%zu N3=%zu budget %f GB\n", N1, N2, N3, (float)budget / (float)(1024 * 1024 * 1024));
+
+	if (budget < freqBytes) {
+		logMessage(LOG_ERROR, "Memory budget too small, need at least %f GB\n", (float)freqBytes / (float)(1024 * 1024 * 1024));
+		return CPU_ALLOC_FAILED;
+	}
+
+	StreamLayout layout;
+	layout.rows = (long long)(N1*N2);
+	layout.n3 = (long long)N3;
+	layout.paddedN3 = 2 * (long long)(N3/2+1);
+	layout.rowsPerBlock = STREAM_BLOCK_BYTES / (layout.paddedN3 * (long long)sizeof(float));
+	if (layout.rowsPerBlock < 1) layout.rowsPerBlock = 1;
+	layout.mappedOTF = false;
+
+#ifndef _WIN32
+	layout.mappedOTF = budget < 2 * freqBytes;
+#endif
+
+	int retval = CPU_SUCCESS;
+	Plans plans = {NULL, NULL};
+	bool stopped = false;
+
+	fftwf_complex * work = fftwf_alloc_complex(nFreq);
+	fftwf_complex * otf = NULL;
+
+	if (work == NULL) {
+		logMessage(LOG_ERROR, "Error allocating the FFT buffer\n");
+		return CPU_ALLOC_FAILED;
+	}
+
+#ifndef _WIN32
+	if (layout.mappedOTF) {
+		otf = (fftwf_complex*)mapScratch(freqBytes);
+		logMessage(LOG_INFO, "OTF in scratch file\n");
+	}
+	else
+#endif
+	{
+		otf = fftwf_alloc_complex(nFreq);
+	}
+
+	if (otf == NULL) {
+		retval = CPU_ALLOC_FAILED;
+		goto cleanup;
+	}
+
+	callStats.mark();
+
+	{
+		std::lock_guard<std::mutex> lock(plannerLock);
+		initThreads();
+		plans.forward = fftwf_plan_dft_r2c_3d((int)N1, (int)N2, (int)N3, (float*)work, work, FFTW_ESTIMATE);
+		plans.inverse = fftwf_plan_dft_c2r_3d((int)N1, (int)N2, (int)N3, work, (float*)work, FFTW_ESTIMATE);
+	}
+
+	callStats.phase(STATS_PLAN_SECONDS);
+	callStats.add(STATS_PEAK_BYTES, layout.mappedOTF ? freqBytes : 2 * freqBytes);
+
+	if (plans.forward == NULL || plans.inverse == NULL) {
+		logMessage(LOG_ERROR, "Error creating FFTW plans\n");
+		retval = CPU_PLAN_FAILED;
+		goto cleanup;
+	}
+
+	// OTF = FFT(psf)/N, computed in the work buffer and copied out
+	{
+		streamToPadded(layout, h_psf, (float*)work);
+		fftwf_execute(plans.forward);
+
+		const float scale = 1.0f / (float)(N1*N2*N3);
+
+#pragma omp parallel for
+		for (long long i = 0; i < nFreq; i++) {
+			otf[i][0] = work[i][0] * scale;
+			otf[i][1] = work[i][1] * scale;
+		}
+
+#ifndef _WIN32
+		if (layout.mappedOTF) {
+			// write back once so the pages are clean and can be dropped and read back during the iterations
+			msync(otf, freqBytes, MS_SYNC);
+			adviseRange(otf, freqBytes, MADV_DONTNEED);
+		}
+#endif
+	}
+
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	logMessage(LOG_INFO, "Running %u iterations of CPU stream RL\n", iter);
+
+	for (unsigned int i = 0; i < iter; i++) {
+		// reblurred = object * psf
+		streamToPadded(layout, h_object, (float*)work);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+		fftwf_execute(plans.forward);
+		callStats.phase(STATS_FFT_SECONDS);
+		streamMultiplyOTF(layout, work, otf, false);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+		fftwf_execute(plans.inverse);
+		callStats.phase(STATS_FFT_SECONDS);
+
+		// ratio of the image to the reblurred, correlated with the psf
+		streamDivide(layout, h_image, (float*)work);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+		fftwf_execute(plans.forward);
+		callStats.phase(STATS_FFT_SECONDS);
+		streamMultiplyOTF(layout, work, otf, true);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+		fftwf_execute(plans.inverse);
+		callStats.phase(STATS_FFT_SECONDS);
+
+		streamUpdate(layout, h_object, (float*)work, h_normal);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+
+		callStats.add(STATS_ITERATIONS, 1);
+		callStats.add(STATS_FFTS, 4);
+
+		logMessage(LOG_DEBUG, "iteration %u\n", i);
+
+		if (!continueIterating(i + 1, iter)) {
+			logMessage(LOG_INFO, "cancelled after %u iterations\n", i + 1);
+			stopped = true;
+			break;
+		}
+	}
+
+	if (stopped) {
+		retval = DECONV_CANCELLED;
+	}
+
+cleanup:
+	destroyPlans(&plans);
+
+	fftwf_free(work);
+
+	if (otf != NULL) {
+#ifndef _WIN32
+		if (layout.mappedOTF) {
+			munmap(otf, freqBytes);
+		}
+		else
+#endif
+		{
+			fftwf_free(otf);
+		}
+	}
+
+	return retval;
+}
+
+int conv_device(size_t N1, size_t N2, size_t N3,
+                  float *h_image, float *h_psf, float *h_out, unsigned int correlate) {
+
+	logMessage(LOG_INFO, "Starting CPU convolution\n");
+
+	const long long nFreq = (long long)(N1*N2*(N3/2+1));
+
+	int retval = CPU_SUCCESS;
+	Plans plans = {NULL, NULL};
+	CallStats callStats;
+	bool planned;
+
+	fftwf_complex * otf = fftwf_alloc_complex(nFreq);
+	fftwf_complex * buf = fftwf_alloc_complex(nFreq);
+
+	if (otf == NULL || buf == NULL) {
+		logMessage(LOG_ERROR, "Error allocating freq buffers of size %zu\n", (size_t)(nFreq*sizeof(fftwf_complex)));
+		retval = CPU_ALLOC_FAILED;
+		goto cleanup;
+	}
+
+	callStats.mark();
+	callStats.add(STATS_PEAK_BYTES, getPeakMemory(N1, N2, N3, PEAK_CONV));
+
+	planned = computeOTF(N1, N2, N3, h_psf, otf);
+	callStats.phase(STATS_OTF_SECONDS);
+
+	planned = planned && createPlans(N1, N2, N3, h_image, buf, h_out, &plans);
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	if (!planned) {
+		logMessage(LOG_ERROR, "Error creating plans\n");
+		retval = CPU_PLAN_FAILED;
+		goto cleanup;
+	}
+
+	fftwf_execute(plans.forward);
+	callStats.phase(STATS_FFT_SECONDS);
+	complexMul(buf, otf, nFreq, correlate == 1);
+	callStats.phase(STATS_POINTWISE_SECONDS);
+	fftwf_execute(plans.inverse);
+	callStats.phase(STATS_FFT_SECONDS);
+	callStats.add(STATS_FFTS, 3);
+
+cleanup:
+	destroyPlans(&plans);
+
+	if (otf) fftwf_free(otf);
+	if (buf) fftwf_free(buf);
+
+	logMessage(LOG_INFO, "Finished Convolution\n");
+	return retval;
+}
+
+// there is one "device", the host
+extern "C" int setDevice(int device) {
+	return device == 0 ? CPU_SUCCESS : CPU_INVALID_DEVICE;
+}
+
+extern "C" int getDeviceCount() {
+	return 1;
+}
+
+extern "C" long long getTotalMem() {
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	GlobalMemoryStatusEx(&status);
+	return (long long)status.ullTotalPhys;
+#else
+	return (long long)sysconf(_SC_PHYS_PAGES) * (long long)sysconf(_SC_PAGE_SIZE);
+#endif
+}
+
+extern "C" long long getFreeMem() {
+#ifdef _WIN32
+	MEMORYSTATUSEX status;
+	status.dwLength = sizeof(status);
+	GlobalMemoryStatusEx(&status);
+	return (long long)status.ullAvailPhys;
+#else
+	// MemAvailable includes the page cache that can be reclaimed, which MemFree (and _SC_AVPHYS_PAGES) don't
+	FILE * meminfo = fopen("/proc/meminfo", "r");
+
+	if (meminfo != NULL) {
+		char line[256];
+		long long kb = -1;
+
+		while (fgets(line, sizeof(line), meminfo) != NULL) {
+			if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) {
+				break;
+			}
+		}
+
+		fclose(meminfo);
+
+		if (kb >= 0) {
+			return kb * 1024;
+		}
+	}
+
+	return (long long)sysconf(_SC_AVPHYS_PAGES) * (long long)sysconf(_SC_PAGE_SIZE);
+#endif
+}
+
+/*
+FFTW has no separate work area, its scratch is allocated inside the plans and is small compared to the volume.
+The library's own buffers (OTF, frequency buffer and spatial temp, about 3 volumes) are within the 7 volumes
+CudaDeconvolutionUtility already budgets, so only the padding of the complex buffers is reported.
+*/
+extern "C" long long getWorkSize(size_t N1, size_t N2, size_t N3) {
+	long long spatialBytes = (long long)(N1*N2*N3) * (long long)sizeof(float);
+	long long freqBytes = (long long)(N1*N2*(N3/2+1)) * (long long)sizeof(fftwf_complex);
+
+	return 2 * (freqBytes - spatialBytes);
+}
+
+/*
+Peak bytes the library allocates for deconv_device, conv_device or deconv_stream (PEAK_ modes in deconv.h), or
+holds in a plan (PEAK_DECONV_PLAN in deconv_cpu.h).  The 
+caller's image, PSF, object and normal are not included, they are used in place.  FFTW's plan scratch is a few rows 
+per thread and not counted.  For deconv_stream this is what the current budget lets it keep resident.
+*/
+extern "C" long long getPeakMemory(size_t N1, size_t N2, size_t N3, int mode) {
+	long long spatialBytes = (long long)(N1*N2*N3) * (long long)sizeof(float);
+	long long freqBytes = (long long)(N1*N2*(N3/2+1)) * (long long)sizeof(fftwf_complex);
+
+	switch (mode) {
+		case PEAK_DECONV:
+		case PEAK_DECONV_NORMAL:
+			// otf, buf, temp
+			return 2 * freqBytes + spatialBytes;
+		case PEAK_CONV:
+			// otf, buf
+			return 2 * freqBytes;
+		case PEAK_DECONV_PLAN:
+			// otf, buf, temp and the object
+			return 2 * freqBytes + 2 * spatialBytes;
+		case PEAK_DECONV_STREAM: {
+			// the FFT buffer, and the OTF unless it goes to the scratch file
+			long long budget = memoryBudget > 0 ? memoryBudget : getFreeMem();
+			return budget >= 2 * freqBytes ? 2 * freqBytes : freqBytes;
+		}
+		default:
+			return -1;
+	}
+}
+
+void removeSmallValues(float *in, long long size) {
+#pragma omp parallel for
+	for (long long i = 0; i < size; i++) {
+		if (in[i] < 0.00001) {
+			in[i] = 1.0;
+		}
+	}
+}
+
+extern "C" void enableStats(int level) {
+	statsLevel = level;
+}
+
+extern "C" void resetStats() {
+	std::lock_guard<std::mutex> lock(statsMutex);
+	memset(stats, 0, sizeof(stats));
+}
+
+// copies min(n, STATS_COUNT) of the statistics into stats, returns the number copied
+extern "C" int getStats(double * stats_out, int n) {
+	n = std::min(n, STATS_COUNT);
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	for (int i = 0; i < n; i++) {
+		stats_out[i] = stats[i];
+	}
+	return n;
+}
+
+extern "C" void setLogLevel(int level) {
+	logLevel = level;
+}
+
+// callback (NULL for none) is called from the thread running the deconvolution, user is passed through
+extern "C" void setProgressCallback(ProgressCallback callback, void * user) {
+	std::lock_guard<std::mutex> lock(progressMutex);
+	progressCallback = callback;
+	progressUser = user;
+}
+
+// non zero stops running and later deconvolutions after their current iteration, until it is set back to 0
+extern "C" void setCancelled(int value) {
+	cancelled = value;
+}
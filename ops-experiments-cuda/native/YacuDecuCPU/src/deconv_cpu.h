@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+// CPU only additions to the YacuDecu API (deconv.h)
+
+// getPeakMemory mode for a plan of createDeconvPlan
+#define PEAK_DECONV_PLAN 4
+
+// the OTF and FFTW plans of one size and PSF (see createDeconvPlan)
+typedef struct DeconvPlan DeconvPlan;
+
+extern "C" {
+	// RAM in bytes deconv_stream may keep resident for its own buffers, 0 (default) uses the free memory at the time of the call
+	int setMemoryBudget(long long bytes);
+	// directory for the scratch file of deconv_stream, NULL or "" uses TMPDIR (or /tmp)
+	int setScratchDirectory(const char * directory);
+	// minimum budget for deconv_stream (one in place FFT buffer), with twice this the OTF stays in RAM too
+	long long getStreamWorkSize(size_t N1, size_t N2, size_t N3);
+	// computes the OTF of h_psf (not kept) and plans the FFTs once for deconv_plan and conv_plan, NULL if that fails
+	DeconvPlan * createDeconvPlan(size_t N1, size_t N2, size_t N3, float * h_psf);
+	// deconv_device and conv_device at the plan's size with its OTF
+	int deconv_plan(DeconvPlan * plan, unsigned int iter, float * h_image, float * h_object, float * h_normal);
+	int conv_plan(DeconvPlan * plan, float * h_image, float * h_out, unsigned int correlate);
+	void destroyDeconvPlan(DeconvPlan * plan);
+}
@@ -133,7 +133,10 @@ public class CudaDeconvolutionUtility {
 
 		mem.numBuffers = 7;
 
-		mem.memoryNeeded = mem.imageBufferSize * mem.numBuffers + mem.workSpaceSize;
+		// the buffer count above is the upper bound, the library reports what it actually allocates
+		mem.memoryNeeded = (float) YacuDecuRichardsonLucyWrapper.getPeakMemory(
+			(int) mem.extendedNumSlices, (int) mem.extendedHeight,
+			(int) mem.extendedWidth, 1) / (float) AlgorithmMemory3D.KB_GB_DIVISOR;
 
 		return mem;
 	}
@@ -142,22 +145,15 @@ public class CudaDeconvolutionUtility {
 		// compute extended size of the image based on PSF dimensions
 		final long[] extendedSize = new long[imgSize.length];
 
-		long numberVoxels = 1;
-
 		for (int d = 0; d < imgSize.length; d++) {
 			extendedSize[d] = imgSize[d] + psfSize[d];
 			extendedSize[d] = (long) NextSmoothNumber.nextSmooth(
 				(int) extendedSize[d]);
-			numberVoxels *= extendedSize[d];
 		}
 
-		long workSize = YacuDecuRichardsonLucyWrapper.getWorkSize(
-			(int) extendedSize[2], (int) extendedSize[1], (int) extendedSize[0]);
-
-		// right now we always use floats
-		int voxelSize = 4;
-
-		return voxelSize * numberVoxels * 7 + workSize;
+		// callYacuDecu always passes the non-circulant normal
+		return YacuDecuRichardsonLucyWrapper.getPeakMemory((int) extendedSize[2],
+			(int) extendedSize[1], (int) extendedSize[0], 1);
 	}
 
 	public static Img<FloatType> callYacuDecu(OpService ops, Img<FloatType> img,
@@ -30,12 +30,29 @@ public class YacuDecuRichardsonLucyWrapper {
 	public static native int getDeviceCount();
 
 	public static native long getWorkSize(int N1, int N2, int N3);
+
+	// peak device memory of deconv_device (mode 0, 1 with a normal), conv_device (2) or deconv_stream (3)
+	public static native long getPeakMemory(int N1, int N2, int N3, int mode);
 	
 	public static native long getTotalMem();
 	
 	public static native long getFreeMem();
 
 	public static native void removeSmallValues(FloatPointer in, long size);
+
+	// engine statistics, levels and indices are the STATS_ defines of the native header
+	// (0 off, 1 counters, 2 per phase times), getStats returns the number of values copied
+	public static native void enableStats(int level);
+
+	public static native void resetStats();
+
+	public static native int getStats(double[] stats, int n);
+
+	// log level (0 none, 1 errors, the default, 2 info, 3 debug) and cancellation, a cancelled run returns
+	// DECONV_CANCELLED (-2000) after its current iteration, until set back to 0
+	public static native void setLogLevel(int level);
+
+	public static native void setCancelled(int cancelled);
 	
 
 
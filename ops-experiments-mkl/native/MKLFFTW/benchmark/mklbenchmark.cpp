@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "MKLFFTW.h"
+#include "fftbackend.h"
+
+// License: BSD
+
+// Google Benchmark suite of the MKL engine: FFT forward and inverse (the FFTW plans the engine uses), mklConvolve3D 
+// and mklRichardsonLucy3D, over smooth and non-smooth sizes and thread counts.  Run with 
+//   mklbenchmark --benchmark_format=json --benchmark_out=mkl.json
+// (or use benchmark.sh in the repository root, which runs every engine).  The names are
+//   BM_MKL_<operation>/nx:../ny:../nz:../threads:..
+// and every result has items_per_second (voxels) and, for RL, rl_iterations per second.
+
+// RL iterations per benchmark iteration, so the plan and OTF setup of mklRichardsonLucy3D is amortized like in use
+#define RL_ITERATIONS 10
+
+// {nx, ny, nz}, powers of two and sizes with a large prime factor (FFT libraries fall back to slower kernels)
+static const int64_t sizes[][3] = {
+	{128, 128, 64}, {256, 256, 64}, {512, 512, 64},
+	{127, 127, 61}, {251, 251, 61}, {509, 509, 61}
+};
+
+// every size with 1, 2, 4 ... threads up to the number of cores
+static void sizesAndThreads(benchmark::internal::Benchmark * b) {
+	int maxThreads = (int)std::thread::hardware_concurrency();
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (int threads = 1; threads <= maxThreads; threads *= 2) {
+			b->Args({sizes[s][0], sizes[s][1], sizes[s][2], threads});
+		}
+	}
+
+	b->ArgNames({"nx", "ny", "nz", "threads"});
+}
+
+// random image in [0, 1), and a normalized "PSF" so RL stays finite
+static std::vector<float> randomVolume(size_t n, bool normalize) {
+	std::vector<float> volume(n);
+	double sum = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		volume[i] = (float) rand() / RAND_MAX;
+		sum += volume[i];
+	}
+
+	if (normalize) {
+		for (size_t i = 0; i < n; i++) {
+			volume[i] = (float) (volume[i] / sum);
+		}
+	}
+
+	return volume;
+}
+
+static void BM_MKL_FFTForward(benchmark::State & state) {
+	const int nx = (int) state.range(0), ny = (int) state.range(1), nz = (int) state.range(2);
+	mklSetNumThreads((int) state.range(3));
+
+	const size_t n = (size_t) nx * ny * nz;
+	const size_t nFreq = (size_t) (nx / 2 + 1) * ny * nz;
+
+	std::vector<float> image = randomVolume(n, false);
+	fftwf_complex * spectrum = (fftwf_complex*) malloc(sizeof(fftwf_complex) * nFreq);
+
+	// numpy order, the same call as the engine
+	fftwf_plan plan = fftwf_plan_dft_r2c_3d(nz, ny, nx, image.data(), spectrum, FFTW_ESTIMATE);
+
+	for (auto _ : state) {
+		fftwf_execute(plan);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetItemsProcessed(state.iterations() * n);
+
+	fftwf_destroy_plan(plan);
+	free(spectrum);
+}
+
+static void BM_MKL_FFTInverse(benchmark::State & state) {
+	const int nx = (int) state.range(0), ny = (int) state.range(1), nz = (int) state.range(2);
+	mklSetNumThreads((int) state.range(3));
+
+	const size_t n = (size_t) nx * ny * nz;
+	const size_t nFreq = (size_t) (nx / 2 + 1) * ny * nz;
+
+	std::vector<float> image(n);
+	std::vector<float> spectrum = randomVolume(2 * nFreq, false);
+
+	fftwf_plan plan = fftwf_plan_dft_c2r_3d(nz, ny, nx, (fftwf_complex*) spectrum.data(), image.data(), FFTW_ESTIMATE);
+
+	for (auto _ : state) {
+		// c2r overwrites its input, the values don't matter for the timing
+		fftwf_execute(plan);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetItemsProcessed(state.iterations() * n);
+
+	fftwf_destroy_plan(plan);
+}
+
+static void BM_MKL_Convolve(benchmark::State & state) {
+	const int nx = (int) state.range(0), ny = (int) state.range(1), nz = (int) state.range(2);
+	mklSetNumThreads((int) state.range(3));
+
+	const size_t n = (size_t) nx * ny * nz;
+
+	std::vector<float> image = randomVolume(n, false);
+	std::vector<float> psf = randomVolume(n, true);
+	std::vector<float> out(n);
+
+	for (auto _ : state) {
+		mklConvolve3D(image.data(), psf.data(), out.data(), nz, ny, nx, false);
+	}
+
+	state.SetItemsProcessed(state.iterations() * n);
+}
+
+static void BM_MKL_RichardsonLucy(benchmark::State & state) {
+	const int nx = (int) state.range(0), ny = (int) state.range(1), nz = (int) state.range(2);
+	mklSetNumThreads((int) state.range(3));
+
+	const size_t n = (size_t) nx * ny * nz;
+
+	std::vector<float> image = randomVolume(n, false);
+	std::vector<float> psf = randomVolume(n, true);
+	std::vector<float> estimate(n);
+
+	for (auto _ : state) {
+		state.PauseTiming();
+		estimate = image;
+		state.ResumeTiming();
+
+		mklRichardsonLucy3D(RL_ITERATIONS, image.data(), psf.data(), estimate.data(), nz, ny, nx, NULL);
+	}
+
+	state.SetItemsProcessed(state.iterations() * n * RL_ITERATIONS);
+	state.counters["rl_iterations"] = benchmark::Counter(RL_ITERATIONS, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK(BM_MKL_FFTForward)->Apply(sizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_MKL_FFTInverse)->Apply(sizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_MKL_Convolve)->Apply(sizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_MKL_RichardsonLucy)->Apply(sizesAndThreads)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char ** argv) {
+	benchmark::Initialize(&argc, argv);
+
+	if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+		return 1;
+	}
+
+	benchmark::AddCustomContext("engine", "mkl");
+#if defined(MKLFFTW_POCKETFFT)
+	benchmark::AddCustomContext("fft", "pocketfft");
+#elif defined(MKLFFTW_FFTW3)
+	benchmark::AddCustomContext("fft", "fftw3");
+#else
+	benchmark::AddCustomContext("fft", "mkl");
+#endif
+	benchmark::AddCustomContext("pointwise", mklGetPointwiseKernels());
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+
+	return 0;
+}
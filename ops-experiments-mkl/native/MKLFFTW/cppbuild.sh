@@ -22,8 +22,22 @@ case $PLATFORM in
         make
         make install
         ;;
+    linux-arm64|linux-ppc64le)
+        # no MKL, FFTW3 from the distribution (libfftw3-dev)
+        $CMAKE -DCMAKE_BUILD_TYPE=Release \
+               -DCMAKE_INSTALL_PREFIX="../.." \
+               -DMKLFFTW_FFT=FFTW3 ..
+        make
+        make install
+        ;;
     macosx-*)
-        echo "TODO"
+        # FFTW3 from Homebrew (brew install fftw)
+        $CMAKE -DCMAKE_BUILD_TYPE=Release \
+               -DCMAKE_INSTALL_PREFIX="../.." \
+               -DMKLFFTW_FFT=FFTW3 \
+               -DFFTW_INCLUDE_DIR="$(brew --prefix)/include" ..
+        make
+        make install
         ;;
     windows-x86_64)
    $CMAKE -G"NMake Makefiles" \
@@ -1,15 +1,30 @@
 #include<stdio.h>
+#include<stdarg.h>
+#include<string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 #include "MKLFFTW.h"
-#include "mkl.h"
-#include "mkl_vml_functions.h"
-#include "mkl_vml.h"
+#include "fftbackend.h"
+#include "pointwise.h"
+#include "mappedfile.h"
+
+#ifdef MKLFFTW_MKL
 #include "mkl_dfti.h"
-#include "mkl_cblas.h"
+#endif
 
-#include "fftw/fftw3.h"
-#include "fftw/fftw3_mkl.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_F16C_DISPATCH
+#endif
 
+// test entry point, left out when the source is built into another executable or module (benchmark, bindings)
+#ifndef MKLFFTW_NO_MAIN
 int main() {
 	int w = 512;
 	int h = 512;
@@ -26,17 +41,190 @@ int main() {
 	free(y);
 
 }
+#endif
+
+// statistics (see mklEnableStats), each call collects its own in a CallStats and adds them to the totals 
+// when it returns.  The setup of an entry point that runs its iterations through another counted call (the ROI)
+// uses an uncounted CallStats, so the call and its time are counted once.
+static std::atomic<int> statsLevel(STATS_OFF);
+static double stats[STATS_COUNT];
+static std::mutex statsMutex;
+
+static double statsClock() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct CallStats {
+	int level;
+	bool counted;
+	double start, last;
+	double values[STATS_COUNT];
+
+	explicit CallStats(bool counted = true) : level(statsLevel), counted(counted), start(0), last(0) {
+		memset(values, 0, sizeof(values));
+		if (level) start = last = statsClock();
+	}
+
+	// charges the time since the last phase to values[index]
+	void phase(int index) {
+		if (level < STATS_PHASES) return;
+		double now = statsClock();
+		values[index] += now - last;
+		last = now;
+	}
+
+	void add(int index, double n) {
+		if (level) values[index] += n;
+	}
+
+	// for a call with stages, the largest of the stages' peaks
+	void peak(double bytes) {
+		if (level) values[STATS_PEAK_BYTES] = std::max(values[STATS_PEAK_BYTES], bytes);
+	}
+
+	~CallStats() {
+		if (!level) return;
+		if (counted) {
+			values[STATS_TOTAL_SECONDS] = statsClock() - start;
+			values[STATS_CALLS] = 1;
+		}
+
+		std::lock_guard<std::mutex> lock(statsMutex);
+		for (int i = 0; i < STATS_COUNT; i++) {
+			stats[i] = i == STATS_PEAK_BYTES ? std::max(stats[i], values[i]) : stats[i] + values[i];
+		}
+	}
+};
+
+extern "C" EXPORT void mklEnableStats(int level) {
+	statsLevel = level;
+}
+
+extern "C" EXPORT void mklResetStats() {
+	std::lock_guard<std::mutex> lock(statsMutex);
+	memset(stats, 0, sizeof(stats));
+}
+
+// copies min(n, STATS_COUNT) of the statistics into stats_out, returns the number copied
+extern "C" EXPORT int mklGetStats(double * stats_out, int n) {
+	n = std::min(n, STATS_COUNT);
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	for (int i = 0; i < n; i++) {
+		stats_out[i] = stats[i];
+	}
+	return n;
+}
+
+// logging, progress and cancellation (see mklSetLogLevel)
+static std::atomic<int> logLevel(LOG_ERROR);
+static std::atomic<int> cancelled(0);
+static ProgressCallback progressCallback = NULL;
+static void * progressUser = NULL;
+static std::mutex progressMutex;
+
+static void logMessage(int level, const char * format, ...) {
+	if (level > logLevel) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+	va_end(args);
+}
+
+// reports iteration of iterations finished, returns false if the run should stop
+static bool continueIterating(int iteration, int iterations) {
+	ProgressCallback callback;
+	void * user;
+
+	{
+		std::lock_guard<std::mutex> lock(progressMutex);
+		callback = progressCallback;
+		user = progressUser;
+	}
+
+	if (callback != NULL && callback(iteration, iterations, user) != 0) {
+		return false;
+	}
+
+	return !cancelled;
+}
+
+extern "C" EXPORT void mklSetLogLevel(int level) {
+	logLevel = level;
+}
+
+// callback (NULL for none) is called from the thread running the deconvolution, user is passed through
+extern "C" EXPORT void mklSetProgressCallback(ProgressCallback callback, void * user) {
+	std::lock_guard<std::mutex> lock(progressMutex);
+	progressCallback = callback;
+	progressUser = user;
+}
+
+// non zero stops running and later Richardson Lucy calls after their current iteration, until it is set back to 0
+extern "C" EXPORT void mklSetCancelled(int value) {
+	cancelled = value;
+}
+
+#ifndef MKLFFTW_MKL
+static int fftThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+#endif
+
+// FFTW's planner (and MKL's FFTW interface) is not thread safe, only fftwf_execute is, so plans are made and 
+// destroyed under this lock.  The first plan also sets up FFTW's threads.
+static std::mutex plannerMutex;
+
+static void initPlanner() {
+#ifndef MKLFFTW_MKL
+	static bool threadsInitialized = false;
+
+	if (!threadsInitialized) {
+		threadsInitialized = true;
+		fftwf_init_threads();
+		fftwf_plan_with_nthreads(fftThreads);
+	}
+#endif
+}
+
+// threads of the FFTs and the pointwise kernels, 0 (the default) for all cores.  MKL builds set MKL's own 
+// thread count, FFTW and pocketfft builds apply it to the plans made after the call. 
+extern "C" EXPORT void mklSetNumThreads(int threads) {
+	std::lock_guard<std::mutex> lock(plannerMutex);
+
+	int count = threads > 0 ? threads : (int)std::max(1u, std::thread::hardware_concurrency());
+
+#ifdef MKLFFTW_MKL
+	mkl_set_num_threads(count);
+#else
+	fftThreads = count;
+	initPlanner();
+	fftwf_plan_with_nthreads(fftThreads);
+#endif
+
+	setPointwiseThreads(threads);
+}
+
+// "avx512", "avx2", "neon" or "scalar", the pointwise kernels the CPU was found to support
+extern "C" EXPORT const char * mklGetPointwiseKernels() {
+	return pointwiseKernels();
+}
 
 extern "C" EXPORT void testMKLFFTW(float * x_, float * y_, int width,
 		int height) {
 
-	printf("starting mkl fftwf\n");
+	logMessage(LOG_INFO, "starting mkl fftwf\n");
 
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
 	fftwf_plan plan = fftwf_plan_dft_r2c_2d(width, height, x_,
 			(fftwf_complex*) y_, (int) FFTW_ESTIMATE);
+	planner.unlock();
 
 	fftwf_execute(plan);
 
+	planner.lock();
 	fftwf_destroy_plan(plan);
 
 }
@@ -44,6 +232,9 @@ extern "C" EXPORT void testMKLFFTW(float * x_, float * y_, int width,
 extern "C" EXPORT void mklConvolve(float * x, float *h, float *y, float * X_,
 		float * H_, const int width, const int height, bool conj) {
 
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
+
 	fftwf_plan forward1 = fftwf_plan_dft_r2c_2d(width, height, x,
 			(fftwf_complex*) X_, (int) FFTW_ESTIMATE);
 
@@ -52,41 +243,43 @@ extern "C" EXPORT void mklConvolve(float * x, float *h, float *y, float * X_,
 
 	fftwf_plan inverse = fftwf_plan_dft_c2r_2d(width, height,
 			(fftwf_complex*) X_, y, (int) FFTW_ESTIMATE);
+	planner.unlock();
 
 	fftwf_execute(forward1);
 	fftwf_execute(forward2);
 
-	const MKL_INT n = (width / 2 + 1) * height;
+	const int n = (width / 2 + 1) * height;
 
 	if (conj) {
 		// multiply X_, H_ for convolution
-		vcMulByConj(n, (MKL_Complex8*) X_, (MKL_Complex8*) H_,
-				(MKL_Complex8*) X_);
+		complexMultiplyConjugate(X_, H_, X_, n, 1.f);
 	} else {
 		// multiply X_, H_ for convolution
-		vcMul(n, (MKL_Complex8*) X_, (MKL_Complex8*) H_, (MKL_Complex8*) X_);
+		complexMultiply(X_, H_, X_, n, 1.f);
 	}
 
 	fftwf_execute(inverse);
 
+	planner.lock();
 	fftwf_destroy_plan(forward1);
 	fftwf_destroy_plan(forward2);
 	fftwf_destroy_plan(inverse);
 
 }
 
-extern "C" EXPORT void mklConvolve3D(float * x, float *h, float *y,  
-		const int n0, const int n1, const int n2, bool conj) {
+// y = x convolved with (or, conj, correlated with) h, the statistics go to the caller's callStats
+static void convolve3D(float * x, float *h, float *y,  
+		const int n0, const int n1, const int n2, bool conj, CallStats & callStats) {
 
-	
-	printf("starting mkl convolve 3D July 11th build - ImageJ Version\n");
-	
-	const MKL_INT imageSize = n0 * n1 * n2;
-	const MKL_INT fftSize = n0 * n1 * (n2 / 2 + 1);
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
 
 	fftwf_complex * X_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
 	fftwf_complex * H_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
 
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
+
 	fftwf_plan forward1 = fftwf_plan_dft_r2c_3d(n0, n1, n2, x,
 			X_, (int) FFTW_ESTIMATE);
 
@@ -95,24 +288,30 @@ extern "C" EXPORT void mklConvolve3D(float * x, float *h, float *y,
 
 	fftwf_plan inverse = fftwf_plan_dft_c2r_3d(n0, n1, n2,  X_,
 			y, (int) FFTW_ESTIMATE);
+	planner.unlock();
+
+	callStats.phase(STATS_PLAN_SECONDS);
 
 	fftwf_execute(forward1);
+	callStats.phase(STATS_FFT_SECONDS);
 	fftwf_execute(forward2);
+	callStats.phase(STATS_OTF_SECONDS);
 
+	// the 1/imageSize normalization of the inverse FFT is folded into the multiply
 	if (conj) {
 		// conjugate multiply X_, H_ for correlation
-		vcMulByConj(fftSize, (MKL_Complex8*) X_, (MKL_Complex8*) H_,
-				(MKL_Complex8*) X_);
+		complexMultiplyConjugate((float*) X_, (float*) H_, (float*) X_, fftSize, 1.f / imageSize);
 	} else {
 		// multiply X_, H_ for convolution
-		vcMul(fftSize, (MKL_Complex8*) X_, (MKL_Complex8*) H_,
-				(MKL_Complex8*) X_);
+		complexMultiply((float*) X_, (float*) H_, (float*) X_, fftSize, 1.f / imageSize);
 	}
+	callStats.phase(STATS_POINTWISE_SECONDS);
 
 	fftwf_execute(inverse);
+	callStats.phase(STATS_FFT_SECONDS);
+	callStats.add(STATS_FFTS, 3);
 
-	cblas_sscal(imageSize, 1. / (imageSize), y, 1);
-
+	planner.lock();
 	fftwf_destroy_plan(forward1);
 	fftwf_destroy_plan(forward2);
 	fftwf_destroy_plan(inverse);
@@ -122,113 +321,1578 @@ extern "C" EXPORT void mklConvolve3D(float * x, float *h, float *y,
 
 }
 
-extern "C" EXPORT void mklRichardsonLucy3D(int iterations, float * x, float *h,
-		float*y, const int n0,
-		const int n1, const int n2, float * normal) {
+extern "C" EXPORT void mklConvolve3D(float * x, float *h, float *y,  
+		const int n0, const int n1, const int n2, bool conj) {
+
+	logMessage(LOG_INFO, "mkl convolve 3D %d x %d x %d\n", n0, n1, n2);
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, 2 * (long long) n0 * n1 * (n2 / 2 + 1) * sizeof(fftwf_complex));
+
+	convolve3D(x, h, y, n0, n1, n2, conj, callStats);
+}
+
+// IEEE half <-> float conversion, round to nearest even (the same rounding as F16C and OpenCL vstore_half)
+static unsigned short floatToHalfScalar(float f) {
+	unsigned int x;
+	memcpy(&x, &f, sizeof(x));
+
+	unsigned short sign = (x >> 16) & 0x8000;
+	unsigned int absx = x & 0x7fffffff;
+
+	// inf and nan
+	if (absx >= 0x7f800000) {
+		return sign | (absx > 0x7f800000 ? 0x7e00 : 0x7c00);
+	}
+
+	// 65520 and above round to inf
+	if (absx >= 0x477ff000) {
+		return sign | 0x7c00;
+	}
+
+	unsigned int half, rem, halfway;
+
+	if (absx < 0x38800000) {
+		// subnormal half (or zero), in units of 2^-24
+		if (absx < 0x33000000) {
+			return sign;
+		}
 
-	if (normal == NULL) {
-		printf("The normal is NULL!\n");
+		unsigned int mant = (absx & 0x7fffff) | 0x800000;
+		int shift = 126 - (absx >> 23);
+
+		half = mant >> shift;
+		rem = mant & ((1u << shift) - 1);
+		halfway = 1u << (shift - 1);
 	} else {
-		printf("We have recieved the normal!");
+		// rebias the exponent from 127 to 15, a carry out of the mantissa correctly increments the exponent
+		half = (absx - 0x38000000) >> 13;
+		rem = absx & 0x1fff;
+		halfway = 0x1000;
 	}
 
-	printf("starting mklrl 3D July 11th build - ImageJ Version\n");
+	if (rem > halfway || (rem == halfway && (half & 1))) {
+		half++;
+	}
 
-	const int imageSize = n0 * n1 * n2;
-	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+	return sign | half;
+}
 
-	float * temp = (float*) malloc(sizeof(float) * n0 * n1 * n2);
+static float halfToFloatScalar(unsigned short h) {
+	unsigned int sign = (unsigned int) (h & 0x8000) << 16;
+	int exp = (h >> 10) & 0x1f;
+	unsigned int mant = h & 0x3ff;
+	unsigned int x;
+
+	if (exp == 0) {
+		if (mant == 0) {
+			x = sign;
+		} else {
+			// subnormal, normalize the mantissa
+			exp = 1;
+			while (!(mant & 0x400)) {
+				mant <<= 1;
+				exp--;
+			}
+			x = sign | ((exp + 112) << 23) | ((mant & 0x3ff) << 13);
+		}
+	} else if (exp == 31) {
+		x = sign | 0x7f800000 | (mant << 13);
+	} else {
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+	}
 
-	fftwf_complex * FFT_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
-	fftwf_complex * H_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
-	
-	fftwf_plan forward1 = fftwf_plan_dft_r2c_3d(n0, n1, n2, y,
-			(fftwf_complex*) FFT_, (int) FFTW_ESTIMATE);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
 
-	// create FFT plan for PSF
-	fftwf_plan forwardH = fftwf_plan_dft_r2c_3d(n0, n1, n2, h,
-			(fftwf_complex*) H_, (int) FFTW_ESTIMATE);
+#ifdef HAVE_F16C_DISPATCH
 
-	// execute FFT plan for PSF
-	fftwf_execute(forwardH);
+// F16C versions, only called if the CPU reports F16C, so the library still loads on older CPUs
+__attribute__((target("avx,f16c"))) static void floatToHalfF16C(const float * in, unsigned short * out, const int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*) (out + i), h);
+	}
+	for (; i < n; i++) {
+		out[i] = floatToHalfScalar(in[i]);
+	}
+}
 
-	fftwf_plan forward3 = fftwf_plan_dft_r2c_3d(n0, n1, n2, temp,
-			(fftwf_complex*) FFT_, (int) FFTW_ESTIMATE);
+__attribute__((target("avx,f16c"))) static void halfToFloatF16C(const unsigned short * in, float * out, const int n) {
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (in + i))));
+	}
+	for (; i < n; i++) {
+		out[i] = halfToFloatScalar(in[i]);
+	}
+}
 
-	fftwf_plan inverse = fftwf_plan_dft_c2r_3d(n0, n1, n2,
-			(fftwf_complex*) FFT_, temp, (int) FFTW_ESTIMATE);
+static bool hasF16C() {
+	static const bool f16c = __builtin_cpu_supports("f16c");
+	return f16c;
+}
+
+#endif
+
+extern "C" EXPORT void mklFloatToHalf(float * in, unsigned short * out, const int n) {
+#ifdef HAVE_F16C_DISPATCH
+	if (hasF16C()) {
+		floatToHalfF16C(in, out, n);
+		return;
+	}
+#endif
+	for (int i = 0; i < n; i++) {
+		out[i] = floatToHalfScalar(in[i]);
+	}
+}
+
+extern "C" EXPORT void mklHalfToFloat(unsigned short * in, float * out, const int n) {
+#ifdef HAVE_F16C_DISPATCH
+	if (hasF16C()) {
+		halfToFloatF16C(in, out, n);
+		return;
+	}
+#endif
+	for (int i = 0; i < n; i++) {
+		out[i] = halfToFloatScalar(in[i]);
+	}
+}
+
+// half arrays are widened a block at a time into a buffer that stays in cache
+static const int HALF_BLOCK = 4096;
+
+// temp = x/temp (0 where temp <= 0)
+static void divideObserved(const float * x, float * temp, const int n) {
+	for (int j = 0; j < n; j++) {
+
+		if (temp[j] > 0) {
+			temp[j] = x[j] / temp[j];
+		} else {
+			temp[j] = 0;
+		}
+	}
+}
+
+static void divideObserved(const unsigned short * x, float * temp, const int n) {
+	float block[HALF_BLOCK];
+
+	for (int start = 0; start < n; start += HALF_BLOCK) {
+		int len = n - start < HALF_BLOCK ? n - start : HALF_BLOCK;
+		mklHalfToFloat((unsigned short*) x + start, block, len);
+		divideObserved(block, temp + start, len);
+	}
+}
+
+// y = y/normal where normal > 0
+static void divideNormal(float * y, const float * normal, const int n) {
+	for (int j = 0; j < n; j++) {
+
+		if (normal[j] > 0) {
+			y[j] = y[j] / normal[j];
+		}
+	}
+}
+
+static void divideNormal(float * y, const unsigned short * normal, const int n) {
+	float block[HALF_BLOCK];
+
+	for (int start = 0; start < n; start += HALF_BLOCK) {
+		int len = n - start < HALF_BLOCK ? n - start : HALF_BLOCK;
+		mklHalfToFloat((unsigned short*) normal + start, block, len);
+		divideNormal(y + start, block, len);
+	}
+}
+
+// x as float in temp, for the FFT of the Wiener start
+static void copyObserved(const float * x, float * temp, const int n) {
+	memcpy(temp, x, n * sizeof(float));
+}
+
+static void copyObserved(const unsigned short * x, float * temp, const int n) {
+	mklHalfToFloat((unsigned short*) x, temp, n);
+}
+
+// smallest value of a Wiener warm start, RL keeps zeros at zero
+#define WARM_START_FLOOR 1e-6f
+
+static std::atomic<float> warmStart(0);
+
+/*
+Regularization of the Wiener estimate mklRichardsonLucy3D (and Half) start from (see mklWiener3D), or 0 (the 
+default) to start from the estimate passed in.  It costs one forward and one inverse FFT on the OTF the iterations 
+use anyway and gets to a given quality in fewer iterations.
+*/
+extern "C" EXPORT void mklSetWarmStart(float regularization) {
+	warmStart = regularization > 0 ? regularization : 0;
+}
+
+static std::atomic<float> tvRegularization(0);
+
+/*
+Weight of the total variation term of mklRichardsonLucy3D (and Half), RL-TV after Dey et al. 2006, or 0 (the 
+default) for plain RL.  It keeps noise from building up over the iterations of low light data, around 0.001 to 0.01.
+The term is computed in the update multiply (see tvMultiply), so it adds no pass over the volume.
+*/
+extern "C" EXPORT void mklSetTVRegularization(float lambda) {
+	tvRegularization = lambda > 0 ? lambda : 0;
+}
+
+// Wiener estimate as the first guess into y if regularization is positive, through temp with the iterations' plans
+// (forward temp to FFT_, inverse FFT_ to temp) and the OTF H_
+template<typename T>
+static void wienerStart(T * x, float * temp, float * y, fftwf_complex * FFT_, fftwf_complex * H_, 
+		fftwf_plan forward, fftwf_plan inverse, const int imageSize, const int fftSize, float regularization, 
+		CallStats & callStats) {
+	if (!(regularization > 0)) {
+		return;
+	}
+
+	copyObserved(x, temp, imageSize);
+	fftwf_execute(forward);
+	callStats.phase(STATS_FFT_SECONDS);
+
+	wienerMultiply((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, regularization, 1.f / imageSize);
+	callStats.phase(STATS_POINTWISE_SECONDS);
+
+	fftwf_execute(inverse);
+	callStats.phase(STATS_FFT_SECONDS);
 
-	// iterations
+	clampMin(temp, imageSize, WARM_START_FLOOR);
+	memcpy(y, temp, imageSize * sizeof(float));
+	callStats.phase(STATS_POINTWISE_SECONDS);
+	callStats.add(STATS_FFTS, 2);
 
-	float delta = 0.00001;
+	logMessage(LOG_DEBUG, "wiener start, regularization %g\n", regularization);
+}
+
+// The RL iterations on the estimate y with the OTF H_, through temp and FFT_ with the plans forward1 (y to FFT_), 
+// forward3 (temp to FFT_) and inverse (FFT_ to temp).  done of total iterations ran before (for the progress 
+// callback), finished (if not NULL) counts the iterations run.  Returns 0, or DECONV_CANCELLED if the run was 
+// cancelled (y then holds the last finished iteration).
+template<typename T>
+static int richardsonLucyLoop(int iterations, T * x, fftwf_complex * H_, float * y, T * normal, 
+		const int n0, const int n1, const int n2, float * temp, fftwf_complex * FFT_, fftwf_plan forward1, 
+		fftwf_plan forward3, fftwf_plan inverse, int done, int total, CallStats & callStats, int * finished = NULL) {
+
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	// two planes for the TV stencil
+	const float lambda = tvRegularization;
+	float * tvScratch = lambda > 0 ? (float*) malloc(sizeof(float) * 2 * n1 * n2) : NULL;
+
+	int ret = 0;
 
 	for (int i = 0; i < iterations; i++) {
 		// create reblurred
 
-		printf("iteration %d\n", i);
-		fflush (stdout);
-
 		fftwf_execute(forward1);
+		callStats.phase(STATS_FFT_SECONDS);
 
-		// multiply X_, H_ for convolution
-		vcMul(fftSize, (MKL_Complex8*) FFT_, (MKL_Complex8*) H_,
-				(MKL_Complex8*) FFT_);
+		// multiply X_, H_ for convolution, with the 1/imageSize of the inverse FFT
+		complexMultiply((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, 1.f / imageSize);
+		callStats.phase(STATS_POINTWISE_SECONDS);
 
 		fftwf_execute(inverse);
-		cblas_sscal(imageSize, 1. / (imageSize), temp, 1);
+		callStats.phase(STATS_FFT_SECONDS);
 
 		// divide original image by temp
 		//vsDiv(imageSize, x, temp, temp);
-		for (int j = 0; j < imageSize; j++) {
-
-			if (temp[j] > 0) {
-				temp[j] = x[j] / temp[j];
-			} else {
-				temp[j] = 0;
-			}
-		}
+		divideObserved(x, temp, imageSize);
+		callStats.phase(STATS_POINTWISE_SECONDS);
 
 		//  cblas_scopy(imageSize, temp, 1, y, 1);
 
 		// correlate with PSF
 		fftwf_execute(forward3);
+		callStats.phase(STATS_FFT_SECONDS);
 
 		// multiply X_, H_* for correllation
-		vcMulByConj(fftSize, (MKL_Complex8*) FFT_, (MKL_Complex8*) H_,
-				(MKL_Complex8*) FFT_);
+		complexMultiplyConjugate((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, 1.f / imageSize);
+		callStats.phase(STATS_POINTWISE_SECONDS);
 
 		fftwf_execute(inverse);
-		cblas_sscal(imageSize, 1. / imageSize, temp, 1);
+		callStats.phase(STATS_FFT_SECONDS);
 
-		// multiply by y
-		vsMul(imageSize, y, temp, y);
+		// multiply by y, with the TV term if set
+		if (lambda > 0) {
+			tvMultiply(y, temp, n0, n1, n2, lambda, tvScratch);
+		}
+		else {
+			multiply(y, temp, y, imageSize);
+		}
 
 		if (normal != NULL) {
 			//vsDiv(imageSize, y, normal, y);
-			for (int j = 0; j < imageSize; j++) {
+			divideNormal(y, normal, imageSize);
+		}
+		callStats.phase(STATS_POINTWISE_SECONDS);
 
-				if (normal[j] > 0) {
-					y[j] = y[j] / normal[j];
-				} else {
-					y[j] = y[j] / 1.;
-				}
-			}
+		callStats.add(STATS_ITERATIONS, 1);
+
+		if (finished != NULL) {
+			(*finished)++;
 		}
+		callStats.add(STATS_FFTS, 4);
 
+		logMessage(LOG_DEBUG, "iteration %d\n", i);
+
+		if (!continueIterating(done + i + 1, total)) {
+			logMessage(LOG_INFO, "cancelled after %d iterations\n", done + i + 1);
+			ret = DECONV_CANCELLED;
+			break;
+		}
 	}
 
+	free(tvScratch);
+
+	return ret;
+}
+
+// Richardson Lucy iterations at one resolution, T is the storage type of the observed image x and the normal (float
+// or half as unsigned short).  The estimate y, the PSF and the scratch are float because FFTW transforms them. 
+// done of total iterations ran before (for the progress callback), regularization is the Wiener start (0 none).
+// Returns 0, or DECONV_CANCELLED if the run was cancelled (y then holds the last finished iteration).  The
+// statistics go to the callStats of the call, which runs one or (coarse to fine) two stages.
+template<typename T>
+static int richardsonLucyIterations(int iterations, T * x, float *h,
+		float*y, const int n0,
+		const int n1, const int n2, T * normal, int done, int total, float regularization, CallStats & callStats) {
+
+	logMessage(LOG_INFO, "mkl rl 3D %d x %d x %d, %d iterations, %s normal, tv %g, %s kernels\n", n0, n1, n2, iterations, 
+			normal == NULL ? "no" : "with", (float)tvRegularization, pointwiseKernels());
+
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	callStats.peak(mklGetPeakMemory(n0, n1, n2));
+
+	float * temp = (float*) malloc(sizeof(float) * n0 * n1 * n2);
+
+	fftwf_complex * FFT_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
+	fftwf_complex * H_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
+	
+	fftwf_plan forward1 = fftwf_plan_dft_r2c_3d(n0, n1, n2, y,
+			(fftwf_complex*) FFT_, (int) FFTW_ESTIMATE);
+
+	// create FFT plan for PSF
+	fftwf_plan forwardH = fftwf_plan_dft_r2c_3d(n0, n1, n2, h,
+			(fftwf_complex*) H_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan forward3 = fftwf_plan_dft_r2c_3d(n0, n1, n2, temp,
+			(fftwf_complex*) FFT_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan inverse = fftwf_plan_dft_c2r_3d(n0, n1, n2,
+			(fftwf_complex*) FFT_, temp, (int) FFTW_ESTIMATE);
+	planner.unlock();
+
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	// execute FFT plan for PSF (FFTW_ESTIMATE plans don't touch the arrays, so it can run after the other plans are made)
+	fftwf_execute(forwardH);
+
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	wienerStart(x, temp, y, FFT_, H_, forward3, inverse, imageSize, fftSize, regularization, callStats);
+
+	int ret = richardsonLucyLoop(iterations, x, H_, y, normal, n0, n1, n2, temp, FFT_, forward1, forward3, inverse, 
+			done, total, callStats);
+
 	//cblas_scopy(width*height, temp, 1, y, 1);
 
+	planner.lock();
 	fftwf_destroy_plan(forward1);
 	fftwf_destroy_plan(forwardH);
+	fftwf_destroy_plan(forward3);
 	fftwf_destroy_plan(inverse);
+	planner.unlock();
 
 	free(temp);
 	free(FFT_);
 	free(H_);
 
+	return ret;
+}
+
+static std::atomic<int> multiresolutionFactor(1);
+static std::atomic<int> multiresolutionIterations(0);
+
+/*
+Coarse to fine RL: the first iterations of mklRichardsonLucy3D (and Half) run on the image, PSF, estimate and 
+normal binned by factor (2 or 4, 1 is off) along each axis the factor divides, then the estimate is upsampled as 
+the start of the remaining iterations at full resolution.  The early iterations mostly recover low frequencies, 
+so they lose little on the coarse grid and cost 1/factor^3 of a full iteration.  A Wiener warm start is computed
+on the coarse grid.
+*/
+extern "C" EXPORT void mklSetMultiresolution(int factor, int iterations) {
+	multiresolutionFactor = factor == 2 || factor == 4 ? factor : 1;
+	multiresolutionIterations = iterations > 0 ? iterations : 0;
+}
+
+static inline float toFloat(float v) {
+	return v;
+}
+
+static inline float toFloat(unsigned short v) {
+	return halfToFloatScalar(v);
+}
+
+/*
+Bins axis of the dims volume in by f into out.  The image, estimate and normal take the mean of each block.  The 
+PSF (wrapped, its center at 0) takes sum_d (f-|d|)/f*h[f*k+d] for |d| < f: that is the mean over the block of the 
+image of the PSF summed over the block of the object, so the coarse model stays centered and keeps the PSF's sum.
+*/
+template<typename T>
+static void binAxis(const T * in, float * out, const int * dims, int axis, int f, bool psf) {
+	long long outer = 1, inner = 1;
+	for (int d = 0; d < axis; d++) outer *= dims[d];
+	for (int d = axis + 1; d < 3; d++) inner *= dims[d];
+
+	const int n = dims[axis];
+	const int coarse = n / f;
+
+	for (long long o = 0; o < outer; o++) {
+		for (int k = 0; k < coarse; k++) {
+			float * row = out + (o * coarse + k) * inner;
+
+			for (long long q = 0; q < inner; q++) {
+				float sum = 0;
+
+				if (psf) {
+					for (int d = 1 - f; d < f; d++) {
+						const int p = ((k * f + d) % n + n) % n;
+						sum += (f - std::abs(d)) * toFloat(in[(o * n + p) * inner + q]);
+					}
+				}
+				else {
+					for (int a = 0; a < f; a++) {
+						sum += toFloat(in[(o * n + k * f + a) * inner + q]);
+					}
+				}
+
+				row[q] = sum / f;
+			}
+		}
+	}
+}
+
+/*
+Linear interpolation of axis of the coarse dims volume in by f into out, circular like the FFTs.  Fine voxel p is
+at (p - (f-1)/2)/f on the coarse grid, the center of the coarse voxel it was binned into.
+*/
+static void upsampleAxis(const float * in, float * out, const int * dims, int axis, int f) {
+	long long outer = 1, inner = 1;
+	for (int d = 0; d < axis; d++) outer *= dims[d];
+	for (int d = axis + 1; d < 3; d++) inner *= dims[d];
+
+	const int coarse = dims[axis];
+	const int n = coarse * f;
+
+	for (long long o = 0; o < outer; o++) {
+		for (int p = 0; p < n; p++) {
+			const float c = (p - (f - 1) / 2.f) / f;
+			const int k = (int) floorf(c);
+			const float w = c - k;
+
+			const float * low = in + (o * coarse + (k + coarse) % coarse) * inner;
+			const float * high = in + (o * coarse + (k + 1) % coarse) * inner;
+			float * row = out + (o * n + p) * inner;
+
+			for (long long q = 0; q < inner; q++) {
+				row[q] = (1 - w) * low[q] + w * high[q];
+			}
+		}
+	}
+}
+
+// bins in (dims) by the per axis factors f into out, one axis at a time
+template<typename T>
+static void binVolume(const T * in, float * out, const int * dims, const int * f, bool psf) {
+	int current[3] = {dims[0], dims[1], dims[2]};
+	float * buffer = NULL;
+	const T * source = in;
+	const float * sourceFloat = NULL;
+
+	for (int axis = 0; axis < 3; axis++) {
+		if (f[axis] == 1) continue;
+
+		bool last = true;
+		for (int d = axis + 1; d < 3; d++) {
+			if (f[d] > 1) last = false;
+		}
+
+		long long size = (long long) current[0] * current[1] * current[2] / f[axis];
+		float * target = last ? out : (float*) malloc(sizeof(float) * size);
+
+		if (sourceFloat == NULL) {
+			binAxis(source, target, current, axis, f[axis], psf);
+		}
+		else {
+			binAxis(sourceFloat, target, current, axis, f[axis], psf);
+		}
+
+		free(buffer);
+		buffer = last ? NULL : target;
+		sourceFloat = target;
+		current[axis] /= f[axis];
+	}
+}
+
+// upsamples in (the coarse dims) by the per axis factors f into out
+static void upsampleVolume(const float * in, float * out, const int * dims, const int * f) {
+	int current[3] = {dims[0], dims[1], dims[2]};
+	float * buffer = NULL;
+	const float * source = in;
+
+	for (int axis = 0; axis < 3; axis++) {
+		if (f[axis] == 1) continue;
+
+		bool last = true;
+		for (int d = axis + 1; d < 3; d++) {
+			if (f[d] > 1) last = false;
+		}
+
+		long long size = (long long) current[0] * current[1] * current[2] * f[axis];
+		float * target = last ? out : (float*) malloc(sizeof(float) * size);
+
+		upsampleAxis(source, target, current, axis, f[axis]);
+
+		free(buffer);
+		buffer = last ? NULL : target;
+		source = target;
+		current[axis] *= f[axis];
+	}
+}
+
+// Richardson Lucy, coarse to fine if mklSetMultiresolution is set (see richardsonLucyIterations)
+template<typename T>
+static int richardsonLucy3D(int iterations, T * x, float *h,
+		float*y, const int n0,
+		const int n1, const int n2, T * normal) {
+
+	// one call, whether it runs in one or two stages
+	CallStats callStats;
+
+	const int dims[3] = {n0, n1, n2};
+	const int factor = multiresolutionFactor;
+	const int coarseIterations = std::min((int)multiresolutionIterations, iterations);
+
+	// axes the factor divides (and leaves at least 2 voxels)
+	int f[3];
+	bool binned = false;
+
+	for (int d = 0; d < 3; d++) {
+		f[d] = factor > 1 && dims[d] % factor == 0 && dims[d] / factor >= 2 ? factor : 1;
+		binned = binned || f[d] > 1;
+	}
+
+	if (!binned || coarseIterations == 0) {
+		return richardsonLucyIterations(iterations, x, h, y, n0, n1, n2, normal, 0, iterations, warmStart, 
+				callStats);
+	}
+
+	const int coarse[3] = {n0 / f[0], n1 / f[1], n2 / f[2]};
+	const long long coarseSize = (long long) coarse[0] * coarse[1] * coarse[2];
+
+	logMessage(LOG_INFO, "mkl rl coarse %d x %d x %d for %d of %d iterations\n", coarse[0], coarse[1], coarse[2], 
+			coarseIterations, iterations);
+
+	float * xc = (float*) malloc(sizeof(float) * coarseSize);
+	float * hc = (float*) malloc(sizeof(float) * coarseSize);
+	float * yc = (float*) malloc(sizeof(float) * coarseSize);
+	float * normalc = normal != NULL ? (float*) malloc(sizeof(float) * coarseSize) : NULL;
+
+	binVolume(x, xc, dims, f, false);
+	binVolume(h, hc, dims, f, true);
+	binVolume(y, yc, dims, f, false);
+
+	if (normal != NULL) {
+		binVolume(normal, normalc, dims, f, false);
+	}
+
+	// the binned volumes are allocated on top of the coarse stage
+	callStats.peak(mklGetPeakMemory(coarse[0], coarse[1], coarse[2]) + 
+			(normal != NULL ? 4 : 3) * coarseSize * sizeof(float));
+
+	int ret = richardsonLucyIterations(coarseIterations, xc, hc, yc, coarse[0], coarse[1], coarse[2], normalc, 0, 
+			iterations, warmStart, callStats);
+
+	upsampleVolume(yc, y, coarse, f);
+
+	free(xc);
+	free(hc);
+	free(yc);
+	free(normalc);
+
+	if (ret != 0 || coarseIterations == iterations) {
+		return ret;
+	}
+
+	return richardsonLucyIterations(iterations - coarseIterations, x, h, y, n0, n1, n2, normal, coarseIterations, 
+			iterations, 0.f, callStats);
+}
+
+extern "C" EXPORT int mklRichardsonLucy3D(int iterations, float * x, float *h,
+		float*y, const int n0,
+		const int n1, const int n2, float * normal) {
+	return richardsonLucy3D(iterations, x, h, y, n0, n1, n2, normal);
+}
+
+/*
+Richardson Lucy with the observed image x and the normal stored as half (see mklFloatToHalf), which halves 
+the memory and bandwidth of the two largest read only arrays.  The result y is float. 
+*/
+extern "C" EXPORT int mklRichardsonLucy3DHalf(int iterations, unsigned short * x, float *h,
+		float*y, const int n0,
+		const int n1, const int n2, unsigned short * normal) {
+	return richardsonLucy3D(iterations, x, h, y, n0, n1, n2, normal);
+}
+
+/*
+A plan for repeated runs of one size and PSF (the deconvolver library keeps one per deconvolver): mklCreatePlan 
+makes the FFT plans and the OTF once, mklRichardsonLucyPlan and mklConvolvePlan only execute them.  The FFTs run 
+on the plan's own estimate and scratch, the caller's estimate is copied in and out.  The warm start and TV 
+settings apply as in mklRichardsonLucy3D, coarse to fine doesn't (the plan is for one size).  One call runs on a 
+plan at a time, calls on different plans run in parallel.
+*/
+struct MKLDeconvPlan {
+	int n0, n1, n2;
+	float * y;
+	float * temp;
+	fftwf_complex * FFT_;
+	fftwf_complex * H_;
+	fftwf_plan forwardEstimate, forwardTemp, inverse;
+	std::mutex lock;
+};
+
+/*
+Plans the n0 x n1 x n2 transforms and computes the OTF of the PSF h (not kept).  Returns NULL if the buffers can't 
+be allocated.  Free with mklFreePlan.
+*/
+extern "C" EXPORT MKLDeconvPlan * mklCreatePlan(float * h, const int n0, const int n1, const int n2) {
+	logMessage(LOG_INFO, "mkl plan 3D %d x %d x %d\n", n0, n1, n2);
+
+	const long long imageSize = (long long) n0 * n1 * n2;
+	const long long fftSize = (long long) n0 * n1 * (n2 / 2 + 1);
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, mklGetPeakMemory(n0, n1, n2) + imageSize * sizeof(float));
+
+	MKLDeconvPlan * plan = new MKLDeconvPlan();
+	plan->n0 = n0;
+	plan->n1 = n1;
+	plan->n2 = n2;
+	plan->y = (float*) malloc(sizeof(float) * imageSize);
+	plan->temp = (float*) malloc(sizeof(float) * imageSize);
+	plan->FFT_ = (fftwf_complex*) malloc(sizeof(fftwf_complex) * fftSize);
+	plan->H_ = (fftwf_complex*) malloc(sizeof(fftwf_complex) * fftSize);
+
+	if (plan->y == NULL || plan->temp == NULL || plan->FFT_ == NULL || plan->H_ == NULL) {
+		logMessage(LOG_ERROR, "mkl plan, can't allocate the buffers of %d x %d x %d\n", n0, n1, n2);
+		free(plan->y);
+		free(plan->temp);
+		free(plan->FFT_);
+		free(plan->H_);
+		delete plan;
+		return NULL;
+	}
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
+
+	plan->forwardEstimate = fftwf_plan_dft_r2c_3d(n0, n1, n2, plan->y, plan->FFT_, (int) FFTW_ESTIMATE);
+	plan->forwardTemp = fftwf_plan_dft_r2c_3d(n0, n1, n2, plan->temp, plan->FFT_, (int) FFTW_ESTIMATE);
+	plan->inverse = fftwf_plan_dft_c2r_3d(n0, n1, n2, plan->FFT_, plan->temp, (int) FFTW_ESTIMATE);
+
+	fftwf_plan forwardH = fftwf_plan_dft_r2c_3d(n0, n1, n2, h, plan->H_, (int) FFTW_ESTIMATE);
+	planner.unlock();
+
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	fftwf_execute(forwardH);
+
+	planner.lock();
+	fftwf_destroy_plan(forwardH);
+	planner.unlock();
+
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	return plan;
+}
+
+/*
+Richardson Lucy of x into the estimate y (in place) with the plan's OTF, as mklRichardsonLucy3D.  Returns 0, or 
+DECONV_CANCELLED if the run was cancelled (y then holds the last finished iteration).
+*/
+extern "C" EXPORT int mklRichardsonLucyPlan(MKLDeconvPlan * plan, int iterations, float * x, float * y, 
+		float * normal) {
+	std::lock_guard<std::mutex> lock(plan->lock);
+
+	const int n0 = plan->n0, n1 = plan->n1, n2 = plan->n2;
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	logMessage(LOG_INFO, "mkl rl plan 3D %d x %d x %d, %d iterations, %s normal, tv %g, %s kernels\n", n0, n1, n2, 
+			iterations, normal == NULL ? "no" : "with", (float)tvRegularization, pointwiseKernels());
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, mklGetPeakMemory(n0, n1, n2) + (long long) imageSize * sizeof(float));
+
+	memcpy(plan->y, y, imageSize * sizeof(float));
+
+	wienerStart(x, plan->temp, plan->y, plan->FFT_, plan->H_, plan->forwardTemp, plan->inverse, imageSize, fftSize, 
+			warmStart, callStats);
+
+	int ret = richardsonLucyLoop(iterations, x, plan->H_, plan->y, normal, n0, n1, n2, plan->temp, plan->FFT_, 
+			plan->forwardEstimate, plan->forwardTemp, plan->inverse, 0, iterations, callStats);
+
+	memcpy(y, plan->y, imageSize * sizeof(float));
+	callStats.phase(STATS_POINTWISE_SECONDS);
+
+	return ret;
+}
+
+// y = x convolved with (or, conj, correlated with) the plan's PSF
+extern "C" EXPORT void mklConvolvePlan(MKLDeconvPlan * plan, float * x, float * y, bool conj) {
+	std::lock_guard<std::mutex> lock(plan->lock);
+
+	const int imageSize = plan->n0 * plan->n1 * plan->n2;
+	const int fftSize = plan->n0 * plan->n1 * (plan->n2 / 2 + 1);
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, mklGetPeakMemory(plan->n0, plan->n1, plan->n2) + 
+			(long long) imageSize * sizeof(float));
+
+	memcpy(plan->temp, x, imageSize * sizeof(float));
+
+	fftwf_execute(plan->forwardTemp);
+	callStats.phase(STATS_FFT_SECONDS);
+
+	// the 1/imageSize normalization of the inverse FFT is folded into the multiply
+	if (conj) {
+		complexMultiplyConjugate((float*) plan->FFT_, (float*) plan->H_, (float*) plan->FFT_, fftSize, 1.f / imageSize);
+	} else {
+		complexMultiply((float*) plan->FFT_, (float*) plan->H_, (float*) plan->FFT_, fftSize, 1.f / imageSize);
+	}
+	callStats.phase(STATS_POINTWISE_SECONDS);
+
+	fftwf_execute(plan->inverse);
+	callStats.phase(STATS_FFT_SECONDS);
+	callStats.add(STATS_FFTS, 2);
+
+	memcpy(y, plan->temp, imageSize * sizeof(float));
+}
+
+extern "C" EXPORT void mklFreePlan(MKLDeconvPlan * plan) {
+	if (plan == NULL) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	fftwf_destroy_plan(plan->forwardEstimate);
+	fftwf_destroy_plan(plan->forwardTemp);
+	fftwf_destroy_plan(plan->inverse);
+	planner.unlock();
+
+	free(plan->y);
+	free(plan->temp);
+	free(plan->FFT_);
+	free(plan->H_);
+	delete plan;
+}
+
+/*
+Smallest size >= n with no prime factor above 7.  FFTW, pocketfft and MKL transform these sizes fastest, and there
+are many more of them than powers of 2 (for 129 it is 135, not 256).
+*/
+extern "C" EXPORT int mklGetFastSize(int n) {
+	for (int size = std::max(n, 1);; size++) {
+		int rest = size;
+
+		for (int factor = 2; factor <= 7; factor++) {
+			while (rest % factor == 0) {
+				rest /= factor;
+			}
+		}
+
+		if (rest == 1) {
+			return size;
+		}
+	}
+}
+
+/*
+Geometry of mklRichardsonLucyROI3D for the roiSize region at roiStart of an m0 x m1 x m2 image and a p0 x p1 x p2 
+PSF (n0, n1, n2 order, n2 fastest).  The image is read in the region grown by half the PSF on each side (clipped to 
+the image), dataStart and dataSize, which holds every voxel the light of the region reaches.  The extended volume is
+that plus the PSF support (p - 1, so the estimate around the data is modelled and nothing wraps around), rounded up 
+to a fast size.  Returns 0, or DECONV_INVALID_VALUE if the region isn't inside the image.
+*/
+extern "C" EXPORT int mklGetROIGeometry(const int m0, const int m1, const int m2, const int p0, const int p1, 
+		const int p2, const int * roiStart, const int * roiSize, int * dataStart, int * dataSize, int * extended) {
+	const int m[3] = {m0, m1, m2};
+	const int p[3] = {p0, p1, p2};
+
+	for (int d = 0; d < 3; d++) {
+		if (p[d] < 1 || roiSize[d] < 1 || roiStart[d] < 0 || roiStart[d] + roiSize[d] > m[d]) {
+			logMessage(LOG_ERROR, "mkl roi, region %d + %d of axis %d is outside the image (%d) or the psf is empty\n", 
+					roiStart[d], roiSize[d], d, m[d]);
+			return DECONV_INVALID_VALUE;
+		}
+
+		const int from = std::max(0, roiStart[d] - p[d] / 2);
+		const int to = std::min(m[d], roiStart[d] + roiSize[d] + p[d] / 2);
+
+		dataStart[d] = from;
+		dataSize[d] = to - from;
+		extended[d] = mklGetFastSize(dataSize[d] + p[d] - 1);
+	}
+
+	return 0;
+}
+
+/*
+Richardson Lucy of the roiSize region at roiStart of the m0 x m1 x m2 image, written to out (roiSize, n2 fastest), 
+for inspecting a region at a fraction of the cost of the whole image.  psf is p0 x p1 x p2 with its center at p/2.
+The data around the region (see mklGetROIGeometry) is placed in the center of the extended volume with zeros 
+around it, and the estimate starts from its mean.  The iterations are non-circulant: the normal is the correlation 
+of the data region with the PSF for this geometry (values below 1e-5 set to 1, as in the OpenCL engine), so the 
+padding doesn't pull the estimate down at the edges of the data.  The warm start, TV and coarse to fine settings, 
+progress and cancellation are those of mklRichardsonLucy3D.  Returns 0, DECONV_CANCELLED (out then holds the last 
+finished iteration) or DECONV_INVALID_VALUE.
+*/
+extern "C" EXPORT int mklRichardsonLucyROI3D(int iterations, const float * image, const int m0, const int m1, 
+		const int m2, const float * psf, const int p0, const int p1, const int p2, const int * roiStart, 
+		const int * roiSize, float * out) {
+
+	int dataStart[3], dataSize[3], n[3];
+
+	if (mklGetROIGeometry(m0, m1, m2, p0, p1, p2, roiStart, roiSize, dataStart, dataSize, n) != 0) {
+		return DECONV_INVALID_VALUE;
+	}
+
+	logMessage(LOG_INFO, "mkl rl roi %d x %d x %d of %d x %d x %d, data %d x %d x %d, extended %d x %d x %d\n", 
+			roiSize[0], roiSize[1], roiSize[2], m0, m1, m2, dataSize[0], dataSize[1], dataSize[2], n[0], n[1], n[2]);
+
+	const long long imageSize = (long long) n[0] * n[1] * n[2];
+
+	if (imageSize > INT_MAX) {
+		logMessage(LOG_ERROR, "mkl roi, the extended volume has more than 2^31 voxels\n");
+		return DECONV_INVALID_VALUE;
+	}
+
+	// the setup, the iterations are counted by the RL call
+	CallStats callStats(false);
+	callStats.add(STATS_PEAK_BYTES, 4 * imageSize * sizeof(float) + mklGetPeakMemory(n[0], n[1], n[2]));
+
+	float * x = (float*) calloc(imageSize, sizeof(float));
+	float * h = (float*) calloc(imageSize, sizeof(float));
+	float * y = (float*) malloc(sizeof(float) * imageSize);
+	float * normal = (float*) calloc(imageSize, sizeof(float));
+
+	// the data region centered in the extended volume (as setNormalMask of the OpenCL engine), ones in the normal
+	const int offset[3] = {(n[0] - dataSize[0]) / 2, (n[1] - dataSize[1]) / 2, (n[2] - dataSize[2]) / 2};
+	double sum = 0;
+
+	for (int k = 0; k < dataSize[0]; k++) {
+		for (int j = 0; j < dataSize[1]; j++) {
+			const float * row = image + ((long long) (dataStart[0] + k) * m1 + dataStart[1] + j) * m2 + dataStart[2];
+			const long long to = ((long long) (offset[0] + k) * n[1] + offset[1] + j) * n[2] + offset[2];
+
+			memcpy(x + to, row, dataSize[2] * sizeof(float));
+
+			for (int i = 0; i < dataSize[2]; i++) {
+				normal[to + i] = 1;
+				sum += row[i];
+			}
+		}
+	}
+
+	// the PSF wrapped, its center to the origin
+	for (int k = 0; k < p0; k++) {
+		for (int j = 0; j < p1; j++) {
+			const long long to = ((long long) ((k - p0 / 2 + n[0]) % n[0]) * n[1] + (j - p1 / 2 + n[1]) % n[1]) * n[2];
+
+			for (int i = 0; i < p2; i++) {
+				h[to + (i - p2 / 2 + n[2]) % n[2]] = psf[((long long) k * p1 + j) * p2 + i];
+			}
+		}
+	}
+
+	// the normal, correlation of the data mask with the PSF
+	convolve3D(normal, h, normal, n[0], n[1], n[2], true, callStats);
+
+	for (long long i = 0; i < imageSize; i++) {
+		if (normal[i] < 1e-5f) {
+			normal[i] = 1;
+		}
+	}
+
+	const float mean = (float) (sum / ((double) dataSize[0] * dataSize[1] * dataSize[2]));
+
+	for (long long i = 0; i < imageSize; i++) {
+		y[i] = mean;
+	}
+
+	int ret = richardsonLucy3D(iterations, x, h, y, n[0], n[1], n[2], normal);
+
+	// crop the region into out
+	for (int k = 0; k < roiSize[0]; k++) {
+		for (int j = 0; j < roiSize[1]; j++) {
+			const long long from = ((long long) (offset[0] + roiStart[0] - dataStart[0] + k) * n[1] + offset[1] + 
+					roiStart[1] - dataStart[1] + j) * n[2] + offset[2] + roiStart[2] - dataStart[2];
+
+			memcpy(out + ((long long) k * roiSize[1] + j) * roiSize[2], y + from, roiSize[2] * sizeof(float));
+		}
+	}
+
+	free(x);
+	free(h);
+	free(y);
+	free(normal);
+
+	return ret;
+}
+
+// temp = mask*(temp - x), the residual of the observed region
+static void maskedResidual(const float * x, const float * mask, float * temp, const int n) {
+	for (int i = 0; i < n; i++) {
+		temp[i] = mask[i] * (temp[i] - x[i]);
+	}
+}
+
+// FISTA's step 1/max|OTF|^2 (the largest eigenvalue of h^T*h).  With htx (circulant) it also computes h^T*x into 
+// htx and turns H_ into |OTF|^2 with the 1/imageSize of the inverse FFT, through temp with the plans forwardTemp 
+// (temp to FFT_) and inverse (FFT_ to temp).
+static float fistaSetup(const float * x, fftwf_complex * H_, float * htx, float * temp, fftwf_complex * FFT_, 
+		fftwf_plan forwardTemp, fftwf_plan inverse, const int imageSize, const int fftSize, CallStats & callStats) {
+	float lipschitz = 0;
+	const float * otf = (const float*) H_;
+
+	for (int i = 0; i < fftSize; i++) {
+		lipschitz = std::max(lipschitz, otf[2*i] * otf[2*i] + otf[2*i + 1] * otf[2*i + 1]);
+	}
+
+	if (htx != NULL) {
+		memcpy(temp, x, imageSize * sizeof(float));
+		fftwf_execute(forwardTemp);
+		complexMultiplyConjugate((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, 1.f / imageSize);
+		fftwf_execute(inverse);
+		memcpy(htx, temp, imageSize * sizeof(float));
+
+		complexMultiplyConjugate((float*) H_, (float*) H_, (float*) H_, fftSize, 1.f / imageSize);
+		callStats.phase(STATS_OTF_SECONDS);
+		callStats.add(STATS_FFTS, 2);
+	}
+
+	return lipschitz > 0 ? 1.f / lipschitz : 0.f;
+}
+
+// The FISTA iterations on the estimate y and the extrapolated point z, H_ and htx from fistaSetup (htx NULL with a
+// mask), through temp and FFT_ with the plans forwardZ (z to FFT_), forwardTemp and inverse.  t is the momentum 
+// (1 at the start), updated for the next call.  done and total and the return value as richardsonLucyLoop.
+static int fistaLoop(int iterations, const float * x, fftwf_complex * H_, float * y, float * z, const float * htx, 
+		const float * mask, const int n0, const int n1, const int n2, float * temp, fftwf_complex * FFT_, 
+		fftwf_plan forwardZ, fftwf_plan forwardTemp, fftwf_plan inverse, float step, float lambda, float * t, 
+		int done, int total, CallStats & callStats, int * finished = NULL) {
+
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	float * tvScratch = lambda > 0 ? (float*) malloc(sizeof(float) * 2 * n1 * n2) : NULL;
+
+	int ret = 0;
+
+	for (int i = 0; i < iterations; i++) {
+		fftwf_execute(forwardZ);
+		callStats.phase(STATS_FFT_SECONDS);
+
+		if (htx != NULL) {
+			// h^T*h*z
+			complexMultiply((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, 1.f);
+			callStats.phase(STATS_POINTWISE_SECONDS);
+
+			fftwf_execute(inverse);
+			callStats.phase(STATS_FFT_SECONDS);
+			callStats.add(STATS_FFTS, 2);
+		}
+		else {
+			// h^T*(mask*(h*z - x))
+			complexMultiply((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, 1.f / imageSize);
+			callStats.phase(STATS_POINTWISE_SECONDS);
+
+			fftwf_execute(inverse);
+			callStats.phase(STATS_FFT_SECONDS);
+
+			maskedResidual(x, mask, temp, imageSize);
+			callStats.phase(STATS_POINTWISE_SECONDS);
+
+			fftwf_execute(forwardTemp);
+			callStats.phase(STATS_FFT_SECONDS);
+
+			complexMultiplyConjugate((float*) FFT_, (float*) H_, (float*) FFT_, fftSize, 1.f / imageSize);
+			callStats.phase(STATS_POINTWISE_SECONDS);
+
+			fftwf_execute(inverse);
+			callStats.phase(STATS_FFT_SECONDS);
+			callStats.add(STATS_FFTS, 4);
+		}
+
+		// beta = (t_k - 1)/t_k+1
+		const float tNext = (1.f + sqrtf(1.f + 4.f * *t * *t)) / 2.f;
+		const float beta = (*t - 1.f) / tNext;
+		*t = tNext;
+
+		fistaStep(y, z, temp, htx, n0, n1, n2, step, beta, lambda, tvScratch);
+		callStats.phase(STATS_POINTWISE_SECONDS);
+
+		callStats.add(STATS_ITERATIONS, 1);
+
+		if (finished != NULL) {
+			(*finished)++;
+		}
+
+		logMessage(LOG_DEBUG, "iteration %d\n", i);
+
+		if (!continueIterating(done + i + 1, total)) {
+			logMessage(LOG_INFO, "cancelled after %d iterations\n", done + i + 1);
+			ret = DECONV_CANCELLED;
+			break;
+		}
+	}
+
+	free(tvScratch);
+
+	return ret;
+}
+
+/*
+FISTA (Beck and Teboulle 2009), accelerated projected gradient descent on |h*y - x|^2/2 + lambda*TV(y) with y >= 0, 
+from the estimate y (or the Wiener estimate, see mklSetWarmStart).  It gets to a given error in far fewer iterations 
+than RL on high SNR data, but unlike RL it doesn't model Poisson noise.  The step is 1/max|OTF|^2.  lambda (0 for 
+none) weights the total variation term and is in units of the image, a few percent of the background noise is a 
+start; unlike the RL-TV term it adds to the gradient, so too large a weight makes the iterations oscillate.
+
+Without a mask the image is circulant and the data gradient h^T*h*z - h^T*x takes two FFTs per iteration (h^T*x is 
+computed once).  With a mask (1 where x was observed, 0 in the padding, the array the RL normal is computed from) 
+only the observed region is fitted, which takes four FFTs per iteration like RL.  Each iteration then updates the 
+estimate and the extrapolated point in one pass (see fistaStep).  Progress and cancellation are those of 
+mklRichardsonLucy3D.  Returns 0, or DECONV_CANCELLED if the run was cancelled (y then holds the last finished 
+iteration).
+*/
+extern "C" EXPORT int mklFista3D(int iterations, float * x, float *h,
+		float*y, const int n0,
+		const int n1, const int n2, float * mask, float lambda) {
+
+	lambda = lambda > 0 ? lambda : 0;
+
+	logMessage(LOG_INFO, "mkl fista 3D %d x %d x %d, %d iterations, %s mask, tv %g, %s kernels\n", n0, n1, n2, iterations, 
+			mask == NULL ? "no" : "with", lambda, pointwiseKernels());
+
+	CallStats callStats;
+
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	callStats.add(STATS_PEAK_BYTES, mklGetFistaPeakMemory(n0, n1, n2, mask != NULL, lambda));
+
+	// the extrapolated point, the gradient and (circulant) h^T*x
+	float * z = (float*) malloc(sizeof(float) * imageSize);
+	float * temp = (float*) malloc(sizeof(float) * imageSize);
+	float * htx = mask == NULL ? (float*) malloc(sizeof(float) * imageSize) : NULL;
+
+	fftwf_complex * FFT_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
+	fftwf_complex * H_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
+
+	fftwf_plan forwardZ = fftwf_plan_dft_r2c_3d(n0, n1, n2, z,
+			FFT_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan forwardH = fftwf_plan_dft_r2c_3d(n0, n1, n2, h,
+			H_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan forwardTemp = fftwf_plan_dft_r2c_3d(n0, n1, n2, temp,
+			FFT_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan inverse = fftwf_plan_dft_c2r_3d(n0, n1, n2,
+			FFT_, temp, (int) FFTW_ESTIMATE);
+	planner.unlock();
+
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	fftwf_execute(forwardH);
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	wienerStart(x, temp, y, FFT_, H_, forwardTemp, inverse, imageSize, fftSize, warmStart, callStats);
+
+	const float step = fistaSetup(x, H_, htx, temp, FFT_, forwardTemp, inverse, imageSize, fftSize, callStats);
+
+	memcpy(z, y, imageSize * sizeof(float));
+
+	float t = 1;
+	int ret = fistaLoop(iterations, x, H_, y, z, htx, mask, n0, n1, n2, temp, FFT_, forwardZ, forwardTemp, inverse, 
+			step, lambda, &t, 0, iterations, callStats);
+
+	planner.lock();
+	fftwf_destroy_plan(forwardZ);
+	fftwf_destroy_plan(forwardH);
+	fftwf_destroy_plan(forwardTemp);
+	fftwf_destroy_plan(inverse);
+	planner.unlock();
+
+	free(z);
+	free(temp);
+	free(htx);
+	free(FFT_);
+	free(H_);
+
+	return ret;
+}
+
+// a deconvolution state (see mklCreateState), the header is followed by the arrays at 64 byte aligned offsets: the 
+// observed image x, the estimate y, the OTF H_ (|OTF|^2 for circulant FISTA), the normal (RL) or mask (FISTA) if 
+// any, and for FISTA the extrapolated point z and the circulant h^T*x
+static const char STATE_MAGIC[8] = {'M', 'K', 'L', 'D', 'S', 'T', '0', '1'};
+
+struct StateHeader {
+	char magic[8];
+	int algorithm;
+	int n0, n1, n2;
+	int hasNormal;
+	// iterations run since the state was created
+	int iterations;
+	// FISTA's TV weight, step and momentum
+	float lambda;
+	float step;
+	float t;
+	long long bytes;
+};
+
+struct MKLDeconvState {
+	// the state file, data is NULL for a state in memory
+	MappedFile file;
+	char * memory;
+
+	StateHeader * header;
+	float * x;
+	float * y;
+	fftwf_complex * H_;
+	float * normal;
+	float * z;
+	float * htx;
+
+	// scratch and plans, made again when a state file is opened
+	float * temp;
+	fftwf_complex * FFT_;
+	fftwf_plan forwardEstimate, forwardTemp, inverse;
+};
+
+static long long alignState(long long offset) {
+	return (offset + 63) / 64 * 64;
+}
+
+// the bytes of a state of algorithm, size and normal, and if state isn't NULL its header and array pointers in base
+static long long stateLayout(MKLDeconvState * state, char * base, int algorithm, int n0, int n1, int n2, int hasNormal) {
+	const long long imageBytes = (long long) n0 * n1 * n2 * sizeof(float);
+	const long long fftBytes = (long long) n0 * n1 * (n2 / 2 + 1) * sizeof(fftwf_complex);
+	const bool fista = algorithm == DECONV_STATE_FISTA;
+
+	long long offset = alignState(sizeof(StateHeader));
+	long long x = offset; offset = alignState(offset + imageBytes);
+	long long y = offset; offset = alignState(offset + imageBytes);
+	long long H = offset; offset = alignState(offset + fftBytes);
+	long long normal = offset; offset = alignState(offset + (hasNormal ? imageBytes : 0));
+	long long z = offset; offset = alignState(offset + (fista ? imageBytes : 0));
+	long long htx = offset; offset = alignState(offset + (fista && !hasNormal ? imageBytes : 0));
+
+	if (state != NULL) {
+		state->header = (StateHeader*) base;
+		state->x = (float*) (base + x);
+		state->y = (float*) (base + y);
+		state->H_ = (fftwf_complex*) (base + H);
+		state->normal = hasNormal ? (float*) (base + normal) : NULL;
+		state->z = fista ? (float*) (base + z) : NULL;
+		state->htx = fista && !hasNormal ? (float*) (base + htx) : NULL;
+	}
+
+	return offset;
+}
+
+// scratch and plans of a state whose arrays are set
+static void stateScratch(MKLDeconvState * state) {
+	const StateHeader * header = state->header;
+	const int fftSize = header->n0 * header->n1 * (header->n2 / 2 + 1);
+
+	state->temp = (float*) malloc(sizeof(float) * header->n0 * header->n1 * header->n2);
+	state->FFT_ = (fftwf_complex*) malloc(sizeof(fftwf_complex) * fftSize);
+
+	std::lock_guard<std::mutex> planner(plannerMutex);
+	initPlanner();
+
+	float * estimate = header->algorithm == DECONV_STATE_FISTA ? state->z : state->y;
+
+	state->forwardEstimate = fftwf_plan_dft_r2c_3d(header->n0, header->n1, header->n2, estimate,
+			state->FFT_, (int) FFTW_ESTIMATE);
+
+	state->forwardTemp = fftwf_plan_dft_r2c_3d(header->n0, header->n1, header->n2, state->temp,
+			state->FFT_, (int) FFTW_ESTIMATE);
+
+	state->inverse = fftwf_plan_dft_c2r_3d(header->n0, header->n1, header->n2,
+			state->FFT_, state->temp, (int) FFTW_ESTIMATE);
+}
+
+/*
+Creates a resumable RL (DECONV_STATE_RL) or FISTA (DECONV_STATE_FISTA) run of the observed image x and the PSF h 
+from the estimate y (or the Wiener estimate, see mklSetWarmStart).  The state holds copies of x and y, the OTF 
+(computed here once), the RL normal or the FISTA mask (normal, may be NULL) and FISTA's extrapolated point and 
+momentum, so mklRunState can continue it any number of times, with the same result as one longer run.  lambda is 
+FISTA's TV weight (see mklFista3D), RL takes mklSetTVRegularization when it runs.  With a path the state lives in 
+that file (created or overwritten, memory mapped) and mklOpenState continues it in a later process, otherwise it 
+is in memory.  Returns NULL if the algorithm is unknown, the file can't be created or the memory allocated.  
+Free with mklFreeState.
+*/
+extern "C" EXPORT MKLDeconvState * mklCreateState(int algorithm, float * x, float * h, float * y,
+		const int n0, const int n1, const int n2, float * normal, float lambda, const char * path) {
+
+	if (algorithm != DECONV_STATE_RL && algorithm != DECONV_STATE_FISTA) {
+		logMessage(LOG_ERROR, "mkl state, unknown algorithm %d\n", algorithm);
+		return NULL;
+	}
+
+	const int hasNormal = normal != NULL ? 1 : 0;
+	const long long bytes = stateLayout(NULL, NULL, algorithm, n0, n1, n2, hasNormal);
+
+	MKLDeconvState * state = new MKLDeconvState();
+	char * base;
+
+	if (path != NULL) {
+		if (!mapFile(path, bytes, true, &state->file)) {
+			logMessage(LOG_ERROR, "mkl state, can't create %s\n", path);
+			delete state;
+			return NULL;
+		}
+
+		base = (char*) state->file.data;
+	}
+	else {
+		state->file.data = NULL;
+		state->memory = (char*) calloc(bytes, 1);
+
+		if (state->memory == NULL) {
+			logMessage(LOG_ERROR, "mkl state, can't allocate %lld bytes\n", bytes);
+			delete state;
+			return NULL;
+		}
+
+		base = state->memory;
+	}
+
+	logMessage(LOG_INFO, "mkl state %s %d x %d x %d, %lld bytes in %s\n", algorithm == DECONV_STATE_FISTA ? "fista" : "rl", 
+			n0, n1, n2, bytes, path != NULL ? path : "memory");
+
+	stateLayout(state, base, algorithm, n0, n1, n2, hasNormal);
+
+	StateHeader * header = state->header;
+	memcpy(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+	header->algorithm = algorithm;
+	header->n0 = n0;
+	header->n1 = n1;
+	header->n2 = n2;
+	header->hasNormal = hasNormal;
+	header->iterations = 0;
+	header->lambda = lambda > 0 ? lambda : 0;
+	header->step = 0;
+	header->t = 1;
+	header->bytes = bytes;
+
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	memcpy(state->x, x, imageSize * sizeof(float));
+	memcpy(state->y, y, imageSize * sizeof(float));
+
+	if (normal != NULL) {
+		memcpy(state->normal, normal, imageSize * sizeof(float));
+	}
+
+	stateScratch(state);
+
+	CallStats callStats;
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	fftwf_plan forwardH = fftwf_plan_dft_r2c_3d(n0, n1, n2, h, state->H_, (int) FFTW_ESTIMATE);
+	planner.unlock();
+
+	fftwf_execute(forwardH);
+	callStats.phase(STATS_OTF_SECONDS);
+	callStats.add(STATS_FFTS, 1);
+
+	planner.lock();
+	fftwf_destroy_plan(forwardH);
+	planner.unlock();
+
+	wienerStart(state->x, state->temp, state->y, state->FFT_, state->H_, state->forwardTemp, state->inverse, imageSize, 
+			fftSize, warmStart, callStats);
+
+	if (algorithm == DECONV_STATE_FISTA) {
+		header->step = fistaSetup(state->x, state->H_, state->htx, state->temp, state->FFT_, state->forwardTemp, 
+				state->inverse, imageSize, fftSize, callStats);
+		memcpy(state->z, state->y, imageSize * sizeof(float));
+	}
+
+	return state;
+}
+
+/*
+Opens a state file of mklCreateState to continue it.  Returns NULL if the file can't be mapped or isn't a state.
+*/
+extern "C" EXPORT MKLDeconvState * mklOpenState(const char * path) {
+	MKLDeconvState * state = new MKLDeconvState();
+	state->memory = NULL;
+
+	if (!mapFile(path, 0, false, &state->file)) {
+		logMessage(LOG_ERROR, "mkl state, can't open %s\n", path);
+		delete state;
+		return NULL;
+	}
+
+	const StateHeader * header = (const StateHeader*) state->file.data;
+
+	if (state->file.bytes < (long long) sizeof(StateHeader) || memcmp(header->magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 ||
+			(header->algorithm != DECONV_STATE_RL && header->algorithm != DECONV_STATE_FISTA) ||
+			header->bytes != state->file.bytes || header->bytes != stateLayout(NULL, NULL, header->algorithm, header->n0, 
+					header->n1, header->n2, header->hasNormal)) {
+		logMessage(LOG_ERROR, "mkl state, %s is not a state file of this version\n", path);
+		unmapFile(&state->file);
+		delete state;
+		return NULL;
+	}
+
+	stateLayout(state, (char*) state->file.data, header->algorithm, header->n0, header->n1, header->n2, header->hasNormal);
+	stateScratch(state);
+
+	logMessage(LOG_INFO, "mkl state %s %d x %d x %d opened after %d iterations\n", header->algorithm == DECONV_STATE_FISTA ? 
+			"fista" : "rl", header->n0, header->n1, header->n2, header->iterations);
+
+	return state;
+}
+
+/*
+Runs iterations more iterations of the state.  With snapshotEvery > 0 and a callback, callback gets the iterations 
+run since the state was created and the estimate every snapshotEvery iterations (and after the last), a state 
+file is synced first so it holds that iteration, and a non zero return stops the run.  Progress and cancellation 
+are those of mklRichardsonLucy3D, counted from the start of this call.  Returns 0, or DECONV_CANCELLED if the run was
+cancelled or stopped by the callback (the state then holds the last finished iteration).
+*/
+extern "C" EXPORT int mklRunState(MKLDeconvState * state, int iterations, int snapshotEvery, 
+		SnapshotCallback callback, void * user) {
+
+	StateHeader * header = state->header;
+	const int n0 = header->n0, n1 = header->n1, n2 = header->n2;
+	const bool fista = header->algorithm == DECONV_STATE_FISTA;
+
+	logMessage(LOG_INFO, "mkl state run %d iterations after %d, %s kernels\n", iterations, header->iterations, 
+			pointwiseKernels());
+
+	CallStats callStats;
+	callStats.add(STATS_PEAK_BYTES, header->bytes);
+
+	int done = 0;
+	int ret = 0;
+
+	while (done < iterations && ret == 0) {
+		const int chunk = snapshotEvery > 0 ? std::min(snapshotEvery, iterations - done) : iterations - done;
+		int finished = 0;
+
+		if (fista) {
+			ret = fistaLoop(chunk, state->x, state->H_, state->y, state->z, state->htx, state->normal, n0, n1, n2, 
+					state->temp, state->FFT_, state->forwardEstimate, state->forwardTemp, state->inverse, header->step, 
+					header->lambda, &header->t, done, iterations, callStats, &finished);
+		}
+		else {
+			ret = richardsonLucyLoop(chunk, state->x, state->H_, state->y, state->normal, n0, n1, n2, state->temp, 
+					state->FFT_, state->forwardEstimate, state->forwardTemp, state->inverse, done, iterations, callStats, 
+					&finished);
+		}
+
+		done += finished;
+		header->iterations += finished;
+
+		if (ret == 0 && snapshotEvery > 0 && callback != NULL) {
+			if (state->file.data != NULL) {
+				syncMappedFile(&state->file);
+			}
+
+			if (callback(header->iterations, state->y, user) != 0) {
+				logMessage(LOG_INFO, "stopped at the snapshot after %d iterations\n", header->iterations);
+				ret = DECONV_CANCELLED;
+			}
+		}
+	}
+
+	return ret;
+}
+
+// copies the estimate of the state into y (n0 x n1 x n2 of mklGetStateShape)
+extern "C" EXPORT void mklGetStateEstimate(MKLDeconvState * state, float * y) {
+	const StateHeader * header = state->header;
+	memcpy(y, state->y, (size_t) header->n0 * header->n1 * header->n2 * sizeof(float));
+}
+
+// the size of the state's volume into shape (n0, n1, n2), returns the iterations run since it was created
+extern "C" EXPORT int mklGetStateShape(MKLDeconvState * state, int * shape) {
+	const StateHeader * header = state->header;
+	shape[0] = header->n0;
+	shape[1] = header->n1;
+	shape[2] = header->n2;
+
+	return header->iterations;
+}
+
+// writes a state file back to disk (nothing to do in memory), returns 0 or -1 on failure
+extern "C" EXPORT int mklSyncState(MKLDeconvState * state) {
+	if (state->file.data == NULL) {
+		return 0;
+	}
+
+	return syncMappedFile(&state->file) ? 0 : -1;
+}
+
+// frees the state (a state file is synced and closed, it stays on disk)
+extern "C" EXPORT void mklFreeState(MKLDeconvState * state) {
+	if (state == NULL) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	fftwf_destroy_plan(state->forwardEstimate);
+	fftwf_destroy_plan(state->forwardTemp);
+	fftwf_destroy_plan(state->inverse);
+	planner.unlock();
+
+	free(state->temp);
+	free(state->FFT_);
+
+	if (state->file.data != NULL) {
+		syncMappedFile(&state->file);
+		unmapFile(&state->file);
+	}
+
+	free(state->memory);
+	delete state;
+}
+
+/*
+Wiener (Tikhonov regularized inverse) filter of x into y, a one pass preview: one forward FFT of x, 
+conj(OTF)/(|OTF|^2 + regularization*|OTF(0)|^2) and one inverse FFT (plus the FFT of the PSF), negative values set 
+to 0.  The regularization is relative to the OTF at zero frequency (the PSF's sum squared), around 1e-3 to 1e-2 for 
+noisy widefield data.  The same estimate can start RL, see mklSetWarmStart.  Returns 0, or -1 if the regularization
+isn't positive.
+*/
+extern "C" EXPORT int mklWiener3D(float * x, float *h, float *y, 
+		const int n0, const int n1, const int n2, float regularization) {
+
+	if (!(regularization > 0)) {
+		logMessage(LOG_ERROR, "mkl wiener needs a positive regularization, not %g\n", regularization);
+		return -1;
+	}
+
+	logMessage(LOG_INFO, "mkl wiener 3D %d x %d x %d, regularization %g\n", n0, n1, n2, regularization);
+
+	CallStats callStats;
+
+	const int imageSize = n0 * n1 * n2;
+	const int fftSize = n0 * n1 * (n2 / 2 + 1);
+
+	fftwf_complex * X_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
+	fftwf_complex * H_ = (fftwf_complex*) malloc(sizeof(fftwf_complex)*fftSize);
+
+	callStats.add(STATS_PEAK_BYTES, 2 * fftSize * sizeof(fftwf_complex));
+
+	std::unique_lock<std::mutex> planner(plannerMutex);
+	initPlanner();
+
+	fftwf_plan forward1 = fftwf_plan_dft_r2c_3d(n0, n1, n2, x,
+			X_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan forward2 = fftwf_plan_dft_r2c_3d(n0, n1, n2, h,
+			H_, (int) FFTW_ESTIMATE);
+
+	fftwf_plan inverse = fftwf_plan_dft_c2r_3d(n0, n1, n2,  X_,
+			y, (int) FFTW_ESTIMATE);
+	planner.unlock();
+
+	callStats.phase(STATS_PLAN_SECONDS);
+
+	fftwf_execute(forward2);
+	callStats.phase(STATS_OTF_SECONDS);
+	fftwf_execute(forward1);
+	callStats.phase(STATS_FFT_SECONDS);
+
+	wienerMultiply((float*) X_, (float*) H_, (float*) X_, fftSize, regularization, 1.f / imageSize);
+	callStats.phase(STATS_POINTWISE_SECONDS);
+
+	fftwf_execute(inverse);
+	callStats.phase(STATS_FFT_SECONDS);
+
+	clampMin(y, imageSize, 0.f);
+	callStats.phase(STATS_POINTWISE_SECONDS);
+	callStats.add(STATS_FFTS, 3);
+
+	planner.lock();
+	fftwf_destroy_plan(forward1);
+	fftwf_destroy_plan(forward2);
+	fftwf_destroy_plan(inverse);
+	planner.unlock();
+
+	free(X_);
+	free(H_);
+
+	return 0;
+}
+
+/*
+Peak bytes mklRichardsonLucy3D (and mklRichardsonLucy3DHalf) allocate: the spatial temp and the FFTs of the 
+estimate and the PSF, and two planes for the TV stencil if mklSetTVRegularization is set.  The caller's arrays are
+used in place and not counted, nor is the FFT library's internal workspace.  The coarse iterations of 
+mklSetMultiresolution allocate the binned image, PSF, estimate and normal and run at the coarse size, which stays 
+below this.  mklRichardsonLucyROI3D adds its image, PSF, estimate and normal of the extended size (see 
+mklGetROIGeometry) to this at that size, and reports the sum in its statistics.  A plan (mklCreatePlan) holds
+this and its own estimate.
+*/
+extern "C" EXPORT long long mklGetPeakMemory(const int n0, const int n1, const int n2) {
+	const long long imageSize = (long long) n0 * n1 * n2;
+	const long long fftSize = (long long) n0 * n1 * (n2 / 2 + 1);
+	const long long tvBytes = tvRegularization > 0 ? 2 * (long long) n1 * n2 * sizeof(float) : 0;
+
+	return imageSize * sizeof(float) + 2 * fftSize * sizeof(fftwf_complex) + tvBytes;
+}
+
+/*
+Peak bytes mklFista3D allocates: the extrapolated point, the gradient and (without a mask) h^T*x, the FFTs of the 
+estimate and the PSF, and two planes for the TV stencil if lambda is positive.
+*/
+extern "C" EXPORT long long mklGetFistaPeakMemory(const int n0, const int n1, const int n2, bool mask, float lambda) {
+	const long long imageSize = (long long) n0 * n1 * n2;
+	const long long fftSize = (long long) n0 * n1 * (n2 / 2 + 1);
+	const long long tvBytes = lambda > 0 ? 2 * (long long) n1 * n2 * sizeof(float) : 0;
+
+	return (mask ? 2 : 3) * imageSize * sizeof(float) + 2 * fftSize * sizeof(fftwf_complex) + tvBytes;
 }
 
+#ifdef MKLFFTW_MKL
 void testMKLFFT() {
 
 	//float _Complex x[32][100];
@@ -260,3 +1924,4 @@ void testMKLFFT() {
 
 	printf("finishing");
 }
+#endif
@@ -15,8 +15,65 @@
     #pragma warning Unknown dynamic link import/export semantics.
 #endif
 
-#include "fftw/fftw3.h"
-#include "fftw/fftw3_mkl.h"
+// levels for mklEnableStats.  The statistics cover mklConvolve3D, mklRichardsonLucy3D(Half) (one call for coarse to
+// fine), mklRichardsonLucyROI3D (counted once, with its RL), mklWiener3D, mklFista3D, mklCreateState, mklRunState
+// and the plans (mklCreatePlan, mklRichardsonLucyPlan and mklConvolvePlan)
+// no statistics, the default (the calls only test a flag)
+#define STATS_OFF 0
+// counters and the total time of each call
+#define STATS_COUNTERS 1
+// also the time of each phase
+#define STATS_PHASES 2
+
+// indices into the array mklGetStats fills, sums over the calls since mklResetStats (except STATS_PEAK_BYTES, 
+// the largest of any call).  Everything is on the host, so there are no transfers.
+#define STATS_PLAN_SECONDS 0
+#define STATS_OTF_SECONDS 1
+#define STATS_FFT_SECONDS 2
+#define STATS_POINTWISE_SECONDS 3
+#define STATS_TRANSFER_SECONDS 4
+#define STATS_TOTAL_SECONDS 5
+#define STATS_CALLS 6
+#define STATS_ITERATIONS 7
+#define STATS_FFTS 8
+#define STATS_BYTES_TO_DEVICE 9
+#define STATS_BYTES_FROM_DEVICE 10
+#define STATS_PEAK_BYTES 11
+#define STATS_COUNT 12
+
+// levels for mklSetLogLevel, a message is printed if its level is at most the set level (errors go to stderr)
+#define LOG_NONE 0
+// errors only, the default
+#define LOG_ERROR 1
+// a line per call
+#define LOG_INFO 2
+// a line per iteration
+#define LOG_DEBUG 3
+
+// returned by the Richardson Lucy entry points when the run was cancelled, the estimate holds the last finished 
+// iteration
+#define DECONV_CANCELLED -2000
+
+// returned by mklRichardsonLucyROI3D and mklGetROIGeometry for a region outside the image
+#define DECONV_INVALID_VALUE -2001
+
+// called after every Richardson Lucy iteration with the number of finished iterations, returning non zero cancels 
+// the run
+typedef int (*ProgressCallback)(int iteration, int iterations, void * user);
+
+// algorithms of mklCreateState
+#define DECONV_STATE_RL 0
+#define DECONV_STATE_FISTA 1
+
+// a resumable RL or FISTA run, in memory or in a memory mapped file (see mklCreateState)
+typedef struct MKLDeconvState MKLDeconvState;
+
+// the FFT plans and OTF of one size and PSF, for repeated runs (see mklCreatePlan)
+typedef struct MKLDeconvPlan MKLDeconvPlan;
+
+// called by mklRunState every snapshotEvery iterations with the iterations run since the state was created and the
+// estimate (valid during the call), returning non zero stops the run
+typedef int (*SnapshotCallback)(int iterations, const float * estimate, void * user);
 
 extern "C" EXPORT void testMKLFFTW(float * x_, float * y_, int width, int height);
 
@@ -24,6 +81,72 @@ extern "C" EXPORT void mklConvolve(float * x, float *h, float * y, float * X_, f
 
 extern "C" EXPORT void mklConvolve3D(float * x, float *h, float * y, const int n0, const int n1, const int n2, bool conj);
 
-extern "C" EXPORT void mklRichardsonLucy3D(int iterations, float * x, float *h, float*y, const int n0, const int n1, const int n2, float * normal);
+extern "C" EXPORT int mklRichardsonLucy3D(int iterations, float * x, float *h, float*y, const int n0, const int n1, const int n2, float * normal);
+
+extern "C" EXPORT int mklRichardsonLucy3DHalf(int iterations, unsigned short * x, float *h, float*y, const int n0, const int n1, const int n2, unsigned short * normal);
+
+extern "C" EXPORT MKLDeconvPlan * mklCreatePlan(float * h, const int n0, const int n1, const int n2);
+
+extern "C" EXPORT int mklRichardsonLucyPlan(MKLDeconvPlan * plan, int iterations, float * x, float * y, float * normal);
+
+extern "C" EXPORT void mklConvolvePlan(MKLDeconvPlan * plan, float * x, float * y, bool conj);
+
+extern "C" EXPORT void mklFreePlan(MKLDeconvPlan * plan);
+
+extern "C" EXPORT int mklRichardsonLucyROI3D(int iterations, const float * image, const int m0, const int m1, const int m2, const float * psf, const int p0, const int p1, const int p2, const int * roiStart, const int * roiSize, float * out);
+
+extern "C" EXPORT int mklGetROIGeometry(const int m0, const int m1, const int m2, const int p0, const int p1, const int p2, const int * roiStart, const int * roiSize, int * dataStart, int * dataSize, int * extended);
+
+extern "C" EXPORT int mklGetFastSize(int n);
+
+extern "C" EXPORT int mklWiener3D(float * x, float *h, float * y, const int n0, const int n1, const int n2, float regularization);
+
+extern "C" EXPORT int mklFista3D(int iterations, float * x, float *h, float*y, const int n0, const int n1, const int n2, float * mask, float lambda);
+
+extern "C" EXPORT MKLDeconvState * mklCreateState(int algorithm, float * x, float * h, float * y, const int n0, const int n1, const int n2, float * normal, float lambda, const char * path);
+
+extern "C" EXPORT MKLDeconvState * mklOpenState(const char * path);
 
+extern "C" EXPORT int mklRunState(MKLDeconvState * state, int iterations, int snapshotEvery, SnapshotCallback callback, void * user);
+
+extern "C" EXPORT void mklGetStateEstimate(MKLDeconvState * state, float * y);
+
+extern "C" EXPORT int mklGetStateShape(MKLDeconvState * state, int * shape);
+
+extern "C" EXPORT int mklSyncState(MKLDeconvState * state);
+
+extern "C" EXPORT void mklFreeState(MKLDeconvState * state);
+
+extern "C" EXPORT void mklSetWarmStart(float regularization);
+
+extern "C" EXPORT void mklSetTVRegularization(float lambda);
+
+extern "C" EXPORT void mklSetMultiresolution(int factor, int iterations);
+
+extern "C" EXPORT long long mklGetPeakMemory(const int n0, const int n1, const int n2);
+
+extern "C" EXPORT long long mklGetFistaPeakMemory(const int n0, const int n1, const int n2, bool mask, float lambda);
+
+extern "C" EXPORT void mklFloatToHalf(float * in, unsigned short * out, const int n);
+
+extern "C" EXPORT void mklHalfToFloat(unsigned short * in, float * out, const int n);
+
+extern "C" EXPORT void mklEnableStats(int level);
+
+extern "C" EXPORT void mklResetStats();
+
+extern "C" EXPORT int mklGetStats(double * stats, int n);
+
+extern "C" EXPORT void mklSetLogLevel(int level);
+
+extern "C" EXPORT void mklSetProgressCallback(ProgressCallback callback, void * user);
+
+extern "C" EXPORT void mklSetCancelled(int cancelled);
+
+extern "C" EXPORT void mklSetNumThreads(int threads);
+
+extern "C" EXPORT const char * mklGetPointwiseKernels();
+
+#ifdef MKLFFTW_MKL
 void testMKLFFT();
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+// The FFT library the engine is built on, chosen by the MKLFFTW_FFT CMake option: MKL's FFTW interface (the
+// default), FFTW3 itself (MKLFFTW_FFTW3), or the header only pocketfft (MKLFFTW_POCKETFFT) for CPUs and
+// platforms without MKL.  All three are used through the FFTW single precision API.
+
+#if defined(MKLFFTW_POCKETFFT)
+#include "pocketfftw.h"
+#elif defined(MKLFFTW_FFTW3)
+#include <fftw3.h>
+#else
+#define MKLFFTW_MKL
+#include "mkl.h"
+#include "fftw/fftw3.h"
+#include "fftw/fftw3_mkl.h"
+#endif
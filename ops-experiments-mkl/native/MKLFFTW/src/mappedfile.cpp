@@ -0,0 +1,123 @@
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool mapFile(const char * path, long long bytes, bool create, MappedFile * mapped) {
+	mapped->data = NULL;
+	mapped->mapping = NULL;
+
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, 
+			FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+
+	if (create) {
+		size.QuadPart = bytes;
+	}
+	else if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = size.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL) : NULL;
+	void * data = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : NULL;
+
+	if (data == NULL) {
+		if (mapping != NULL) CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	mapped->data = data;
+	mapped->bytes = size.QuadPart;
+	mapped->file = file;
+	mapped->mapping = mapping;
+
+	return true;
+}
+
+bool syncMappedFile(MappedFile * mapped) {
+	return FlushViewOfFile(mapped->data, 0) && FlushFileBuffers((HANDLE) mapped->file);
+}
+
+void unmapFile(MappedFile * mapped) {
+	if (mapped->data == NULL) {
+		return;
+	}
+
+	UnmapViewOfFile(mapped->data);
+	CloseHandle((HANDLE) mapped->mapping);
+	CloseHandle((HANDLE) mapped->file);
+	mapped->data = NULL;
+}
+
+#else
+
+bool mapFile(const char * path, long long bytes, bool create, MappedFile * mapped) {
+	mapped->data = NULL;
+
+	int fd = open(path, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	if (create) {
+		if (ftruncate(fd, (off_t) bytes) != 0) {
+			close(fd);
+			return false;
+		}
+	}
+	else {
+		struct stat st;
+
+		if (fstat(fd, &st) != 0) {
+			close(fd);
+			return false;
+		}
+
+		bytes = st.st_size;
+	}
+
+	void * data = bytes > 0 ? mmap(NULL, (size_t) bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+	if (data == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+
+	mapped->data = data;
+	mapped->bytes = bytes;
+	mapped->fd = fd;
+
+	return true;
+}
+
+bool syncMappedFile(MappedFile * mapped) {
+	return msync(mapped->data, (size_t) mapped->bytes, MS_SYNC) == 0;
+}
+
+void unmapFile(MappedFile * mapped) {
+	if (mapped->data == NULL) {
+		return;
+	}
+
+	munmap(mapped->data, (size_t) mapped->bytes);
+	close(mapped->fd);
+	mapped->data = NULL;
+}
+
+#endif
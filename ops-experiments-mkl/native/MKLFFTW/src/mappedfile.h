@@ -0,0 +1,26 @@
+#pragma once
+
+// A file mapped into memory read and write (mmap, MapViewOfFile on Windows), for the deconvolution states 
+// (mklCreateState) that have to outlive the process.  Changes reach the file when the pages are written back, 
+// syncMappedFile forces that.
+
+struct MappedFile {
+	void * data;
+	long long bytes;
+#ifdef _WIN32
+	void * file;
+	void * mapping;
+#else
+	int fd;
+#endif
+};
+
+// maps path into mapped, creating (or truncating) it with bytes if create, else the whole existing file.  Returns 
+// false if the file can't be opened, sized or mapped.
+bool mapFile(const char * path, long long bytes, bool create, MappedFile * mapped);
+
+// writes the changed pages back to the file, returns false on failure
+bool syncMappedFile(MappedFile * mapped);
+
+// unmaps and closes (without a sync, the system writes the pages back in its own time)
+void unmapFile(MappedFile * mapped);
@@ -0,0 +1,106 @@
+#pragma once
+
+// The FFTW calls the engine makes (3D and 2D real to complex and back, execute, destroy, threads) on the header
+// only pocketfft (pocketfft_hdronly.h, https://gitlab.mpcdf.mpg.de/mtr/pocketfft, cpp branch), for builds
+// without MKL or FFTW (MKLFFTW_FFT=POCKETFFT).  Like FFTW the transforms are unnormalized and the complex
+// arrays are n0 x n1 x (n2/2+1) interleaved re, im.  Plans only keep the sizes and arrays, pocketfft caches
+// its twiddle factors itself.
+
+#include <algorithm>
+#include <complex>
+#include <thread>
+
+#include "pocketfft_hdronly.h"
+
+typedef float fftwf_complex[2];
+
+#define FFTW_ESTIMATE (1U << 6)
+
+struct pocketfftw_plan {
+	pocketfft::shape_t shape;
+	bool forward;
+	float * real;
+	fftwf_complex * complex;
+	size_t threads;
+};
+
+typedef pocketfftw_plan * fftwf_plan;
+
+// threads of the plans made after the call, 0 (the default) is one per core
+inline size_t & pocketfftwThreads() {
+	static size_t threads = 0;
+	return threads;
+}
+
+inline int fftwf_init_threads() {
+	return 1;
+}
+
+inline void fftwf_plan_with_nthreads(int threads) {
+	pocketfftwThreads() = threads > 0 ? (size_t)threads : 0;
+}
+
+inline fftwf_plan pocketfftwPlan(const pocketfft::shape_t & shape, bool forward, float * real, fftwf_complex * complex) {
+	size_t threads = pocketfftwThreads();
+
+	fftwf_plan plan = new pocketfftw_plan;
+	plan->shape = shape;
+	plan->forward = forward;
+	plan->real = real;
+	plan->complex = complex;
+	plan->threads = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+
+	return plan;
+}
+
+inline fftwf_plan fftwf_plan_dft_r2c_3d(int n0, int n1, int n2, float * in, fftwf_complex * out, unsigned flags) {
+	return pocketfftwPlan({(size_t)n0, (size_t)n1, (size_t)n2}, true, in, out);
+}
+
+inline fftwf_plan fftwf_plan_dft_c2r_3d(int n0, int n1, int n2, fftwf_complex * in, float * out, unsigned flags) {
+	return pocketfftwPlan({(size_t)n0, (size_t)n1, (size_t)n2}, false, out, in);
+}
+
+inline fftwf_plan fftwf_plan_dft_r2c_2d(int n0, int n1, float * in, fftwf_complex * out, unsigned flags) {
+	return pocketfftwPlan({(size_t)n0, (size_t)n1}, true, in, out);
+}
+
+inline fftwf_plan fftwf_plan_dft_c2r_2d(int n0, int n1, fftwf_complex * in, float * out, unsigned flags) {
+	return pocketfftwPlan({(size_t)n0, (size_t)n1}, false, out, in);
+}
+
+inline void fftwf_execute(const fftwf_plan plan) {
+	const pocketfft::shape_t & shape = plan->shape;
+	const size_t rank = shape.size();
+
+	// C order byte strides of the real array and of the half complex one
+	pocketfft::shape_t complexShape(shape);
+	complexShape[rank - 1] = shape[rank - 1] / 2 + 1;
+
+	pocketfft::stride_t realStride(rank), complexStride(rank);
+	realStride[rank - 1] = sizeof(float);
+	complexStride[rank - 1] = sizeof(std::complex<float>);
+
+	for (size_t d = rank - 1; d > 0; d--) {
+		realStride[d - 1] = realStride[d] * shape[d];
+		complexStride[d - 1] = complexStride[d] * complexShape[d];
+	}
+
+	pocketfft::shape_t axes(rank);
+	for (size_t d = 0; d < rank; d++) {
+		axes[d] = d;
+	}
+
+	std::complex<float> * complex = reinterpret_cast<std::complex<float> *>(plan->complex);
+
+	if (plan->forward) {
+		pocketfft::r2c(shape, realStride, complexStride, axes, pocketfft::FORWARD, plan->real, complex, 1.f, plan->threads);
+	}
+	else {
+		pocketfft::c2r(shape, complexStride, realStride, axes, pocketfft::BACKWARD, complex, plan->real, 1.f, plan->threads);
+	}
+}
+
+inline void fftwf_destroy_plan(fftwf_plan plan) {
+	delete plan;
+}
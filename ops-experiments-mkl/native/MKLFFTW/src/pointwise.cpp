@@ -0,0 +1,405 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "pointwise.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_DISPATCH
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON
+#endif
+
+// complex values per block, the blocks of a, b and out of a thread stay in its L2
+static const long long BLOCK = 8192;
+
+static std::atomic<int> pointwiseThreads(0);
+
+typedef void (*ComplexKernel)(const float *, const float *, float *, long long, float);
+typedef void (*RealKernel)(const float *, const float *, float *, long long);
+
+// plain C++, also the tails of the SIMD kernels
+
+static void complexMultiplyScalar(const float * a, const float * b, float * out, long long n, float scale) {
+	for (long long i = 0; i < n; i++) {
+		float re = a[2*i] * b[2*i] - a[2*i + 1] * b[2*i + 1];
+		float im = a[2*i] * b[2*i + 1] + a[2*i + 1] * b[2*i];
+		out[2*i] = re * scale;
+		out[2*i + 1] = im * scale;
+	}
+}
+
+static void complexMultiplyConjugateScalar(const float * a, const float * b, float * out, long long n, float scale) {
+	for (long long i = 0; i < n; i++) {
+		float re = a[2*i] * b[2*i] + a[2*i + 1] * b[2*i + 1];
+		float im = a[2*i + 1] * b[2*i] - a[2*i] * b[2*i + 1];
+		out[2*i] = re * scale;
+		out[2*i + 1] = im * scale;
+	}
+}
+
+static void multiplyScalar(const float * a, const float * b, float * out, long long n) {
+	for (long long i = 0; i < n; i++) {
+		out[i] = a[i] * b[i];
+	}
+}
+
+#ifdef HAVE_X86_DISPATCH
+
+// For interleaved complex a and b: the real parts of b duplicated (moveldup) times a, plus or minus the
+// imaginary parts of b duplicated (movehdup) times a with re and im swapped, fmaddsub subtracts in the real
+// and adds in the imaginary lanes (a*b), fmsubadd the other way round (a*conj(b)).  Only called if the CPU
+// reports the instructions, so the library still loads on older CPUs.
+
+__attribute__((target("avx2,fma"))) static void complexMultiplyAVX2(const float * a, const float * b, float * out, long long n, float scale) {
+	const __m256 s = _mm256_set1_ps(scale);
+	long long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256 va = _mm256_loadu_ps(a + 2*i);
+		__m256 vb = _mm256_loadu_ps(b + 2*i);
+		__m256 cross = _mm256_mul_ps(_mm256_permute_ps(va, 0xB1), _mm256_movehdup_ps(vb));
+		__m256 product = _mm256_fmaddsub_ps(va, _mm256_moveldup_ps(vb), cross);
+		_mm256_storeu_ps(out + 2*i, _mm256_mul_ps(product, s));
+	}
+	complexMultiplyScalar(a + 2*i, b + 2*i, out + 2*i, n - i, scale);
+}
+
+__attribute__((target("avx2,fma"))) static void complexMultiplyConjugateAVX2(const float * a, const float * b, float * out, long long n, float scale) {
+	const __m256 s = _mm256_set1_ps(scale);
+	long long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		__m256 va = _mm256_loadu_ps(a + 2*i);
+		__m256 vb = _mm256_loadu_ps(b + 2*i);
+		__m256 cross = _mm256_mul_ps(_mm256_permute_ps(va, 0xB1), _mm256_movehdup_ps(vb));
+		__m256 product = _mm256_fmsubadd_ps(va, _mm256_moveldup_ps(vb), cross);
+		_mm256_storeu_ps(out + 2*i, _mm256_mul_ps(product, s));
+	}
+	complexMultiplyConjugateScalar(a + 2*i, b + 2*i, out + 2*i, n - i, scale);
+}
+
+__attribute__((target("avx2,fma"))) static void multiplyAVX2(const float * a, const float * b, float * out, long long n) {
+	long long i = 0;
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+	}
+	multiplyScalar(a + i, b + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void complexMultiplyAVX512(const float * a, const float * b, float * out, long long n, float scale) {
+	const __m512 s = _mm512_set1_ps(scale);
+	long long i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m512 va = _mm512_loadu_ps(a + 2*i);
+		__m512 vb = _mm512_loadu_ps(b + 2*i);
+		__m512 cross = _mm512_mul_ps(_mm512_permute_ps(va, 0xB1), _mm512_movehdup_ps(vb));
+		__m512 product = _mm512_fmaddsub_ps(va, _mm512_moveldup_ps(vb), cross);
+		_mm512_storeu_ps(out + 2*i, _mm512_mul_ps(product, s));
+	}
+	complexMultiplyScalar(a + 2*i, b + 2*i, out + 2*i, n - i, scale);
+}
+
+__attribute__((target("avx512f"))) static void complexMultiplyConjugateAVX512(const float * a, const float * b, float * out, long long n, float scale) {
+	const __m512 s = _mm512_set1_ps(scale);
+	long long i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m512 va = _mm512_loadu_ps(a + 2*i);
+		__m512 vb = _mm512_loadu_ps(b + 2*i);
+		__m512 cross = _mm512_mul_ps(_mm512_permute_ps(va, 0xB1), _mm512_movehdup_ps(vb));
+		__m512 product = _mm512_fmsubadd_ps(va, _mm512_moveldup_ps(vb), cross);
+		_mm512_storeu_ps(out + 2*i, _mm512_mul_ps(product, s));
+	}
+	complexMultiplyConjugateScalar(a + 2*i, b + 2*i, out + 2*i, n - i, scale);
+}
+
+__attribute__((target("avx512f"))) static void multiplyAVX512(const float * a, const float * b, float * out, long long n) {
+	long long i = 0;
+	for (; i + 16 <= n; i += 16) {
+		_mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+	}
+	multiplyScalar(a + i, b + i, out + i, n - i);
+}
+
+#endif
+
+#ifdef HAVE_NEON
+
+// NEON is part of every AArch64 CPU, vld2q splits 4 complex values into their real and imaginary parts
+
+static void complexMultiplyNEON(const float * a, const float * b, float * out, long long n, float scale) {
+	long long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4x2_t va = vld2q_f32(a + 2*i);
+		float32x4x2_t vb = vld2q_f32(b + 2*i);
+		float32x4x2_t product;
+		product.val[0] = vmulq_n_f32(vfmsq_f32(vmulq_f32(va.val[0], vb.val[0]), va.val[1], vb.val[1]), scale);
+		product.val[1] = vmulq_n_f32(vfmaq_f32(vmulq_f32(va.val[0], vb.val[1]), va.val[1], vb.val[0]), scale);
+		vst2q_f32(out + 2*i, product);
+	}
+	complexMultiplyScalar(a + 2*i, b + 2*i, out + 2*i, n - i, scale);
+}
+
+static void complexMultiplyConjugateNEON(const float * a, const float * b, float * out, long long n, float scale) {
+	long long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		float32x4x2_t va = vld2q_f32(a + 2*i);
+		float32x4x2_t vb = vld2q_f32(b + 2*i);
+		float32x4x2_t product;
+		product.val[0] = vmulq_n_f32(vfmaq_f32(vmulq_f32(va.val[0], vb.val[0]), va.val[1], vb.val[1]), scale);
+		product.val[1] = vmulq_n_f32(vfmsq_f32(vmulq_f32(va.val[1], vb.val[0]), va.val[0], vb.val[1]), scale);
+		vst2q_f32(out + 2*i, product);
+	}
+	complexMultiplyConjugateScalar(a + 2*i, b + 2*i, out + 2*i, n - i, scale);
+}
+
+static void multiplyNEON(const float * a, const float * b, float * out, long long n) {
+	long long i = 0;
+	for (; i + 4 <= n; i += 4) {
+		vst1q_f32(out + i, vmulq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+	}
+	multiplyScalar(a + i, b + i, out + i, n - i);
+}
+
+#endif
+
+struct Kernels {
+	const char * name;
+	ComplexKernel complexMultiply;
+	ComplexKernel complexMultiplyConjugate;
+	RealKernel multiply;
+};
+
+static Kernels selectKernels() {
+	const char * limit = getenv("MKLFFTW_SIMD");
+	bool scalarOnly = limit != NULL && strcmp(limit, "scalar") == 0;
+
+	Kernels scalar = {"scalar", &complexMultiplyScalar, &complexMultiplyConjugateScalar, &multiplyScalar};
+
+	if (scalarOnly) {
+		return scalar;
+	}
+
+#ifdef HAVE_X86_DISPATCH
+	bool avx2Only = limit != NULL && strcmp(limit, "avx2") == 0;
+
+	if (!avx2Only && __builtin_cpu_supports("avx512f")) {
+		Kernels avx512 = {"avx512", &complexMultiplyAVX512, &complexMultiplyConjugateAVX512, &multiplyAVX512};
+		return avx512;
+	}
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		Kernels avx2 = {"avx2", &complexMultiplyAVX2, &complexMultiplyConjugateAVX2, &multiplyAVX2};
+		return avx2;
+	}
+#endif
+
+#ifdef HAVE_NEON
+	Kernels neon = {"neon", &complexMultiplyNEON, &complexMultiplyConjugateNEON, &multiplyNEON};
+	return neon;
+#endif
+
+	return scalar;
+}
+
+static const Kernels & kernels() {
+	static const Kernels selected = selectKernels();
+	return selected;
+}
+
+#ifdef _OPENMP
+static int threadCount() {
+	int threads = pointwiseThreads;
+	return threads > 0 ? threads : omp_get_max_threads();
+}
+#endif
+
+// n complex values in blocks, the blocks spread over the threads
+static void runComplex(ComplexKernel kernel, const float * a, const float * b, float * out, long long n, float scale) {
+	const long long blocks = (n + BLOCK - 1) / BLOCK;
+
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(blocks > 1)
+	for (long long block = 0; block < blocks; block++) {
+		long long start = block * BLOCK;
+		kernel(a + 2*start, b + 2*start, out + 2*start, std::min(BLOCK, n - start), scale);
+	}
+}
+
+void complexMultiply(const float * a, const float * b, float * out, long long n, float scale) {
+	runComplex(kernels().complexMultiply, a, b, out, n, scale);
+}
+
+void complexMultiplyConjugate(const float * a, const float * b, float * out, long long n, float scale) {
+	runComplex(kernels().complexMultiplyConjugate, a, b, out, n, scale);
+}
+
+void multiply(const float * a, const float * b, float * out, long long n) {
+	// blocks of the same number of bytes as the complex ones
+	const long long blocks = (n + 2*BLOCK - 1) / (2*BLOCK);
+	RealKernel kernel = kernels().multiply;
+
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(blocks > 1)
+	for (long long block = 0; block < blocks; block++) {
+		long long start = block * 2*BLOCK;
+		kernel(a + start, b + start, out + start, std::min(2*BLOCK, n - start));
+	}
+}
+
+void wienerMultiply(const float * a, const float * otf, float * out, long long n, float regularization, float scale) {
+	const float dc = regularization * (otf[0] * otf[0] + otf[1] * otf[1]);
+
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(n > BLOCK)
+	for (long long i = 0; i < n; i++) {
+		float re = a[2*i] * otf[2*i] + a[2*i + 1] * otf[2*i + 1];
+		float im = a[2*i + 1] * otf[2*i] - a[2*i] * otf[2*i + 1];
+		float factor = scale / (otf[2*i] * otf[2*i] + otf[2*i + 1] * otf[2*i + 1] + dc);
+		out[2*i] = re * factor;
+		out[2*i + 1] = im * factor;
+	}
+}
+
+void clampMin(float * a, long long n, float lowest) {
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(n > 2*BLOCK)
+	for (long long i = 0; i < n; i++) {
+		a[i] = std::max(a[i], lowest);
+	}
+}
+
+// denominator of tvMultiply at least this, |div| <= 6 so it only matters for lambda above 1/6
+static const float TV_MIN_DENOMINATOR = 0.01f;
+
+// component of the normalized gradient, 0 where the gradient is 0
+static inline float normalized(float g, float gx, float gy, float gz) {
+	float magnitude = sqrtf(gx * gx + gy * gy + gz * gz);
+	return magnitude > 0 ? g / magnitude : 0.f;
+}
+
+// div(grad v/|grad v|) at voxel (i, j) of plane current, below and next are the planes z-1 and z+1 (NULL at 
+// the borders): the normalized forward difference gradient at the voxel minus the components of the neighbors' 
+// normalized gradients along the axis to them
+static inline float divergence(const float * current, const float * below, const float * next, int i, int j, int n1, int n2) {
+	const long long k = (long long)j * n2 + i;
+	const float v = current[k];
+
+	float gx = i + 1 < n2 ? current[k + 1] - v : 0.f;
+	float gy = j + 1 < n1 ? current[k + n2] - v : 0.f;
+	float gz = next != NULL ? next[k] - v : 0.f;
+
+	float div = normalized(gx, gx, gy, gz) + normalized(gy, gx, gy, gz) + normalized(gz, gx, gy, gz);
+
+	if (i > 0) {
+		const float w = current[k - 1];
+		float wx = v - w;
+		float wy = j + 1 < n1 ? current[k - 1 + n2] - w : 0.f;
+		float wz = next != NULL ? next[k - 1] - w : 0.f;
+		div -= normalized(wx, wx, wy, wz);
+	}
+
+	if (j > 0) {
+		const float w = current[k - n2];
+		float wx = i + 1 < n2 ? current[k - n2 + 1] - w : 0.f;
+		float wy = v - w;
+		float wz = next != NULL ? next[k - n2] - w : 0.f;
+		div -= normalized(wy, wx, wy, wz);
+	}
+
+	if (below != NULL) {
+		const float w = below[k];
+		float wx = i + 1 < n2 ? below[k + 1] - w : 0.f;
+		float wy = j + 1 < n1 ? below[k + n2] - w : 0.f;
+		float wz = v - w;
+		div -= normalized(wz, wx, wy, wz);
+	}
+
+	return div;
+}
+
+void tvMultiply(float * y, const float * update, int n0, int n1, int n2, float lambda, float * scratch) {
+	const long long plane = (long long)n1 * n2;
+
+	// old values of planes z-1 and z
+	float * previous = scratch;
+	float * current = scratch + plane;
+
+	for (int z = 0; z < n0; z++) {
+		float * out = y + z * plane;
+		const float * next = z + 1 < n0 ? out + plane : NULL;
+		const float * below = z > 0 ? previous : NULL;
+
+		memcpy(current, out, plane * sizeof(float));
+
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(plane > 2*BLOCK)
+		for (int j = 0; j < n1; j++) {
+			for (int i = 0; i < n2; i++) {
+				const long long k = (long long)j * n2 + i;
+				const float div = divergence(current, below, next, i, j, n1, n2);
+
+				out[k] = current[k] * update[z * plane + k] / std::max(1.f - lambda * div, TV_MIN_DENOMINATOR);
+			}
+		}
+
+		std::swap(previous, current);
+	}
+}
+
+// the FISTA step at one voxel, g the gradient of the data term
+static inline void fistaVoxel(float * y, float * z, long long k, float zOld, float g, float step, float beta) {
+	const float u = std::max(zOld - step * g, 0.f);
+	z[k] = u + beta * (u - y[k]);
+	y[k] = u;
+}
+
+void fistaStep(float * y, float * z, const float * gradient, const float * offset, int n0, int n1, int n2, 
+		float step, float beta, float lambda, float * scratch) {
+	const long long n = (long long)n0 * n1 * n2;
+
+	if (!(lambda > 0)) {
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(n > 2*BLOCK)
+		for (long long k = 0; k < n; k++) {
+			const float g = offset != NULL ? gradient[k] - offset[k] : gradient[k];
+			fistaVoxel(y, z, k, z[k], g, step, beta);
+		}
+		return;
+	}
+
+	// as tvMultiply, z is streamed in planes and the old planes z-1 and z are kept for the stencil
+	const long long plane = (long long)n1 * n2;
+
+	float * previous = scratch;
+	float * current = scratch + plane;
+
+	for (int p = 0; p < n0; p++) {
+		float * zPlane = z + p * plane;
+		const float * next = p + 1 < n0 ? zPlane + plane : NULL;
+		const float * below = p > 0 ? previous : NULL;
+
+		memcpy(current, zPlane, plane * sizeof(float));
+
+#pragma omp parallel for schedule(static) num_threads(threadCount()) if(plane > 2*BLOCK)
+		for (int j = 0; j < n1; j++) {
+			for (int i = 0; i < n2; i++) {
+				const long long k = p * plane + (long long)j * n2 + i;
+				const float div = divergence(current, below, next, i, j, n1, n2);
+				const float g = (offset != NULL ? gradient[k] - offset[k] : gradient[k]) - lambda * div;
+
+				fistaVoxel(y, z, k, current[k - p * plane], g, step, beta);
+			}
+		}
+
+		std::swap(previous, current);
+	}
+}
+
+void setPointwiseThreads(int threads) {
+	pointwiseThreads = threads;
+}
+
+const char * pointwiseKernels() {
+	return kernels().name;
+}
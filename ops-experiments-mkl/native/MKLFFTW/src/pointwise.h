@@ -0,0 +1,40 @@
+#pragma once
+
+// Pointwise kernels of the engine, in place of MKL's vcMul, vcMulByConj, vsMul and cblas_sscal so the engine
+// also builds on FFTW3 or pocketfft for non Intel CPUs.  The instruction set (AVX-512, AVX2 with FMA, NEON or
+// plain C++) is chosen once at run time from what the CPU reports, the MKLFFTW_SIMD environment variable
+// (avx512, avx2, scalar) limits it, for comparisons.  Blocks are spread over OpenMP threads when built with it.
+
+// out = a*b*scale, n interleaved complex values (the FFTW layout), out may be a or b
+void complexMultiply(const float * a, const float * b, float * out, long long n, float scale);
+
+// out = a*conj(b)*scale
+void complexMultiplyConjugate(const float * a, const float * b, float * out, long long n, float scale);
+
+// out = a*b, n floats
+void multiply(const float * a, const float * b, float * out, long long n);
+
+// out = a*conj(otf)/(|otf|^2 + regularization*|otf[0]|^2)*scale, the Wiener filter, once per call so plain C++
+void wienerMultiply(const float * a, const float * otf, float * out, long long n, float regularization, float scale);
+
+// a = max(a, lowest), n floats
+void clampMin(float * a, long long n, float lowest);
+
+// y = y*update/(1 - lambda*div(grad y/|grad y|)), the RL update with the total variation term of Dey et al. 2006, 
+// for y of n0 x n1 x n2 (n2 fastest).  One pass over y in z planes with forward differences and zero gradient at
+// the borders: the stencil reads the old planes z-1, z and z+1, so plane z is saved before it is overwritten and 
+// the working set is three planes.  scratch holds two planes.
+void tvMultiply(float * y, const float * update, int n0, int n1, int n2, float lambda, float * scratch);
+
+// One FISTA step (Beck and Teboulle 2009) of min |h*u - x|^2/2 + lambda*TV(u) with u >= 0, for y (the iterate) 
+// and z (the extrapolated point) of n0 x n1 x n2: u = max(z - step*(gradient - offset - lambda*div(grad z/|grad z|)), 0), 
+// then z = u + beta*(u - y) and y = u, in one pass.  offset may be NULL.  With lambda > 0 z is streamed in planes as 
+// in tvMultiply and scratch holds two planes, otherwise scratch isn't used.
+void fistaStep(float * y, float * z, const float * gradient, const float * offset, int n0, int n1, int n2, 
+		float step, float beta, float lambda, float * scratch);
+
+// threads of the kernels, 0 for the OpenMP default
+void setPointwiseThreads(int threads);
+
+// name of the kernels in use, "avx512", "avx2", "neon" or "scalar"
+const char * pointwiseKernels();
@@ -2,6 +2,7 @@ package net.imagej.ops.experiments.filter.deconvolve;
 
 import org.bytedeco.javacpp.FloatPointer;
 import org.bytedeco.javacpp.Loader;
+import org.bytedeco.javacpp.Pointer;
 import org.bytedeco.javacpp.annotation.Cast;
 import org.bytedeco.javacpp.annotation.Platform;
 import org.bytedeco.javacpp.annotation.Properties;
@@ -26,7 +27,73 @@ public class MKLRichardsonLucyWrapper {
 		Loader.load();
 	}
 
-	public static native void mklRichardsonLucy3D(int iterations, FloatPointer x, FloatPointer h, FloatPointer y, int n0, int n1, int n2, FloatPointer normal);
+	public static native int mklRichardsonLucy3D(int iterations, FloatPointer x, FloatPointer h, FloatPointer y, int n0, int n1, int n2, FloatPointer normal);
+
+	public static native long mklGetPeakMemory(int n0, int n1, int n2);
+
+	// RL of the roiSize region at roiStart (n0, n1, n2 order) of the m0 x m1 x m2 image, into out (roiSize), the
+	// centered p0 x p1 x p2 psf.  Only the region grown by half the psf is deconvolved, non-circulant in a fast
+	// size (mklGetROIGeometry), so it costs a fraction of the whole image
+	public static native int mklRichardsonLucyROI3D(int iterations, FloatPointer image, int m0, int m1, int m2, FloatPointer psf, int p0, int p1, int p2, int[] roiStart, int[] roiSize, FloatPointer out);
+
+	public static native int mklGetROIGeometry(int m0, int m1, int m2, int p0, int p1, int p2, int[] roiStart, int[] roiSize, int[] dataStart, int[] dataSize, int[] extended);
+
+	// smallest size >= n without prime factors above 7
+	public static native int mklGetFastSize(int n);
+
+	// one pass Wiener preview, the regularization is relative to the OTF at 0 (around 1e-3 to 1e-2)
+	public static native int mklWiener3D(FloatPointer x, FloatPointer h, FloatPointer y, int n0, int n1, int n2, float regularization);
+
+	// Wiener first guess of mklRichardsonLucy3D, 0 (the default) starts from the estimate passed in
+	public static native void mklSetWarmStart(float regularization);
+
+	// weight of the total variation term of mklRichardsonLucy3D (RL-TV), 0 (the default) for plain RL
+	public static native void mklSetTVRegularization(float lambda);
+
+	// coarse to fine RL, the first iterations of mklRichardsonLucy3D run binned by factor (2 or 4, 1 off)
+	public static native void mklSetMultiresolution(int factor, int iterations);
+
+	// FISTA on the same plans and kernels, least squares with y >= 0, the mask (1 where observed, may be null)
+	// fits only the observed region, lambda (0 for none) weights a TV term in units of the image
+	public static native int mklFista3D(int iterations, FloatPointer x, FloatPointer h, FloatPointer y, int n0, int n1, int n2, FloatPointer mask, float lambda);
+
+	public static native long mklGetFistaPeakMemory(int n0, int n1, int n2, boolean mask, float lambda);
+
+	// resumable RL (algorithm 0) or FISTA (1) runs, the state copies x, h, y and the normal (or mask) and keeps
+	// them in memory or, with a path, in a memory mapped file mklOpenState continues in a later process.
+	// mklRunState continues the run, snapshots every snapshotEvery iterations (callback may be null), and
+	// returns DECONV_CANCELLED when cancelled or stopped by the callback
+	public static native Pointer mklCreateState(int algorithm, FloatPointer x, FloatPointer h, FloatPointer y, int n0, int n1, int n2, FloatPointer normal, float lambda, String path);
+
+	public static native Pointer mklOpenState(String path);
+
+	public static native int mklRunState(Pointer state, int iterations, int snapshotEvery, Pointer callback, Pointer user);
+
+	public static native void mklGetStateEstimate(Pointer state, FloatPointer y);
+
+	// shape into n0, n1, n2, returns the iterations run so far
+	public static native int mklGetStateShape(Pointer state, int[] shape);
+
+	public static native int mklSyncState(Pointer state);
+
+	public static native void mklFreeState(Pointer state);
+
+	// engine statistics, levels and indices are the STATS_ defines of the native header
+	// (0 off, 1 counters, 2 per phase times), getStats returns the number of values copied
+	public static native void mklEnableStats(int level);
+
+	public static native void mklResetStats();
+
+	public static native int mklGetStats(double[] stats, int n);
+
+	// log level (0 none, 1 errors, the default, 2 info, 3 debug) and cancellation, a cancelled run returns
+	// DECONV_CANCELLED (-2000) after its current iteration, until set back to 0
+	public static native void mklSetLogLevel(int level);
+
+	public static native void mklSetCancelled(int cancelled);
+
+	// threads of the FFTs and the pointwise kernels, 0 for all cores
+	public static native void mklSetNumThreads(int threads);
 
 	public static void load() {
 		Loader.load();
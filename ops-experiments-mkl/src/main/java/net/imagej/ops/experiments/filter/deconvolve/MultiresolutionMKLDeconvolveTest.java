@@ -0,0 +1,97 @@
+
+package net.imagej.ops.experiments.filter.deconvolve;
+
+import java.io.IOException;
+
+import net.imagej.ImageJ;
+import net.imagej.ops.experiments.testImages.Bars;
+import net.imagej.ops.experiments.testImages.CElegans;
+import net.imagej.ops.experiments.testImages.DeconvolutionTestData;
+import net.imagej.ops.special.computer.Computers;
+import net.imagej.ops.special.computer.UnaryComputerOp;
+import net.imglib2.Cursor;
+import net.imglib2.RandomAccessibleInterval;
+import net.imglib2.img.Img;
+import net.imglib2.type.NativeType;
+import net.imglib2.type.numeric.RealType;
+import net.imglib2.type.numeric.real.FloatType;
+import net.imglib2.view.Views;
+
+/**
+ * Wall time and result of coarse to fine RL (mklSetMultiresolution) compared to
+ * RL at full resolution for the same number of iterations, on the Bars and
+ * CElegans test data
+ */
+public class MultiresolutionMKLDeconvolveTest<T extends RealType<T> & NativeType<T>> {
+
+	final static ImageJ ij = new ImageJ();
+
+	final static int iterations = 100;
+
+	// {factor, coarse iterations}, {1, 0} is full resolution
+	final static int[][] modes = { { 1, 0 }, { 2, 50 }, { 2, 80 }, { 4, 50 } };
+
+	public static <T extends RealType<T> & NativeType<T>> void main(
+		final String[] args) throws IOException
+	{
+		MKLRichardsonLucyWrapper.load();
+
+		run("Bars", new Bars("../images/"));
+		run("CElegans", new CElegans("../images/"));
+
+		MKLRichardsonLucyWrapper.mklSetMultiresolution(1, 0);
+	}
+
+	static void run(final String name, final DeconvolutionTestData testData)
+		throws IOException
+	{
+		testData.LoadImages(ij);
+		RandomAccessibleInterval<FloatType> imgF = testData.getImg();
+		RandomAccessibleInterval<FloatType> psfF = testData.getPSF();
+
+		@SuppressWarnings("unchecked")
+		final UnaryComputerOp<RandomAccessibleInterval<FloatType>, RandomAccessibleInterval<FloatType>> deconvolver =
+			(UnaryComputerOp) Computers.unary(ij.op(), UnaryComputerMKLDecon.class,
+				RandomAccessibleInterval.class, imgF, psfF, iterations);
+
+		Img<FloatType> reference = null;
+
+		for (int[] mode : modes) {
+			MKLRichardsonLucyWrapper.mklSetMultiresolution(mode[0], mode[1]);
+
+			Img<FloatType> deconvolved = ij.op().create().img(imgF);
+
+			long startTime = System.currentTimeMillis();
+			deconvolver.compute(imgF, deconvolved);
+			long endTime = System.currentTimeMillis();
+
+			if (reference == null) {
+				reference = deconvolved;
+			}
+
+			System.out.println(name + " factor " + mode[0] + ", " + mode[1] +
+				" of " + iterations + " iterations coarse: " + (endTime - startTime) +
+				" ms, relative difference to full resolution " + relativeDifference(
+					reference, deconvolved));
+		}
+	}
+
+	// sum |a - b| / sum |a|
+	static double relativeDifference(Img<FloatType> a, Img<FloatType> b) {
+		Cursor<FloatType> ca = a.cursor();
+		Cursor<FloatType> cb = Views.flatIterable(b).cursor();
+
+		double diff = 0, sum = 0;
+
+		while (ca.hasNext()) {
+			float va = ca.next().get();
+			float vb = cb.next().get();
+
+			diff += Math.abs(va - vb);
+			sum += Math.abs(va);
+		}
+
+		return sum > 0 ? diff / sum : 0;
+	}
+
+}
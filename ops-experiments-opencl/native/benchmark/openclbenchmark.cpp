@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "CL/cl.h"
+#include "clFFT.h"
+#include "opencldeconv.h"
+#include "opencldeconvcore.h"
+
+// License: BSD
+
+// Google Benchmark suite of the OpenCL engine on one device: clFFT forward and inverse with the deconvolution plans,
+// conv_long (including its program build and plans, as callers pay them) and RL iterations of deconvCore with a
+// cached program and plans.  Buffers stay on the device, so the numbers exclude host transfers.  Run with 
+//   openclbenchmark --benchmark_format=json --benchmark_out=opencl.json
+// OPS_OPENCL_PLATFORM and OPS_OPENCL_DEVICE select the device (default 0, 0).  On POCL the thread count is 
+// POCL_MAX_PTHREAD_COUNT, read when the platform loads, so thread sweeps are separate runs (see benchmark.sh in 
+// the repository root).  The device name and thread count are in the context of the output.
+
+// RL iterations per benchmark iteration
+#define RL_ITERATIONS 10
+
+// {nx, ny, nz}, powers of two and sizes with a large prime factor (clFFT needs 2, 3, 5, 7 factors for its fast 
+// kernels, other sizes fail or fall back, which is what the suite should catch)
+static const int64_t sizes[][3] = {
+  {128, 128, 64}, {256, 256, 64}, {512, 512, 64},
+  {127, 127, 61}, {251, 251, 61}, {509, 509, 61}
+};
+
+static void allSizes(benchmark::internal::Benchmark * b) {
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    b->Args({sizes[s][0], sizes[s][1], sizes[s][2]});
+  }
+
+  b->ArgNames({"nx", "ny", "nz"});
+}
+
+// the device, created once in main
+static cl_device_id deviceID;
+static cl_context context;
+static cl_command_queue commandQueue;
+static cl_program program;
+
+static cl_mem randomBuffer(size_t n, float scale, cl_int * ret) {
+  std::vector<float> values(n);
+
+  for (size_t i = 0; i < n; i++) {
+    values[i] = scale * rand() / RAND_MAX;
+  }
+
+  cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(float), NULL, ret);
+  *ret |= clEnqueueWriteBuffer(commandQueue, buffer, CL_TRUE, 0, n * sizeof(float), values.data(), 0, NULL, NULL);
+
+  return buffer;
+}
+
+// the dims of the benchmark (x fastest), and its spatial and frequency sizes
+struct Dims {
+  size_t N0, N1, N2, n, nFreq;
+
+  Dims(benchmark::State & state) {
+    N0 = (size_t)state.range(0);
+    N1 = (size_t)state.range(1);
+    N2 = (size_t)state.range(2);
+    n = N0*N1*N2;
+    nFreq = (N0/2+1)*N1*N2;
+  }
+};
+
+static void BM_OpenCL_FFTForward(benchmark::State & state) {
+  Dims dims(state);
+  cl_int ret;
+
+  cl_mem d_image = randomBuffer(dims.n, 1, &ret);
+  cl_mem d_fft = clCreateBuffer(context, CL_MEM_READ_WRITE, 2 * dims.nFreq * sizeof(float), NULL, &ret);
+
+  clfftPlanHandle forward, backward;
+  ret |= createDeconvPlans(context, commandQueue, dims.N0, dims.N1, dims.N2, &forward, &backward);
+
+  if (ret != CL_SUCCESS) {
+    state.SkipWithError(("setup failed with OpenCL error " + std::to_string(ret)).c_str());
+  }
+  else {
+    for (auto _ : state) {
+      ret = clfftEnqueueTransform(forward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_image, &d_fft, NULL);
+      clFinish(commandQueue);
+
+      if (ret != CL_SUCCESS) {
+        state.SkipWithError(("clfftEnqueueTransform failed with OpenCL error " + std::to_string(ret)).c_str());
+        break;
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations() * dims.n);
+  }
+
+  clfftDestroyPlan(&forward);
+  clfftDestroyPlan(&backward);
+  clReleaseMemObject(d_image);
+  clReleaseMemObject(d_fft);
+}
+
+static void BM_OpenCL_FFTInverse(benchmark::State & state) {
+  Dims dims(state);
+  cl_int ret;
+
+  cl_mem d_image = clCreateBuffer(context, CL_MEM_READ_WRITE, dims.n * sizeof(float), NULL, &ret);
+  cl_mem d_fft = randomBuffer(2 * dims.nFreq, 1, &ret);
+
+  clfftPlanHandle forward, backward;
+  ret |= createDeconvPlans(context, commandQueue, dims.N0, dims.N1, dims.N2, &forward, &backward);
+
+  if (ret != CL_SUCCESS) {
+    state.SkipWithError(("setup failed with OpenCL error " + std::to_string(ret)).c_str());
+  }
+  else {
+    for (auto _ : state) {
+      ret = clfftEnqueueTransform(backward, CLFFT_BACKWARD, 1, &commandQueue, 0, NULL, NULL, &d_fft, &d_image, NULL);
+      clFinish(commandQueue);
+
+      if (ret != CL_SUCCESS) {
+        state.SkipWithError(("clfftEnqueueTransform failed with OpenCL error " + std::to_string(ret)).c_str());
+        break;
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations() * dims.n);
+  }
+
+  clfftDestroyPlan(&forward);
+  clfftDestroyPlan(&backward);
+  clReleaseMemObject(d_image);
+  clReleaseMemObject(d_fft);
+}
+
+static void BM_OpenCL_Convolve(benchmark::State & state) {
+  Dims dims(state);
+  cl_int ret;
+
+  cl_mem d_image = randomBuffer(dims.n, 1, &ret);
+  cl_mem d_psf = randomBuffer(dims.n, 1.0f / dims.n, &ret);
+  cl_mem d_out = clCreateBuffer(context, CL_MEM_READ_WRITE, dims.n * sizeof(float), NULL, &ret);
+
+  for (auto _ : state) {
+    ret = conv_long(dims.N0, dims.N1, dims.N2, (long)d_image, (long)d_psf, (long)d_out, false, (long)context, (long)commandQueue, (long)deviceID);
+
+    if (ret != CL_SUCCESS) {
+      state.SkipWithError(("conv_long failed with OpenCL error " + std::to_string(ret)).c_str());
+      break;
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * dims.n);
+
+  clReleaseMemObject(d_image);
+  clReleaseMemObject(d_psf);
+  clReleaseMemObject(d_out);
+}
+
+static void BM_OpenCL_RichardsonLucy(benchmark::State & state) {
+  Dims dims(state);
+  cl_int ret;
+
+  cl_mem d_observed = randomBuffer(dims.n, 1, &ret);
+  cl_mem d_psf = randomBuffer(dims.n, 1.0f / dims.n, &ret);
+  cl_mem d_estimate = clCreateBuffer(context, CL_MEM_READ_WRITE, dims.n * sizeof(float), NULL, &ret);
+
+  clfftPlanHandle plans[2];
+  ret |= createDeconvPlans(context, commandQueue, dims.N0, dims.N1, dims.N2, &plans[0], &plans[1]);
+
+  if (ret != CL_SUCCESS) {
+    state.SkipWithError(("setup failed with OpenCL error " + std::to_string(ret)).c_str());
+  }
+  else {
+    for (auto _ : state) {
+      state.PauseTiming();
+      clEnqueueCopyBuffer(commandQueue, d_observed, d_estimate, 0, 0, dims.n * sizeof(float), 0, NULL, NULL);
+      clFinish(commandQueue);
+      state.ResumeTiming();
+
+      ret = deconvCore(RL_ITERATIONS, dims.N0, dims.N1, dims.N2, d_observed, d_psf, d_estimate, NULL, NULL, 
+          context, commandQueue, deviceID, program, plans, false);
+
+      if (ret != CL_SUCCESS) {
+        state.SkipWithError(("deconvCore failed with OpenCL error " + std::to_string(ret)).c_str());
+        break;
+      }
+    }
+
+    state.SetItemsProcessed(state.iterations() * dims.n * RL_ITERATIONS);
+    state.counters["rl_iterations"] = benchmark::Counter(RL_ITERATIONS, benchmark::Counter::kIsIterationInvariantRate);
+  }
+
+  clfftDestroyPlan(&plans[0]);
+  clfftDestroyPlan(&plans[1]);
+  clReleaseMemObject(d_observed);
+  clReleaseMemObject(d_psf);
+  clReleaseMemObject(d_estimate);
+}
+
+BENCHMARK(BM_OpenCL_FFTForward)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_OpenCL_FFTInverse)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_OpenCL_Convolve)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_OpenCL_RichardsonLucy)->Apply(allSizes)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static int envIndex(const char * name) {
+  const char * value = getenv(name);
+  return value != NULL ? atoi(value) : 0;
+}
+
+// the device selected by OPS_OPENCL_PLATFORM and OPS_OPENCL_DEVICE
+static cl_int openDevice() {
+  cl_uint numPlatforms = 0, numDevices = 0;
+  cl_int ret = clGetPlatformIDs(0, NULL, &numPlatforms);
+
+  int platform = envIndex("OPS_OPENCL_PLATFORM");
+  int device = envIndex("OPS_OPENCL_DEVICE");
+
+  if ((ret != CL_SUCCESS) || (platform >= (int)numPlatforms)) {
+    return CL_INVALID_PLATFORM;
+  }
+
+  std::vector<cl_platform_id> platforms(numPlatforms);
+  ret = clGetPlatformIDs(numPlatforms, platforms.data(), NULL);
+  ret |= clGetDeviceIDs(platforms[platform], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices);
+
+  if ((ret != CL_SUCCESS) || (device >= (int)numDevices)) {
+    return CL_INVALID_DEVICE;
+  }
+
+  std::vector<cl_device_id> ids(numDevices);
+  ret = clGetDeviceIDs(platforms[platform], CL_DEVICE_TYPE_ALL, numDevices, ids.data(), NULL);
+  deviceID = ids[device];
+
+  context = clCreateContext(NULL, 1, &deviceID, NULL, NULL, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  program = buildDeconvProgram(context, deviceID, &ret);
+
+  return ret;
+}
+
+int main(int argc, char ** argv) {
+  benchmark::Initialize(&argc, argv);
+
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  cl_int ret = openDevice();
+
+  if (ret != CL_SUCCESS) {
+    printf("could not open the OpenCL device %d\n", ret);
+    return 1;
+  }
+
+  char name[256] = "";
+  clGetDeviceInfo(deviceID, CL_DEVICE_NAME, sizeof(name), name, NULL);
+
+  const char * poclThreads = getenv("POCL_MAX_PTHREAD_COUNT");
+
+  benchmark::AddCustomContext("engine", "opencl");
+  benchmark::AddCustomContext("device", name);
+  benchmark::AddCustomContext("threads", poclThreads != NULL ? poclThreads : "default");
+
+  acquireClfft();
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  releaseClfft();
+
+  clReleaseProgram(program);
+  clReleaseCommandQueue(commandQueue);
+  clReleaseContext(context);
+
+  return 0;
+}
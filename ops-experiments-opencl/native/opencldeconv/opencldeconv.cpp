@@ -1,12 +1,33 @@
 #include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
 #include "CL/cl.h"
 #include "clFFT.h"
 #include <math.h>
 #include "opencldeconv.h"
+#include "opencldeconvcore.h"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 #define MAX_SOURCE_SIZE (0x100000)
 
+// alignment (bytes) and size granularity required by most runtimes (Intel, POCL, AMD APU)
+// before a CL_MEM_USE_HOST_PTR buffer is used in place instead of being shadowed by a copy
+#define HOST_PTR_ALIGNMENT 4096
+#define HOST_PTR_SIZE_MULTIPLE 64
+
+// smallest value of a Wiener warm start (see setWarmStart), RL keeps zeros at zero
+#define WARM_START_FLOOR 1e-6f
+
 // Author: Brian Northan
 // License: BSD
 
@@ -93,6 +114,221 @@ const char * programString =                                       "\n" \
 "        c[id] = a[id]*b[id];        \n" \
 "        }                           \n" \
 "}                                                               \n" \
+"// update multiplied by estimate and divided by the non-circulant normal in one pass  \n" \
+"__kernel void vecMulDivNormal(  __global float *a,              \n" \
+"                       __global float *b,                       \n" \
+"                       __global float *normal,                  \n" \
+"                       __global float *c,                       \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    //Get our global thread ID                                  \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    //Make sure we do not go out of bounds                      \n" \
+"    if (id < n)  {                                              \n" \
+"      if (normal[id] != 0)  {                                   \n" \
+"        c[id] = a[id]*b[id]/normal[id];                         \n" \
+"      }                                                         \n" \
+"      else {                                                    \n" \
+"        c[id]=0;                                                \n" \
+"      }                                                         \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"// ones inside the M0xM1xM2 measured region (centered in the N0xN1xN2 extended volume), zeros outside \n" \
+"__kernel void setNormalMask(  __global float *mask,             \n" \
+"                       const unsigned int N0,                   \n" \
+"                       const unsigned int N1,                   \n" \
+"                       const unsigned int N2,                   \n" \
+"                       const unsigned int M0,                   \n" \
+"                       const unsigned int M1,                   \n" \
+"                       const unsigned int M2)                   \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < N0*N1*N2)  {                                       \n" \
+"        unsigned int x = id % N0;                               \n" \
+"        unsigned int y = (id / N0) % N1;                        \n" \
+"        unsigned int z = id / (N0*N1);                          \n" \
+"        unsigned int s0 = (N0-M0)/2;                            \n" \
+"        unsigned int s1 = (N1-M1)/2;                            \n" \
+"        unsigned int s2 = (N2-M2)/2;                            \n" \
+"        bool inside = x>=s0 && x<s0+M0 && y>=s1 && y<s1+M1 && z>=s2 && z<s2+M2; \n" \
+"        mask[id] = inside ? 1.0f : 0.0f;                        \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"// same as removeSmallValues in YacuDecu, avoids dividing by ~0 far outside the measured region \n" \
+"__kernel void vecRemoveSmallValues(  __global float *a,         \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      if (a[id] < 0.00001f)  {                                  \n" \
+"        a[id] = 1.0f;                                           \n" \
+"      }                                                         \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"// half precision storage (see setStorageMode), vload_half/vstore_half are core   \n" \
+"// OpenCL and don't need cl_khr_fp16, the arithmetic stays in float              \n" \
+"__kernel void vecFloatToHalf(  __global float *a,               \n" \
+"                       __global half *b,                        \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      vstore_half(a[id], id, b);                                \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"__kernel void vecDivHalf(  __global half *a,                    \n" \
+"                       __global float *b,                       \n" \
+"                       __global float *c,                       \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      c[id] = vload_half(id, a)/b[id];                          \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"__kernel void vecMulDivNormalHalf(  __global float *a,          \n" \
+"                       __global float *b,                       \n" \
+"                       __global half *normal,                   \n" \
+"                       __global float *c,                       \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      float norm = vload_half(id, normal);                      \n" \
+"      if (norm != 0)  {                                         \n" \
+"        c[id] = a[id]*b[id]/norm;                               \n" \
+"      }                                                         \n" \
+"      else {                                                    \n" \
+"        c[id]=0;                                                \n" \
+"      }                                                         \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"// Wiener (Tikhonov) filter: c = a*conj(b)/(|b|^2 + reg*|b[0]|^2), the regularization is relative to the \n" \
+"// OTF at zero frequency so it doesn't depend on the PSF's sum      \n" \
+"__kernel void vecWiener(  __global float *a,                    \n" \
+"                       __global float *b,                       \n" \
+"                       __global float *c,                       \n" \
+"                       const float reg,                         \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      float dc = b[0]*b[0] + b[1]*b[1];                         \n" \
+"      float denom = b[2*id]*b[2*id] + b[2*id+1]*b[2*id+1] + reg*dc; \n" \
+"      float real = a[2*id]*b[2*id] + a[2*id+1]*b[2*id+1];       \n" \
+"      float imag = a[2*id+1]*b[2*id] - a[2*id]*b[2*id+1];       \n" \
+"      c[2*id] = real/denom;                                     \n" \
+"      c[2*id+1] = imag/denom;                                   \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"// a = max(a, lowest), removes the negative ringing of the Wiener estimate \n" \
+"__kernel void vecClampMin(  __global float *a,                  \n" \
+"                       const float lowest,                      \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      a[id] = fmax(a[id], lowest);                              \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"__kernel void vecHalfToFloat(  __global half *a,                \n" \
+"                       __global float *b,                       \n" \
+"                       const unsigned int n)                    \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < n)  {                                              \n" \
+"      b[id] = vload_half(id, a);                                \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"// RL-TV (Dey et al. 2006): divergence of the normalized gradient of the estimate, forward differences with zero\n" \
+"// gradient at the borders, x = id % N0 fastest                 \n" \
+"float tvNormalized(float g, float gx, float gy, float gz) {     \n" \
+"  float magnitude = sqrt(gx*gx + gy*gy + gz*gz);                \n" \
+"  return magnitude > 0 ? g/magnitude : 0.0f;                    \n" \
+"}                                                               \n" \
+"float tvDivergence(__global float *e, unsigned int id, unsigned int N0, unsigned int N1, unsigned int N2) {\n" \
+"  unsigned int x = id % N0;                                     \n" \
+"  unsigned int y = (id / N0) % N1;                              \n" \
+"  unsigned int z = id / (N0*N1);                                \n" \
+"  unsigned int s1 = N0;                                         \n" \
+"  unsigned int s2 = N0*N1;                                      \n" \
+"  float v = e[id];                                              \n" \
+"  float gx = x+1<N0 ? e[id+1]-v : 0.0f;                         \n" \
+"  float gy = y+1<N1 ? e[id+s1]-v : 0.0f;                        \n" \
+"  float gz = z+1<N2 ? e[id+s2]-v : 0.0f;                        \n" \
+"  float div = tvNormalized(gx, gx, gy, gz) + tvNormalized(gy, gx, gy, gz) + tvNormalized(gz, gx, gy, gz);\n" \
+"  if (x>0) {                                                    \n" \
+"    float w = e[id-1];                                          \n" \
+"    float wy = y+1<N1 ? e[id-1+s1]-w : 0.0f;                    \n" \
+"    float wz = z+1<N2 ? e[id-1+s2]-w : 0.0f;                    \n" \
+"    div -= tvNormalized(v-w, v-w, wy, wz);                      \n" \
+"  }                                                             \n" \
+"  if (y>0) {                                                    \n" \
+"    float w = e[id-s1];                                         \n" \
+"    float wx = x+1<N0 ? e[id-s1+1]-w : 0.0f;                    \n" \
+"    float wz = z+1<N2 ? e[id-s1+s2]-w : 0.0f;                   \n" \
+"    div -= tvNormalized(v-w, wx, v-w, wz);                      \n" \
+"  }                                                             \n" \
+"  if (z>0) {                                                    \n" \
+"    float w = e[id-s2];                                         \n" \
+"    float wx = x+1<N0 ? e[id-s2+1]-w : 0.0f;                    \n" \
+"    float wy = y+1<N1 ? e[id-s2+s1]-w : 0.0f;                   \n" \
+"    div -= tvNormalized(v-w, wx, wy, v-w);                      \n" \
+"  }                                                             \n" \
+"  return div;                                                   \n" \
+"}                                                               \n" \
+"// estimate times update divided by (1 - lambda*div) and the normal (if hasNormal) in one pass, c may be b but\n" \
+"// not a (the stencil reads the neighbors of a)                 \n" \
+"__kernel void vecMulTV(  __global float *a,                     \n" \
+"                       __global float *b,                       \n" \
+"                       __global float *normal,                  \n" \
+"                       __global float *c,                       \n" \
+"                       const float lambda,                      \n" \
+"                       const unsigned int hasNormal,            \n" \
+"                       const unsigned int N0,                   \n" \
+"                       const unsigned int N1,                   \n" \
+"                       const unsigned int N2)                   \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < N0*N1*N2)  {                                       \n" \
+"      float value = a[id]*b[id]/fmax(1.0f - lambda*tvDivergence(a, id, N0, N1, N2), 0.01f);\n" \
+"      if (hasNormal)  {                                         \n" \
+"        value = normal[id] != 0 ? value/normal[id] : 0.0f;      \n" \
+"      }                                                         \n" \
+"      c[id] = value;                                            \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
+"__kernel void vecMulTVHalf(  __global float *a,                 \n" \
+"                       __global float *b,                       \n" \
+"                       __global half *normal,                   \n" \
+"                       __global float *c,                       \n" \
+"                       const float lambda,                      \n" \
+"                       const unsigned int hasNormal,            \n" \
+"                       const unsigned int N0,                   \n" \
+"                       const unsigned int N1,                   \n" \
+"                       const unsigned int N2)                   \n" \
+"{                                                               \n" \
+"    int id = get_global_id(0);                                  \n" \
+"                                                                \n" \
+"    if (id < N0*N1*N2)  {                                       \n" \
+"      float value = a[id]*b[id]/fmax(1.0f - lambda*tvDivergence(a, id, N0, N1, N2), 0.01f);\n" \
+"      if (hasNormal)  {                                         \n" \
+"        float norm = vload_half(id, normal);                    \n" \
+"        value = norm != 0 ? value/norm : 0.0f;                  \n" \
+"      }                                                         \n" \
+"      c[id] = value;                                            \n" \
+"    }                                                           \n" \
+"}                                                               \n" \
  
 
 
@@ -103,34 +339,34 @@ cl_int callKernel(cl_kernel kernel, cl_mem in1, cl_mem in2, cl_mem out, const un
 	cl_int ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&in1);
 
   if (ret!=0) {	
-    printf("\nset variable 1 %d\n", ret);
+    logStatus("set variable 1", ret);
     return ret;
   }
 
 	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&in2);	
    
   if (ret!=0) {	
-    printf("\nset variable 2 %d\n", ret);
+    logStatus("set variable 2", ret);
     return ret;
   }
 
 	ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&out);	
   if (ret!=0) {	
-    printf("\nset variable 3 %d\n", ret);
+    logStatus("set variable 3", ret);
     return ret;
   }
 
   ret = clSetKernelArg(kernel, 3, sizeof(unsigned int), &n);	
   
   if (ret!=0) {	
-    printf("\nset variable 4 %d\n", ret);
+    logStatus("set variable 4", ret);
     return ret;
   }
   
   ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
   
   if (ret!=0) {	
-    printf("\nEnqueue Kernel %d\n", ret);
+    logStatus("Enqueue Kernel", ret);
     return ret;
   }
 
@@ -140,16 +376,449 @@ cl_int callKernel(cl_kernel kernel, cl_mem in1, cl_mem in2, cl_mem out, const un
 }
 
 void test() {
-  printf("Test opencldeconv entry point \n");
+  logMessage(LOG_INFO, "Test opencldeconv entry point\n");
 
   void * test;
   cl_mem test2=(cl_mem)(test);
 }
 
+// how the host arrays passed to conv and deconv are given to the device (see setHostMemoryMode)
+static std::atomic<int> hostMemoryMode(HOST_MEMORY_COPY);
+
+int setHostMemoryMode(int mode) {
+  if (mode<HOST_MEMORY_COPY || mode>HOST_MEMORY_ZERO_COPY) {
+    return CL_INVALID_VALUE;
+  }
+
+  hostMemoryMode = mode;
+
+  return CL_SUCCESS;
+}
+
+static std::atomic<int> storageMode(STORAGE_FLOAT);
+
+/*
+Storage precision of the observed image and the normal in the host memory entry points (deconv, deconv_noncirculant,
+deconv_multidevice).  STORAGE_HALF keeps them as 16 bit floats on the device, which halves their memory and the 
+bandwidth of the pointwise steps.  The estimate and the spatial scratch stay float because clFFT reads and writes them.
+*/
+int setStorageMode(int mode) {
+  if (mode<STORAGE_FLOAT || mode>STORAGE_HALF) {
+    return CL_INVALID_VALUE;
+  }
+
+  storageMode = mode;
+
+  return CL_SUCCESS;
+}
+
+static std::atomic<float> tvRegularization(0);
+
+/*
+RL-TV weight of the RL entry points, as mklSetTVRegularization of MKLFFTW.  The term is computed in vecMulTV, which
+writes into the reblurred buffer, and the two buffers swap roles.
+*/
+int setTVRegularization(float lambda) {
+  if (lambda<0) {
+    return CL_INVALID_VALUE;
+  }
+
+  tvRegularization = lambda;
+
+  return CL_SUCCESS;
+}
+
+static std::atomic<int> multiresolutionFactor(1);
+static std::atomic<int> multiresolutionIterations(0);
+
+/*
+Coarse to fine RL for deconv and deconv_noncirculant, as mklSetMultiresolution of MKLFFTW, with the binning and 
+upsampling on the host (see deconvHost).  The device buffer entry points (the _long ones, deconv_multidevice) and 
+deconvCore run at full resolution only.
+*/
+int setMultiresolution(int factor, int iterations) {
+  if ((factor!=1 && factor!=2 && factor!=4) || iterations<0) {
+    return CL_INVALID_VALUE;
+  }
+
+  multiresolutionFactor = factor;
+  multiresolutionIterations = iterations;
+
+  return CL_SUCCESS;
+}
+
+/*
+Bins axis of the dims volume in (dims[2] fastest) by f into out.  The image, estimate and normal take the mean of 
+each block.  The PSF (wrapped, its center at 0) takes sum_d (f-|d|)/f*h[f*k+d] for |d| < f, the mean over the 
+block of the image of the PSF summed over the block of the object, so the coarse model stays centered.
+*/
+static void binAxis(const float * in, float * out, const size_t * dims, int axis, int f, bool psf) {
+  size_t outer = 1, inner = 1;
+  for (int d = 0; d < axis; d++) outer *= dims[d];
+  for (int d = axis + 1; d < 3; d++) inner *= dims[d];
+
+  const long n = (long)dims[axis];
+  const long coarse = n / f;
+
+  for (size_t o = 0; o < outer; o++) {
+    for (long k = 0; k < coarse; k++) {
+      float * row = out + (o * coarse + k) * inner;
+
+      for (size_t q = 0; q < inner; q++) {
+        float sum = 0;
+
+        if (psf) {
+          for (long d = 1 - f; d < f; d++) {
+            const long p = ((k * f + d) % n + n) % n;
+            sum += (f - labs(d)) * in[(o * n + p) * inner + q];
+          }
+        }
+        else {
+          for (long a = 0; a < f; a++) {
+            sum += in[(o * n + k * f + a) * inner + q];
+          }
+        }
+
+        row[q] = sum / f;
+      }
+    }
+  }
+}
+
+/*
+Linear interpolation of axis of the coarse dims volume in by f into out, circular like the FFTs, fine voxel p is 
+at (p - (f-1)/2)/f on the coarse grid.
+*/
+static void upsampleAxis(const float * in, float * out, const size_t * dims, int axis, int f) {
+  size_t outer = 1, inner = 1;
+  for (int d = 0; d < axis; d++) outer *= dims[d];
+  for (int d = axis + 1; d < 3; d++) inner *= dims[d];
+
+  const long coarse = (long)dims[axis];
+  const long n = coarse * f;
+
+  for (size_t o = 0; o < outer; o++) {
+    for (long p = 0; p < n; p++) {
+      const float c = (p - (f - 1) / 2.f) / f;
+      const long k = (long)floorf(c);
+      const float w = c - k;
+
+      const float * low = in + (o * coarse + (k + coarse) % coarse) * inner;
+      const float * high = in + (o * coarse + (k + 1) % coarse) * inner;
+      float * row = out + (o * n + p) * inner;
+
+      for (size_t q = 0; q < inner; q++) {
+        row[q] = (1 - w) * low[q] + w * high[q];
+      }
+    }
+  }
+}
+
+// bins (or upsamples) in by the per axis factors f into out, one axis at a time, dims are those of in
+static void resampleVolume(const float * in, float * out, const size_t * dims, const int * f, bool upsample, bool psf) {
+  size_t current[3] = {dims[0], dims[1], dims[2]};
+  float * buffer = NULL;
+  const float * source = in;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (f[axis] == 1) continue;
+
+    bool last = true;
+    for (int d = axis + 1; d < 3; d++) {
+      if (f[d] > 1) last = false;
+    }
+
+    size_t size = upsample ? current[0] * current[1] * current[2] * f[axis] : current[0] * current[1] * current[2] / f[axis];
+    float * target = last ? out : (float*)malloc(size * sizeof(float));
+
+    if (upsample) {
+      upsampleAxis(source, target, current, axis, f[axis]);
+      current[axis] *= f[axis];
+    }
+    else {
+      binAxis(source, target, current, axis, f[axis], psf);
+      current[axis] /= f[axis];
+    }
+
+    free(buffer);
+    buffer = last ? NULL : target;
+    source = target;
+  }
+}
+
+static std::atomic<float> warmStart(0);
+
+/*
+Wiener warm start of the RL entry points (see wiener), as mklSetWarmStart of MKLFFTW.
+*/
+int setWarmStart(float regularization) {
+  if (regularization<0) {
+    return CL_INVALID_VALUE;
+  }
+
+  warmStart = regularization;
+
+  return CL_SUCCESS;
+}
+
+// convert a float buffer to a new half buffer on the device
+static cl_mem convertToHalf(cl_context context, cl_command_queue commandQueue, cl_program program, cl_mem d_float, size_t n, cl_int * ret) {
+  cl_mem d_half = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(cl_half), NULL, ret);
+
+  if (*ret!=0) {
+    return NULL;
+  }
+
+  cl_kernel kernel = clCreateKernel(program, "vecFloatToHalf", ret);
+
+  if (*ret!=CL_SUCCESS) {
+    logStatus("create convert to half kernel", *ret);
+    clReleaseMemObject(d_half);
+    return NULL;
+  }
+
+  unsigned int nKernel = (unsigned int)n;
+  size_t localItemSize=64;
+  size_t globalItemSize=((n+localItemSize-1)/localItemSize)*localItemSize;
+
+  *ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&d_float);
+
+  if (*ret==CL_SUCCESS) {
+    *ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&d_half);
+  }
+
+  if (*ret==CL_SUCCESS) {
+    *ret = clSetKernelArg(kernel, 2, sizeof(unsigned int), &nKernel);
+  }
+
+  if (*ret==CL_SUCCESS) {
+    *ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);
+  }
+
+  if (*ret==CL_SUCCESS) {
+    *ret = clFinish(commandQueue);
+  }
+
+  clReleaseKernel(kernel);
+
+  logStatus("convert to half", *ret);
+
+  if (*ret!=CL_SUCCESS) {
+    clReleaseMemObject(d_half);
+    return NULL;
+  }
+
+  return d_half;
+}
+
+// upload a host float array to a new half buffer, through a temporary float staging buffer
+static cl_mem uploadHalf(cl_context context, cl_command_queue commandQueue, cl_program program, float * h_data, size_t n, cl_int * ret) {
+  cl_mem d_staging = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, n * sizeof(float), h_data, ret);
+
+  if (*ret!=0) {
+    return NULL;
+  }
+
+  cl_mem d_half = convertToHalf(context, commandQueue, program, d_staging, n, ret);
+
+  clReleaseMemObject(d_staging);
+
+  return d_half;
+}
+
+// bytes allocated by allocHostBuffer, so createHostBuffer can wrap the padding of odd sizes as well
+static std::map<float *, size_t> hostBuffers;
+static std::mutex hostBuffersLock;
+
+static size_t hostPtrSize(size_t bytes) {
+  return ((bytes+HOST_PTR_SIZE_MULTIPLE-1)/HOST_PTR_SIZE_MULTIPLE)*HOST_PTR_SIZE_MULTIPLE;
+}
+
+/*
+Allocate a float buffer aligned so it can be wrapped by CL_MEM_USE_HOST_PTR without the runtime
+making a shadow copy.  Callers that allocate image, psf and output with this function get true
+zero copy on CPU and integrated devices.  Must be released with freeHostBuffer.
+*/
+float * allocHostBuffer(size_t n) {
+  // round the size up so the buffer also satisfies the size granularity
+  size_t bytes = hostPtrSize(n*sizeof(float));
+  float * buffer = NULL;
+
+#ifdef _WIN32
+  buffer = (float*)_aligned_malloc(bytes, HOST_PTR_ALIGNMENT);
+#else
+  void * aligned = NULL;
+
+  if (posix_memalign(&aligned, HOST_PTR_ALIGNMENT, bytes)==0) {
+    buffer = (float*)aligned;
+  }
+#endif
+
+  if (buffer != NULL) {
+    std::lock_guard<std::mutex> lock(hostBuffersLock);
+    hostBuffers[buffer] = bytes;
+  }
+
+  return buffer;
+}
+
+void freeHostBuffer(float * buffer) {
+  if (buffer != NULL) {
+    std::lock_guard<std::mutex> lock(hostBuffersLock);
+    hostBuffers.erase(buffer);
+  }
+
+#ifdef _WIN32
+  _aligned_free(buffer);
+#else
+  free(buffer);
+#endif
+}
+
+// the size to wrap h_data with for zero copy (size rounded up if h_data is from allocHostBuffer, which owns the
+// padding), or 0 if it can't be wrapped
+static size_t zeroCopySize(const float * h_data, size_t size) {
+  if ((size_t)h_data % HOST_PTR_ALIGNMENT != 0) {
+    return 0;
+  }
+
+  if (size % HOST_PTR_SIZE_MULTIPLE == 0) {
+    return size;
+  }
+
+  std::lock_guard<std::mutex> lock(hostBuffersLock);
+  std::map<float *, size_t>::iterator it = hostBuffers.find((float *)h_data);
+
+  if ((it != hostBuffers.end()) && (it->second >= hostPtrSize(size))) {
+    return hostPtrSize(size);
+  }
+
+  return 0;
+}
+
+// clFFT setup and teardown are global (teardown destroys every plan in the process), so they are reference 
+// counted across the library and clFFT is only torn down when the last user (including cached plans) releases it
+static int clfftUsers = 0;
+static std::mutex clfftLock;
+
+cl_int acquireClfft() {
+  std::lock_guard<std::mutex> lock(clfftLock);
+
+  if (clfftUsers == 0) {
+    clfftSetupData fftSetup;
+    cl_int ret = clfftInitSetupData(&fftSetup);
+    logStatus("clfft init", ret);
+    ret = clfftSetup(&fftSetup);
+
+    if (ret != CLFFT_SUCCESS) {
+      return ret;
+    }
+  }
+
+  clfftUsers++;
+
+  return CLFFT_SUCCESS;
+}
+
+void releaseClfft() {
+  std::lock_guard<std::mutex> lock(clfftLock);
+
+  if (clfftUsers > 0) {
+    clfftUsers--;
+
+    if (clfftUsers == 0) {
+      clfftTeardown();
+    }
+  }
+}
+
+// true if the device works directly on host memory (CPU runtimes, integrated GPUs)
+static bool deviceSharesHostMemory(cl_device_id deviceID) {
+  cl_bool unified = CL_FALSE;
+  cl_device_type type = 0;
+
+  clGetDeviceInfo(deviceID, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(cl_bool), &unified, NULL);
+  clGetDeviceInfo(deviceID, CL_DEVICE_TYPE, sizeof(cl_device_type), &type, NULL);
+
+  return (unified==CL_TRUE) || (type & CL_DEVICE_TYPE_CPU);
+}
+
+static bool useZeroCopy(cl_device_id deviceID) {
+  const int mode = hostMemoryMode;
+
+  if (mode==HOST_MEMORY_ZERO_COPY) {
+    return true;
+  }
+
+  if (mode==HOST_MEMORY_AUTO) {
+    return deviceSharesHostMemory(deviceID);
+  }
+
+  return false;
+}
+
+/*
+Create a buffer backed by host memory instead of a device copy.
+
+If h_data is suitably aligned (and its size a multiple of HOST_PTR_SIZE_MULTIPLE, or it is from allocHostBuffer) it 
+is wrapped directly (CL_MEM_USE_HOST_PTR) and no copy is made at all.
+Otherwise the runtime allocates aligned host memory (CL_MEM_ALLOC_HOST_PTR) and h_data is copied into
+it through a map, which replaces both the staging copy and the write transfer of clEnqueueWriteBuffer.
+copyIn can be false for output buffers whose initial contents are not used.
+*/
+static cl_mem createHostBuffer(cl_context context, cl_command_queue commandQueue, size_t size, float *h_data, bool copyIn, cl_int *ret) {
+
+  size_t wrapped = zeroCopySize(h_data, size);
+
+  if (wrapped > 0) {
+    logMessage(LOG_INFO, "host buffer of %zu bytes wrapped in place (%zu with padding)\n", size, wrapped);
+    return clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, wrapped, h_data, ret);
+  }
+
+  logMessage(LOG_INFO, "host buffer of %zu bytes copied into runtime allocated host memory\n", size);
+
+  cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, ret);
+
+  if ((*ret!=CL_SUCCESS) || !copyIn) {
+    return buffer;
+  }
+
+  void * mapped = clEnqueueMapBuffer(commandQueue, buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, size, 0, NULL, NULL, ret);
+
+  if (*ret!=CL_SUCCESS) {
+    return buffer;
+  }
+
+  memcpy(mapped, h_data, size);
+
+  *ret = clEnqueueUnmapMemObject(commandQueue, buffer, mapped, 0, NULL, NULL);
+
+  return buffer;
+}
+
+/*
+Make the contents of a buffer created with createHostBuffer visible in h_data.  Mapping synchronizes
+the host view, if the buffer wraps h_data the map returns h_data itself and nothing is copied.
+*/
+static cl_int readHostBuffer(cl_command_queue commandQueue, cl_mem buffer, size_t size, float *h_data) {
+  cl_int ret;
+
+  void * mapped = clEnqueueMapBuffer(commandQueue, buffer, CL_TRUE, CL_MAP_READ, 0, size, 0, NULL, NULL, &ret);
+
+  if (ret!=CL_SUCCESS) {
+    return ret;
+  }
+
+  if (mapped!=h_data) {
+    memcpy(h_data, mapped, size);
+  }
+
+  return clEnqueueUnmapMemObject(commandQueue, buffer, mapped, 0, NULL, NULL);
+}
+
 
 int fft2d_long(long N0, long N1, long d_image, long d_out, long l_context, long l_queue) {
-  printf("input address %ld", d_image);
-  printf("input address %lu", (unsigned long)d_image);
+  logMessage(LOG_DEBUG, "input address %lu\n", (unsigned long)d_image);
 
   cl_platform_id platformId = NULL;
 	cl_device_id deviceID = NULL;
@@ -157,7 +826,7 @@ int fft2d_long(long N0, long N1, long d_image, long d_out, long l_context, long
 	cl_uint retNumPlatforms;
   cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
 
-  printf("\ncreated platform\n");
+  logMessage(LOG_DEBUG, "created platform\n");
 
 	ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
   
@@ -179,52 +848,49 @@ int fft2d_long(long N0, long N1, long d_image, long d_out, long l_context, long
   size_t outStride[3] = {1,N0/2+1};
 
   /* Setup clFFT. */
-  clfftSetupData fftSetup;
-  ret = clfftInitSetupData(&fftSetup);
-  printf("clfft init %d\n", ret);
-  ret = clfftSetup(&fftSetup);
+  ret = acquireClfft();
 
-  printf("clfft setup %d\n", ret);
+  logStatus("clfft setup", ret);
   /* Create a default plan for a complex FFT. */
   ret = clfftCreateDefaultPlan(&planHandleForward, context, dim, clLengths);
 
-  printf("Create Default Plan %d\n", ret);
+  logStatus("Create Default Plan", ret);
   
   /* Set plan parameters. */
   ret = clfftSetPlanPrecision(planHandleForward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleForward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleForward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleForward, dim, inStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleForward, dim, outStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   /* Bake the plan. */
   ret = clfftBakePlan(planHandleForward, 1, &commandQueue, NULL, NULL);
 
-  printf("Bake %d\n", ret);
+  logStatus("Bake", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
   cl_mem cl_mem_image=(cl_mem)d_image;
   cl_mem cl_mem_out=(cl_mem)d_out;
   
   /* Execute the plan. */
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &cl_mem_image, &cl_mem_out, NULL);
-  printf("Forward FFT %d\n", ret);
+  logStatus("Forward FFT", ret);
   
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue for forward FFT %d\n", ret);
+  logStatus("Finish Command Queue for forward FFT", ret);
   
    // Release the plan. 
    ret = clfftDestroyPlan( &planHandleForward );
 
-   clfftTeardown();
+   releaseClfft();
    
-   printf("FFT finished\n");
+   logMessage(LOG_DEBUG, "FFT finished\n");
 
    return 0; 
 }
@@ -237,36 +903,36 @@ int fft2d(size_t N0, size_t N1, float *h_image, float * h_out) {
 	cl_uint retNumPlatforms;
   cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
 
-  printf("\ncreated platform\n");
+  logMessage(LOG_DEBUG, "created platform\n");
 
 	ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
 
 	// Creating context.
 	cl_context context = clCreateContext(NULL, 1, &deviceID, NULL, NULL,  &ret);
 
-  printf("\ncreated context\n");
+  logMessage(LOG_DEBUG, "created context\n");
 
 	// Creating command queue
 	cl_command_queue commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
 
-  printf("\ncreated command queue\n");
+  logMessage(LOG_DEBUG, "created command queue\n");
 	
   // Memory buffers for each array
 	cl_mem aMemObj = clCreateBuffer(context, CL_MEM_READ_WRITE, N1 * N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate variable 1 %d\n", ret);
+  logStatus("create variable 1", ret);
 	
-  printf("\nallocated memory\n");
+  logMessage(LOG_DEBUG, "allocated memory\n");
 
    // Copy lists to memory buffers
 	ret = clEnqueueWriteBuffer(commandQueue, aMemObj, CL_TRUE, 0, N1 * N0 * sizeof(float), h_image, 0, NULL, NULL);;
-  printf("\ncopy to GPU  %d\n", ret);
+  logStatus("copy to GPU", ret);
 
   // number of elements in Hermitian (interleaved) output 
   unsigned long nFreq=N1*(N0/2+1);
 
   // create output buffer (note each complex number is represented by 2 floats)
   cl_mem FFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq*sizeof(float), NULL, &ret);
-  printf("\ncreate FFT %d\n", ret);
+  logStatus("create FFT", ret);
 	 
   /* FFT library realted declarations */
   clfftPlanHandle planHandleForward;
@@ -277,46 +943,43 @@ int fft2d(size_t N0, size_t N1, float *h_image, float * h_out) {
   size_t outStride[3] = {1,N0/2+1};
 
   /* Setup clFFT. */
-  clfftSetupData fftSetup;
-  ret = clfftInitSetupData(&fftSetup);
-  printf("clfft init %d\n", ret);
-  ret = clfftSetup(&fftSetup);
+  ret = acquireClfft();
 
-  printf("clfft setup %d\n", ret);
+  logStatus("clfft setup", ret);
   /* Create a default plan for a complex FFT. */
   ret = clfftCreateDefaultPlan(&planHandleForward, context, dim, clLengths);
 
-  printf("Create Default Plan %d\n", ret);
+  logStatus("Create Default Plan", ret);
   
   /* Set plan parameters. */
   ret = clfftSetPlanPrecision(planHandleForward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleForward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleForward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleForward, dim, inStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleForward, dim, outStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   /* Bake the plan. */
   ret = clfftBakePlan(planHandleForward, 1, &commandQueue, NULL, NULL);
 
-  printf("Bake %d\n", ret);
+  logStatus("Bake", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
   /* Execute the plan. */
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &aMemObj, &FFT, NULL);
 
-  printf("Forward FFT %d\n", ret);
+  logStatus("Forward FFT", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue for forward FFT %d\n", ret);
+  logStatus("Finish Command Queue for forward FFT", ret);
   
   // transfer from device back to GPU
   ret = clEnqueueReadBuffer( commandQueue, FFT, CL_TRUE, 0, 2*nFreq*sizeof(float), h_out, 0, NULL, NULL );
-  printf("copy back to host %d\n", ret);
+  logStatus("copy back to host", ret);
   
   // Release OpenCL memory objects. 
   
@@ -327,7 +990,7 @@ int fft2d(size_t N0, size_t N1, float *h_image, float * h_out) {
    ret = clfftDestroyPlan( &planHandleForward );
 
    // Release clFFT library. 
-   clfftTeardown( );
+   releaseClfft();
 
    // Release OpenCL working objects.
    clReleaseCommandQueue( commandQueue );
@@ -352,36 +1015,36 @@ int fftinv2d(size_t N0, size_t N1, float *h_fft, float * h_out) {
 	cl_uint retNumPlatforms;
   cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
 
-  printf("\ncreated platform\n"); 
+  logMessage(LOG_DEBUG, "created platform\n"); 
 
 	ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
 
 	// Creating context.
 	cl_context context = clCreateContext(NULL, 1, &deviceID, NULL, NULL,  &ret);
 
-  printf("\ncreated context\n");
+  logMessage(LOG_DEBUG, "created context\n");
 
 	// Creating command queue
 	cl_command_queue commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
 
-  printf("\ncreated command queue\n");
+  logMessage(LOG_DEBUG, "created command queue\n");
 
   // number of elements in Hermitian (interleaved) output 
   unsigned long nFreq = (N0/2+1)*N1;
 	
   // declare FFT memory on GPU
 	cl_mem FFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2 *nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate variable 1 %d\n", ret);
+  logStatus("create variable 1", ret);
 	
-  printf("\nallocated memory\n");
+  logMessage(LOG_DEBUG, "allocated memory\n");
 
    // Copy fft to GPU
 	ret = clEnqueueWriteBuffer(commandQueue, FFT, CL_TRUE, 0, 2 * nFreq * sizeof(float), h_fft, 0, NULL, NULL);;
-  printf("\ncopy to GPU  %d\n", ret);
+  logStatus("copy to GPU", ret);
 
   // create output buffer 
   cl_mem img = clCreateBuffer(context, CL_MEM_READ_WRITE, N0*N1*sizeof(float), NULL, &ret);
-  printf("\ncreate img on GPU %d\n", ret);
+  logStatus("create img on GPU", ret);
 	 
   /* FFT library realted declarations */
   clfftPlanHandle planHandleBackward;
@@ -392,42 +1055,39 @@ int fftinv2d(size_t N0, size_t N1, float *h_fft, float * h_out) {
   size_t outStride[3] = {1,N0};
 
   /* Setup clFFT. */
-  clfftSetupData fftSetup;
-  ret = clfftInitSetupData(&fftSetup);
-  printf("clfft init %d\n", ret);
-  ret = clfftSetup(&fftSetup);
+  ret = acquireClfft();
 
-  printf("clfft setup %d\n", ret);
+  logStatus("clfft setup", ret);
   /* Create a default plan for a complex FFT. */
   ret = clfftCreateDefaultPlan(&planHandleBackward, context, dim, clLengths);
 
-  printf("Create Default Plan %d\n", ret);
+  logStatus("Create Default Plan", ret);
   
   /* Set plan parameters. */
   ret = clfftSetPlanPrecision(planHandleBackward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleBackward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleBackward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleBackward, dim, inStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleBackward, dim, outStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   /* Bake the plan. */
   ret = clfftBakePlan(planHandleBackward, 1, &commandQueue, NULL, NULL);
 
-  printf("Bake %d\n", ret);
+  logStatus("Bake", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
   /* Execute the plan. */
   ret = clfftEnqueueTransform(planHandleBackward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &FFT, &img, NULL);
 
-  printf("Backward FFT %d\n", ret);
+  logStatus("Backward FFT", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue for forward FFT %d\n", ret);
+  logStatus("Finish Command Queue for forward FFT", ret);
   
   // transfer from device back to GPU
   ret = clEnqueueReadBuffer( commandQueue, img, CL_TRUE, 0, N0*N1*sizeof(float), h_out, 0, NULL, NULL );
@@ -441,7 +1101,7 @@ int fftinv2d(size_t N0, size_t N1, float *h_fft, float * h_out) {
    ret = clfftDestroyPlan( &planHandleBackward );
 
    // Release clFFT library. 
-   clfftTeardown( );
+   releaseClfft();
 
    // Release OpenCL working objects.
    clReleaseCommandQueue( commandQueue );
@@ -453,7 +1113,7 @@ int fftinv2d(size_t N0, size_t N1, float *h_fft, float * h_out) {
 
 int conv_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf,  long l_output, bool correlate, long l_context, long l_queue, long l_device) {
 
-  printf("enter convolve");
+  logMessage(LOG_DEBUG, "enter convolve\n");
 
   cl_int ret;
 
@@ -481,19 +1141,19 @@ int conv_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf,  long l
  
   // create memory for FFT of estimate and PSF 
 	cl_mem estimateFFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate PSF FFT %d\n", ret);
+  logStatus("create PSF FFT", ret);
  
   cl_mem psfFFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate Object FFT %d\n", ret);
+  logStatus("create Object FFT", ret);
 		
   // Create program from kernel source
 	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&programString, NULL, &ret);	
-  printf("\ncreate program %d\n", ret);
+  logStatus("create program", ret);
 
 	// Build opencl program
 	ret = clBuildProgram(program, 1, &deviceID, NULL, NULL, NULL);
 
-  printf("\nbuild program %d\n", ret);
+  logStatus("build program", ret);
 
   if (ret!=0) {
     return ret;
@@ -501,7 +1161,7 @@ int conv_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf,  long l
 
 	// Create complex multiply kernel
 	cl_kernel kernelComplexMultiply = clCreateKernel(program, "vecComplexMultiply", &ret);
-  printf("\ncreate KERNEL in GPU %d\n", ret);
+  logStatus("create KERNEL in GPU", ret);
 	
   /* FFT library related declarations */
   clfftPlanHandle planHandleForward;
@@ -519,71 +1179,68 @@ int conv_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf,  long l
   size_t fftStride[3] = {1, (N0/2+1), (N0/2+1)*N1};
 
   // Setup clFFT. 
-  clfftSetupData fftSetup;
-  ret = clfftInitSetupData(&fftSetup);
-  printf("clfft init %d\n", ret);
-  ret = clfftSetup(&fftSetup);
-  printf("clfft setup %d\n", ret);
+  ret = acquireClfft();
+  logStatus("clfft setup", ret);
 
   // Create default forward and backward plans
   ret = clfftCreateDefaultPlan(&planHandleForward, context, dim, clLengths);
   ret = clfftCreateDefaultPlan(&planHandleBackward, context, dim, clLengths);
 
-  printf("Create Default Plan %d\n", ret);
+  logStatus("Create Default Plan", ret);
   
   // Set plan parameters for forward plan
   ret = clfftSetPlanPrecision(planHandleForward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleForward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleForward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleForward, dim, imgStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleForward, dim, fftStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   // Set plan parameters for backward plan
   ret = clfftSetPlanPrecision(planHandleBackward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleBackward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleBackward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleBackward, dim, fftStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleBackward, dim, imgStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   // Bake the plans
   ret = clfftBakePlan(planHandleForward, 1, &commandQueue, NULL, NULL);
-  printf("Bake forward plan %d\n", ret);
+  logStatus("Bake forward plan", ret);
  // ret = clfftBakePlan(planHandleBackward, 1, &commandQueue, NULL, NULL);
- // printf("Bake backward plan %d\n", ret);
+ // logStatus("Bake backward plan", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
   // compute item sizes 
   size_t localItemSize=64;
 	size_t globalItemSize= ceil((N2*N1*N0)/(float)localItemSize)*localItemSize;
 	size_t globalItemSizeFreq = ceil((nFreq)/(float)localItemSize)*localItemSize;
-  printf("nFreq %d glbalItemSizeFreq %d\n",nFreq, globalItemSizeFreq);
+  logMessage(LOG_DEBUG, "nFreq %d glbalItemSizeFreq %d\n",nFreq, globalItemSizeFreq);
  
   // FFT of PSF
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_psf, &psfFFT, NULL);
-  printf("fft psf %d\n", ret);
+  logStatus("fft psf", ret);
   
   // FFT of estimate
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_image, &estimateFFT, NULL);
-  printf("fft estimate %d\n", ret);
+  logStatus("fft estimate", ret);
 
   // complex multipy estimate FFT and PSF FFT
   ret = callKernel(kernelComplexMultiply, estimateFFT, psfFFT, estimateFFT, nFreq, commandQueue, globalItemSizeFreq, localItemSize);
-  printf("kernel complex %d\n", ret);
+  logStatus("kernel complex", ret);
   
   // Inverse to get convolved
   ret = clfftEnqueueTransform(planHandleBackward, CLFFT_BACKWARD, 1, &commandQueue, 0, NULL, NULL, &estimateFFT, &d_output, NULL);
-  printf("fft inverse %d\n", ret);
+  logStatus("fft inverse", ret);
  
    // Release OpenCL memory objects. 
   clReleaseMemObject( psfFFT );
@@ -594,7 +1251,7 @@ int conv_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf,  long l
    ret = clfftDestroyPlan( &planHandleBackward );
 
    // Release clFFT library. 
-   clfftTeardown( );
+   releaseClfft();
 
   return ret;
 }
@@ -608,41 +1265,57 @@ int conv(size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h
 	cl_uint retNumPlatforms;
   cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
 
-  printf("\ncreated platform\n");
+  logMessage(LOG_DEBUG, "created platform\n");
 
 	ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
 
 	// Creating context.
 	cl_context context = clCreateContext(NULL, 1, &deviceID, NULL, NULL,  &ret);
 
-  printf("\ncreated context\n");
+  logMessage(LOG_DEBUG, "created context\n");
 
 	// Creating command queue
 	cl_command_queue commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
 
-  printf("\ncreated command queue\n");
+  logMessage(LOG_DEBUG, "created command queue\n");
 	
-  // Memory buffers for each array
-	cl_mem d_image = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate gpu mem for image %d\n", ret);
-	cl_mem d_psf = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate gpu mem for psf %d\n", ret);
-	cl_mem d_out = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate variable 3 %d\n", ret);
+  bool zeroCopy = useZeroCopy(deviceID);
+  size_t bytes = N2*N1*N0 * sizeof(float);
+
+  cl_mem d_image, d_psf, d_out;
+
+  if (zeroCopy) {
+    // on CPU and integrated devices use the host arrays (or mapped host memory) instead of device copies
+    d_image = createHostBuffer(context, commandQueue, bytes, h_image, true, &ret);
+    logStatus("create host mem for image", ret);
+    d_psf = createHostBuffer(context, commandQueue, bytes, h_psf, true, &ret);
+    logStatus("create host mem for psf", ret);
+    d_out = createHostBuffer(context, commandQueue, bytes, h_out, false, &ret);
+    logStatus("create host mem for output", ret);
+  }
+  else {
+    // Memory buffers for each array
+    d_image = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    logStatus("create gpu mem for image", ret);
+    d_psf = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    logStatus("create gpu mem for psf", ret);
+    d_out = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    logStatus("create variable 3", ret);
   
-  printf("\nallocated memory\n");
+    logMessage(LOG_DEBUG, "allocated memory\n");
 
-   // Copy lists to memory buffers
-	ret = clEnqueueWriteBuffer(commandQueue, d_image, CL_TRUE, 0, N2*N1*N0 * sizeof(float), h_image, 0, NULL, NULL);;
-  printf("\ncopy to GPU  %d\n", ret);
-	ret = clEnqueueWriteBuffer(commandQueue, d_psf, CL_TRUE, 0, N2*N1*N0 * sizeof(float), h_psf, 0, NULL, NULL);
-  printf("\ncopy to GPU  %d\n", ret);
+    // Copy lists to memory buffers
+    ret = clEnqueueWriteBuffer(commandQueue, d_image, CL_TRUE, 0, bytes, h_image, 0, NULL, NULL);;
+    logStatus("copy to GPU", ret);
+    ret = clEnqueueWriteBuffer(commandQueue, d_psf, CL_TRUE, 0, bytes, h_psf, 0, NULL, NULL);
+    logStatus("copy to GPU", ret);
+  }
 	
   unsigned long nFreq=(N0/2+1)*N1*N2;
   cl_mem psfFFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate PSF FFT %d\n", ret);
+  logStatus("create PSF FFT", ret);
 	cl_mem estimateFFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate Object FFT %d\n", ret);
+  logStatus("create Object FFT", ret);
 	 
   /* FFT library related declarations */
   clfftPlanHandle planHandleForward;
@@ -653,293 +1326,899 @@ int conv(size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h
   size_t fftStride[3] = {1, (N0/2+1), (N0/2+1)*N1};
 
   /* Setup clFFT. */
-  clfftSetupData fftSetup;
-  ret = clfftInitSetupData(&fftSetup);
-  printf("clfft init %d\n", ret);
-  ret = clfftSetup(&fftSetup);
+  ret = acquireClfft();
 
-  printf("clfft setup %d\n", ret);
+  logStatus("clfft setup", ret);
   /* Create a default plan for a complex FFT. */
   ret = clfftCreateDefaultPlan(&planHandleForward, context, dim, clLengths);
   ret = clfftCreateDefaultPlan(&planHandleBackward, context, dim, clLengths);
 
-  printf("Create Default Plan %d\n", ret);
+  logStatus("Create Default Plan", ret);
   
   /* Set plan parameters. */
   ret = clfftSetPlanPrecision(planHandleForward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleForward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleForward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleForward, dim, imgStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleForward, dim, fftStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   /* Set plan parameters. */
   ret = clfftSetPlanPrecision(planHandleBackward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
+  logStatus("clfft precision", ret);
   ret = clfftSetLayout(planHandleBackward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
+  logStatus("clfft set layout real hermittian interveaved", ret);
   ret = clfftSetResultLocation(planHandleBackward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
+  logStatus("clfft set result location", ret);
   ret=clfftSetPlanInStride(planHandleBackward, dim, fftStride);
-  printf("clfft set instride %d\n", ret);
+  logStatus("clfft set instride", ret);
   ret=clfftSetPlanOutStride(planHandleBackward, dim, imgStride);
-  printf("clfft set out stride %d\n", ret);
+  logStatus("clfft set out stride", ret);
 
   /* Bake the plan. */
   ret = clfftBakePlan(planHandleForward, 1, &commandQueue, NULL, NULL);
 
-  printf("Bake %d\n", ret);
+  logStatus("Bake", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
   /* Execute the plan. */
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_image, &estimateFFT, NULL);
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_psf, &psfFFT, NULL);
 
-  printf("Forward FFT %d\n", ret);
+  logStatus("Forward FFT", ret);
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue for forward FFT %d\n", ret);
+  logStatus("Finish Command Queue for forward FFT", ret);
   
   // complex multiply
  	
   // Create program from kernel source
 	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&programString, NULL, &ret);	
 
-  printf("\ncreate program %d\n", ret);
+  logStatus("create program", ret);
 	// Build program
 	ret = clBuildProgram(program, 1, &deviceID, NULL, NULL, NULL);
 
-  printf("\nbuild program %d\n", ret);
+  logStatus("build program", ret);
 
   if (ret!=0) {
     return ret;
   }
 	// Create kernel
 	cl_kernel kernel = clCreateKernel(program, "vecComplexMultiply", &ret);
-  printf("\ncreate KERNEL in GPU %d\n", ret);
+  logStatus("create KERNEL in GPU", ret);
  
    // Set arguments for kernel
 	ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&estimateFFT);	
-  printf("\nset variable 1 %d\n", ret);
+  logStatus("set variable 1", ret);
 	ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), (void *)&psfFFT);	
-  printf("\nset variable 2 %d\n", ret);
+  logStatus("set variable 2", ret);
 	ret = clSetKernelArg(kernel, 2, sizeof(cl_mem), (void *)&estimateFFT);	
-  printf("\nset variable 3 %d\n", ret);
+  logStatus("set variable 3", ret);
   ret = clSetKernelArg(kernel, 3, sizeof(nFreq), &nFreq);	
-  printf("\nset variable 4 %d\n", ret);
+  logStatus("set variable 4", ret);
 
   size_t localItemSize=64;
  	// Execute the kernel
 	size_t globalItemSize = ceil(((float)nFreq)/(float)localItemSize)*localItemSize;
-  printf("nFreq/globalItemSize %d,%u\n", nFreq, globalItemSize);
+  logMessage(LOG_DEBUG, "nFreq/globalItemSize %d,%u\n", nFreq, globalItemSize);
   
   ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
-  printf("\nexecute kernel %d\n", ret);
+  logStatus("execute kernel", ret);
 
   // Inverse 
   ret = clfftEnqueueTransform(planHandleBackward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &estimateFFT, &d_out, NULL);
 
-  printf("Inverse FFT %d\n", ret);
+  logStatus("Inverse FFT", ret);
   // Wait for calculations to be finished. 
   ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+  logStatus("Finish Command Queue", ret);
 
   // copy back to host 
-  ret = clEnqueueReadBuffer( commandQueue, d_out, CL_TRUE, 0, N0*N1*N2*sizeof(float), h_out, 0, NULL, NULL );
+  if (zeroCopy) {
+    ret = readHostBuffer(commandQueue, d_out, bytes, h_out);
+  }
+  else {
+    ret = clEnqueueReadBuffer( commandQueue, d_out, CL_TRUE, 0, bytes, h_out, 0, NULL, NULL );
+  }
 
   return 0;
 }
 
-int deconv_long(int iterations, size_t N0, size_t N1, size_t N2, long l_observed, long l_psf, long l_estimate, long l_normal, long l_context, long l_queue, long l_device) {
-
-  cl_int ret;
-  
-	// cast long to context 
-	cl_context context = (cl_context)l_context;
-  
-	// cast long to queue 
-	cl_command_queue commandQueue = (cl_command_queue)l_queue;
-	
-  // cast long pointers to cl_mem 
-	cl_mem d_observed = (cl_mem)l_observed;
-	cl_mem d_psf =  (cl_mem)l_psf;
-	cl_mem d_estimate = (cl_mem)l_estimate; 
-  cl_device_id deviceID = (cl_device_id)l_device;
+// arguments for the setNormalMask kernel 
+static cl_int callMaskKernel(cl_kernel kernel, cl_mem mask, const unsigned int * extendedDims, const unsigned int * validDims, cl_command_queue commandQueue, size_t globalItemSize, size_t localItemSize) {
+  cl_int ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), (void *)&mask);
 
-  // size in spatial domain
-  unsigned long n = N0*N1*N2;
+  for (int d=0;d<3;d++) {
+    ret |= clSetKernelArg(kernel, 1+d, sizeof(unsigned int), &extendedDims[d]);
+    ret |= clSetKernelArg(kernel, 4+d, sizeof(unsigned int), &validDims[d]);
+  }
+
+  if (ret!=0) {	
+    logStatus("set mask variables", ret);
+    return ret;
+  }
+
+  ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
+  
+  if (ret!=0) {	
+    logStatus("Enqueue Kernel", ret);
+  }
+
+  return ret;
+}
+
+// statistics (see enableStats in opencldeconv.h), totals of the calls, each call collects its own in a CallStats
+static std::atomic<int> statsLevel(STATS_OFF);
+static double stats[STATS_COUNT];
+static std::mutex statsMutex;
+
+static double statsClock() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+CallStats::CallStats(cl_command_queue commandQueue, bool active) : level(active ? (int)statsLevel : STATS_OFF), commandQueue(commandQueue), start(0), last(0) {
+  memset(values, 0, sizeof(values));
+
+  if (level) {
+    start = last = statsClock();
+  }
+}
+
+CallStats::~CallStats() {
+  if (!level) {
+    return;
+  }
+
+  values[STATS_TOTAL_SECONDS] = statsClock() - start;
+  values[STATS_CALLS] = 1;
+
+  std::lock_guard<std::mutex> lock(statsMutex);
+  for (int i = 0; i < STATS_COUNT; i++) {
+    stats[i] = i == STATS_PEAK_BYTES ? std::max(stats[i], values[i]) : stats[i] + values[i];
+  }
+}
+
+void CallStats::mark() {
+  if (level < STATS_PHASES) {
+    return;
+  }
+
+  clFinish(commandQueue);
+  last = statsClock();
+}
+
+void CallStats::phase(int index) {
+  if (level < STATS_PHASES) {
+    return;
+  }
+
+  clFinish(commandQueue);
+  double now = statsClock();
+  values[index] += now - last;
+  last = now;
+}
+
+void enableStats(int level) {
+  statsLevel = level;
+}
+
+void resetStats() {
+  std::lock_guard<std::mutex> lock(statsMutex);
+  memset(stats, 0, sizeof(stats));
+}
+
+/*
+Copies min(n, STATS_COUNT) of the statistics into stats_out, returns the number copied.
+*/
+int getStats(double * stats_out, int n) {
+  n = std::min(n, STATS_COUNT);
+
+  std::lock_guard<std::mutex> lock(statsMutex);
+  for (int i = 0; i < n; i++) {
+    stats_out[i] = stats[i];
+  }
+  return n;
+}
+
+// logging, progress and cancellation (see setLogLevel in opencldeconv.h), the defaults print errors only
+static std::atomic<int> logLevel(LOG_ERROR);
+static std::atomic<int> cancelled(0);
+static ProgressCallback progressCallback = NULL;
+static void * progressUser = NULL;
+static std::mutex progressMutex;
+
+void logMessage(int level, const char * format, ...) {
+  if (level > logLevel) {
+    return;
+  }
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(level == LOG_ERROR ? stderr : stdout, format, args);
+  va_end(args);
+}
+
+void logStatus(const char * what, int ret) {
+  logMessage(ret != CL_SUCCESS ? LOG_ERROR : LOG_DEBUG, "%s %d\n", what, ret);
+}
+
+// iterations a coarse to fine run finished before the current deconvCore, and its total (0 when not coarse to fine)
+static thread_local int progressDone = 0;
+static thread_local int progressTotal = 0;
+
+bool continueIterating(int iteration, int iterations) {
+  ProgressCallback callback;
+  void * user;
+
+  if (progressTotal>0) {
+    iteration += progressDone;
+    iterations = progressTotal;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(progressMutex);
+    callback = progressCallback;
+    user = progressUser;
+  }
+
+  if (callback != NULL && callback(iteration, iterations, user) != 0) {
+    return false;
+  }
+
+  return !cancelled;
+}
+
+void setLogLevel(int level) {
+  logLevel = level;
+}
+
+/*
+callback (NULL for none) is called from the thread running the deconvolution, for deconv_multidevice from the 
+device worker threads (one run per volume), user is passed through.
+*/
+void setProgressCallback(ProgressCallback callback, void * user) {
+  std::lock_guard<std::mutex> lock(progressMutex);
+  progressCallback = callback;
+  progressUser = user;
+}
+
+/*
+Non zero stops running and later deconvolutions after their current iteration, until it is set back to 0.
+*/
+void setCancelled(int value) {
+  cancelled = value;
+}
+
+/*
+Build the deconvolution kernels for a device.  The program can be re-used across calls to deconvCore on the same context.
+*/
+cl_program buildDeconvProgram(cl_context context, cl_device_id deviceID, cl_int * ret) {
+
+  // Create program from kernel source
+	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&programString, NULL, ret);	
+
+  logStatus("create program", *ret);
+
+  if (*ret!=0) {
+    return program;
+  }
+
+	// Build opencl program
+	*ret = clBuildProgram(program, 1, &deviceID, NULL, NULL, NULL);
+
+  logStatus("build program", *ret);
+
+  return program;
+}
+
+/*
+Create and bake the real to hermitian forward and hermitian to real backward plans used by deconvCore.
+clFFT must already be set up.
+*/
+cl_int createDeconvPlans(cl_context context, cl_command_queue commandQueue, size_t N0, size_t N1, size_t N2, clfftPlanHandle * planForward, clfftPlanHandle * planBackward) {
+
+  cl_int ret;
+  clfftDim dim = CLFFT_3D;
+  size_t clLengths[3] = {N0, N1, N2};
+  size_t imgStride[3] = {1, N0, N0*N1};
+  size_t fftStride[3] = {1, (N0/2+1), (N0/2+1)*N1};
+
+  // Create default plans for forward and backward FFT 
+  ret = clfftCreateDefaultPlan(planForward, context, dim, clLengths);
+  ret = clfftCreateDefaultPlan(planBackward, context, dim, clLengths);
+
+  logStatus("Create Default Plan", ret);
+  
+  // Set plan parameters for forward FFT
+  ret = clfftSetPlanPrecision(*planForward, CLFFT_SINGLE);
+  logStatus("clfft precision", ret);
+  ret = clfftSetLayout(*planForward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
+  logStatus("clfft set layout real hermittian interveaved", ret);
+  ret = clfftSetResultLocation(*planForward, CLFFT_OUTOFPLACE);
+  logStatus("clfft set result location", ret);
+  ret=clfftSetPlanInStride(*planForward, dim, imgStride);
+  logStatus("clfft set instride", ret);
+  ret=clfftSetPlanOutStride(*planForward, dim, fftStride);
+  logStatus("clfft set out stride", ret);
+
+  // Set plan parameters for backward FFT
+  ret = clfftSetPlanPrecision(*planBackward, CLFFT_SINGLE);
+  logStatus("clfft precision", ret);
+  ret = clfftSetLayout(*planBackward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
+  logStatus("clfft set layout real hermittian interveaved", ret);
+  ret = clfftSetResultLocation(*planBackward, CLFFT_OUTOFPLACE);
+  logStatus("clfft set result location", ret);
+  ret=clfftSetPlanInStride(*planBackward, dim, fftStride);
+  logStatus("clfft set instride", ret);
+  ret=clfftSetPlanOutStride(*planBackward, dim, imgStride);
+  logStatus("clfft set out stride", ret);
+ 
+  // Bake the plan. 
+  ret = clfftBakePlan(*planForward, 1, &commandQueue, NULL, NULL);
+  logStatus("Bake", ret);
+  
+  ret = clFinish(commandQueue);
+  logStatus("Finish Command Queue", ret);
+
+  return ret;
+}
+
+/*
+Richardson Lucy on device buffers.
+
+d_normal - optional non-circulant normalization factor, the estimate is divided by it after each update
+           (as in deconv_device).  Can be NULL.
+validDims - if not NULL and d_normal is NULL, the normal is built on the device for a measured region of 
+            validDims centered in the N0 x N1 x N2 volume (correlation of the region mask with the PSF, re-using
+            the OTF computed for the iterations). 
+program - program from buildDeconvProgram for this context, or NULL to build (and release) it here
+plans - cached {forward, backward} plans from createDeconvPlans for this size, or NULL to set up clFFT, create the 
+        plans and tear clFFT down again here
+halfStorage - d_observed and d_normal are half precision buffers (see setStorageMode)
+callStats - statistics of the calling entry point, or NULL to count this as a call of its own
+wienerRegularization - if > 0 the estimate is replaced by the Wiener estimate before the iterations (with 0 
+                       iterations that is the result), 0 keeps the estimate passed in, < 0 uses setWarmStart
+*/
+int deconvCore(int iterations, size_t N0, size_t N1, size_t N2, cl_mem d_observed, cl_mem d_psf, cl_mem d_estimate, cl_mem d_normal, const size_t * validDims, cl_context context, cl_command_queue commandQueue, cl_device_id deviceID, cl_program program, clfftPlanHandle * plans, bool halfStorage, CallStats * callStats, float wienerRegularization) {
+
+  cl_int ret;
+
+  CallStats ownStats(commandQueue, callStats == NULL);
+
+  if (callStats == NULL) {
+    callStats = &ownStats;
+  }
+  
+  // true if we create (and release) the normal here
+  bool ownNormal = false;
+
+  // true if the progress callback or setCancelled stopped the iterations
+  bool stopped = false;
+
+  // size in spatial domain
+  unsigned long n = N0*N1*N2;
 
   // size in frequency domain
   unsigned long nFreq=(N0/2+1)*N1*N2;
 
   // create memory for reblurred 	
   cl_mem d_reblurred = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate memory for reblurred %d\n", ret);
+  logStatus("create memory for reblurred", ret);
  
   // create memory for FFT of estimate and PSF 
 	cl_mem estimateFFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate PSF FFT %d\n", ret);
+  logStatus("create PSF FFT", ret);
  
   cl_mem psfFFT = clCreateBuffer(context, CL_MEM_READ_WRITE, 2*nFreq * sizeof(float), NULL, &ret);
-  printf("\ncreate Object FFT %d\n", ret);
+  logStatus("create Object FFT", ret);
 	
-  // Create kernels 	
-  // Create program from kernel source
-	cl_program program = clCreateProgramWithSource(context, 1, (const char **)&programString, NULL, &ret);	
-
-  printf("\ncreate program %d\n", ret);
+  // build the program unless the caller passes one already built for this device
+  bool ownProgram = (program == NULL);
 
-	// Build opencl program
-	ret = clBuildProgram(program, 1, &deviceID, NULL, NULL, NULL);
-
-  printf("\nbuild program %d\n", ret);
+  if (ownProgram) {
+    program = buildDeconvProgram(context, deviceID, &ret);
 
-  if (ret!=0) {
-    return ret;
+    if (ret!=0) {
+      return ret;
+    }
   }
 
 	// Create complex multiply kernel
 	cl_kernel kernelComplexMultiply = clCreateKernel(program, "vecComplexMultiply", &ret);
-  printf("\ncreate KERNEL in GPU %d\n", ret);
+  logStatus("create KERNEL in GPU", ret);
  
  	// Create complex conjugate multiply kernel
 	cl_kernel kernelComplexConjugateMultiply = clCreateKernel(program, "vecComplexConjugateMultiply", &ret);
-  printf("\ncreate KERNEL in GPU %d\n", ret);
+  logStatus("create KERNEL in GPU", ret);
  	
   // Create divide kernel
-	cl_kernel kernelDiv = clCreateKernel(program, "vecDiv", &ret);
-  printf("\ncreate Divide KERNEL in GPU %d\n", ret);
+	cl_kernel kernelDiv = clCreateKernel(program, halfStorage ? "vecDivHalf" : "vecDiv", &ret);
+  logStatus("create Divide KERNEL in GPU", ret);
  
   // Create multiply kernel
 	cl_kernel kernelMul = clCreateKernel(program, "vecMul", &ret);
-  printf("\ncreate Divide KERNEL in GPU %d\n", ret);
+  logStatus("create Divide KERNEL in GPU", ret);
+
+  // Create fused multiply and normalize kernel
+	cl_kernel kernelMulDivNormal = clCreateKernel(program, halfStorage ? "vecMulDivNormalHalf" : "vecMulDivNormal", &ret);
+  logStatus("create multiply/normalize KERNEL in GPU", ret);
+
+  // RL-TV multiply (and normalize), the result goes to the reblurred buffer and the buffers swap, the caller's 
+  // estimate buffer gets the result after the last iteration
+  const float lambda = tvRegularization;
+  cl_mem d_callerEstimate = d_estimate;
+  cl_kernel kernelMulTV = NULL;
+
+  if (lambda>0) {
+    kernelMulTV = clCreateKernel(program, halfStorage ? "vecMulTVHalf" : "vecMulTV", &ret);
+    logStatus("create TV multiply KERNEL in GPU", ret);
+  }
   
-  // FFT library related declarations 
+  // FFT plans, created here unless the caller passes cached {forward, backward} plans for this size
   clfftPlanHandle planHandleForward;
   clfftPlanHandle planHandleBackward;
-  clfftDim dim = CLFFT_3D;
-  size_t clLengths[3] = {N0, N1, N2};
-  size_t imgStride[3] = {1, N0, N0*N1};
-  size_t fftStride[3] = {1, (N0/2+1), (N0/2+1)*N1};
+  bool ownPlans = (plans == NULL);
 
-  // Setup clFFT
-  clfftSetupData fftSetup;
-  ret = clfftInitSetupData(&fftSetup);
-  printf("clfft init %d\n", ret);
-  ret = clfftSetup(&fftSetup);
-  printf("clfft setup %d\n", ret);
-  
-  // Create default plans for forward and backward FFT 
-  ret = clfftCreateDefaultPlan(&planHandleForward, context, dim, clLengths);
-  ret = clfftCreateDefaultPlan(&planHandleBackward, context, dim, clLengths);
+  callStats->mark();
 
-  printf("Create Default Plan %d\n", ret);
-  
-  // Set plan parameters for forward FFT
-  ret = clfftSetPlanPrecision(planHandleForward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
-  ret = clfftSetLayout(planHandleForward, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
-  ret = clfftSetResultLocation(planHandleForward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
-  ret=clfftSetPlanInStride(planHandleForward, dim, imgStride);
-  printf("clfft set instride %d\n", ret);
-  ret=clfftSetPlanOutStride(planHandleForward, dim, fftStride);
-  printf("clfft set out stride %d\n", ret);
+  if (ownPlans) {
+    // Setup clFFT
+    ret = acquireClfft();
+    logStatus("clfft setup", ret);
 
-  // Set plan parameters for backward FFT
-  ret = clfftSetPlanPrecision(planHandleBackward, CLFFT_SINGLE);
-  printf("clfft precision %d\n", ret);
-  ret = clfftSetLayout(planHandleBackward, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
-  printf("clfft set layout real hermittian interveaved %d\n", ret);
-  ret = clfftSetResultLocation(planHandleBackward, CLFFT_OUTOFPLACE);
-  printf("clfft set result location %d\n", ret);
-  ret=clfftSetPlanInStride(planHandleBackward, dim, fftStride);
-  printf("clfft set instride %d\n", ret);
-  ret=clfftSetPlanOutStride(planHandleBackward, dim, imgStride);
-  printf("clfft set out stride %d\n", ret);
- 
-  // Bake the plan. 
-  ret = clfftBakePlan(planHandleForward, 1, &commandQueue, NULL, NULL);
-  printf("Bake %d\n", ret);
-  
-  ret = clFinish(commandQueue);
-  printf("Finish Command Queue %d\n", ret);
+    ret = createDeconvPlans(context, commandQueue, N0, N1, N2, &planHandleForward, &planHandleBackward);
+  }
+  else {
+    planHandleForward = plans[0];
+    planHandleBackward = plans[1];
+  }
+
+  callStats->phase(STATS_PLAN_SECONDS);
 
   // compute item sizes 
   size_t localItemSize=64;
 	size_t globalItemSize= ceil((N2*N1*N0)/(float)localItemSize)*localItemSize;
 	size_t globalItemSizeFreq = ceil((nFreq+1000)/(float)localItemSize)*localItemSize;
-  printf("nFreq %d glbalItemSizeFreq %d\n",nFreq, globalItemSizeFreq);
+  logMessage(LOG_DEBUG, "nFreq %d glbalItemSizeFreq %d\n",nFreq, globalItemSizeFreq);
+
+  // number of spatial elements as passed to the kernels
+  unsigned int nKernel = (unsigned int)n;
   
    // FFT of PSF
   ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_psf, &psfFFT, NULL);
 
-  printf("FFT of PSF %d\n", ret);
+  logStatus("FFT of PSF", ret);
+
+  callStats->phase(STATS_OTF_SECONDS);
+  callStats->add(STATS_FFTS, 1);
+
+  if ((d_normal==NULL) && (validDims!=NULL)) {
+    // build the normal from the measured region and the OTF, see 
+    // http://bigwww.epfl.ch/deconvolution/challenge2013/index.html?p=doc_math_rl 
+    d_normal = clCreateBuffer(context, CL_MEM_READ_WRITE, n * sizeof(float), NULL, &ret);
+    logStatus("create memory for normal", ret);
+    
+    if (ret!=0) {
+      return ret;
+    }
+
+    ownNormal = true;
+
+    cl_kernel kernelMask = clCreateKernel(program, "setNormalMask", &ret);
+    cl_kernel kernelRemoveSmall = clCreateKernel(program, "vecRemoveSmallValues", &ret);
+
+    unsigned int extendedDims[3] = {(unsigned int)N0, (unsigned int)N1, (unsigned int)N2};
+    unsigned int measuredDims[3] = {(unsigned int)validDims[0], (unsigned int)validDims[1], (unsigned int)validDims[2]};
+
+    ret = callMaskKernel(kernelMask, d_normal, extendedDims, measuredDims, commandQueue, globalItemSize, localItemSize);
+
+    // correlate mask with PSF
+    ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_normal, &estimateFFT, NULL);
+    ret = callKernel(kernelComplexConjugateMultiply, estimateFFT, psfFFT, estimateFFT, nFreq, commandQueue, globalItemSizeFreq, localItemSize);
+    ret = clfftEnqueueTransform(planHandleBackward, CLFFT_BACKWARD, 1, &commandQueue, 0, NULL, NULL, &estimateFFT, &d_normal, NULL);
+
+    // replace ~0 values outside the support
+    ret = clSetKernelArg(kernelRemoveSmall, 0, sizeof(cl_mem), (void *)&d_normal);
+    ret = clSetKernelArg(kernelRemoveSmall, 1, sizeof(unsigned int), &nKernel);
+    ret = clEnqueueNDRangeKernel(commandQueue, kernelRemoveSmall, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
+    
+    ret = clFinish(commandQueue);
+    logStatus("create normal", ret);
+
+    clReleaseKernel(kernelMask);
+    clReleaseKernel(kernelRemoveSmall);
+
+    if (halfStorage) {
+      cl_mem d_normalHalf = convertToHalf(context, commandQueue, program, d_normal, n, &ret);
+      clReleaseMemObject(d_normal);
+      d_normal = d_normalHalf;
+
+      if (ret!=CL_SUCCESS) {
+        return ret;
+      }
+    }
+
+    // the normal is built from the OTF, so it is counted with it
+    callStats->phase(STATS_OTF_SECONDS);
+    callStats->add(STATS_FFTS, 2);
+  }
+
+  if (wienerRegularization<0) {
+    wienerRegularization = warmStart;
+  }
+
+  if (wienerRegularization>0) {
+    // Wiener estimate from the OTF above, the reblurred buffer holds the observed image as float for the FFT
+    cl_mem d_observedFloat = d_observed;
+
+    if (halfStorage) {
+      cl_kernel kernelToFloat = clCreateKernel(program, "vecHalfToFloat", &ret);
+      ret = clSetKernelArg(kernelToFloat, 0, sizeof(cl_mem), (void *)&d_observed);
+      ret = clSetKernelArg(kernelToFloat, 1, sizeof(cl_mem), (void *)&d_reblurred);
+      ret = clSetKernelArg(kernelToFloat, 2, sizeof(unsigned int), &nKernel);
+      ret = clEnqueueNDRangeKernel(commandQueue, kernelToFloat, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);
+      clReleaseKernel(kernelToFloat);
+      d_observedFloat = d_reblurred;
+    }
+
+    ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_observedFloat, &estimateFFT, NULL);
+    callStats->phase(STATS_FFT_SECONDS);
+
+    cl_kernel kernelWiener = clCreateKernel(program, "vecWiener", &ret);
+    unsigned int nFreqKernel = (unsigned int)nFreq;
+    ret = clSetKernelArg(kernelWiener, 0, sizeof(cl_mem), (void *)&estimateFFT);
+    ret = clSetKernelArg(kernelWiener, 1, sizeof(cl_mem), (void *)&psfFFT);
+    ret = clSetKernelArg(kernelWiener, 2, sizeof(cl_mem), (void *)&estimateFFT);
+    ret = clSetKernelArg(kernelWiener, 3, sizeof(float), &wienerRegularization);
+    ret = clSetKernelArg(kernelWiener, 4, sizeof(unsigned int), &nFreqKernel);
+    ret = clEnqueueNDRangeKernel(commandQueue, kernelWiener, 1, NULL, &globalItemSizeFreq, &localItemSize, 0, NULL, NULL);
+    logStatus("wiener", ret);
+    clReleaseKernel(kernelWiener);
+    callStats->phase(STATS_POINTWISE_SECONDS);
+
+    ret = clfftEnqueueTransform(planHandleBackward, CLFFT_BACKWARD, 1, &commandQueue, 0, NULL, NULL, &estimateFFT, &d_estimate, NULL);
+    callStats->phase(STATS_FFT_SECONDS);
+
+    // RL can't grow an estimate of 0, so a warm start is kept slightly positive, a preview only drops the negatives
+    float lowest = iterations>0 ? WARM_START_FLOOR : 0.0f;
+    cl_kernel kernelClamp = clCreateKernel(program, "vecClampMin", &ret);
+    ret = clSetKernelArg(kernelClamp, 0, sizeof(cl_mem), (void *)&d_estimate);
+    ret = clSetKernelArg(kernelClamp, 1, sizeof(float), &lowest);
+    ret = clSetKernelArg(kernelClamp, 2, sizeof(unsigned int), &nKernel);
+    ret = clEnqueueNDRangeKernel(commandQueue, kernelClamp, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);
+    clReleaseKernel(kernelClamp);
+
+    ret = clFinish(commandQueue);
+    logStatus("wiener estimate", ret);
+    callStats->phase(STATS_POINTWISE_SECONDS);
+    callStats->add(STATS_FFTS, 2);
+  }
 
   for (int i=0;i<iterations;i++) {
       // FFT of estimate
       ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_estimate, &estimateFFT, NULL);
       //printf("fft1 %d\n", ret);
+      callStats->phase(STATS_FFT_SECONDS);
 
       // complex multipy estimate FFT and PSF FFT
       ret = callKernel(kernelComplexMultiply, estimateFFT, psfFFT, estimateFFT, nFreq, commandQueue, globalItemSizeFreq, localItemSize);
       //printf("kernel complex %d\n", ret);
+      callStats->phase(STATS_POINTWISE_SECONDS);
       
       // Inverse to get reblurred
       ret = clfftEnqueueTransform(planHandleBackward, CLFFT_BACKWARD, 1, &commandQueue, 0, NULL, NULL, &estimateFFT, &d_reblurred, NULL);
       //printf("fft2 %d\n", ret);
+      callStats->phase(STATS_FFT_SECONDS);
       
       // divide observed by reblurred
       ret = callKernel(kernelDiv, d_observed, d_reblurred, d_reblurred, n, commandQueue, globalItemSize, localItemSize);
       
       if (ret!=0) {
-        printf("kernel div %d\n", ret);
+        logStatus("kernel div", ret);
       }
+      callStats->phase(STATS_POINTWISE_SECONDS);
       
       // FFT of observed/reblurred 
       ret = clfftEnqueueTransform(planHandleForward, CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_reblurred, &estimateFFT, NULL);
       //printf("fft %d\n", ret);
+      callStats->phase(STATS_FFT_SECONDS);
       
       // Correlate above result with PSF 
       ret = callKernel(kernelComplexConjugateMultiply, estimateFFT, psfFFT, estimateFFT, nFreq, commandQueue, globalItemSizeFreq, localItemSize);
-      printf("correlate %d\n", ret);
+      logStatus("correlate", ret);
+      callStats->phase(STATS_POINTWISE_SECONDS);
       
       // Inverse FFT to get update factor 
       ret = clfftEnqueueTransform(planHandleBackward, CLFFT_BACKWARD, 1, &commandQueue, 0, NULL, NULL, &estimateFFT, &d_reblurred, NULL);
-
-      // multiply estimate by update factor 
-      ret = callKernel(kernelMul, d_estimate, d_reblurred, d_estimate, n, commandQueue, globalItemSize, localItemSize);
+      callStats->phase(STATS_FFT_SECONDS);
+
+      if (lambda>0) {
+        // multiply estimate by update factor with the TV term (and divide by normal) into reblurred, then swap
+        unsigned int hasNormal = d_normal!=NULL ? 1 : 0;
+        cl_mem normalArg = d_normal!=NULL ? d_normal : d_reblurred;
+        unsigned int dims[3] = {(unsigned int)N0, (unsigned int)N1, (unsigned int)N2};
+
+        ret = clSetKernelArg(kernelMulTV, 0, sizeof(cl_mem), (void *)&d_estimate);
+        ret = clSetKernelArg(kernelMulTV, 1, sizeof(cl_mem), (void *)&d_reblurred);
+        ret = clSetKernelArg(kernelMulTV, 2, sizeof(cl_mem), (void *)&normalArg);
+        ret = clSetKernelArg(kernelMulTV, 3, sizeof(cl_mem), (void *)&d_reblurred);
+        ret = clSetKernelArg(kernelMulTV, 4, sizeof(float), &lambda);
+        ret = clSetKernelArg(kernelMulTV, 5, sizeof(unsigned int), &hasNormal);
+        ret = clSetKernelArg(kernelMulTV, 6, sizeof(unsigned int), &dims[0]);
+        ret = clSetKernelArg(kernelMulTV, 7, sizeof(unsigned int), &dims[1]);
+        ret = clSetKernelArg(kernelMulTV, 8, sizeof(unsigned int), &dims[2]);
+        ret = clEnqueueNDRangeKernel(commandQueue, kernelMulTV, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
+
+        cl_mem swap = d_estimate;
+        d_estimate = d_reblurred;
+        d_reblurred = swap;
+      }
+      else if (d_normal!=NULL) {
+        // multiply estimate by update factor and divide by normal
+        ret = clSetKernelArg(kernelMulDivNormal, 0, sizeof(cl_mem), (void *)&d_estimate);
+        ret = clSetKernelArg(kernelMulDivNormal, 1, sizeof(cl_mem), (void *)&d_reblurred);
+        ret = clSetKernelArg(kernelMulDivNormal, 2, sizeof(cl_mem), (void *)&d_normal);
+        ret = clSetKernelArg(kernelMulDivNormal, 3, sizeof(cl_mem), (void *)&d_estimate);
+        ret = clSetKernelArg(kernelMulDivNormal, 4, sizeof(unsigned int), &nKernel);
+        ret = clEnqueueNDRangeKernel(commandQueue, kernelMulDivNormal, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);	
+      }
+      else {
+        // multiply estimate by update factor 
+        ret = callKernel(kernelMul, d_estimate, d_reblurred, d_estimate, n, commandQueue, globalItemSize, localItemSize);
+      }
       //printf("update %d\n", ret);
       
       ret = clFinish(commandQueue);
+      callStats->phase(STATS_POINTWISE_SECONDS);
+      callStats->add(STATS_ITERATIONS, 1);
+      callStats->add(STATS_FFTS, 4);
 
-      printf("Finished iteration %d\n",i);
+      logMessage(LOG_DEBUG, "Finished iteration %d\n", i);
+
+      // the queue is finished above, so the callback sees the iterations that really finished
+      if (!continueIterating(i + 1, iterations)) {
+        logMessage(LOG_INFO, "cancelled after %d iterations\n", i + 1);
+        stopped = true;
+        break;
+      }
 
   }  
+
+  if (d_estimate!=d_callerEstimate) {
+    // after an odd number of RL-TV iterations the result is in our buffer
+    ret = clEnqueueCopyBuffer(commandQueue, d_estimate, d_callerEstimate, 0, 0, n*sizeof(float), 0, NULL, NULL);
+    ret = clFinish(commandQueue);
+    logStatus("copy TV estimate", ret);
+
+    d_reblurred = d_estimate;
+    d_estimate = d_callerEstimate;
+  }
+
+  if (callStats->level) {
+    // reblurred, estimate FFT, PSF FFT and the normal built here, the clFFT temp buffers are only known once the 
+    // plans ran
+    size_t tmpForward = 0, tmpBackward = 0;
+    clfftGetTmpBufSize(planHandleForward, &tmpForward);
+    clfftGetTmpBufSize(planHandleBackward, &tmpBackward);
+
+    callStats->add(STATS_PEAK_BYTES, n*sizeof(float) + 2*2*nFreq*sizeof(float) + tmpForward + tmpBackward + (ownNormal ? n*sizeof(float) : 0));
+  }
  
    // Release OpenCL memory objects. 
   clReleaseMemObject( d_reblurred);
   clReleaseMemObject( psfFFT );
   clReleaseMemObject( estimateFFT );
 
-   // Release the plan. 
-   ret = clfftDestroyPlan( &planHandleBackward );
+  if (ownNormal) {
+    clReleaseMemObject( d_normal );
+  }
 
-   // Release clFFT library. 
-   clfftTeardown( );
+  clReleaseKernel(kernelComplexMultiply);
+  clReleaseKernel(kernelComplexConjugateMultiply);
+  clReleaseKernel(kernelDiv);
+  clReleaseKernel(kernelMul);
+  clReleaseKernel(kernelMulDivNormal);
+
+  if (kernelMulTV!=NULL) {
+    clReleaseKernel(kernelMulTV);
+  }
+
+  if (ownProgram) {
+    clReleaseProgram(program);
+  }
 
+  if (ownPlans) {
+    // Release the plan. 
+    ret = clfftDestroyPlan( &planHandleForward );
+    ret = clfftDestroyPlan( &planHandleBackward );
 
+    // Release clFFT library. 
+    releaseClfft();
+  }
+
+  return stopped ? DECONV_CANCELLED : ret;
 }
 
-int deconv(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float * normal) {
+/*
+d_normal - optional non-circulant normalization factor (as cl_mem), pass 0 for circulant RL
+*/
+int deconv_long(int iterations, size_t N0, size_t N1, size_t N2, long l_observed, long l_psf, long l_estimate, long l_normal, long l_context, long l_queue, long l_device) {
+
+  // cast long pointers to cl types and run RL
+  return deconvCore(iterations, N0, N1, N2, (cl_mem)l_observed, (cl_mem)l_psf, (cl_mem)l_estimate, (cl_mem)l_normal, NULL, 
+      (cl_context)l_context, (cl_command_queue)l_queue, (cl_device_id)l_device, NULL, NULL, false);
+}
+
+/*
+Richardson Lucy with non-circulant edge handling.  The normal is built on the device from the OTF for a 
+measured region of M0 x M1 x M2 centered in the extended N0 x N1 x N2 volume.
+*/
+int deconv_noncirculant_long(int iterations, size_t N0, size_t N1, size_t N2, size_t M0, size_t M1, size_t M2, long l_observed, long l_psf, long l_estimate, long l_context, long l_queue, long l_device) {
+  
+  size_t validDims[3] = {M0, M1, M2};
+
+  return deconvCore(iterations, N0, N1, N2, (cl_mem)l_observed, (cl_mem)l_psf, (cl_mem)l_estimate, NULL, validDims, 
+      (cl_context)l_context, (cl_command_queue)l_queue, (cl_device_id)l_device, NULL, NULL, false);
+}
+
+
+/*
+Host memory version of deconvCore on an existing context and queue, transfers (or wraps, see setHostMemoryMode) 
+the host arrays and runs RL.  program, plans and wienerRegularization are passed through to deconvCore (NULL to 
+create the program and plans per call).  With a Wiener start h_out is only written.
+*/
+int deconvHostOnQueue(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float * normal, const size_t * validDims, cl_context context, cl_command_queue commandQueue, cl_device_id deviceID, cl_program program, clfftPlanHandle * plans, CallStats * callStats, float wienerRegularization) {
+
+  cl_int ret;
+
+  CallStats ownStats(commandQueue, callStats == NULL);
+
+  if (callStats == NULL) {
+    callStats = &ownStats;
+  }
+
+  bool zeroCopy = useZeroCopy(deviceID);
+  bool halfStorage = (storageMode == STORAGE_HALF);
+  size_t n = N2*N1*N0;
+  size_t bytes = n * sizeof(float);
+
+  if (wienerRegularization<0) {
+    wienerRegularization = warmStart;
+  }
+
+  // the Wiener estimate replaces the first guess, so it isn't copied to the device
+  bool uploadEstimate = !(wienerRegularization>0);
+
+  // the half conversion needs the program, build it here if the caller didn't pass one (and pass it on to deconvCore)
+  bool ownProgram = false;
+
+  if (halfStorage && program == NULL) {
+    program = buildDeconvProgram(context, deviceID, &ret);
+
+    if (ret!=0) {
+      return ret;
+    }
+
+    ownProgram = true;
+  }
+
+  cl_mem d_observed, d_psf, d_estimate;
+
+  callStats->mark();
+
+  if (halfStorage) {
+    // the observed image is only read by the divide kernel, so it is stored as half 
+    d_observed = uploadHalf(context, commandQueue, program, h_image, n, &ret);
+    logStatus("create half mem for image", ret);
+  }
+
+  if (zeroCopy) {
+    // on CPU and integrated devices use the host arrays (or mapped host memory) instead of device copies
+    if (!halfStorage) {
+      d_observed = createHostBuffer(context, commandQueue, bytes, h_image, true, &ret);
+      logStatus("create host mem for image", ret);
+    }
+    d_psf = createHostBuffer(context, commandQueue, bytes, h_psf, true, &ret);
+    logStatus("create host mem for psf", ret);
+    d_estimate = createHostBuffer(context, commandQueue, bytes, h_out, true, &ret);
+    logStatus("create host mem for estimate", ret);
+  }
+  else {
+    // create device memory buffers for each array
+    if (!halfStorage) {
+      d_observed = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+      logStatus("create gpu mem for image", ret);
+    }
+    d_psf = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    logStatus("create gpu mem for psf", ret);
+    d_estimate = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    logStatus("create variable 3", ret);
+ 
+    logMessage(LOG_DEBUG, "allocated memory\n");
+
+    // Copy lists to memory buffers
+    if (!halfStorage) {
+      ret = clEnqueueWriteBuffer(commandQueue, d_observed, CL_TRUE, 0, bytes, h_image, 0, NULL, NULL);
+      logStatus("copy to GPU", ret);
+    }
+    ret = clEnqueueWriteBuffer(commandQueue, d_psf, CL_TRUE, 0, bytes, h_psf, 0, NULL, NULL);
+    logStatus("copy to GPU", ret);
+    if (uploadEstimate) {
+      ret = clEnqueueWriteBuffer(commandQueue, d_estimate, CL_TRUE, 0, bytes, h_out, 0, NULL, NULL);
+      logStatus("copy to GPU", ret);
+    }
+  }
+
+  // non-circulant normalization factor (optional)
+  cl_mem d_normal = NULL;
+
+  if (normal != NULL) {
+    if (halfStorage) {
+      d_normal = uploadHalf(context, commandQueue, program, normal, n, &ret);
+    }
+    else if (zeroCopy) {
+      d_normal = createHostBuffer(context, commandQueue, bytes, normal, true, &ret);
+    }
+    else {
+      d_normal = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &ret);
+      ret = clEnqueueWriteBuffer(commandQueue, d_normal, CL_TRUE, 0, bytes, normal, 0, NULL, NULL);
+    }
+    logStatus("copy normal to GPU", ret);
+  }
+
+  callStats->phase(STATS_TRANSFER_SECONDS);
+
+  if (callStats->level) {
+    // half storage uploads float and converts on the device, zero copy buffers aren't copied (as far as we can tell)
+    size_t arrays = (normal != NULL ? 4 : 3) - (uploadEstimate ? 0 : 1);
+    size_t halfArrays = halfStorage ? (normal != NULL ? 2 : 1) : 0;
+
+    callStats->add(STATS_BYTES_TO_DEVICE, (zeroCopy ? halfArrays : arrays) * bytes);
+    callStats->add(STATS_PEAK_BYTES, (zeroCopy ? 0 : (arrays - halfArrays) * bytes) + halfArrays * bytes / 2);
+  }
+
+  logMessage(LOG_DEBUG, "Call deconv with cl buffers\n");
+  int deconvRet = deconvCore(iterations, N0, N1, N2, d_observed, d_psf, d_estimate, d_normal, validDims, context, commandQueue, deviceID, program, plans, halfStorage, callStats, wienerRegularization); 
+    
+  // copy back to host 
+  if (zeroCopy) {
+    ret = readHostBuffer(commandQueue, d_estimate, bytes, h_out);
+  }
+  else {
+    ret = clEnqueueReadBuffer( commandQueue, d_estimate, CL_TRUE, 0, bytes, h_out, 0, NULL, NULL );
+    callStats->add(STATS_BYTES_FROM_DEVICE, bytes);
+  }
+
+  callStats->phase(STATS_TRANSFER_SECONDS);
+ 
+  // Release OpenCL memory objects. 
+  clReleaseMemObject( d_estimate);
+  clReleaseMemObject( d_observed );
+  clReleaseMemObject( d_psf);
+
+  if (d_normal != NULL) {
+    clReleaseMemObject( d_normal );
+  }
+
+  if (ownProgram) {
+    clReleaseProgram(program);
+  }
+  
+  return deconvRet!=0 ? deconvRet : ret;
+}
+
+/*
+Host memory version of deconvCore on the default device.
+*/
+static int deconvHost(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float * normal, const size_t * validDims, float wienerRegularization = -1) {
 
   cl_platform_id platformId = NULL;
 	cl_device_id deviceID = NULL;
@@ -947,50 +2226,83 @@ int deconv(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, floa
 	cl_uint retNumPlatforms;
 
   cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
-  printf("\ncreated platform %d \n",ret);
+  logStatus("created platform", ret);
 	
   ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
-  printf("\nget device IDs %d \n",ret);
+  logStatus("get device IDs", ret);
 	
   // Creating context.
 	cl_context context = clCreateContext(NULL, 1, &deviceID, NULL, NULL,  &ret);
-  printf("created context %d\n", ret);
+  logStatus("created context", ret);
 
 	// Creating command queue
 	cl_command_queue commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
-  printf("created command queue %d\n", ret);
+  logStatus("created command queue", ret);
 	
-  // create device memory buffers for each array
-	cl_mem d_observed = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate gpu mem for image %d\n", ret);
-	cl_mem d_psf = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate gpu mem for psf %d\n", ret);
-	cl_mem d_estimate = clCreateBuffer(context, CL_MEM_READ_WRITE, N2*N1*N0 * sizeof(float), NULL, &ret);
-  printf("\ncreate variable 3 %d\n", ret);
- 
-  printf("\nallocated memory\n");
+  // axes the multiresolution factor divides (and leaves at least 2 voxels), slowest first
+  const size_t dims[3] = {N2, N1, N0};
+  const int factor = multiresolutionFactor;
+  const int coarseIterations = std::min((int)multiresolutionIterations, iterations);
+  int f[3];
+  bool binned = false;
+
+  for (int d = 0; d < 3; d++) {
+    f[d] = factor > 1 && dims[d] % factor == 0 && dims[d] / factor >= 2 ? factor : 1;
+    binned = binned || f[d] > 1;
+  }
 
-  // Copy lists to memory buffers
-	ret = clEnqueueWriteBuffer(commandQueue, d_observed, CL_TRUE, 0, N2*N1*N0 * sizeof(float), h_image, 0, NULL, NULL);;
-  printf("\ncopy to GPU  %d\n", ret);
-	ret = clEnqueueWriteBuffer(commandQueue, d_psf, CL_TRUE, 0, N2*N1*N0 * sizeof(float), h_psf, 0, NULL, NULL);
-  printf("\ncopy to GPU  %d\n", ret);
-	ret = clEnqueueWriteBuffer(commandQueue, d_estimate, CL_TRUE, 0, N2*N1*N0 * sizeof(float), h_out, 0, NULL, NULL);
-  printf("\ncopy to GPU  %d\n", ret);
+  if (!binned || coarseIterations == 0) {
+    ret = deconvHostOnQueue(iterations, N0, N1, N2, h_image, h_psf, h_out, normal, validDims, context, commandQueue, deviceID, NULL, NULL, NULL, wienerRegularization);
+  }
+  else {
+    const size_t coarse[3] = {N2 / f[0], N1 / f[1], N0 / f[2]};
+    const size_t coarseSize = coarse[0] * coarse[1] * coarse[2];
 
-  unsigned long n = N0*N1*N2;
-  unsigned long nFreq=(N0/2+1)*N1*N2;
+    logMessage(LOG_INFO, "coarse %zu x %zu x %zu for %d of %d iterations\n", coarse[2], coarse[1], coarse[0], coarseIterations, iterations);
 
-  printf("Call deconv with long pointers\n\n");
-  deconv_long(iterations, N0, N1, N2, (long)d_observed, (long)d_psf, (long)d_estimate, (long)0, (long)context, (long)commandQueue, (long)deviceID); 
-    
-  // copy back to host 
-  ret = clEnqueueReadBuffer( commandQueue, d_estimate, CL_TRUE, 0, N0*N1*N2*sizeof(float), h_out, 0, NULL, NULL );
- 
-  // Release OpenCL memory objects. 
-  clReleaseMemObject( d_estimate);
-  clReleaseMemObject( d_observed );
-  clReleaseMemObject( d_psf);
+    float * c_image = (float*)malloc(coarseSize * sizeof(float));
+    float * c_psf = (float*)malloc(coarseSize * sizeof(float));
+    float * c_out = (float*)malloc(coarseSize * sizeof(float));
+    float * c_normal = normal != NULL ? (float*)malloc(coarseSize * sizeof(float)) : NULL;
+
+    resampleVolume(h_image, c_image, dims, f, false, false);
+    resampleVolume(h_psf, c_psf, dims, f, false, true);
+    resampleVolume(h_out, c_out, dims, f, false, false);
+
+    if (normal != NULL) {
+      resampleVolume(normal, c_normal, dims, f, false, false);
+    }
+
+    // the measured region of deconv_noncirculant, rounded up to whole coarse voxels
+    size_t c_validDims[3];
+
+    if (validDims != NULL) {
+      c_validDims[0] = (validDims[0] + f[2] - 1) / f[2];
+      c_validDims[1] = (validDims[1] + f[1] - 1) / f[1];
+      c_validDims[2] = (validDims[2] + f[0] - 1) / f[0];
+    }
+
+    progressDone = 0;
+    progressTotal = iterations;
+
+    ret = deconvHostOnQueue(coarseIterations, coarse[2], coarse[1], coarse[0], c_image, c_psf, c_out, c_normal, validDims != NULL ? c_validDims : NULL, context, commandQueue, deviceID, NULL, NULL, NULL, wienerRegularization);
+
+    resampleVolume(c_out, h_out, coarse, f, true, false);
+
+    free(c_image);
+    free(c_psf);
+    free(c_out);
+    free(c_normal);
+
+    if (ret == CL_SUCCESS && coarseIterations < iterations) {
+      // the remaining iterations start from the upsampled estimate, not a Wiener estimate
+      progressDone = coarseIterations;
+      ret = deconvHostOnQueue(iterations - coarseIterations, N0, N1, N2, h_image, h_psf, h_out, normal, validDims, context, commandQueue, deviceID, NULL, NULL, NULL, 0);
+    }
+
+    progressDone = 0;
+    progressTotal = 0;
+  }
 
    // Release OpenCL working objects.
    clReleaseCommandQueue( commandQueue );
@@ -998,3 +2310,127 @@ int deconv(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, floa
   
   return ret;
 }
+
+/*
+normal - optional non-circulant normalization factor (NULL for circulant RL).  Each iteration the estimate
+         is divided by the normal, as in deconv_device.
+*/
+int deconv(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float * normal) {
+  return deconvHost(iterations, N0, N1, N2, h_image, h_psf, h_out, normal, NULL);
+}
+
+/*
+Non-circulant RL where the normal is built on the device, M0 x M1 x M2 is the size of the measured image 
+centered in the extended N0 x N1 x N2 volume.
+*/
+int deconv_noncirculant(int iterations, size_t N0, size_t N1, size_t N2, size_t M0, size_t M1, size_t M2, float *h_image, float *h_psf, float *h_out) {
+  size_t validDims[3] = {M0, M1, M2};
+
+  return deconvHost(iterations, N0, N1, N2, h_image, h_psf, h_out, NULL, validDims);
+}
+
+/*
+Wiener (Tikhonov regularized inverse) filter, a one pass preview: one forward FFT of the image, 
+conj(OTF)/(|OTF|^2 + regularization*|OTF(0)|^2) and one inverse FFT, negative values set to 0.  The regularization
+is relative to the OTF at zero frequency (the PSF's sum squared), around 1e-3 to 1e-2 for noisy widefield data, 
+smaller keeps more detail and more noise.  The same estimate can start RL, see setWarmStart.
+*/
+int wiener(size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float regularization) {
+  if (!(regularization>0)) {
+    return CL_INVALID_VALUE;
+  }
+
+  logMessage(LOG_INFO, "wiener %d x %d x %d, regularization %g\n", (int)N0, (int)N1, (int)N2, regularization);
+
+  return deconvHost(0, N0, N1, N2, h_image, h_psf, h_out, NULL, NULL, regularization);
+}
+
+int wiener_long(size_t N0, size_t N1, size_t N2, long l_observed, long l_psf, long l_out, float regularization, long l_context, long l_queue, long l_device) {
+  if (!(regularization>0)) {
+    return CL_INVALID_VALUE;
+  }
+
+  return deconvCore(0, N0, N1, N2, (cl_mem)l_observed, (cl_mem)l_psf, (cl_mem)l_out, NULL, NULL, 
+      (cl_context)l_context, (cl_command_queue)l_queue, (cl_device_id)l_device, NULL, NULL, false, NULL, regularization);
+}
+
+/*
+Peak device memory in bytes of deconv (or deconv_noncirculant, see the PEAK_ flags in opencldeconv.h) on the default
+device, with the current storage and host memory modes: the reblurred and the two FFT buffers, the clFFT temp 
+buffers of the two plans, the normal (built in float and converted if half storage), and the copies of the host 
+arrays unless they are zero copy.  The plans are baked on the default device to get the clFFT temp size.
+Returns -1 on error.
+*/
+long long getPeakMemory(size_t N0, size_t N1, size_t N2, int flags) {
+
+  cl_platform_id platformId = NULL;
+  cl_device_id deviceID = NULL;
+  cl_uint retNumDevices;
+  cl_uint retNumPlatforms;
+
+  cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
+  ret |= clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
+
+  if (ret!=CL_SUCCESS) {
+    return -1;
+  }
+
+  cl_context context = clCreateContext(NULL, 1, &deviceID, NULL, NULL, &ret);
+  cl_command_queue commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
+
+  // clFFT allocates a temp buffer per plan on the first transform if the plan needs one
+  size_t tmpForward = 0, tmpBackward = 0;
+  clfftPlanHandle planForward, planBackward;
+
+  ret = acquireClfft();
+  ret |= createDeconvPlans(context, commandQueue, N0, N1, N2, &planForward, &planBackward);
+  ret |= clfftBakePlan(planBackward, 1, &commandQueue, NULL, NULL);
+  ret |= clfftGetTmpBufSize(planForward, &tmpForward);
+  ret |= clfftGetTmpBufSize(planBackward, &tmpBackward);
+
+  clfftDestroyPlan(&planForward);
+  clfftDestroyPlan(&planBackward);
+  releaseClfft();
+
+  bool zeroCopy = useZeroCopy(deviceID);
+
+  clReleaseCommandQueue(commandQueue);
+  clReleaseContext(context);
+
+  if (ret!=CL_SUCCESS) {
+    logStatus("get peak memory", ret);
+    return -1;
+  }
+
+  long long n = (long long)(N0*N1*N2);
+  long long nFreq = (long long)((N0/2+1)*N1*N2);
+  bool halfStorage = (storageMode == STORAGE_HALF);
+  long long storageBytes = halfStorage ? 2 : 4;
+
+  // reblurred, estimate FFT and PSF FFT
+  long long bytes = 4*n + 2*8*nFreq + (long long)(tmpForward + tmpBackward);
+
+  if (flags & PEAK_NONCIRCULANT) {
+    // built in float, and while it is converted the half copy exists as well
+    bytes += halfStorage ? 6*n : 4*n;
+  }
+  else if ((flags & PEAK_NORMAL) && (halfStorage || !zeroCopy)) {
+    bytes += storageBytes*n;
+  }
+
+  if (!(flags & PEAK_CALLER_BUFFERS)) {
+    // half storage always converts the image on the device, the PSF and estimate are copied unless zero copy
+    if (halfStorage) {
+      bytes += 2*n;
+    }
+    else if (!zeroCopy) {
+      bytes += 4*n;
+    }
+
+    if (!zeroCopy) {
+      bytes += 8*n;
+    }
+  }
+
+  return bytes;
+}
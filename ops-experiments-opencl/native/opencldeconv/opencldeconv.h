@@ -1,13 +1,113 @@
 #pragma once
 
+#include <stddef.h>
+
+// host memory modes for setHostMemoryMode
+// copy host arrays to device buffers (default, best for discrete GPUs)
+#define HOST_MEMORY_COPY 0
+// use zero copy host buffers if the device reports it shares memory with the host (CPU runtimes, integrated GPUs)
+#define HOST_MEMORY_AUTO 1
+// always use zero copy host buffers
+#define HOST_MEMORY_ZERO_COPY 2
+
+// storage modes for setStorageMode
+// observed image and normal stored as float (default)
+#define STORAGE_FLOAT 0
+// observed image and normal stored as half, the estimate and the FFT buffers stay float
+#define STORAGE_HALF 1
+
+// flags for getPeakMemory
+// a normal is passed to deconv
+#define PEAK_NORMAL 1
+// the normal is built on the device (deconv_noncirculant)
+#define PEAK_NONCIRCULANT 2
+// the _long entry points, the image, PSF and estimate are the caller's buffers and not counted
+#define PEAK_CALLER_BUFFERS 4
+
+// levels for enableStats, the statistics cover the RL entry points (deconv*, and the volumes of deconv_multidevice)
+// no statistics, the default (the calls only test a flag)
+#define STATS_OFF 0
+// counters and the total time of each call, no extra synchronization
+#define STATS_COUNTERS 1
+// also the time of each phase, the queue is finished after every phase so the phase times add up, which 
+// makes the calls a bit slower
+#define STATS_PHASES 2
+
+// indices into the array getStats fills, sums over the calls since resetStats
+// (except STATS_PEAK_BYTES, the largest of any call)
+#define STATS_PLAN_SECONDS 0
+#define STATS_OTF_SECONDS 1
+#define STATS_FFT_SECONDS 2
+#define STATS_POINTWISE_SECONDS 3
+#define STATS_TRANSFER_SECONDS 4
+#define STATS_TOTAL_SECONDS 5
+#define STATS_CALLS 6
+#define STATS_ITERATIONS 7
+#define STATS_FFTS 8
+#define STATS_BYTES_TO_DEVICE 9
+#define STATS_BYTES_FROM_DEVICE 10
+#define STATS_PEAK_BYTES 11
+#define STATS_COUNT 12
+
+// levels for setLogLevel, a message is printed if its level is at most the set level (errors go to stderr)
+#define LOG_NONE 0
+// errors only, the default
+#define LOG_ERROR 1
+// a line per call (devices, scheduling)
+#define LOG_INFO 2
+// every OpenCL and clFFT status and a line per iteration
+#define LOG_DEBUG 3
+
+// returned by the RL entry points when the run was cancelled, the estimate holds the last finished iteration
+// (outside the OpenCL and clFFT error codes)
+#define DECONV_CANCELLED -2000
+
+// called after every RL iteration with the number of finished iterations, returning non zero cancels the run
+typedef int (*ProgressCallback)(int iteration, int iterations, void * user);
+
 #ifdef _WIN64
  __declspec(dllexport) void test();
  __declspec(dllexport) int conv(size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out);
  __declspec(dllexport) int deconv(int iterations, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out, float * normal);
  __declspec(dllexport) int deconv_long(int iterations, size_t N0, size_t N1, size_t N2, long d_image, long d_psf, long d_update, long d_normal, long l_context, long l_queuee, long l_device); 
+ __declspec(dllexport) int deconv_noncirculant(int iterations, size_t N0, size_t N1, size_t N2, size_t M0, size_t M1, size_t M2, float *h_image, float *h_psf, float *h_out);
+ __declspec(dllexport) int deconv_noncirculant_long(int iterations, size_t N0, size_t N1, size_t N2, size_t M0, size_t M1, size_t M2, long d_image, long d_psf, long d_update, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) int wiener(size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float regularization);
+ __declspec(dllexport) int wiener_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf, long l_out, float regularization, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) int setWarmStart(float regularization);
+ __declspec(dllexport) int setTVRegularization(float lambda);
+ __declspec(dllexport) int setMultiresolution(int factor, int iterations);
  __declspec(dllexport)  int fft2d(size_t N1, size_t N2, float *h_image, float * h_out);
  __declspec(dllexport)  int fft2d_long(long N1, long N2, long h_image, long h_out, long l_context, long l_queue);
  __declspec(dllexport)  int fftinv2d(size_t N1, size_t N2, float *h_fft, float * h_out);
+ __declspec(dllexport) int fft2d_batch(size_t N0, size_t N1, size_t numPlanes, float * h_image, float * h_out);
+ __declspec(dllexport) int fftinv2d_batch(size_t N0, size_t N1, size_t numPlanes, float * h_fft, float * h_out);
+ __declspec(dllexport) int fft2d_batch_long(size_t N0, size_t N1, size_t numPlanes, long l_image, long l_out, long l_context, long l_queue);
+ __declspec(dllexport) int fftinv2d_batch_long(size_t N0, size_t N1, size_t numPlanes, long l_fft, long l_out, long l_context, long l_queue);
+ __declspec(dllexport) void releaseFFTBatchPlans();
+ __declspec(dllexport) int setHostMemoryMode(int mode);
+ __declspec(dllexport) int setStorageMode(int mode);
+ __declspec(dllexport) long long getPeakMemory(size_t N0, size_t N1, size_t N2, int flags);
+ __declspec(dllexport) float * allocHostBuffer(size_t n);
+ __declspec(dllexport) void freeHostBuffer(float * buffer);
+ __declspec(dllexport) int getNumOpenCLDevices();
+ __declspec(dllexport) int getOpenCLDeviceName(int device, char * name, size_t size);
+ __declspec(dllexport) int setOpenCLDeviceEnabled(int device, int enabled);
+ __declspec(dllexport) double getOpenCLDeviceThroughput(int device);
+ __declspec(dllexport) int deconv_multidevice(int iterations, size_t N0, size_t N1, size_t N2, size_t numVolumes, float * h_images, float * h_psf, float * h_out, float * h_normal);
+ __declspec(dllexport) void releaseOpenCLDevices();
+ __declspec(dllexport) int sum_long(size_t n, long l_buffer, float * result, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) int mean_long(size_t n, long l_buffer, float * result, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) int minmax_long(size_t n, long l_buffer, float * min, float * max, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) int idivergence_long(size_t n, long l_observed, long l_reblurred, float * result, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) int normalize_long(size_t n, long l_buffer, float * sum, long l_context, long l_queue, long l_device);
+ __declspec(dllexport) void releaseReductionPrograms();
+ __declspec(dllexport) void enableStats(int level);
+ __declspec(dllexport) void resetStats();
+ __declspec(dllexport) int getStats(double * stats, int n);
+ __declspec(dllexport) void setLogLevel(int level);
+ __declspec(dllexport) void setProgressCallback(ProgressCallback callback, void * user);
+ __declspec(dllexport) void setCancelled(int cancelled);
 #else
 extern "C" {
   void test();
@@ -15,9 +115,44 @@ extern "C" {
   int conv_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf,  long l_output, bool correlate, long l_context, long l_queue, long l_device);
   int deconv(int iterations, size_t N1, size_t N2, size_t N3, float *h_image, float *h_psf, float *h_out, float * normal);
   int deconv_long(int iterations, size_t N0, size_t N1, size_t N2, long d_image, long d_psf, long d_update, long d_normal, long l_context, long l_queuee, long l_device); 
+  int deconv_noncirculant(int iterations, size_t N0, size_t N1, size_t N2, size_t M0, size_t M1, size_t M2, float *h_image, float *h_psf, float *h_out);
+  int deconv_noncirculant_long(int iterations, size_t N0, size_t N1, size_t N2, size_t M0, size_t M1, size_t M2, long d_image, long d_psf, long d_update, long l_context, long l_queue, long l_device);
+  int wiener(size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float regularization);
+  int wiener_long(size_t N0, size_t N1, size_t N2, long l_image, long l_psf, long l_out, float regularization, long l_context, long l_queue, long l_device);
+  int setWarmStart(float regularization);
+  int setTVRegularization(float lambda);
+  int setMultiresolution(int factor, int iterations);
   int fft2d(size_t N1, size_t N2, float *h_image, float * h_out);
   int fft2d_long(long N1, long N2, long h_image, long h_out, long l_context, long l_queue);
   int fftinv2d(size_t N1, size_t N2, float *h_fft, float * h_out);
+  int fft2d_batch(size_t N0, size_t N1, size_t numPlanes, float * h_image, float * h_out);
+  int fftinv2d_batch(size_t N0, size_t N1, size_t numPlanes, float * h_fft, float * h_out);
+  int fft2d_batch_long(size_t N0, size_t N1, size_t numPlanes, long l_image, long l_out, long l_context, long l_queue);
+  int fftinv2d_batch_long(size_t N0, size_t N1, size_t numPlanes, long l_fft, long l_out, long l_context, long l_queue);
+  void releaseFFTBatchPlans();
+  int setHostMemoryMode(int mode);
+  int setStorageMode(int mode);
+  long long getPeakMemory(size_t N0, size_t N1, size_t N2, int flags);
+  float * allocHostBuffer(size_t n);
+  void freeHostBuffer(float * buffer);
+  int getNumOpenCLDevices();
+  int getOpenCLDeviceName(int device, char * name, size_t size);
+  int setOpenCLDeviceEnabled(int device, int enabled);
+  double getOpenCLDeviceThroughput(int device);
+  int deconv_multidevice(int iterations, size_t N0, size_t N1, size_t N2, size_t numVolumes, float * h_images, float * h_psf, float * h_out, float * h_normal);
+  void releaseOpenCLDevices();
+  int sum_long(size_t n, long l_buffer, float * result, long l_context, long l_queue, long l_device);
+  int mean_long(size_t n, long l_buffer, float * result, long l_context, long l_queue, long l_device);
+  int minmax_long(size_t n, long l_buffer, float * min, float * max, long l_context, long l_queue, long l_device);
+  int idivergence_long(size_t n, long l_observed, long l_reblurred, float * result, long l_context, long l_queue, long l_device);
+  int normalize_long(size_t n, long l_buffer, float * sum, long l_context, long l_queue, long l_device);
+  void releaseReductionPrograms();
+  void enableStats(int level);
+  void resetStats();
+  int getStats(double * stats, int n);
+  void setLogLevel(int level);
+  void setProgressCallback(ProgressCallback callback, void * user);
+  void setCancelled(int cancelled);
 }
 #endif
 
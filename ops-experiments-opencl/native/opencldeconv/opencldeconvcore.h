@@ -0,0 +1,48 @@
+#pragma once
+
+// Internal (not exported) pieces of the RL implementation shared by the single device entry points in 
+// opencldeconv.cpp and the multi device scheduler in openclmultidevice.cpp
+
+#include "CL/cl.h"
+#include "clFFT.h"
+#include "opencldeconv.h"
+
+// printf style message if level is at most the setLogLevel level (errors to stderr)
+void logMessage(int level, const char * format, ...);
+// what and the return code, as an error if ret isn't CL_SUCCESS, else at LOG_DEBUG
+void logStatus(const char * what, int ret);
+// reports iteration of iterations finished to the progress callback, returns false if the run should stop
+bool continueIterating(int iteration, int iterations);
+
+// reference counted clfftSetup/clfftTeardown, use instead of calling them directly
+cl_int acquireClfft();
+void releaseClfft();
+
+// statistics of one call (see enableStats in opencldeconv.h), added to the library totals when it goes out of
+// scope.  An inactive one (or level STATS_OFF) collects nothing, entry points that call each other pass theirs 
+// down so the call is counted once.
+struct CallStats {
+  CallStats(cl_command_queue commandQueue, bool active = true);
+  ~CallStats();
+
+  // restarts the phase clock without charging the time to a phase (allocation)
+  void mark();
+  // charges the time since the last phase to values[index], after the queue finished the work enqueued in it
+  void phase(int index);
+  void add(int index, double n) {
+    if (level) values[index] += n;
+  }
+
+  int level;
+  cl_command_queue commandQueue;
+  double start, last;
+  double values[STATS_COUNT];
+};
+
+cl_program buildDeconvProgram(cl_context context, cl_device_id deviceID, cl_int * ret);
+
+cl_int createDeconvPlans(cl_context context, cl_command_queue commandQueue, size_t N0, size_t N1, size_t N2, clfftPlanHandle * planForward, clfftPlanHandle * planBackward);
+
+int deconvCore(int iterations, size_t N0, size_t N1, size_t N2, cl_mem d_observed, cl_mem d_psf, cl_mem d_estimate, cl_mem d_normal, const size_t * validDims, cl_context context, cl_command_queue commandQueue, cl_device_id deviceID, cl_program program, clfftPlanHandle * plans, bool halfStorage, CallStats * callStats = NULL, float wienerRegularization = -1);
+
+int deconvHostOnQueue(int iterations, size_t N0, size_t N1, size_t N2, float *h_image, float *h_psf, float *h_out, float * normal, const size_t * validDims, cl_context context, cl_command_queue commandQueue, cl_device_id deviceID, cl_program program, clfftPlanHandle * plans, CallStats * callStats = NULL, float wienerRegularization = -1);
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include "CL/cl.h"
+#include "clFFT.h"
+#include "opencldeconv.h"
+#include "opencldeconvcore.h"
+
+// License: BSD
+
+// Batched 2D FFTs of stacks.  All planes of a N0 x N1 x numPlanes stack are transformed by one clFFT plan
+// (batch size numPlanes, distance between planes N0*N1 in the spatial domain and (N0/2+1)*N1 complex numbers in
+// the frequency domain).  Plans are cached per context, size and direction, and the host entry points use one
+// default context and queue, so repeated calls skip the context creation and the plan bake.
+
+typedef std::tuple<cl_context, size_t, size_t, size_t, bool> BatchPlanKey;
+
+static std::map<BatchPlanKey, clfftPlanHandle> batchPlans;
+static std::mutex batchLock;
+
+// default device context and queue for fft2d_batch and fftinv2d_batch, created on first use
+static cl_context defaultContext = NULL;
+static cl_command_queue defaultQueue = NULL;
+
+// the caller holds batchLock
+static cl_int getDefaultQueue(cl_context * context, cl_command_queue * commandQueue) {
+
+  if (defaultQueue == NULL) {
+    cl_platform_id platformId = NULL;
+    cl_device_id deviceID = NULL;
+    cl_uint retNumDevices;
+    cl_uint retNumPlatforms;
+
+    cl_int ret = clGetPlatformIDs(1, &platformId, &retNumPlatforms);
+    ret = clGetDeviceIDs(platformId, CL_DEVICE_TYPE_DEFAULT, 1, &deviceID, &retNumDevices);
+
+    if (ret != CL_SUCCESS) {
+      logStatus("get device IDs", ret);
+      return ret;
+    }
+
+    defaultContext = clCreateContext(NULL, 1, &deviceID, NULL, NULL, &ret);
+    logStatus("created context", ret);
+
+    if (ret != CL_SUCCESS) {
+      defaultContext = NULL;
+      return ret;
+    }
+
+    defaultQueue = clCreateCommandQueue(defaultContext, deviceID, 0, &ret);
+    logStatus("created command queue", ret);
+
+    if (ret != CL_SUCCESS) {
+      clReleaseContext(defaultContext);
+      defaultContext = NULL;
+      defaultQueue = NULL;
+      return ret;
+    }
+  }
+
+  *context = defaultContext;
+  *commandQueue = defaultQueue;
+
+  return CL_SUCCESS;
+}
+
+// get (or create and bake) the batched plan, the caller holds batchLock
+static cl_int getBatchPlan(cl_context context, cl_command_queue commandQueue, size_t N0, size_t N1, size_t numPlanes, bool inverse, clfftPlanHandle * plan) {
+
+  BatchPlanKey key(context, N0, N1, numPlanes, inverse);
+  std::map<BatchPlanKey, clfftPlanHandle>::iterator it = batchPlans.find(key);
+
+  if (it != batchPlans.end()) {
+    *plan = it->second;
+    return CL_SUCCESS;
+  }
+
+  // the cache holds one clFFT reference while it has plans
+  cl_int ret;
+
+  if (batchPlans.empty()) {
+    ret = acquireClfft();
+    logStatus("clfft setup", ret);
+
+    if (ret != CL_SUCCESS) {
+      return ret;
+    }
+  }
+
+  clfftDim dim = CLFFT_2D;
+  size_t clLengths[2] = {N0, N1};
+  size_t realStride[2] = {1, N0};
+  // note each complex row has N0/2+1 complex numbers
+  size_t complexStride[2] = {1, N0/2+1};
+  size_t realDistance = N0*N1;
+  size_t complexDistance = (N0/2+1)*N1;
+
+  ret = clfftCreateDefaultPlan(plan, context, dim, clLengths);
+  logStatus("Create Default Plan", ret);
+
+  ret = clfftSetPlanPrecision(*plan, CLFFT_SINGLE);
+  ret |= clfftSetResultLocation(*plan, CLFFT_OUTOFPLACE);
+
+  if (inverse) {
+    ret |= clfftSetLayout(*plan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL);
+    ret |= clfftSetPlanInStride(*plan, dim, complexStride);
+    ret |= clfftSetPlanOutStride(*plan, dim, realStride);
+    ret |= clfftSetPlanDistance(*plan, complexDistance, realDistance);
+  }
+  else {
+    ret |= clfftSetLayout(*plan, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED);
+    ret |= clfftSetPlanInStride(*plan, dim, realStride);
+    ret |= clfftSetPlanOutStride(*plan, dim, complexStride);
+    ret |= clfftSetPlanDistance(*plan, realDistance, complexDistance);
+  }
+
+  ret |= clfftSetPlanBatchSize(*plan, numPlanes);
+  logStatus("clfft set batch plan parameters", ret);
+
+  ret |= clfftBakePlan(*plan, 1, &commandQueue, NULL, NULL);
+  logStatus("Bake", ret);
+
+  if (ret != CL_SUCCESS) {
+    clfftDestroyPlan(plan);
+
+    if (batchPlans.empty()) {
+      releaseClfft();
+    }
+
+    return ret;
+  }
+
+  // the key holds a reference on the context so a released context can not be reused by a new one with the same handle
+  clRetainContext(context);
+  batchPlans[key] = *plan;
+
+  return CL_SUCCESS;
+}
+
+static int transformBatchOnQueue(size_t N0, size_t N1, size_t numPlanes, bool inverse, cl_mem d_in, cl_mem d_out, cl_context context, cl_command_queue commandQueue) {
+
+  clfftPlanHandle plan;
+  cl_int ret = getBatchPlan(context, commandQueue, N0, N1, numPlanes, inverse, &plan);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  // for real transforms the direction follows from the layout
+  ret = clfftEnqueueTransform(plan, inverse ? CLFFT_BACKWARD : CLFFT_FORWARD, 1, &commandQueue, 0, NULL, NULL, &d_in, &d_out, NULL);
+
+  if (ret != CL_SUCCESS) {
+    logStatus("batched FFT", ret);
+  }
+
+  return ret;
+}
+
+// upload the stack once, transform every plane with one enqueue and read the result back once
+static int transformBatchHost(size_t N0, size_t N1, size_t numPlanes, bool inverse, float * h_in, float * h_out) {
+
+  std::lock_guard<std::mutex> lock(batchLock);
+
+  cl_context context;
+  cl_command_queue commandQueue;
+  cl_int ret = getDefaultQueue(&context, &commandQueue);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  size_t realBytes = N0*N1*numPlanes*sizeof(float);
+  size_t complexBytes = 2*(N0/2+1)*N1*numPlanes*sizeof(float);
+  size_t inBytes = inverse ? complexBytes : realBytes;
+  size_t outBytes = inverse ? realBytes : complexBytes;
+
+  cl_mem d_in = clCreateBuffer(context, CL_MEM_READ_ONLY, inBytes, NULL, &ret);
+  cl_mem d_out = NULL;
+
+  if (ret == CL_SUCCESS) {
+    d_out = clCreateBuffer(context, CL_MEM_READ_WRITE, outBytes, NULL, &ret);
+  }
+
+  if (ret != CL_SUCCESS) {
+    logStatus("create stack buffers", ret);
+  }
+  else {
+    // each step only if the one before succeeded, ret is the first error
+    ret = clEnqueueWriteBuffer(commandQueue, d_in, CL_FALSE, 0, inBytes, h_in, 0, NULL, NULL);
+
+    if (ret == CL_SUCCESS) {
+      ret = transformBatchOnQueue(N0, N1, numPlanes, inverse, d_in, d_out, context, commandQueue);
+    }
+
+    if (ret == CL_SUCCESS) {
+      ret = clEnqueueReadBuffer(commandQueue, d_out, CL_TRUE, 0, outBytes, h_out, 0, NULL, NULL);
+    }
+
+    if (ret != CL_SUCCESS) {
+      // the write from h_in may still be queued
+      clFinish(commandQueue);
+    }
+
+    logMessage(ret != CL_SUCCESS ? LOG_ERROR : LOG_DEBUG, "batched FFT of %d planes %d\n", (int)numPlanes, ret);
+  }
+
+  if (d_in != NULL) {
+    clReleaseMemObject(d_in);
+  }
+  if (d_out != NULL) {
+    clReleaseMemObject(d_out);
+  }
+
+  return ret;
+}
+
+/*
+Forward real to complex FFT of each plane of a N0 x N1 x numPlanes stack of CLBuffers.
+d_out receives numPlanes Hermitian interleaved FFTs of (N0/2+1) x N1 complex numbers.
+*/
+int fft2d_batch_long(size_t N0, size_t N1, size_t numPlanes, long l_image, long l_out, long l_context, long l_queue) {
+  std::lock_guard<std::mutex> lock(batchLock);
+
+  return transformBatchOnQueue(N0, N1, numPlanes, false, (cl_mem)l_image, (cl_mem)l_out, (cl_context)l_context, (cl_command_queue)l_queue);
+}
+
+/*
+Inverse complex to real FFT of numPlanes Hermitian interleaved planes (see fft2d_batch_long).
+*/
+int fftinv2d_batch_long(size_t N0, size_t N1, size_t numPlanes, long l_fft, long l_out, long l_context, long l_queue) {
+  std::lock_guard<std::mutex> lock(batchLock);
+
+  return transformBatchOnQueue(N0, N1, numPlanes, true, (cl_mem)l_fft, (cl_mem)l_out, (cl_context)l_context, (cl_command_queue)l_queue);
+}
+
+int fft2d_batch(size_t N0, size_t N1, size_t numPlanes, float * h_image, float * h_out) {
+  return transformBatchHost(N0, N1, numPlanes, false, h_image, h_out);
+}
+
+int fftinv2d_batch(size_t N0, size_t N1, size_t numPlanes, float * h_fft, float * h_out) {
+  return transformBatchHost(N0, N1, numPlanes, true, h_fft, h_out);
+}
+
+/*
+Destroy the cached batch plans and the default context.  Plans cached for a context passed to the _long
+functions must be released before that context is.
+*/
+void releaseFFTBatchPlans() {
+  std::lock_guard<std::mutex> lock(batchLock);
+
+  if (!batchPlans.empty()) {
+    for (std::map<BatchPlanKey, clfftPlanHandle>::iterator it = batchPlans.begin(); it != batchPlans.end(); ++it) {
+      clfftDestroyPlan(&it->second);
+      clReleaseContext(std::get<0>(it->first));
+    }
+
+    batchPlans.clear();
+    releaseClfft();
+  }
+
+  if (defaultQueue != NULL) {
+    clReleaseCommandQueue(defaultQueue);
+    clReleaseContext(defaultContext);
+    defaultQueue = NULL;
+    defaultContext = NULL;
+  }
+}
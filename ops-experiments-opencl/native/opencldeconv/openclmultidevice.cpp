@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "CL/cl.h"
+#include "clFFT.h"
+#include "opencldeconv.h"
+#include "opencldeconvcore.h"
+
+// License: BSD
+
+// Multi device scheduler.  Every OpenCL device on every platform gets its own context, queue, program and
+// plan cache, and a worker thread (like GPUQueueMonitor on the Java side).  A batch of equally sized volumes
+// (timepoints, or tiles already extended by the caller) is split between the devices in proportion to their
+// throughput, and a device that runs out of work steals volumes from the end of the busiest queue.
+
+// weight of the newest measurement in the running throughput estimate
+#define THROUGHPUT_SMOOTHING 0.3
+
+struct DevicePlans {
+  clfftPlanHandle forward;
+  clfftPlanHandle backward;
+};
+
+struct OpenCLDevice {
+  cl_platform_id platformID;
+  cl_device_id deviceID;
+  std::string name;
+  bool enabled;
+
+  // created on first use and kept until releaseOpenCLDevices
+  cl_context context;
+  cl_command_queue commandQueue;
+  cl_program program;
+
+  // plans keyed by {N0, N1, N2}, kept until releaseOpenCLDevices (they hold one clFFT reference while there are any)
+  std::map<std::vector<size_t>, DevicePlans> plans;
+
+  // compute units * clock, used to split work until the device has been timed
+  double nominalSpeed;
+
+  // measured voxel iterations per second, 0 if the device has not processed a volume yet
+  double throughput;
+
+  // volumes (indexes into the batch) waiting for this device
+  std::deque<size_t> work;
+  std::mutex workLock;
+};
+
+struct MultiDeviceJob {
+  int iterations;
+  size_t N0, N1, N2;
+  float * h_images;
+  float * h_psf;
+  float * h_out;
+  float * h_normal;
+
+  // first error reported by any device
+  int ret;
+  std::mutex retLock;
+};
+
+static std::vector<OpenCLDevice *> devices;
+static bool devicesEnumerated = false;
+
+// guards enumeration and serializes batches, clFFT setup and teardown are global
+static std::mutex schedulerLock;
+
+// find every device on every platform, the caller holds schedulerLock
+static int enumerateDevices() {
+
+  if (devicesEnumerated) {
+    return (int)devices.size();
+  }
+
+  devicesEnumerated = true;
+
+  cl_uint numPlatforms = 0;
+  cl_int ret = clGetPlatformIDs(0, NULL, &numPlatforms);
+  logMessage(ret != CL_SUCCESS ? LOG_ERROR : LOG_DEBUG, "number of platforms %d (%d)\n", numPlatforms, ret);
+
+  if ((ret != CL_SUCCESS) || (numPlatforms == 0)) {
+    return 0;
+  }
+
+  std::vector<cl_platform_id> platforms(numPlatforms);
+  ret = clGetPlatformIDs(numPlatforms, platforms.data(), NULL);
+
+  for (cl_uint p = 0; p < numPlatforms; p++) {
+    cl_uint numDevices = 0;
+    ret = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices);
+
+    if ((ret != CL_SUCCESS) || (numDevices == 0)) {
+      continue;
+    }
+
+    std::vector<cl_device_id> ids(numDevices);
+    ret = clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, numDevices, ids.data(), NULL);
+
+    for (cl_uint d = 0; d < numDevices; d++) {
+      OpenCLDevice * device = new OpenCLDevice();
+      device->platformID = platforms[p];
+      device->deviceID = ids[d];
+      device->enabled = true;
+      device->context = NULL;
+      device->commandQueue = NULL;
+      device->program = NULL;
+      device->throughput = 0;
+
+      char name[256] = "";
+      clGetDeviceInfo(ids[d], CL_DEVICE_NAME, sizeof(name), name, NULL);
+      device->name = name;
+
+      cl_uint computeUnits = 1, clock = 1;
+      clGetDeviceInfo(ids[d], CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, NULL);
+      clGetDeviceInfo(ids[d], CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &clock, NULL);
+      device->nominalSpeed = (double)(computeUnits > 0 ? computeUnits : 1) * (clock > 0 ? clock : 1);
+
+      logMessage(LOG_INFO, "device %d: %s, %u compute units, %u MHz\n", (int)devices.size(), name, computeUnits, clock);
+
+      devices.push_back(device);
+    }
+  }
+
+  return (int)devices.size();
+}
+
+// create the context, queue and program for a device the first time it is used
+static cl_int initDevice(OpenCLDevice * device) {
+
+  if (device->program != NULL) {
+    return CL_SUCCESS;
+  }
+
+  cl_int ret;
+
+  if (device->context == NULL) {
+    device->context = clCreateContext(NULL, 1, &device->deviceID, NULL, NULL, &ret);
+    logMessage(ret != CL_SUCCESS ? LOG_ERROR : LOG_DEBUG, "created context for %s %d\n", device->name.c_str(), ret);
+
+    if (ret != CL_SUCCESS) {
+      device->context = NULL;
+      return ret;
+    }
+  }
+
+  if (device->commandQueue == NULL) {
+    device->commandQueue = clCreateCommandQueue(device->context, device->deviceID, 0, &ret);
+    logMessage(ret != CL_SUCCESS ? LOG_ERROR : LOG_DEBUG, "created command queue for %s %d\n", device->name.c_str(), ret);
+
+    if (ret != CL_SUCCESS) {
+      device->commandQueue = NULL;
+      return ret;
+    }
+  }
+
+  cl_program program = buildDeconvProgram(device->context, device->deviceID, &ret);
+
+  if (ret != CL_SUCCESS) {
+    if (program != NULL) {
+      clReleaseProgram(program);
+    }
+    return ret;
+  }
+
+  device->program = program;
+
+  return CL_SUCCESS;
+}
+
+// get the cached plans for this size, creating them on first use
+static cl_int getPlans(OpenCLDevice * device, size_t N0, size_t N1, size_t N2, DevicePlans ** plans) {
+
+  std::vector<size_t> key = {N0, N1, N2};
+  std::map<std::vector<size_t>, DevicePlans>::iterator it = device->plans.find(key);
+
+  if (it == device->plans.end()) {
+    cl_int ret;
+
+    if (device->plans.empty()) {
+      ret = acquireClfft();
+
+      if (ret != CL_SUCCESS) {
+        return ret;
+      }
+    }
+
+    DevicePlans created;
+    ret = createDeconvPlans(device->context, device->commandQueue, N0, N1, N2, &created.forward, &created.backward);
+
+    if (ret != CL_SUCCESS) {
+      if (device->plans.empty()) {
+        releaseClfft();
+      }
+
+      return ret;
+    }
+
+    it = device->plans.insert(std::make_pair(key, created)).first;
+  }
+
+  *plans = &it->second;
+
+  return CL_SUCCESS;
+}
+
+static void releasePlans(OpenCLDevice * device) {
+  if (device->plans.empty()) {
+    return;
+  }
+
+  for (std::map<std::vector<size_t>, DevicePlans>::iterator it = device->plans.begin(); it != device->plans.end(); ++it) {
+    clfftDestroyPlan(&it->second.forward);
+    clfftDestroyPlan(&it->second.backward);
+  }
+
+  device->plans.clear();
+  releaseClfft();
+}
+
+// split numVolumes between the devices in proportion to measured throughput (or nominal speed until every
+// device has been timed), each device gets a contiguous block so stealing from the back takes the volumes
+// its owner would reach last
+static void distributeWork(std::vector<OpenCLDevice *> & active, size_t numVolumes) {
+
+  bool measured = true;
+
+  for (size_t d = 0; d < active.size(); d++) {
+    measured = measured && (active[d]->throughput > 0);
+  }
+
+  std::vector<double> weights(active.size());
+  double total = 0;
+
+  for (size_t d = 0; d < active.size(); d++) {
+    weights[d] = measured ? active[d]->throughput : active[d]->nominalSpeed;
+    total += weights[d];
+  }
+
+  size_t next = 0;
+
+  for (size_t d = 0; d < active.size(); d++) {
+    size_t count = (size_t)floor(numVolumes * weights[d] / total);
+
+    // the last device takes the remainder from rounding down
+    if ((d == active.size() - 1) || (next + count > numVolumes)) {
+      count = numVolumes - next;
+    }
+
+    active[d]->work.clear();
+
+    for (size_t i = 0; i < count; i++) {
+      active[d]->work.push_back(next++);
+    }
+
+    logMessage(LOG_INFO, "device %s: %d volumes (weight %f)\n", active[d]->name.c_str(), (int)count, weights[d] / total);
+  }
+}
+
+// next volume for device d, from the front of its own queue or stolen from the back of the longest queue
+static bool nextVolume(std::vector<OpenCLDevice *> & active, size_t d, size_t * volume) {
+
+  {
+    std::lock_guard<std::mutex> lock(active[d]->workLock);
+
+    if (!active[d]->work.empty()) {
+      *volume = active[d]->work.front();
+      active[d]->work.pop_front();
+      return true;
+    }
+  }
+
+  while (true) {
+    size_t victim = d;
+    size_t longest = 0;
+
+    for (size_t v = 0; v < active.size(); v++) {
+      std::lock_guard<std::mutex> lock(active[v]->workLock);
+
+      if (active[v]->work.size() > longest) {
+        longest = active[v]->work.size();
+        victim = v;
+      }
+    }
+
+    if (longest == 0) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(active[victim]->workLock);
+
+    // the victim may have drained its queue since we looked
+    if (!active[victim]->work.empty()) {
+      *volume = active[victim]->work.back();
+      active[victim]->work.pop_back();
+      logMessage(LOG_DEBUG, "device %s stole volume %d from %s\n", active[d]->name.c_str(), (int)*volume, active[victim]->name.c_str());
+      return true;
+    }
+  }
+}
+
+// true once a volume was cancelled (see setCancelled), the workers then leave the remaining volumes
+static bool jobCancelled(MultiDeviceJob * job) {
+  std::lock_guard<std::mutex> lock(job->retLock);
+  return job->ret == DECONV_CANCELLED;
+}
+
+static void deviceWorker(std::vector<OpenCLDevice *> * active, size_t d, MultiDeviceJob * job) {
+
+  OpenCLDevice * device = (*active)[d];
+  size_t n = job->N0 * job->N1 * job->N2;
+  size_t volume;
+
+  while (!jobCancelled(job) && nextVolume(*active, d, &volume)) {
+
+    DevicePlans * plans;
+    int ret = getPlans(device, job->N0, job->N1, job->N2, &plans);
+
+    // timed after the plans, so the bake of the first volume doesn't count against the device's throughput
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (ret == CL_SUCCESS) {
+      clfftPlanHandle planHandles[2] = {plans->forward, plans->backward};
+
+      ret = deconvHostOnQueue(job->iterations, job->N0, job->N1, job->N2, job->h_images + volume * n, job->h_psf,
+          job->h_out + volume * n, job->h_normal, NULL, device->context, device->commandQueue, device->deviceID,
+          device->program, planHandles);
+    }
+
+    if (ret != CL_SUCCESS) {
+      logMessage(ret == DECONV_CANCELLED ? LOG_INFO : LOG_ERROR, "device %s failed on volume %d %d\n", device->name.c_str(), (int)volume, ret);
+
+      // a cancel wins over other errors so the remaining workers stop
+      std::lock_guard<std::mutex> lock(job->retLock);
+      if (job->ret == 0 || ret == DECONV_CANCELLED) {
+        job->ret = ret;
+      }
+
+      // leave the remaining volumes to the other devices
+      return;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double rate = (double)n * job->iterations / (seconds > 0 ? seconds : 1e-9);
+
+    device->throughput = device->throughput > 0 ? (1 - THROUGHPUT_SMOOTHING) * device->throughput + THROUGHPUT_SMOOTHING * rate : rate;
+  }
+}
+
+int getNumOpenCLDevices() {
+  std::lock_guard<std::mutex> lock(schedulerLock);
+
+  return enumerateDevices();
+}
+
+int getOpenCLDeviceName(int device, char * name, size_t size) {
+  std::lock_guard<std::mutex> lock(schedulerLock);
+
+  if ((device < 0) || (device >= enumerateDevices()) || (size == 0)) {
+    return -1;
+  }
+
+  strncpy(name, devices[device]->name.c_str(), size - 1);
+  name[size - 1] = 0;
+
+  return 0;
+}
+
+int setOpenCLDeviceEnabled(int device, int enabled) {
+  std::lock_guard<std::mutex> lock(schedulerLock);
+
+  if ((device < 0) || (device >= enumerateDevices())) {
+    return -1;
+  }
+
+  devices[device]->enabled = (enabled != 0);
+
+  return 0;
+}
+
+double getOpenCLDeviceThroughput(int device) {
+  std::lock_guard<std::mutex> lock(schedulerLock);
+
+  if ((device < 0) || (device >= enumerateDevices())) {
+    return -1;
+  }
+
+  return devices[device]->throughput;
+}
+
+/*
+Richardson Lucy on a batch of numVolumes volumes of size N0 x N1 x N2 stored one after another in h_images,
+using every enabled OpenCL device.  h_out holds the initial estimates (same layout as h_images) and receives
+the results.  The PSF (extended to N0 x N1 x N2) and the optional normal are shared by all volumes.
+*/
+int deconv_multidevice(int iterations, size_t N0, size_t N1, size_t N2, size_t numVolumes, float * h_images, float * h_psf, float * h_out, float * h_normal) {
+
+  std::lock_guard<std::mutex> lock(schedulerLock);
+
+  enumerateDevices();
+
+  std::vector<OpenCLDevice *> active;
+
+  for (size_t d = 0; d < devices.size(); d++) {
+    if (!devices[d]->enabled) {
+      continue;
+    }
+
+    cl_int ret = initDevice(devices[d]);
+
+    if (ret == CL_SUCCESS) {
+      active.push_back(devices[d]);
+    }
+    else {
+      logMessage(LOG_ERROR, "skipping device %s %d\n", devices[d]->name.c_str(), ret);
+    }
+  }
+
+  if (active.empty()) {
+    logMessage(LOG_ERROR, "no usable OpenCL devices\n");
+    return -1;
+  }
+
+  // Setup clFFT once for the batch, the plans cached per device hold their own reference
+  cl_int ret = acquireClfft();
+  logStatus("clfft setup", ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  MultiDeviceJob job;
+  job.iterations = iterations;
+  job.N0 = N0;
+  job.N1 = N1;
+  job.N2 = N2;
+  job.h_images = h_images;
+  job.h_psf = h_psf;
+  job.h_out = h_out;
+  job.h_normal = h_normal;
+  job.ret = 0;
+
+  distributeWork(active, numVolumes);
+
+  std::vector<std::thread> workers;
+
+  for (size_t d = 0; d < active.size(); d++) {
+    workers.push_back(std::thread(deviceWorker, &active, d, &job));
+  }
+
+  for (size_t d = 0; d < workers.size(); d++) {
+    workers[d].join();
+  }
+
+  // volumes left behind if every device failed or the job was cancelled
+  for (size_t d = 0; d < active.size(); d++) {
+    if (!active[d]->work.empty()) {
+      logMessage(job.ret == DECONV_CANCELLED ? LOG_INFO : LOG_ERROR, "%d volumes not processed on %s\n", (int)active[d]->work.size(), active[d]->name.c_str());
+      active[d]->work.clear();
+    }
+  }
+
+  releaseClfft();
+
+  return job.ret;
+}
+
+/*
+Release the per device plans, contexts, queues and programs.  The devices are enumerated again on next use.
+*/
+void releaseOpenCLDevices() {
+  std::lock_guard<std::mutex> lock(schedulerLock);
+
+  for (size_t d = 0; d < devices.size(); d++) {
+    releasePlans(devices[d]);
+
+    if (devices[d]->program != NULL) {
+      clReleaseProgram(devices[d]->program);
+    }
+    if (devices[d]->commandQueue != NULL) {
+      clReleaseCommandQueue(devices[d]->commandQueue);
+    }
+    if (devices[d]->context != NULL) {
+      clReleaseContext(devices[d]->context);
+    }
+
+    delete devices[d];
+  }
+
+  devices.clear();
+  devicesEnumerated = false;
+}
@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <limits.h>
+#include <map>
+#include <mutex>
+#include <utility>
+#include "CL/cl.h"
+#include "opencldeconv.h"
+#include "opencldeconvcore.h"
+
+// License: BSD
+
+// Reductions on device buffers (sum, min/max, mean, I-divergence).  Each work group accumulates a strided
+// slice of the input, reduces it in local memory with a tree and writes one partial result.  A second pass
+// with a single work group reduces the partials, so only the final scalar is read back to the host.
+
+// work group size (a power of 2, reduced if the device allows less) and maximum number of groups in the first pass
+#define REDUCE_LOCAL_SIZE 256
+#define REDUCE_MAX_GROUPS 256
+
+static const char * reduceProgramString =                                          "\n" \
+"__kernel void reduceSum(__global const float *a,                                \n" \
+"                        __global float *partial,                                \n" \
+"                        __local float *scratch,                                 \n" \
+"                        const unsigned int n)                                   \n" \
+"{                                                                               \n" \
+"    unsigned int lid = get_local_id(0);                                         \n" \
+"                                                                                \n" \
+"    float acc = 0;                                                              \n" \
+"    for (unsigned int i = get_global_id(0); i < n; i += get_global_size(0))     \n" \
+"        acc += a[i];                                                            \n" \
+"                                                                                \n" \
+"    scratch[lid] = acc;                                                         \n" \
+"    barrier(CLK_LOCAL_MEM_FENCE);                                               \n" \
+"                                                                                \n" \
+"    for (unsigned int s = get_local_size(0)/2; s > 0; s >>= 1) {                \n" \
+"        if (lid < s)                                                            \n" \
+"            scratch[lid] += scratch[lid + s];                                   \n" \
+"        barrier(CLK_LOCAL_MEM_FENCE);                                           \n" \
+"    }                                                                           \n" \
+"                                                                                \n" \
+"    if (lid == 0)                                                               \n" \
+"        partial[get_group_id(0)] = scratch[0];                                  \n" \
+"}                                                                               \n" \
+"\n" \
+"// first pass passes the same buffer as aMin and aMax, second pass the partials \n" \
+"__kernel void reduceMinMax(__global const float *aMin,                          \n" \
+"                           __global const float *aMax,                          \n" \
+"                           __global float *partialMin,                          \n" \
+"                           __global float *partialMax,                          \n" \
+"                           __local float *scratchMin,                           \n" \
+"                           __local float *scratchMax,                           \n" \
+"                           const unsigned int n)                                \n" \
+"{                                                                               \n" \
+"    unsigned int lid = get_local_id(0);                                         \n" \
+"                                                                                \n" \
+"    float accMin = INFINITY;                                                    \n" \
+"    float accMax = -INFINITY;                                                   \n" \
+"    for (unsigned int i = get_global_id(0); i < n; i += get_global_size(0)) {   \n" \
+"        accMin = fmin(accMin, aMin[i]);                                         \n" \
+"        accMax = fmax(accMax, aMax[i]);                                         \n" \
+"    }                                                                           \n" \
+"                                                                                \n" \
+"    scratchMin[lid] = accMin;                                                   \n" \
+"    scratchMax[lid] = accMax;                                                   \n" \
+"    barrier(CLK_LOCAL_MEM_FENCE);                                               \n" \
+"                                                                                \n" \
+"    for (unsigned int s = get_local_size(0)/2; s > 0; s >>= 1) {                \n" \
+"        if (lid < s) {                                                          \n" \
+"            scratchMin[lid] = fmin(scratchMin[lid], scratchMin[lid + s]);       \n" \
+"            scratchMax[lid] = fmax(scratchMax[lid], scratchMax[lid + s]);       \n" \
+"        }                                                                       \n" \
+"        barrier(CLK_LOCAL_MEM_FENCE);                                           \n" \
+"    }                                                                           \n" \
+"                                                                                \n" \
+"    if (lid == 0) {                                                             \n" \
+"        partialMin[get_group_id(0)] = scratchMin[0];                            \n" \
+"        partialMax[get_group_id(0)] = scratchMax[0];                            \n" \
+"    }                                                                           \n" \
+"}                                                                               \n" \
+"\n" \
+"// I-divergence sum(o*log(o/r) - o + r), terms with o<=0 reduce to r and       \n" \
+"// reblurred values <=0 are skipped                                            \n" \
+"__kernel void reduceIDivergence(__global const float *observed,                 \n" \
+"                                __global const float *reblurred,                \n" \
+"                                __global float *partial,                        \n" \
+"                                __local float *scratch,                         \n" \
+"                                const unsigned int n)                           \n" \
+"{                                                                               \n" \
+"    unsigned int lid = get_local_id(0);                                         \n" \
+"                                                                                \n" \
+"    float acc = 0;                                                              \n" \
+"    for (unsigned int i = get_global_id(0); i < n; i += get_global_size(0)) {   \n" \
+"        float o = observed[i];                                                  \n" \
+"        float r = reblurred[i];                                                 \n" \
+"        if (r > 0) {                                                            \n" \
+"            if (o > 0)                                                          \n" \
+"                acc += o*log(o/r) - o + r;                                      \n" \
+"            else                                                                \n" \
+"                acc += r;                                                       \n" \
+"        }                                                                       \n" \
+"    }                                                                           \n" \
+"                                                                                \n" \
+"    scratch[lid] = acc;                                                         \n" \
+"    barrier(CLK_LOCAL_MEM_FENCE);                                               \n" \
+"                                                                                \n" \
+"    for (unsigned int s = get_local_size(0)/2; s > 0; s >>= 1) {                \n" \
+"        if (lid < s)                                                            \n" \
+"            scratch[lid] += scratch[lid + s];                                   \n" \
+"        barrier(CLK_LOCAL_MEM_FENCE);                                           \n" \
+"    }                                                                           \n" \
+"                                                                                \n" \
+"    if (lid == 0)                                                               \n" \
+"        partial[get_group_id(0)] = scratch[0];                                  \n" \
+"}                                                                               \n" \
+"\n" \
+"// divide by a value that is already on the device (no read back)             \n" \
+"__kernel void vecDivScalar(__global float *a,                                   \n" \
+"                           __global const float *scalar,                        \n" \
+"                           const unsigned int n)                                \n" \
+"{                                                                               \n" \
+"    int id = get_global_id(0);                                                  \n" \
+"    float s = scalar[0];                                                        \n" \
+"                                                                                \n" \
+"    if ((id < n) && (s != 0))                                                   \n" \
+"        a[id] = a[id] / s;                                                      \n" \
+"}                                                                               \n" \
+"\n";
+
+// reduction programs, built once per context and device.  The context is retained while its program is cached
+// so the handle can't be re-used by a new context.
+static std::map<std::pair<cl_context, cl_device_id>, cl_program> reducePrograms;
+static std::mutex reduceProgramsLock;
+
+static cl_program getReduceProgram(cl_context context, cl_device_id deviceID, cl_int * ret) {
+
+  std::lock_guard<std::mutex> lock(reduceProgramsLock);
+
+  std::pair<cl_context, cl_device_id> key(context, deviceID);
+  std::map<std::pair<cl_context, cl_device_id>, cl_program>::iterator it = reducePrograms.find(key);
+
+  if (it != reducePrograms.end()) {
+    *ret = CL_SUCCESS;
+    return it->second;
+  }
+
+  cl_program program = clCreateProgramWithSource(context, 1, (const char **)&reduceProgramString, NULL, ret);
+
+  if (*ret != CL_SUCCESS) {
+    logStatus("create reduce program", *ret);
+    return NULL;
+  }
+
+  *ret = clBuildProgram(program, 1, &deviceID, NULL, NULL, NULL);
+
+  if (*ret != CL_SUCCESS) {
+    logStatus("build reduce program", *ret);
+    clReleaseProgram(program);
+    return NULL;
+  }
+
+  clRetainContext(context);
+  reducePrograms[key] = program;
+
+  return program;
+}
+
+// largest power of 2 work group size the device allows, up to REDUCE_LOCAL_SIZE
+static size_t reduceLocalSize(cl_device_id deviceID) {
+  size_t maxSize = REDUCE_LOCAL_SIZE;
+  clGetDeviceInfo(deviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxSize, NULL);
+
+  size_t localSize = 1;
+  while ((localSize * 2 <= maxSize) && (localSize * 2 <= REDUCE_LOCAL_SIZE)) {
+    localSize *= 2;
+  }
+
+  return localSize;
+}
+
+// set a kernel argument if every call before succeeded, so ret stays the first error
+static void setArg(cl_kernel kernel, cl_uint index, size_t size, const void * value, cl_int * ret) {
+  if (*ret == CL_SUCCESS) {
+    *ret = clSetKernelArg(kernel, index, size, value);
+  }
+}
+
+// the kernels index with unsigned int, so larger buffers are rejected rather than truncated
+static cl_int checkReduceSize(size_t n) {
+  if (n > UINT_MAX) {
+    logStatus("reduce size exceeds unsigned int", CL_INVALID_BUFFER_SIZE);
+    return CL_INVALID_BUFFER_SIZE;
+  }
+
+  return CL_SUCCESS;
+}
+
+static size_t reduceNumGroups(size_t n, size_t localSize) {
+  size_t groups = (n + localSize - 1) / localSize;
+
+  if (groups > REDUCE_MAX_GROUPS) {
+    groups = REDUCE_MAX_GROUPS;
+  }
+
+  return groups > 0 ? groups : 1;
+}
+
+/*
+Reduce to a sum in d_result[0] on the device.  If d_reblurred is not NULL the I-divergence between d_input
+(observed) and d_reblurred is summed instead of d_input.
+*/
+static cl_int sumOnDevice(size_t n, cl_mem d_input, cl_mem d_reblurred, cl_mem d_result, cl_context context, cl_command_queue commandQueue, cl_device_id deviceID) {
+
+  cl_int ret = checkReduceSize(n);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  cl_program program = getReduceProgram(context, deviceID, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  size_t localSize = reduceLocalSize(deviceID);
+  size_t numGroups = reduceNumGroups(n, localSize);
+  size_t globalSize = numGroups * localSize;
+
+  cl_mem d_partial = clCreateBuffer(context, CL_MEM_READ_WRITE, numGroups * sizeof(float), NULL, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  cl_kernel kernelFirst = clCreateKernel(program, d_reblurred == NULL ? "reduceSum" : "reduceIDivergence", &ret);
+
+  if (ret != CL_SUCCESS) {
+    logStatus("create reduce kernel", ret);
+    clReleaseMemObject(d_partial);
+    return ret;
+  }
+
+  cl_kernel kernelSecond = clCreateKernel(program, "reduceSum", &ret);
+
+  if (ret != CL_SUCCESS) {
+    logStatus("create reduce kernel", ret);
+    clReleaseKernel(kernelFirst);
+    clReleaseMemObject(d_partial);
+    return ret;
+  }
+
+  unsigned int nKernel = (unsigned int)n;
+  unsigned int nPartial = (unsigned int)numGroups;
+  int arg = 0;
+
+  // first pass, one partial per work group
+  setArg(kernelFirst, arg++, sizeof(cl_mem), (void *)&d_input, &ret);
+  if (d_reblurred != NULL) {
+    setArg(kernelFirst, arg++, sizeof(cl_mem), (void *)&d_reblurred, &ret);
+  }
+  setArg(kernelFirst, arg++, sizeof(cl_mem), (void *)&d_partial, &ret);
+  setArg(kernelFirst, arg++, localSize * sizeof(float), NULL, &ret);
+  setArg(kernelFirst, arg++, sizeof(unsigned int), &nKernel, &ret);
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueNDRangeKernel(commandQueue, kernelFirst, 1, NULL, &globalSize, &localSize, 0, NULL, NULL);
+  }
+
+  // second pass, a single work group reduces the partials
+  setArg(kernelSecond, 0, sizeof(cl_mem), (void *)&d_partial, &ret);
+  setArg(kernelSecond, 1, sizeof(cl_mem), (void *)&d_result, &ret);
+  setArg(kernelSecond, 2, localSize * sizeof(float), NULL, &ret);
+  setArg(kernelSecond, 3, sizeof(unsigned int), &nPartial, &ret);
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueNDRangeKernel(commandQueue, kernelSecond, 1, NULL, &localSize, &localSize, 0, NULL, NULL);
+  }
+
+  if (ret != CL_SUCCESS) {
+    logStatus("reduce sum", ret);
+  }
+
+  clReleaseKernel(kernelFirst);
+  clReleaseKernel(kernelSecond);
+
+  // deferred by the runtime until the queued kernels are done
+  clReleaseMemObject(d_partial);
+
+  return ret;
+}
+
+// sum on the device and read back the scalar
+static cl_int sumToHost(size_t n, cl_mem d_input, cl_mem d_reblurred, float * result, cl_context context, cl_command_queue commandQueue, cl_device_id deviceID) {
+
+  cl_int ret;
+  cl_mem d_result = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float), NULL, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  ret = sumOnDevice(n, d_input, d_reblurred, d_result, context, commandQueue, deviceID);
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueReadBuffer(commandQueue, d_result, CL_TRUE, 0, sizeof(float), result, 0, NULL, NULL);
+  }
+
+  clReleaseMemObject(d_result);
+
+  return ret;
+}
+
+int sum_long(size_t n, long l_buffer, float * result, long l_context, long l_queue, long l_device) {
+  return sumToHost(n, (cl_mem)l_buffer, NULL, result, (cl_context)l_context, (cl_command_queue)l_queue, (cl_device_id)l_device);
+}
+
+int mean_long(size_t n, long l_buffer, float * result, long l_context, long l_queue, long l_device) {
+  int ret = sum_long(n, l_buffer, result, l_context, l_queue, l_device);
+
+  if ((ret == CL_SUCCESS) && (n > 0)) {
+    *result = *result / n;
+  }
+
+  return ret;
+}
+
+/*
+I-divergence between observed and reblurred, for convergence checks in RL.
+*/
+int idivergence_long(size_t n, long l_observed, long l_reblurred, float * result, long l_context, long l_queue, long l_device) {
+  return sumToHost(n, (cl_mem)l_observed, (cl_mem)l_reblurred, result, (cl_context)l_context, (cl_command_queue)l_queue, (cl_device_id)l_device);
+}
+
+int minmax_long(size_t n, long l_buffer, float * min, float * max, long l_context, long l_queue, long l_device) {
+
+  cl_context context = (cl_context)l_context;
+  cl_command_queue commandQueue = (cl_command_queue)l_queue;
+  cl_device_id deviceID = (cl_device_id)l_device;
+  cl_mem d_input = (cl_mem)l_buffer;
+
+  cl_int ret = checkReduceSize(n);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  cl_program program = getReduceProgram(context, deviceID, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  size_t localSize = reduceLocalSize(deviceID);
+  size_t numGroups = reduceNumGroups(n, localSize);
+  size_t globalSize = numGroups * localSize;
+
+  // partial and final minima and maxima (separate buffers, sub buffer offsets must be aligned to the device base address)
+  // (each creation is checked before the next, what was created is released at the end)
+  cl_mem d_partialMin = NULL;
+  cl_mem d_partialMax = NULL;
+  cl_mem d_resultMin = NULL;
+  cl_mem d_resultMax = NULL;
+  cl_kernel kernel = NULL;
+
+  d_partialMin = clCreateBuffer(context, CL_MEM_READ_WRITE, numGroups * sizeof(float), NULL, &ret);
+  if (ret == CL_SUCCESS) {
+    d_partialMax = clCreateBuffer(context, CL_MEM_READ_WRITE, numGroups * sizeof(float), NULL, &ret);
+  }
+  if (ret == CL_SUCCESS) {
+    d_resultMin = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float), NULL, &ret);
+  }
+  if (ret == CL_SUCCESS) {
+    d_resultMax = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float), NULL, &ret);
+  }
+  if (ret == CL_SUCCESS) {
+    kernel = clCreateKernel(program, "reduceMinMax", &ret);
+  }
+
+  if (ret != CL_SUCCESS) {
+    logStatus("create min max buffers and kernel", ret);
+
+    if (kernel != NULL) {
+      clReleaseKernel(kernel);
+    }
+    if (d_resultMax != NULL) {
+      clReleaseMemObject(d_resultMax);
+    }
+    if (d_resultMin != NULL) {
+      clReleaseMemObject(d_resultMin);
+    }
+    if (d_partialMax != NULL) {
+      clReleaseMemObject(d_partialMax);
+    }
+    if (d_partialMin != NULL) {
+      clReleaseMemObject(d_partialMin);
+    }
+
+    return ret;
+  }
+
+  unsigned int nKernel = (unsigned int)n;
+  unsigned int nPartial = (unsigned int)numGroups;
+
+  // first pass over the input
+  setArg(kernel, 0, sizeof(cl_mem), (void *)&d_input, &ret);
+  setArg(kernel, 1, sizeof(cl_mem), (void *)&d_input, &ret);
+  setArg(kernel, 2, sizeof(cl_mem), (void *)&d_partialMin, &ret);
+  setArg(kernel, 3, sizeof(cl_mem), (void *)&d_partialMax, &ret);
+  setArg(kernel, 4, localSize * sizeof(float), NULL, &ret);
+  setArg(kernel, 5, localSize * sizeof(float), NULL, &ret);
+  setArg(kernel, 6, sizeof(unsigned int), &nKernel, &ret);
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalSize, &localSize, 0, NULL, NULL);
+  }
+
+  // second pass over the partials
+  setArg(kernel, 0, sizeof(cl_mem), (void *)&d_partialMin, &ret);
+  setArg(kernel, 1, sizeof(cl_mem), (void *)&d_partialMax, &ret);
+  setArg(kernel, 2, sizeof(cl_mem), (void *)&d_resultMin, &ret);
+  setArg(kernel, 3, sizeof(cl_mem), (void *)&d_resultMax, &ret);
+  setArg(kernel, 6, sizeof(unsigned int), &nPartial, &ret);
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &localSize, &localSize, 0, NULL, NULL);
+  }
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueReadBuffer(commandQueue, d_resultMin, CL_TRUE, 0, sizeof(float), min, 0, NULL, NULL);
+  }
+
+  if (ret == CL_SUCCESS) {
+    ret = clEnqueueReadBuffer(commandQueue, d_resultMax, CL_TRUE, 0, sizeof(float), max, 0, NULL, NULL);
+  }
+
+  if (ret != CL_SUCCESS) {
+    logStatus("reduce min max", ret);
+  }
+
+  clReleaseKernel(kernel);
+  clReleaseMemObject(d_resultMin);
+  clReleaseMemObject(d_resultMax);
+  clReleaseMemObject(d_partialMin);
+  clReleaseMemObject(d_partialMax);
+
+  return ret;
+}
+
+/*
+Divide the buffer by its sum (for example to normalize the PSF) without reading the buffer back.  The sum
+is returned in sum (pass NULL to skip the read back of the scalar as well).
+*/
+int normalize_long(size_t n, long l_buffer, float * sum, long l_context, long l_queue, long l_device) {
+
+  cl_context context = (cl_context)l_context;
+  cl_command_queue commandQueue = (cl_command_queue)l_queue;
+  cl_device_id deviceID = (cl_device_id)l_device;
+  cl_mem d_buffer = (cl_mem)l_buffer;
+
+  cl_int ret;
+  cl_mem d_sum = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(float), NULL, &ret);
+
+  if (ret != CL_SUCCESS) {
+    return ret;
+  }
+
+  ret = sumOnDevice(n, d_buffer, NULL, d_sum, context, commandQueue, deviceID);
+
+  if (ret == CL_SUCCESS) {
+    cl_program program = getReduceProgram(context, deviceID, &ret);
+    cl_kernel kernel = NULL;
+
+    if (ret == CL_SUCCESS) {
+      kernel = clCreateKernel(program, "vecDivScalar", &ret);
+    }
+
+    if (ret == CL_SUCCESS) {
+      unsigned int nKernel = (unsigned int)n;
+      size_t localItemSize = 64;
+      size_t globalItemSize = ((n + localItemSize - 1) / localItemSize) * localItemSize;
+
+      setArg(kernel, 0, sizeof(cl_mem), (void *)&d_buffer, &ret);
+      setArg(kernel, 1, sizeof(cl_mem), (void *)&d_sum, &ret);
+      setArg(kernel, 2, sizeof(unsigned int), &nKernel, &ret);
+
+      if (ret == CL_SUCCESS) {
+        ret = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL, &globalItemSize, &localItemSize, 0, NULL, NULL);
+      }
+
+      clReleaseKernel(kernel);
+    }
+    else {
+      logStatus("create normalize kernel", ret);
+    }
+  }
+
+  if ((ret == CL_SUCCESS) && (sum != NULL)) {
+    ret = clEnqueueReadBuffer(commandQueue, d_sum, CL_TRUE, 0, sizeof(float), sum, 0, NULL, NULL);
+  }
+
+  clReleaseMemObject(d_sum);
+
+  return ret;
+}
+
+/*
+Release the cached reduction programs (and the references they hold on their contexts).
+*/
+void releaseReductionPrograms() {
+  std::lock_guard<std::mutex> lock(reduceProgramsLock);
+
+  for (std::map<std::pair<cl_context, cl_device_id>, cl_program>::iterator it = reducePrograms.begin(); it != reducePrograms.end(); ++it) {
+    clReleaseProgram(it->second);
+    clReleaseContext(it->first.first);
+  }
+
+  reducePrograms.clear();
+}
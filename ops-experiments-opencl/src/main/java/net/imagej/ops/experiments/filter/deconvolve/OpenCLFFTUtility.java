@@ -195,8 +195,7 @@ public class OpenCLFFTUtility {
 		// call the decon wrapper (100 iterations of RL)
 		OpenCLWrapper.deconv_long(100, gpuImg.getDimensions()[0], gpuImg
 			.getDimensions()[1], gpuImg.getDimensions()[2], longPointerImg,
-			longPointerPSF, longPointerEstimate, longPointerImg, l_context, l_queue,
-			l_device);
+			longPointerPSF, longPointerEstimate, 0, l_context, l_queue, l_device);
 
 		long finish = System.currentTimeMillis();
 
@@ -252,8 +251,7 @@ public class OpenCLFFTUtility {
 		// call the decon wrapper (100 iterations of RL)
 		OpenCLWrapper.deconv_long(100, gpuImg.getDimensions()[0], gpuImg
 			.getDimensions()[1], gpuImg.getDimensions()[2], longPointerImg,
-			longPointerPSF, longPointerEstimate, longPointerImg, l_context, l_queue,
-			l_device);
+			longPointerPSF, longPointerEstimate, 0, l_context, l_queue, l_device);
 
 		long finish = System.currentTimeMillis();
 
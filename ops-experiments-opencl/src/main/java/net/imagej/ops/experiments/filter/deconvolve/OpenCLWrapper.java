@@ -1,6 +1,7 @@
 
 package net.imagej.ops.experiments.filter.deconvolve;
 
+import org.bytedeco.javacpp.FloatPointer;
 import org.bytedeco.javacpp.Loader;
 import org.bytedeco.javacpp.annotation.Platform;
 import org.bytedeco.javacpp.annotation.Properties;
@@ -22,6 +23,14 @@ public class OpenCLWrapper {
 	public static native long fft2d_long(long N1, long N2, long inPointer,
 		long outPointer, long contextPointer, long queuePointer);
 
+	public static native int fft2d_batch_long(long N0, long N1, long numPlanes,
+		long l_image, long l_out, long l_context, long l_queue);
+
+	public static native int fftinv2d_batch_long(long N0, long N1,
+		long numPlanes, long l_fft, long l_out, long l_context, long l_queue);
+
+	public static native void releaseFFTBatchPlans();
+
 	public static native int conv_long(long N0, long N1, long N2, long l_image,
 		long l_psf, long l_output, boolean correlate, long l_context, long l_queue,
 		long l_device);
@@ -30,6 +39,74 @@ public class OpenCLWrapper {
 		long N2, long d_image, long d_psf, long d_update, long d_normal,
 		long l_context, long l_queuee, long l_device);
 
+	public static native int deconv_noncirculant_long(int iterations, long N0,
+		long N1, long N2, long M0, long M1, long M2, long d_image, long d_psf,
+		long d_update, long l_context, long l_queue, long l_device);
+
+	// one pass Wiener preview, the regularization is relative to the OTF at 0 (around 1e-3 to 1e-2)
+	public static native int wiener_long(long N0, long N1, long N2, long l_image,
+		long l_psf, long l_out, float regularization, long l_context, long l_queue,
+		long l_device);
+
+	// Wiener first guess of the RL entry points, 0 (the default) starts from the estimate passed in
+	public static native int setWarmStart(float regularization);
+
+	// weight of the total variation term of the RL entry points (RL-TV), 0 (the default) for plain RL
+	public static native int setTVRegularization(float lambda);
+
+	// coarse to fine RL, the first iterations of deconv run binned by factor (2 or 4, 1 off)
+	public static native int setMultiresolution(int factor, int iterations);
+
+	public static native int getNumOpenCLDevices();
+
+	public static native int setOpenCLDeviceEnabled(int device, int enabled);
+
+	public static native double getOpenCLDeviceThroughput(int device);
+
+	public static native int deconv_multidevice(int iterations, long N0, long N1,
+		long N2, long numVolumes, FloatPointer h_images, FloatPointer h_psf,
+		FloatPointer h_out, FloatPointer h_normal);
+
+	public static native void releaseOpenCLDevices();
+
+	// 0 float, 1 half storage of the observed image and normal in deconv_multidevice
+	public static native int setStorageMode(int mode);
+
+	// peak device bytes of deconv, flags 1 normal, 2 non-circulant, 4 caller buffers (_long)
+	public static native long getPeakMemory(long N0, long N1, long N2, int flags);
+
+	public static native int sum_long(long n, long l_buffer, FloatPointer result,
+		long l_context, long l_queue, long l_device);
+
+	public static native int mean_long(long n, long l_buffer, FloatPointer result,
+		long l_context, long l_queue, long l_device);
+
+	public static native int minmax_long(long n, long l_buffer, FloatPointer min,
+		FloatPointer max, long l_context, long l_queue, long l_device);
+
+	public static native int idivergence_long(long n, long l_observed,
+		long l_reblurred, FloatPointer result, long l_context, long l_queue,
+		long l_device);
+
+	public static native int normalize_long(long n, long l_buffer,
+		FloatPointer sum, long l_context, long l_queue, long l_device);
+
+	public static native void releaseReductionPrograms();
+
+	// engine statistics, levels and indices are the STATS_ defines of the native header
+	// (0 off, 1 counters, 2 per phase times), getStats returns the number of values copied
+	public static native void enableStats(int level);
+
+	public static native void resetStats();
+
+	public static native int getStats(double[] stats, int n);
+
+	// log level (0 none, 1 errors, the default, 2 info, 3 debug) and cancellation, a cancelled run returns
+	// DECONV_CANCELLED (-2000) after its current iteration, until set back to 0
+	public static native void setLogLevel(int level);
+
+	public static native void setCancelled(int cancelled);
+
 	public static void load() {
 		Loader.load();
 	};
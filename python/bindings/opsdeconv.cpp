@@ -0,0 +1,1053 @@
+#include <stdio.h>
+#include <string.h>
+#include <climits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#ifdef OPS_OPENCL
+#include "CL/cl.h"
+#include "clFFT.h"
+#include "opencldeconv.h"
+#include "opencldeconvcore.h"
+#endif
+
+#ifdef OPS_MKL
+#include "MKLFFTW.h"
+#endif
+
+// License: BSD
+
+// Python bindings for the OpenCL and MKL engines.  Volumes come in through the buffer protocol as any 3D float32
+// array (numpy order z, y, x), strided views included, so the sandboxes no longer need np.pad, ifftshift or
+// ascontiguousarray copies: the engines place the image in the extended volume, wrap the centered PSF to the
+// origin and crop the result themselves.  The GIL is released while an engine computes, and each engine keeps its
+// device context, program, FFT plans and buffers between calls, so Python threads with one engine each run
+// deconvolutions concurrently.
+
+namespace py = pybind11;
+
+// a 3D float view from the buffer protocol, dims and strides (in bytes) in numpy order z, y, x
+struct Volume {
+  py::buffer_info info;
+  size_t dims[3];
+  py::ssize_t strides[3];
+
+  size_t size() const {
+    return dims[0]*dims[1]*dims[2];
+  }
+
+  // rows are contiguous and rows and planes don't overlap, so the OpenCL rect transfers can read it directly
+  bool rowsContiguous() const {
+    return (strides[2] == sizeof(float)) && (strides[1] >= (py::ssize_t)(dims[2]*sizeof(float))) &&
+      (strides[0] >= (py::ssize_t)dims[1]*strides[1]);
+  }
+
+  const char * at(size_t z, size_t y, size_t x) const {
+    return (const char *)info.ptr + z*strides[0] + y*strides[1] + x*strides[2];
+  }
+};
+
+// the engines' statistics (getStats, mklGetStats) as a dict, names in the order of the STATS_ indices
+static py::dict statsDict(int (*getStats)(double *, int)) {
+  static const char * names[STATS_COUNT] = {"plan_seconds", "otf_seconds", "fft_seconds", "pointwise_seconds",
+    "transfer_seconds", "total_seconds", "calls", "iterations", "ffts", "bytes_to_device", "bytes_from_device",
+    "peak_bytes"};
+
+  double values[STATS_COUNT];
+  int n = getStats(values, STATS_COUNT);
+
+  py::dict stats;
+  for (int i = 0; i < n; i++) {
+    stats[names[i]] = values[i];
+  }
+  return stats;
+}
+
+// Python progress callbacks, callable(iteration, iterations) with a true return cancelling the run.  The engines
+// call them from the thread running the deconvolution, which doesn't hold the GIL.
+static int pythonProgress(int iteration, int iterations, void * user) {
+  py::gil_scoped_acquire acquire;
+
+  try {
+    return py::cast<bool>((*(py::object *)user)(iteration, iterations)) ? 1 : 0;
+  }
+  catch (py::error_already_set & e) {
+    // an exception in the callback cancels the run
+    e.discard_as_unraisable("progress callback");
+    return 1;
+  }
+}
+
+static void setPythonProgress(void (*setProgressCallback)(ProgressCallback, void *), py::object callback) {
+  if (callback.is_none()) {
+    setProgressCallback(NULL, NULL);
+    return;
+  }
+
+  // never freed, a deconvolution running on another thread may still call the previous callback
+  setProgressCallback(&pythonProgress, new py::object(callback));
+}
+
+// the engines return DECONV_CANCELLED with the estimate of the last finished iteration in out
+static void checkCancelled(int ret) {
+  if (ret == DECONV_CANCELLED) {
+    throw std::runtime_error("deconv was cancelled, out holds the last finished iteration");
+  }
+}
+
+static Volume getVolume(py::buffer buffer, bool writable, const char * name) {
+  Volume volume;
+  volume.info = buffer.request(writable);
+
+  if ((volume.info.ndim != 3) || (volume.info.format != py::format_descriptor<float>::format())) {
+    throw py::type_error(std::string(name) + " must be a 3D float32 array");
+  }
+
+  for (int d = 0; d < 3; d++) {
+    volume.dims[d] = (size_t)volume.info.shape[d];
+    volume.strides[d] = volume.info.strides[d];
+  }
+
+  return volume;
+}
+
+// copy any strided volume to a contiguous buffer (only for views the rect transfers can't read, and for MKL)
+static void gather(const Volume & volume, float * out) {
+  for (size_t z = 0; z < volume.dims[0]; z++) {
+    for (size_t y = 0; y < volume.dims[1]; y++) {
+      float * row = out + (z*volume.dims[1] + y)*volume.dims[2];
+
+      if (volume.strides[2] == sizeof(float)) {
+        memcpy(row, volume.at(z, y, 0), volume.dims[2]*sizeof(float));
+      }
+      else {
+        for (size_t x = 0; x < volume.dims[2]; x++) {
+          row[x] = *(const float *)volume.at(z, y, x);
+        }
+      }
+    }
+  }
+}
+
+static void scatter(const float * in, const Volume & volume) {
+  for (size_t z = 0; z < volume.dims[0]; z++) {
+    for (size_t y = 0; y < volume.dims[1]; y++) {
+      for (size_t x = 0; x < volume.dims[2]; x++) {
+        *(float *)volume.at(z, y, x) = in[(z*volume.dims[1] + y)*volume.dims[2] + x];
+      }
+    }
+  }
+}
+
+// extended size, the image size unless shape is passed
+static std::vector<size_t> extendedShape(const Volume & image, py::object shape) {
+  std::vector<size_t> extended(image.dims, image.dims + 3);
+
+  if (!shape.is_none()) {
+    extended = shape.cast<std::vector<size_t> >();
+
+    if (extended.size() != 3) {
+      throw py::value_error("shape must have 3 dimensions");
+    }
+  }
+
+  for (int d = 0; d < 3; d++) {
+    if (extended[d] < image.dims[d]) {
+      throw py::value_error("shape is smaller than the image");
+    }
+  }
+
+  return extended;
+}
+
+static void checkPSF(const Volume & psf, const std::vector<size_t> & extended) {
+  for (int d = 0; d < 3; d++) {
+    if (psf.dims[d] > extended[d]) {
+      throw py::value_error("the PSF is larger than the extended image");
+    }
+  }
+}
+
+// the (numpy order) offset of the image centered in the extended volume, same as DeconUtility.padNDImage and
+// the setNormalMask kernel
+static size_t centerOffset(size_t extended, size_t measured) {
+  return (extended - measured)/2;
+}
+
+// the PSF is centered at size/2 in each dimension (as np.fft.ifftshift expects), it goes to the origin of the
+// extended volume with the part before the center wrapped to the end, so each dimension splits into 2 pieces
+struct WrapPiece {
+  size_t from, to, length;
+};
+
+static int wrapPieces(size_t psfSize, size_t extendedSize, WrapPiece * pieces) {
+  size_t c = psfSize/2;
+
+  pieces[0].from = c;
+  pieces[0].to = 0;
+  pieces[0].length = psfSize - c;
+
+  if (c == 0) {
+    return 1;
+  }
+
+  pieces[1].from = 0;
+  pieces[1].to = extendedSize - c;
+  pieces[1].length = c;
+
+  return 2;
+}
+
+#ifdef OPS_OPENCL
+
+static void checkCL(cl_int ret, const char * what) {
+  if (ret != CL_SUCCESS) {
+    throw std::runtime_error(std::string(what) + " failed with OpenCL error " + std::to_string(ret));
+  }
+}
+
+/*
+One OpenCL device with its context, queue, program and plan cache, kept for the life of the engine (like a
+device of the multi device scheduler in openclmultidevice.cpp).  Calls on one engine are serialized, use an
+engine per thread to run concurrently.
+*/
+class OpenCLEngine {
+public:
+
+  OpenCLEngine(int platform, int device) {
+    cl_uint numPlatforms = 0;
+    checkCL(clGetPlatformIDs(0, NULL, &numPlatforms), "clGetPlatformIDs");
+
+    if ((platform < 0) || ((cl_uint)platform >= numPlatforms)) {
+      throw py::value_error("no OpenCL platform " + std::to_string(platform));
+    }
+
+    std::vector<cl_platform_id> platforms(numPlatforms);
+    checkCL(clGetPlatformIDs(numPlatforms, platforms.data(), NULL), "clGetPlatformIDs");
+
+    cl_uint numDevices = 0;
+    checkCL(clGetDeviceIDs(platforms[platform], CL_DEVICE_TYPE_ALL, 0, NULL, &numDevices), "clGetDeviceIDs");
+
+    if ((device < 0) || ((cl_uint)device >= numDevices)) {
+      throw py::value_error("no OpenCL device " + std::to_string(device) + " on platform " + std::to_string(platform));
+    }
+
+    std::vector<cl_device_id> ids(numDevices);
+    checkCL(clGetDeviceIDs(platforms[platform], CL_DEVICE_TYPE_ALL, numDevices, ids.data(), NULL), "clGetDeviceIDs");
+    deviceID = ids[device];
+
+    char deviceName[256] = "";
+    clGetDeviceInfo(deviceID, CL_DEVICE_NAME, sizeof(deviceName), deviceName, NULL);
+    name = deviceName;
+
+    cl_int ret;
+    context = clCreateContext(NULL, 1, &deviceID, NULL, NULL, &ret);
+    checkCL(ret, "clCreateContext");
+
+    commandQueue = clCreateCommandQueue(context, deviceID, 0, &ret);
+    checkCL(ret, "clCreateCommandQueue");
+
+    program = buildDeconvProgram(context, deviceID, &ret);
+    checkCL(ret, "building the deconvolution program");
+
+    checkCL(acquireClfft(), "clfftSetup");
+  }
+
+  ~OpenCLEngine() {
+    for (std::map<std::vector<size_t>, std::vector<clfftPlanHandle> >::iterator it = plans.begin(); it != plans.end(); ++it) {
+      clfftDestroyPlan(&it->second[0]);
+      clfftDestroyPlan(&it->second[1]);
+    }
+
+    releaseClfft();
+
+    clReleaseProgram(program);
+    clReleaseCommandQueue(commandQueue);
+    clReleaseContext(context);
+  }
+
+  /*
+  Richardson Lucy of image (z, y, x).  psf is centered (any size up to the extended size).  If shape is larger than
+  the image the image is centered in a zero volume of that size and the non-circulant normal is built on the device
+  (like deconv_noncirculant), starting from the mean of the image.  Otherwise RL is circulant, starts from the image
+  and divides by the optional normal.  The result (image sized) is written to out if passed, else returned.
+  */
+  py::object deconv(py::buffer image, py::buffer psf, int iterations, py::object shape, py::object normal, py::object out) {
+    Volume vImage = getVolume(image, false, "image");
+    Volume vPSF = getVolume(psf, false, "psf");
+    std::vector<size_t> extended = extendedShape(vImage, shape);
+    checkPSF(vPSF, extended);
+
+    bool noncirculant = (extended[0] != vImage.dims[0]) || (extended[1] != vImage.dims[1]) || (extended[2] != vImage.dims[2]);
+
+    Volume vNormal;
+    bool hasNormal = !normal.is_none();
+
+    if (hasNormal) {
+      if (noncirculant) {
+        throw py::value_error("the normal is built on the device when shape is larger than the image");
+      }
+      vNormal = getVolume(normal.cast<py::buffer>(), false, "normal");
+
+      if (memcmp(vNormal.dims, vImage.dims, sizeof(vImage.dims)) != 0) {
+        throw py::value_error("the normal must have the shape of the image");
+      }
+    }
+
+    py::object result = out;
+
+    if (out.is_none()) {
+      result = py::array_t<float>({vImage.dims[0], vImage.dims[1], vImage.dims[2]});
+    }
+
+    Volume vOut = getVolume(result.cast<py::buffer>(), true, "out");
+
+    if (memcmp(vOut.dims, vImage.dims, sizeof(vImage.dims)) != 0) {
+      throw py::value_error("out must have the shape of the image");
+    }
+
+    int ret;
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(engineLock);
+
+      ret = run(iterations, extended, vImage, vPSF, hasNormal ? &vNormal : NULL, noncirculant, vOut);
+    }
+
+    checkCancelled(ret);
+    checkCL(ret, "deconv");
+
+    return result;
+  }
+
+  std::string getName() const {
+    return name;
+  }
+
+private:
+
+  // (OpenCL order) x, y, z dims of the extended volume
+  size_t N[3];
+
+  // upload a volume to a box of the device buffer at (numpy order) offset, straight from a strided view
+  // if its rows are contiguous, else through a contiguous copy
+  cl_int writeBox(cl_mem buffer, const Volume & volume, const size_t * from, const size_t * offset, const size_t * count) {
+    size_t bufferOrigin[3] = {offset[2]*sizeof(float), offset[1], offset[0]};
+    size_t region[3] = {count[2]*sizeof(float), count[1], count[0]};
+
+    if (volume.rowsContiguous()) {
+      size_t hostOrigin[3] = {from[2]*sizeof(float), from[1], from[0]};
+
+      return clEnqueueWriteBufferRect(commandQueue, buffer, CL_TRUE, bufferOrigin, hostOrigin, region,
+          N[0]*sizeof(float), N[0]*N[1]*sizeof(float), (size_t)volume.strides[1], (size_t)volume.strides[0], volume.info.ptr, 0, NULL, NULL);
+    }
+
+    std::vector<float> contiguous(volume.size());
+    gather(volume, contiguous.data());
+
+    size_t hostOrigin[3] = {from[2]*sizeof(float), from[1], from[0]};
+
+    return clEnqueueWriteBufferRect(commandQueue, buffer, CL_TRUE, bufferOrigin, hostOrigin, region,
+        N[0]*sizeof(float), N[0]*N[1]*sizeof(float), volume.dims[2]*sizeof(float), volume.dims[1]*volume.dims[2]*sizeof(float),
+        contiguous.data(), 0, NULL, NULL);
+  }
+
+  cl_int readBox(cl_mem buffer, const Volume & volume, const size_t * offset) {
+    size_t bufferOrigin[3] = {offset[2]*sizeof(float), offset[1], offset[0]};
+    size_t hostOrigin[3] = {0, 0, 0};
+    size_t region[3] = {volume.dims[2]*sizeof(float), volume.dims[1], volume.dims[0]};
+
+    if (volume.rowsContiguous()) {
+      return clEnqueueReadBufferRect(commandQueue, buffer, CL_TRUE, bufferOrigin, hostOrigin, region,
+          N[0]*sizeof(float), N[0]*N[1]*sizeof(float), (size_t)volume.strides[1], (size_t)volume.strides[0], volume.info.ptr, 0, NULL, NULL);
+    }
+
+    std::vector<float> contiguous(volume.size());
+
+    cl_int ret = clEnqueueReadBufferRect(commandQueue, buffer, CL_TRUE, bufferOrigin, hostOrigin, region,
+        N[0]*sizeof(float), N[0]*N[1]*sizeof(float), volume.dims[2]*sizeof(float), volume.dims[1]*volume.dims[2]*sizeof(float),
+        contiguous.data(), 0, NULL, NULL);
+
+    scatter(contiguous.data(), volume);
+
+    return ret;
+  }
+
+  // zero the buffer and write the PSF wrapped to the origin, up to 8 boxes
+  cl_int writePSF(cl_mem d_psf, const Volume & psf, const std::vector<size_t> & extended) {
+    float zero = 0;
+    cl_int ret = clEnqueueFillBuffer(commandQueue, d_psf, &zero, sizeof(float), 0, extended[0]*extended[1]*extended[2]*sizeof(float), 0, NULL, NULL);
+
+    if (ret != CL_SUCCESS) {
+      return ret;
+    }
+
+    WrapPiece pieces[3][2];
+    int numPieces[3];
+
+    for (int d = 0; d < 3; d++) {
+      numPieces[d] = wrapPieces(psf.dims[d], extended[d], pieces[d]);
+    }
+
+    for (int z = 0; z < numPieces[0]; z++) {
+      for (int y = 0; y < numPieces[1]; y++) {
+        for (int x = 0; x < numPieces[2]; x++) {
+          size_t from[3] = {pieces[0][z].from, pieces[1][y].from, pieces[2][x].from};
+          size_t to[3] = {pieces[0][z].to, pieces[1][y].to, pieces[2][x].to};
+          size_t count[3] = {pieces[0][z].length, pieces[1][y].length, pieces[2][x].length};
+
+          ret = writeBox(d_psf, psf, from, to, count);
+
+          if (ret != CL_SUCCESS) {
+            return ret;
+          }
+        }
+      }
+    }
+
+    return CL_SUCCESS;
+  }
+
+  cl_int getPlans(clfftPlanHandle ** cached) {
+    std::vector<size_t> key(N, N + 3);
+
+    if (plans.find(key) == plans.end()) {
+      std::vector<clfftPlanHandle> created(2);
+      cl_int ret = createDeconvPlans(context, commandQueue, N[0], N[1], N[2], &created[0], &created[1]);
+
+      if (ret != CL_SUCCESS) {
+        return ret;
+      }
+
+      plans[key] = created;
+    }
+
+    *cached = plans[key].data();
+
+    return CL_SUCCESS;
+  }
+
+  // runs without the GIL, the engine lock is held
+  int run(int iterations, const std::vector<size_t> & extended, const Volume & image, const Volume & psf, const Volume * normal, bool noncirculant, const Volume & out) {
+    N[0] = extended[2];
+    N[1] = extended[1];
+    N[2] = extended[0];
+
+    size_t n = N[0]*N[1]*N[2];
+    size_t bytes = n*sizeof(float);
+
+    clfftPlanHandle * cachedPlans;
+    cl_int ret = getPlans(&cachedPlans);
+
+    if (ret != CL_SUCCESS) {
+      return ret;
+    }
+
+    // each step runs only if the ones before succeeded, so ret is the first error
+    cl_mem d_observed = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    cl_mem d_psf = NULL;
+    cl_mem d_estimate = NULL;
+    cl_mem d_normal = NULL;
+
+    if (ret == CL_SUCCESS) {
+      d_psf = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    }
+
+    if (ret == CL_SUCCESS) {
+      d_estimate = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, NULL, &ret);
+    }
+
+    if ((ret == CL_SUCCESS) && (normal != NULL)) {
+      d_normal = clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, NULL, &ret);
+    }
+
+    size_t offset[3] = {centerOffset(extended[0], image.dims[0]), centerOffset(extended[1], image.dims[1]), centerOffset(extended[2], image.dims[2])};
+    size_t origin[3] = {0, 0, 0};
+
+    // the image centered in zeros (the observed image is 0 outside the measured region for non-circulant RL)
+    if ((ret == CL_SUCCESS) && noncirculant) {
+      float zero = 0;
+      ret = clEnqueueFillBuffer(commandQueue, d_observed, &zero, sizeof(float), 0, bytes, 0, NULL, NULL);
+    }
+
+    if (ret == CL_SUCCESS) {
+      ret = writeBox(d_observed, image, origin, offset, image.dims);
+    }
+
+    if (ret == CL_SUCCESS) {
+      ret = writePSF(d_psf, psf, extended);
+    }
+
+    if ((ret == CL_SUCCESS) && noncirculant) {
+      // start from the mean of the measured region
+      float sum = 0;
+      ret = sum_long(n, (long)d_observed, &sum, (long)context, (long)commandQueue, (long)deviceID);
+
+      if (ret == CL_SUCCESS) {
+        float mean = sum/(float)image.size();
+        ret = clEnqueueFillBuffer(commandQueue, d_estimate, &mean, sizeof(float), 0, bytes, 0, NULL, NULL);
+      }
+    }
+    else if (ret == CL_SUCCESS) {
+      ret = clEnqueueCopyBuffer(commandQueue, d_observed, d_estimate, 0, 0, bytes, 0, NULL, NULL);
+    }
+
+    if ((ret == CL_SUCCESS) && (normal != NULL)) {
+      ret = writeBox(d_normal, *normal, origin, origin, normal->dims);
+    }
+
+    if (ret == CL_SUCCESS) {
+      size_t validDims[3] = {image.dims[2], image.dims[1], image.dims[0]};
+
+      ret = deconvCore(iterations, N[0], N[1], N[2], d_observed, d_psf, d_estimate, d_normal, noncirculant ? validDims : NULL,
+          context, commandQueue, deviceID, program, cachedPlans, false);
+    }
+
+    if (ret == CL_SUCCESS) {
+      ret = readBox(d_estimate, out, offset);
+    }
+
+    if (d_observed != NULL) {
+      clReleaseMemObject(d_observed);
+    }
+
+    if (d_psf != NULL) {
+      clReleaseMemObject(d_psf);
+    }
+
+    if (d_estimate != NULL) {
+      clReleaseMemObject(d_estimate);
+    }
+
+    if (d_normal != NULL) {
+      clReleaseMemObject(d_normal);
+    }
+
+    return ret;
+  }
+
+  cl_device_id deviceID;
+  cl_context context;
+  cl_command_queue commandQueue;
+  cl_program program;
+  std::string name;
+
+  // {forward, backward} plans keyed by the extended size
+  std::map<std::vector<size_t>, std::vector<clfftPlanHandle> > plans;
+
+  std::mutex engineLock;
+};
+
+#endif
+
+#ifdef OPS_MKL
+
+static void checkMKL(int ret, const char * what) {
+  if (ret == DECONV_INVALID_VALUE) {
+    throw py::value_error(std::string(what) + " got an invalid value, see the log");
+  }
+
+  if (ret != 0) {
+    throw std::runtime_error(std::string(what) + " failed with error " + std::to_string(ret));
+  }
+}
+
+/*
+MKL Richardson Lucy.  FFTW needs contiguous arrays, so the engine keeps contiguous image, PSF, estimate and normal
+buffers and reuses them while the size doesn't change.  The strided input is gathered into them without the GIL
+(that is the only copy, np.pad, ifftshift and the crop are done in the same pass).
+*/
+class MKLEngine {
+public:
+
+  // same arguments as OpenCLEngine.deconv, RL is circulant and shape (if larger than the image) zero pads
+  py::object deconv(py::buffer image, py::buffer psf, int iterations, py::object shape, py::object normal, py::object out) {
+    Volume vImage = getVolume(image, false, "image");
+    Volume vPSF = getVolume(psf, false, "psf");
+    std::vector<size_t> extended = extendedShape(vImage, shape);
+    checkPSF(vPSF, extended);
+
+    if ((double)extended[0]*extended[1]*extended[2] > INT_MAX) {
+      throw py::value_error("the MKL engine takes up to 2^31 voxels");
+    }
+
+    Volume vNormal;
+    bool hasNormal = !normal.is_none();
+
+    if (hasNormal) {
+      vNormal = getVolume(normal.cast<py::buffer>(), false, "normal");
+
+      if (memcmp(vNormal.dims, vImage.dims, sizeof(vImage.dims)) != 0) {
+        throw py::value_error("the normal must have the shape of the image");
+      }
+    }
+
+    py::object result = out;
+
+    if (out.is_none()) {
+      result = py::array_t<float>({vImage.dims[0], vImage.dims[1], vImage.dims[2]});
+    }
+
+    Volume vOut = getVolume(result.cast<py::buffer>(), true, "out");
+
+    if (memcmp(vOut.dims, vImage.dims, sizeof(vImage.dims)) != 0) {
+      throw py::value_error("out must have the shape of the image");
+    }
+
+    int ret;
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(engineLock);
+
+      ret = run(iterations, extended, vImage, vPSF, hasNormal ? &vNormal : NULL, vOut);
+    }
+
+    checkCancelled(ret);
+    checkMKL(ret, "deconv");
+
+    return result;
+  }
+
+  /*
+  RL of the size region at start (z, y, x) of image (mklRichardsonLucyROI3D): only the region grown by half the PSF
+  is gathered and deconvolved, non-circulant in the smallest fast size that holds it with the PSF support, so a 
+  region costs a fraction of the whole image.  The result (size) is written to out if passed, else returned.
+  */
+  py::object deconv_roi(py::buffer image, py::buffer psf, int iterations, std::vector<int> start, std::vector<int> size, py::object out) {
+    Volume vImage = getVolume(image, false, "image");
+    Volume vPSF = getVolume(psf, false, "psf");
+
+    if (start.size() != 3 || size.size() != 3) {
+      throw py::value_error("start and size must have 3 values");
+    }
+
+    int dataStart[3], dataSize[3], extended[3];
+
+    if (mklGetROIGeometry((int)vImage.dims[0], (int)vImage.dims[1], (int)vImage.dims[2], (int)vPSF.dims[0], (int)vPSF.dims[1],
+        (int)vPSF.dims[2], start.data(), size.data(), dataStart, dataSize, extended) != 0) {
+      throw py::value_error("the region must be inside the image");
+    }
+
+    py::object result = out;
+
+    if (out.is_none()) {
+      result = py::array_t<float>({(size_t)size[0], (size_t)size[1], (size_t)size[2]});
+    }
+
+    Volume vOut = getVolume(result.cast<py::buffer>(), true, "out");
+
+    for (int d = 0; d < 3; d++) {
+      if (vOut.dims[d] != (size_t)size[d]) {
+        throw py::value_error("out must have the shape of the region");
+      }
+    }
+
+    int ret;
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(engineLock);
+
+      // the region the engine reads, as the image of the call
+      std::vector<size_t> data = {(size_t)dataSize[0], (size_t)dataSize[1], (size_t)dataSize[2]};
+      size_t from[3] = {(size_t)dataStart[0], (size_t)dataStart[1], (size_t)dataStart[2]};
+      size_t origin[3] = {0, 0, 0};
+      int roiStart[3] = {start[0] - dataStart[0], start[1] - dataStart[1], start[2] - dataStart[2]};
+
+      x.resize(data[0]*data[1]*data[2]);
+      h.resize(vPSF.size());
+      y.resize(vOut.size());
+
+      place(vImage, from, origin, data.data(), data, x.data());
+      gather(vPSF, h.data());
+
+      ret = mklRichardsonLucyROI3D(iterations, x.data(), dataSize[0], dataSize[1], dataSize[2], h.data(), (int)vPSF.dims[0],
+          (int)vPSF.dims[1], (int)vPSF.dims[2], roiStart, size.data(), y.data());
+
+      scatter(y.data(), vOut);
+    }
+
+    checkCancelled(ret);
+    checkMKL(ret, "deconv_roi");
+
+    return result;
+  }
+
+private:
+
+  // copy volume into the box of the contiguous extended buffer at offset
+  static void place(const Volume & volume, const size_t * from, const size_t * offset, const size_t * count,
+      const std::vector<size_t> & extended, float * buffer) {
+    for (size_t z = 0; z < count[0]; z++) {
+      for (size_t y = 0; y < count[1]; y++) {
+        float * row = buffer + ((offset[0] + z)*extended[1] + offset[1] + y)*extended[2] + offset[2];
+
+        for (size_t x = 0; x < count[2]; x++) {
+          row[x] = *(const float *)volume.at(from[0] + z, from[1] + y, from[2] + x);
+        }
+      }
+    }
+  }
+
+  int run(int iterations, const std::vector<size_t> & extended, const Volume & image, const Volume & psf, const Volume * normal, const Volume & out) {
+    size_t n = extended[0]*extended[1]*extended[2];
+
+    // assign keeps the capacity, so a repeated size doesn't reallocate
+    x.assign(n, 0);
+    h.assign(n, 0);
+
+    size_t offset[3] = {centerOffset(extended[0], image.dims[0]), centerOffset(extended[1], image.dims[1]), centerOffset(extended[2], image.dims[2])};
+    size_t origin[3] = {0, 0, 0};
+
+    place(image, origin, offset, image.dims, extended, x.data());
+
+    WrapPiece pieces[3][2];
+    int numPieces[3];
+
+    for (int d = 0; d < 3; d++) {
+      numPieces[d] = wrapPieces(psf.dims[d], extended[d], pieces[d]);
+    }
+
+    for (int pz = 0; pz < numPieces[0]; pz++) {
+      for (int py = 0; py < numPieces[1]; py++) {
+        for (int px = 0; px < numPieces[2]; px++) {
+          size_t from[3] = {pieces[0][pz].from, pieces[1][py].from, pieces[2][px].from};
+          size_t to[3] = {pieces[0][pz].to, pieces[1][py].to, pieces[2][px].to};
+          size_t count[3] = {pieces[0][pz].length, pieces[1][py].length, pieces[2][px].length};
+
+          place(psf, from, to, count, extended, h.data());
+        }
+      }
+    }
+
+    // start from the image
+    y = x;
+
+    float * normalData = NULL;
+
+    if (normal != NULL) {
+      normalBuffer.assign(n, 0);
+      place(*normal, origin, offset, normal->dims, extended, normalBuffer.data());
+      normalData = normalBuffer.data();
+    }
+
+    int ret = mklRichardsonLucy3D(iterations, x.data(), h.data(), y.data(), (int)extended[0], (int)extended[1], (int)extended[2], normalData);
+
+    // crop into out
+    for (size_t z = 0; z < out.dims[0]; z++) {
+      for (size_t j = 0; j < out.dims[1]; j++) {
+        const float * row = y.data() + ((offset[0] + z)*extended[1] + offset[1] + j)*extended[2] + offset[2];
+
+        for (size_t i = 0; i < out.dims[2]; i++) {
+          *(float *)out.at(z, j, i) = row[i];
+        }
+      }
+    }
+
+    return ret;
+  }
+
+  std::vector<float> x, h, y, normalBuffer;
+
+  std::mutex engineLock;
+};
+
+
+// snapshot callbacks of MKLState.run, callable(iterations, estimate) with a true return stopping the run, estimate is 
+// a copy
+struct PythonSnapshot {
+  py::object callback;
+  size_t dims[3];
+};
+
+static int pythonSnapshot(int iterations, const float * estimate, void * user) {
+  py::gil_scoped_acquire acquire;
+  PythonSnapshot * snapshot = (PythonSnapshot *)user;
+
+  try {
+    py::object copy = py::array_t<float>({snapshot->dims[0], snapshot->dims[1], snapshot->dims[2]});
+    scatter(estimate, getVolume(copy.cast<py::buffer>(), true, "estimate"));
+
+    return py::cast<bool>(snapshot->callback(iterations, copy)) ? 1 : 0;
+  }
+  catch (py::error_already_set & e) {
+    // an exception in the callback stops the run
+    e.discard_as_unraisable("snapshot callback");
+    return 1;
+  }
+}
+
+/*
+A resumable RL or FISTA run of the MKL engine (mklCreateState).  Unlike MKLEngine.deconv image, psf (wrapped to the 
+origin) and estimate are all of the extended size, the state copies them.  run(iterations) continues where the last 
+run stopped, so 50 iterations, a look at estimate and 50 more give the result of 100.  With a path the state lives in
+a memory mapped file that MKLState.open continues in a later process.
+*/
+class MKLState {
+public:
+
+  static MKLState * create(int algorithm, py::buffer image, py::buffer psf, py::buffer estimate, py::object normal,
+      float lam, py::object path) {
+    Volume vImage = getVolume(image, false, "image");
+    Volume vPSF = getVolume(psf, false, "psf");
+    Volume vEstimate = getVolume(estimate, false, "estimate");
+
+    if ((memcmp(vPSF.dims, vImage.dims, sizeof(vImage.dims)) != 0) || (memcmp(vEstimate.dims, vImage.dims, sizeof(vImage.dims)) != 0)) {
+      throw py::value_error("image, psf and estimate must have one shape");
+    }
+
+    if ((double)vImage.size() > INT_MAX) {
+      throw py::value_error("the MKL engine takes up to 2^31 voxels");
+    }
+
+    Volume vNormal;
+    bool hasNormal = !normal.is_none();
+
+    if (hasNormal) {
+      vNormal = getVolume(normal.cast<py::buffer>(), false, "normal");
+
+      if (memcmp(vNormal.dims, vImage.dims, sizeof(vImage.dims)) != 0) {
+        throw py::value_error("the normal must have the shape of the image");
+      }
+    }
+
+    std::string file = path.is_none() ? std::string() : path.cast<std::string>();
+    MKLDeconvState * state;
+
+    {
+      py::gil_scoped_release release;
+
+      std::vector<float> x(vImage.size()), h(vImage.size()), y(vImage.size()), normalBuffer;
+      gather(vImage, x.data());
+      gather(vPSF, h.data());
+      gather(vEstimate, y.data());
+
+      if (hasNormal) {
+        normalBuffer.resize(vImage.size());
+        gather(vNormal, normalBuffer.data());
+      }
+
+      state = mklCreateState(algorithm, x.data(), h.data(), y.data(), (int)vImage.dims[0], (int)vImage.dims[1],
+          (int)vImage.dims[2], hasNormal ? normalBuffer.data() : NULL, lam, path.is_none() ? NULL : file.c_str());
+    }
+
+    if (state == NULL) {
+      throw std::runtime_error("the state could not be created, see the log");
+    }
+
+    return new MKLState(state);
+  }
+
+  static MKLState * open(const std::string & path) {
+    MKLDeconvState * state = mklOpenState(path.c_str());
+
+    if (state == NULL) {
+      throw std::runtime_error(path + " is not a state file");
+    }
+
+    return new MKLState(state);
+  }
+
+  // returns False if the run was cancelled (mklSetProgressCallback) or a snapshot callback stopped it
+  bool run(int iterations, int snapshotEvery, py::object callback) {
+    PythonSnapshot snapshot;
+    snapshot.callback = callback;
+    shape(snapshot.dims);
+
+    int ret;
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(stateLock);
+
+      ret = mklRunState(get(), iterations, callback.is_none() ? 0 : snapshotEvery,
+          callback.is_none() ? NULL : &pythonSnapshot, &snapshot);
+    }
+
+    return ret == 0;
+  }
+
+  py::object estimate() {
+    size_t dims[3];
+    shape(dims);
+
+    std::vector<float> y(dims[0]*dims[1]*dims[2]);
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(stateLock);
+
+      mklGetStateEstimate(get(), y.data());
+    }
+
+    py::object result = py::array_t<float>({dims[0], dims[1], dims[2]});
+    scatter(y.data(), getVolume(result.cast<py::buffer>(), true, "estimate"));
+    return result;
+  }
+
+  int iterations() {
+    size_t dims[3];
+    return shape(dims);
+  }
+
+  void sync() {
+    int ret;
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(stateLock);
+
+      ret = mklSyncState(get());
+    }
+
+    if (ret != 0) {
+      throw std::runtime_error("the state file could not be written");
+    }
+  }
+
+  // frees the state (after a run in another thread has finished), a state file stays on disk
+  void close() {
+    py::gil_scoped_release release;
+    std::lock_guard<std::mutex> lock(stateLock);
+
+    mklFreeState(state);
+    state = NULL;
+  }
+
+  // nothing else holds the state once it is destroyed
+  ~MKLState() {
+    mklFreeState(state);
+  }
+
+private:
+
+  MKLState(MKLDeconvState * state) : state(state) {}
+
+  MKLDeconvState * get() {
+    if (state == NULL) {
+      throw std::runtime_error("the state is closed");
+    }
+    return state;
+  }
+
+  // the shape, returns the iterations run.  As every lock of the state, without the GIL, which the callbacks of a
+  // run in another thread take while it holds the lock
+  int shape(size_t * dims) {
+    int n[3];
+    int done;
+
+    {
+      py::gil_scoped_release release;
+      std::lock_guard<std::mutex> lock(stateLock);
+
+      done = mklGetStateShape(get(), n);
+    }
+
+    for (int d = 0; d < 3; d++) {
+      dims[d] = (size_t)n[d];
+    }
+
+    return done;
+  }
+
+  MKLDeconvState * state;
+
+  std::mutex stateLock;
+};
+
+#endif
+
+PYBIND11_MODULE(opsdeconv, m) {
+  m.doc() = "Richardson Lucy on the OpenCL and MKL engines of ops-experiments";
+
+#ifdef OPS_OPENCL
+  py::class_<OpenCLEngine>(m, "OpenCLEngine")
+    .def(py::init<int, int>(), py::arg("platform") = 0, py::arg("device") = 0)
+    .def("deconv", &OpenCLEngine::deconv, py::arg("image"), py::arg("psf"), py::arg("iterations"),
+        py::arg("shape") = py::none(), py::arg("normal") = py::none(), py::arg("out") = py::none())
+    .def_property_readonly("name", &OpenCLEngine::getName);
+
+  m.def("getPeakMemory", &getPeakMemory);
+
+  // statistics of the OpenCL engine (levels STATS_OFF, STATS_COUNTERS, STATS_PHASES)
+  m.def("enableStats", &enableStats, py::arg("level"));
+  m.def("resetStats", &resetStats);
+  m.def("getStats", []() { return statsDict(&getStats); });
+
+  // logging, progress and cancellation of the OpenCL engine (levels LOG_NONE ... LOG_DEBUG)
+  m.def("setLogLevel", &setLogLevel, py::arg("level"));
+  m.def("setProgressCallback", [](py::object callback) { setPythonProgress(&setProgressCallback, callback); }, py::arg("callback"));
+  m.def("setCancelled", &setCancelled, py::arg("cancelled"));
+
+  // Wiener first guess of OpenCLEngine.deconv (0 off), with 0 iterations deconv returns the Wiener preview
+  m.def("setWarmStart", &setWarmStart, py::arg("regularization"));
+
+  // RL-TV weight of OpenCLEngine.deconv (0 plain RL)
+  m.def("setTVRegularization", &setTVRegularization, py::arg("lambda"));
+
+#endif
+
+#ifdef OPS_MKL
+  py::class_<MKLEngine>(m, "MKLEngine")
+    .def(py::init<>())
+    .def("deconv", &MKLEngine::deconv, py::arg("image"), py::arg("psf"), py::arg("iterations"),
+        py::arg("shape") = py::none(), py::arg("normal") = py::none(), py::arg("out") = py::none())
+    .def("deconv_roi", &MKLEngine::deconv_roi, py::arg("image"), py::arg("psf"), py::arg("iterations"), py::arg("start"),
+        py::arg("size"), py::arg("out") = py::none());
+
+  m.def("mklGetFastSize", &mklGetFastSize, py::arg("n"));
+
+  py::class_<MKLState>(m, "MKLState")
+    .def_static("create", &MKLState::create, py::arg("algorithm"), py::arg("image"), py::arg("psf"), py::arg("estimate"),
+        py::arg("normal") = py::none(), py::arg("lam") = 0.f, py::arg("path") = py::none())
+    .def_static("open", &MKLState::open, py::arg("path"))
+    .def("run", &MKLState::run, py::arg("iterations"), py::arg("snapshot_every") = 0, py::arg("callback") = py::none())
+    .def_property_readonly("estimate", &MKLState::estimate)
+    .def_property_readonly("iterations", &MKLState::iterations)
+    .def("sync", &MKLState::sync)
+    .def("close", &MKLState::close);
+
+  m.attr("DECONV_STATE_RL") = DECONV_STATE_RL;
+  m.attr("DECONV_STATE_FISTA") = DECONV_STATE_FISTA;
+
+  m.def("mklGetPeakMemory", &mklGetPeakMemory);
+
+  m.def("mklEnableStats", &mklEnableStats, py::arg("level"));
+  m.def("mklResetStats", &mklResetStats);
+  m.def("mklGetStats", []() { return statsDict(&mklGetStats); });
+
+  m.def("mklSetLogLevel", &mklSetLogLevel, py::arg("level"));
+  m.def("mklSetProgressCallback", [](py::object callback) { setPythonProgress(&mklSetProgressCallback, callback); }, py::arg("callback"));
+  m.def("mklSetCancelled", &mklSetCancelled, py::arg("cancelled"));
+
+  m.def("mklSetNumThreads", &mklSetNumThreads, py::arg("threads"));
+
+  // Wiener first guess of MKLEngine.deconv (0 off), with 0 iterations deconv returns the Wiener preview
+  m.def("mklSetWarmStart", &mklSetWarmStart, py::arg("regularization"));
+
+  // RL-TV weight of MKLEngine.deconv (0 plain RL)
+  m.def("mklSetTVRegularization", &mklSetTVRegularization, py::arg("lambda"));
+
+  // coarse to fine MKLEngine.deconv, the first iterations binned by factor (2 or 4, 1 off)
+  m.def("mklSetMultiresolution", &mklSetMultiresolution, py::arg("factor"), py::arg("iterations"));
+  m.def("mklGetPointwiseKernels", &mklGetPointwiseKernels);
+#endif
+
+  m.attr("STATS_OFF") = STATS_OFF;
+  m.attr("STATS_COUNTERS") = STATS_COUNTERS;
+  m.attr("STATS_PHASES") = STATS_PHASES;
+
+  m.attr("LOG_NONE") = LOG_NONE;
+  m.attr("LOG_ERROR") = LOG_ERROR;
+  m.attr("LOG_INFO") = LOG_INFO;
+  m.attr("LOG_DEBUG") = LOG_DEBUG;
+}
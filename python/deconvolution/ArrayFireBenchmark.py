@@ -0,0 +1,106 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Richardson Lucy timing of the ArrayFire backends (CPU, CUDA, OpenCL, whichever the unified library finds) and
+the MKL engine on the same synthetic stacks, to pick the fastest engine for a node type.
+
+Needs libarrayfiredecon.so (the unified backend build, the per backend libraries can't switch) and optionally
+libMKLFFTW.so on the library path.  Prints a table and writes the results to ArrayFireBenchmark.csv
+"""
+
+from ctypes import *
+import numpy as np
+import numpy.ctypeslib as npct
+import csv
+import platform
+import time
+import ArrayFireUtility
+
+iterations=50
+repeats=3
+
+# (z, y, x), FFT friendly so both engines run without padding
+sizes=[(32,128,128), (64,256,256), (128,256,256), (64,512,512)]
+
+def syntheticStack(shape, seed=42):
+    ''' sparse points blurred by a Gaussian PSF with Poisson noise, returns the image and the shifted PSF '''
+    rng=np.random.RandomState(seed)
+
+    truth=np.zeros(shape, dtype=np.float32)
+    n=int(np.prod(shape))//1000
+    truth[tuple(rng.randint(0, s, n) for s in shape)]=1000
+
+    # Gaussian PSF centered at 0,0,0 (wrapped), sigma 2 pixels in xy and 4 in z
+    grids=np.meshgrid(*[np.fft.fftfreq(s)*s for s in shape], indexing='ij')
+    psf=np.exp(-(grids[0]**2/(2*4.**2)+grids[1]**2/(2*2.**2)+grids[2]**2/(2*2.**2)))
+    psf=(psf/psf.sum()).astype(np.float32)
+
+    img=np.fft.irfftn(np.fft.rfftn(truth)*np.fft.rfftn(psf), s=shape, axes=(0, 1, 2))
+    img=rng.poisson(np.maximum(img, 0)+10).astype(np.float32)
+
+    return img, psf
+
+def timeRun(run, img):
+    ''' best time of repeats runs of run(estimate), after a warm up (program builds, JIT and plans) '''
+    estimate=img.copy()
+    run(1, estimate)
+
+    best=float('inf')
+    for r in range(repeats):
+        estimate=img.copy()
+        start=time.time()
+        run(iterations, estimate)
+        best=min(best, time.time()-start)
+
+    return best, estimate
+
+libaf=ArrayFireUtility.getArrayFire('libarrayfiredecon.so')
+backends=ArrayFireUtility.availableBackends(libaf)
+
+try:
+    libmkl=CDLL('libMKLFFTW.so', mode=RTLD_GLOBAL)
+    array_3d_float = npct.ndpointer(dtype=np.float32, ndim=3 , flags='CONTIGUOUS')
+    libmkl.mklRichardsonLucy3D.argtypes = [c_int, array_3d_float, array_3d_float, array_3d_float, c_int, c_int, c_int, c_void_p]
+    libmkl.mklGetPeakMemory.argtypes = [c_int, c_int, c_int]
+    libmkl.mklGetPeakMemory.restype = c_longlong
+except OSError:
+    libmkl=None
+    print('libMKLFFTW.so not found, skipping MKL')
+
+results=[]
+
+for shape in sizes:
+    img, psf=syntheticStack(shape)
+    (nz, ny, nx)=shape
+
+    reference=None
+
+    if libmkl is not None:
+        run=lambda it, est: libmkl.mklRichardsonLucy3D(it, img, psf, est, nz, ny, nx, None)
+        seconds, reference=timeRun(run, img)
+        results.append(['mkl', shape, seconds, libmkl.mklGetPeakMemory(nz, ny, nx), 0.])
+
+    for backend in backends:
+        if libaf.setBackend(backend)!=0:
+            continue
+
+        run=lambda it, est: libaf.deconv(it, nx, ny, nz, img, psf, est, None)
+        seconds, estimate=timeRun(run, img)
+
+        # max difference to MKL relative to its max, the engines should agree to float precision
+        diff=0. if reference is None else float(np.abs(estimate-reference).max()/reference.max())
+        results.append(['arrayfire '+ArrayFireUtility.backendNames[backend], shape, seconds, libaf.getPeakMemory(nx, ny, nz, 0), diff])
+
+libaf.setBackend(ArrayFireUtility.BACKEND_DEFAULT)
+
+print()
+print(platform.node(), platform.processor())
+print('{:<20} {:<16} {:>12} {:>14} {:>12}'.format('engine', 'size', 'ms/iteration', 'peak MB', 'rel diff'))
+for (engine, shape, seconds, peak, diff) in results:
+    print('{:<20} {:<16} {:>12.2f} {:>14.1f} {:>12.2e}'.format(engine, 'x'.join(map(str, shape)), 1000*seconds/iterations, peak/2**20, diff))
+
+with open('ArrayFireBenchmark.csv', 'w', newline='') as f:
+    writer=csv.writer(f)
+    writer.writerow(['node', 'engine', 'z', 'y', 'x', 'iterations', 'seconds', 'peak_bytes', 'rel_diff'])
+    for (engine, shape, seconds, peak, diff) in results:
+        writer.writerow([platform.node(), engine]+list(shape)+[iterations, seconds, peak, diff])
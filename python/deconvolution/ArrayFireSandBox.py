@@ -48,10 +48,22 @@ lib=ArrayFireUtility.getArrayFire()
 lib.conv2(img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, out2);
 plt.imshow(out2.max(axis=0))
 
+print('peak memory',lib.getPeakMemory(img.shape[2], img.shape[1], img.shape[0], 0))
+
 start=time.time()
 
-lib.deconv(60, img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconv, deconv);
+lib.deconv(60, img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconv, None);
 
 end=time.time()
 print(end-start)
 plt.imshow(deconv.max(axis=0))
+
+# batch of 4 copies of the image, each volume should match the single volume result
+batch=np.stack([img]*4)
+deconvBatch=np.copy(batch)
+
+start=time.time()
+lib.deconv_batch(60, img.shape[2], img.shape[1], img.shape[0], batch.shape[0], batch, shifted_psf, deconvBatch, None);
+end=time.time()
+print('batch of',batch.shape[0],end-start)
+print('max difference to single volume',np.abs(deconvBatch-deconv).max())
@@ -14,24 +14,65 @@ https://github.com/koschink/PyYacuDecu
 from ctypes import *
 import numpy as np
 import numpy.ctypeslib as npct
+import ProgressUtility
+import StatsUtility
 
-def getArrayFire():
+# backends, the values of af_backend
+BACKEND_DEFAULT=0
+BACKEND_CPU=1
+BACKEND_CUDA=2
+BACKEND_OPENCL=4
+
+backendNames={BACKEND_CPU:'cpu', BACKEND_CUDA:'cuda', BACKEND_OPENCL:'opencl'}
+
+def getArrayFire(libName='libarrayfiredecon_opencl.so'):
+    ''' load the decon library, use libarrayfiredecon.so (the unified backend) to switch backends with setBackend '''
     print('getArrayFire')
     # load library
-    lib=CDLL('libarrayfiredecon_opencl.so', mode=RTLD_GLOBAL)
+    lib=CDLL(libName, mode=RTLD_GLOBAL)
     
     array_3d_float = npct.ndpointer(dtype=np.float32, ndim=3 , flags='CONTIGUOUS')
     array_1d_float = npct.ndpointer(dtype=np.float32, ndim=1 , flags='CONTIGUOUS')
     
     lib.arrayTest.argtypes = [c_int, array_1d_float];
-    lib.conv.argtypes = [c_int, c_int, c_int, array_3d_float, array_3d_float, array_3d_float]
-    lib.conv2.argtypes = [c_int, c_int, c_int, array_3d_float, array_3d_float, array_3d_float]
-    lib.deconv.argtypes = [c_int, c_int, c_int, c_int, array_3d_float, array_3d_float, array_3d_float, array_3d_float]
+    lib.conv.argtypes = [c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float]
+    lib.conv2.argtypes = [c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float]
+    # the normal is optional (None or normal.ctypes.data)
+    lib.deconv.argtypes = [c_int, c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float, c_void_p]
+    # peak device bytes of deconv (counted from the arrays of the iterations, last argument 1 with a normal)
+    lib.getPeakMemory.argtypes = [c_size_t, c_size_t, c_size_t, c_int]
+    lib.getPeakMemory.restype = c_longlong
+    
+    # batches of volumes, images and estimates are (M, N3, N2, N1) stacks, the PSF and normal are one volume
+    array_4d_float = npct.ndpointer(dtype=np.float32, ndim=4 , flags='CONTIGUOUS')
+    lib.deconv_batch.argtypes = [c_int, c_size_t, c_size_t, c_size_t, c_size_t, array_4d_float, array_3d_float, array_4d_float, c_void_p]
+    lib.getPeakMemoryBatch.argtypes = [c_size_t, c_size_t, c_size_t, c_size_t, c_int]
+    lib.getPeakMemoryBatch.restype = c_longlong
+    
+    # backend and device selection, the setters return 0 or the ArrayFire error code
+    lib.getBackends.restype = c_int
+    lib.getActiveBackend.restype = c_int
+    lib.setBackend.argtypes = [c_int]
+    lib.setBackend.restype = c_int
+    lib.getDeviceCount.restype = c_int
+    lib.setDevice.argtypes = [c_int]
+    lib.setDevice.restype = c_int
+    
+    # statistics (see StatsUtility)
+    StatsUtility.setStatsArgtypes(lib)
+
+    # logging, progress and cancellation (see ProgressUtility)
+    ProgressUtility.setControlArgtypes(lib)
     
     #lib.test()
     
     print('gotarrayfire!!')
     
     return lib
+
+def availableBackends(lib):
+    ''' the backends (BACKEND_CPU, BACKEND_CUDA, BACKEND_OPENCL) the library can switch to '''
+    bits=lib.getBackends()
+    return [b for b in (BACKEND_CPU, BACKEND_CUDA, BACKEND_OPENCL) if bits & b]
     
     
\ No newline at end of file
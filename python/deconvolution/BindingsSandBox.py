@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+opsdeconv bindings (python/bindings): non-circulant RL straight from the unpadded image and centered PSF, 
+and concurrent deconvolutions of the time points of a stack from Python threads, one engine per thread
+"""
+
+from skimage import io
+import numpy as np
+import threading
+import time
+import opsdeconv
+import DeconUtility
+
+iterations=100
+
+# open image and psf
+imgName='/home/bnorthan/code/images/Bars-G10-P15-stack-cropped.tif'
+psfName='/home/bnorthan/code/images/PSF-Bars-stack-cropped.tif'
+
+img=io.imread(imgName).astype('float32')
+psf=io.imread(psfName).astype('float32')
+psf=psf/psf.sum()
+
+# extend by the PSF size, the engine centers the image and wraps the PSF (no padNDImage or ifftshift)
+extDims=DeconUtility.nextPow2(DeconUtility.getPadSize(img, psf))
+
+engine=opsdeconv.OpenCLEngine()
+print(engine.name, 'peak memory', opsdeconv.getPeakMemory(extDims[2], extDims[1], extDims[0], 2))
+
+start=time.time()
+result=engine.deconv(img, psf, iterations, shape=extDims)
+print('non-circulant', time.time()-start)
+
+# a stack of time points, every other plane of each, deconvolved from two threads without copying the views
+stack=np.stack([img]*4)
+results=[None]*stack.shape[0]
+
+def worker(engine, timepoints):
+    for t in timepoints:
+        results[t]=engine.deconv(stack[t, ::2], psf[::2], iterations, shape=DeconUtility.nextPow2(stack[t, ::2].shape))
+
+engines=[opsdeconv.OpenCLEngine(), opsdeconv.OpenCLEngine()]
+threads=[threading.Thread(target=worker, args=(engines[i], range(i, stack.shape[0], 2))) for i in range(2)]
+
+start=time.time()
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
+print('4 time points on 2 threads', time.time()-start)
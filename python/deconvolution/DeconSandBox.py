@@ -59,7 +59,7 @@ libcl=OpenCLDeconvUtility.getArrayFire()
 deconcl=img.copy()
 
 start=time.time()
-libcl.deconv(100,img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconcl, img);
+libcl.deconv(100,img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconcl, normal);
 end=time.time()
 cvtime=end-start
 print('cl time', end-start)
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+The unified C API (libdeconvolver, ops-experiments-common/native/deconvolver) over the native engines.  It loads
+whichever engine libraries are on the library path and picks the fastest available (or the one named, or the
+one in OPS_DECONVOLVER).
+
+    lib=DeconvolverUtility.getDeconvolver()
+    print(DeconvolverUtility.availableBackends(lib))
+    d=DeconvolverUtility.Deconvolver(lib)
+    d.plan(img.shape)
+    d.setPSF(shifted_psf)
+    estimate=img.copy()
+    d.run(100, img, estimate)
+
+Volumes are contiguous float32 arrays of the planned shape (z, y, x), the PSF is extended to that shape and
+shifted (its center at the origin), like the engines' own APIs take it.
+"""
+
+from ctypes import *
+import numpy as np
+import numpy.ctypeslib as npct
+import ProgressUtility
+
+# return codes besides the engines' own (and ProgressUtility.DECONV_CANCELLED)
+DECONVOLVER_SUCCESS=0
+DECONVOLVER_NO_BACKEND=-1001
+DECONVOLVER_NOT_PLANNED=-1002
+DECONVOLVER_NO_PSF=-1003
+DECONVOLVER_BAD_SIZE=-1004
+DECONVOLVER_PLAN_FAILED=-1005
+
+def getDeconvolver(name='libdeconvolver.so'):
+    lib=CDLL(name, mode=RTLD_GLOBAL)
+
+    array_3d_float = npct.ndpointer(dtype=np.float32, ndim=3 , flags='CONTIGUOUS')
+
+    lib.getDeconvolverBackendName.argtypes = [c_int]
+    lib.getDeconvolverBackendName.restype = c_char_p
+    lib.isDeconvolverBackendAvailable.argtypes = [c_int]
+    lib.createDeconvolver.argtypes = [c_char_p]
+    lib.createDeconvolver.restype = c_void_p
+    lib.releaseDeconvolver.argtypes = [c_void_p]
+    lib.getDeconvolverName.argtypes = [c_void_p]
+    lib.getDeconvolverName.restype = c_char_p
+    lib.deconvolverPlan.argtypes = [c_void_p, c_size_t, c_size_t, c_size_t]
+    lib.deconvolverSetPSF.argtypes = [c_void_p, array_3d_float]
+    lib.deconvolverRun.argtypes = [c_void_p, c_int, array_3d_float, array_3d_float, c_void_p]
+    lib.deconvolverConvolve.argtypes = [c_void_p, array_3d_float, array_3d_float, c_int]
+    lib.deconvolverGetPeakMemory.argtypes = [c_void_p, c_int]
+    lib.deconvolverGetPeakMemory.restype = c_longlong
+    lib.deconvolverSetLogLevel.argtypes = [c_void_p, c_int]
+    lib.deconvolverSetProgressCallback.argtypes = [c_void_p, ProgressUtility.ProgressCallback, c_void_p]
+    lib.deconvolverSetCancelled.argtypes = [c_void_p, c_int]
+    lib.deconvolverEnableStats.argtypes = [c_void_p, c_int]
+    lib.deconvolverResetStats.argtypes = [c_void_p]
+    lib.deconvolverGetStats.argtypes = [c_void_p, npct.ndpointer(dtype=np.float64, ndim=1, flags='CONTIGUOUS'), c_int]
+    lib.setDeconvolverLogLevel.argtypes = [c_int]
+
+    return lib
+
+def backends(lib):
+    ''' names of the registered backends, fastest first '''
+    return [lib.getDeconvolverBackendName(i).decode() for i in range(lib.getNumDeconvolverBackends())]
+
+def availableBackends(lib):
+    ''' names of the backends whose library and device were found '''
+    return [name for (i, name) in enumerate(backends(lib)) if lib.isDeconvolverBackendAvailable(i)]
+
+class Deconvolver:
+    ''' a deconvolver on the named backend, or the fastest available '''
+
+    def __init__(self, lib, backend=None):
+        self.lib=lib
+        self.handle=lib.createDeconvolver(backend.encode() if backend else None)
+
+        if not self.handle:
+            raise RuntimeError('no deconvolver backend '+(backend or '')+' available')
+
+        self.name=lib.getDeconvolverName(self.handle).decode()
+
+    def __del__(self):
+        if getattr(self, 'handle', None):
+            self.lib.releaseDeconvolver(self.handle)
+
+    def check(self, ret, what):
+        if ret!=DECONVOLVER_SUCCESS:
+            raise RuntimeError(what+' on '+self.name+' failed with '+str(ret))
+
+    def plan(self, shape):
+        self.check(self.lib.deconvolverPlan(self.handle, *shape), 'plan')
+
+    def setPSF(self, psf):
+        self.check(self.lib.deconvolverSetPSF(self.handle, psf), 'setPSF')
+
+    def run(self, iterations, image, estimate, normal=None):
+        ''' RL from the first guess in estimate, returns 0 or ProgressUtility.DECONV_CANCELLED '''
+        if normal is not None:
+            normal=np.ascontiguousarray(normal, dtype=np.float32)
+
+        normalPointer=None if normal is None else normal.ctypes.data_as(c_void_p)
+        ret=self.lib.deconvolverRun(self.handle, iterations, image, estimate, normalPointer)
+
+        if ret!=ProgressUtility.DECONV_CANCELLED:
+            self.check(ret, 'run')
+
+        return ret
+
+    def convolve(self, image, out, correlate=False):
+        self.check(self.lib.deconvolverConvolve(self.handle, image, out, 1 if correlate else 0), 'convolve')
+
+    def getPeakMemory(self, normal=False):
+        return self.lib.deconvolverGetPeakMemory(self.handle, 1 if normal else 0)
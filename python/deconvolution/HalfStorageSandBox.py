@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Accuracy and timing of half precision storage (setStorageMode / mklRichardsonLucy3DHalf) 
+compared to float storage, for the Bars test image
+"""
+
+from ctypes import *
+from skimage import io
+import numpy as np
+import numpy.ctypeslib as npct
+import time
+import OpenCLDeconvUtility
+import DeconUtility
+
+iterations=100
+
+def report(name, reference, result, reftime, time):
+    ''' print the difference of result to the float storage reference '''
+    diff=np.abs(result-reference)
+    # relative error where the reference is above 1% of its max, the background isn't meaningful
+    mask=reference>0.01*reference.max()
+    rel=diff[mask]/reference[mask]
+    print(name, 'max abs', diff.max(), 'max rel', rel.max(), 'mean rel', rel.mean())
+    print(name, 'float time', reftime, 'half time', time)
+
+# open image and psf
+imgName='/home/bnorthan/code/images/Bars-G10-P15-stack-cropped.tif'
+psfName='/home/bnorthan/code/images/PSF-Bars-stack-cropped.tif'
+
+img=io.imread(imgName)
+psf=io.imread(psfName)
+
+extDims=DeconUtility.nextPow2(img.shape)
+
+img=img.astype('float32')
+psf=psf.astype('float64')
+psf=psf/psf.sum();
+psf=psf.astype('float32')
+
+(img, padding)=DeconUtility.padNDImage(img, extDims, 'reflect')
+(psf, padding)=DeconUtility.padNDImage(psf, extDims, 'constant')
+
+shifted_psf = np.fft.ifftshift(psf)
+normal=np.ones(img.shape).astype('float32')
+
+# OpenCL
+libcl=OpenCLDeconvUtility.getArrayFire()
+
+deconFloat=img.copy()
+libcl.setStorageMode(0)
+start=time.time()
+libcl.deconv(iterations, img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconFloat, normal)
+floattime=time.time()-start
+
+deconHalf=img.copy()
+libcl.setStorageMode(1)
+start=time.time()
+libcl.deconv(iterations, img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconHalf, normal)
+halftime=time.time()-start
+libcl.setStorageMode(0)
+
+report('opencl', deconFloat, deconHalf, floattime, halftime)
+
+# MKL, if the library was built as a shared library
+try:
+    libmkl=CDLL('libMKLFFTW.so', mode=RTLD_GLOBAL)
+except OSError:
+    libmkl=None
+    print('libMKLFFTW.so not found, skipping MKL')
+
+if libmkl is not None:
+    array_3d_float = npct.ndpointer(dtype=np.float32, ndim=3 , flags='CONTIGUOUS')
+    array_3d_half = npct.ndpointer(dtype=np.uint16, ndim=3 , flags='CONTIGUOUS')
+    
+    libmkl.mklRichardsonLucy3D.argtypes = [c_int, array_3d_float, array_3d_float, array_3d_float, c_int, c_int, c_int, array_3d_float]
+    libmkl.mklRichardsonLucy3DHalf.argtypes = [c_int, array_3d_half, array_3d_float, array_3d_float, c_int, c_int, c_int, array_3d_half]
+    
+    # the native conversion rounds the same way as numpy
+    imgHalf=img.astype(np.float16).view(np.uint16)
+    normalHalf=normal.astype(np.float16).view(np.uint16)
+    
+    deconFloat=img.copy()
+    start=time.time()
+    libmkl.mklRichardsonLucy3D(iterations, img, shifted_psf, deconFloat, img.shape[0], img.shape[1], img.shape[2], normal)
+    floattime=time.time()-start
+    
+    deconHalf=img.copy()
+    start=time.time()
+    libmkl.mklRichardsonLucy3DHalf(iterations, imgHalf, shifted_psf, deconHalf, img.shape[0], img.shape[1], img.shape[2], normalHalf)
+    halftime=time.time()-start
+    
+    report('mkl', deconFloat, deconHalf, floattime, halftime)
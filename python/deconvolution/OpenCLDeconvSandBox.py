@@ -57,16 +57,18 @@ shifted_psf = np.fft.ifftshift(psf)
 
 deconcl=img.copy()
 deconaf=img.copy()
+# normal of ones (no edge correction)
+normal=np.ones(img.shape).astype('float32')
 
 #lib.conv(img.shape[0], img.shape[1], img.shape[2], img, shifted_psf, out2);
 start=time.time()
-libaf.deconv(100,img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconaf, img);
+libaf.deconv(100,img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconaf, normal);
 end=time.time()
 aftime=end-start
 print('af time', aftime)
 
 start=time.time()
-libcl.deconv(100,img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconcl, img);
+libcl.deconv(100,img.shape[2], img.shape[1], img.shape[0], img, shifted_psf, deconcl, normal);
 end=time.time()
 cltime=end-start
 print('cl time', cltime)
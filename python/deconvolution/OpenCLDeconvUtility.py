@@ -14,24 +14,83 @@ https://github.com/koschink/PyYacuDecu
 from ctypes import *
 import numpy as np
 import numpy.ctypeslib as npct
+import ProgressUtility
+import StatsUtility
 
 def getArrayFire():
     print('getArrayFire')
     # load library
     lib=CDLL('libopencldeconv.so', mode=RTLD_GLOBAL)
     
+    array_4d_float = npct.ndpointer(dtype=np.float32, ndim=4 , flags='CONTIGUOUS')   
     array_3d_float = npct.ndpointer(dtype=np.float32, ndim=3 , flags='CONTIGUOUS')   
     array_2d_float = npct.ndpointer(dtype=np.float32, ndim=2 , flags='CONTIGUOUS')
     array_1d_float = npct.ndpointer(dtype=np.float32, ndim=1 , flags='CONTIGUOUS')
     
     #lib.arrayTest.argtypes = [c_int, array_1d_float];
-    lib.conv.argtypes = [c_int, c_int, c_int, array_3d_float, array_3d_float, array_3d_float]
-    lib.fft2d.argtypes = [c_int, c_int, array_2d_float, array_2d_float]
-    lib.fftinv2d.argtypes = [c_int, c_int, array_2d_float, array_2d_float]
-    lib.deconv.argtypes = [c_int, c_int, c_int, c_int, array_3d_float, array_3d_float, array_3d_float, array_3d_float]
+    lib.conv.argtypes = [c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float]
+    lib.fft2d.argtypes = [c_size_t, c_size_t, array_2d_float, array_2d_float]
+    lib.fftinv2d.argtypes = [c_size_t, c_size_t, array_2d_float, array_2d_float]
+    # batched 2D FFT of all planes of a stack (N0, N1, numPlanes), the FFT has shape (numPlanes, N1, N0/2+1) complex 
+    lib.fft2d_batch.argtypes = [c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float]
+    lib.fftinv2d_batch.argtypes = [c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float]
+    lib.deconv.argtypes = [c_int, c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float, array_3d_float]
+    lib.deconv_noncirculant.argtypes = [c_int, c_size_t, c_size_t, c_size_t, c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float]
+    
+    # one pass Wiener preview (regularization relative to the OTF at 0, ~1e-3 to 1e-2), and the same estimate as 
+    # the first guess of the RL entry points (0 off)
+    lib.wiener.argtypes = [c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float, c_float]
+    lib.setWarmStart.argtypes = [c_float]
+    
+    # RL-TV weight of the RL entry points (~0.001 to 0.01, 0 plain RL)
+    lib.setTVRegularization.argtypes = [c_float]
+    
+    # coarse to fine RL, the first iterations of deconv on the image binned by factor (2 or 4, 1 off)
+    lib.setMultiresolution.argtypes = [c_int, c_int]
+    
+    # zero copy host memory (0 copy to device, 1 auto, 2 always zero copy)
+    lib.setHostMemoryMode.argtypes = [c_int]
+    lib.allocHostBuffer.argtypes = [c_size_t]
+    lib.allocHostBuffer.restype = POINTER(c_float)
+    lib.freeHostBuffer.argtypes = [POINTER(c_float)]
+    
+    # storage of the observed image and normal (0 float, 1 half)
+    lib.setStorageMode.argtypes = [c_int]
+    
+    # peak device bytes of deconv for the current modes (flags 1 normal, 2 non-circulant, 4 caller buffers)
+    lib.getPeakMemory.argtypes = [c_size_t, c_size_t, c_size_t, c_int]
+    lib.getPeakMemory.restype = c_longlong
+    
+    # multi device scheduler, images and estimates are stacks of volumes (numVolumes, N2, N1, N0), 
+    # the normal is optional (None or normal.ctypes.data)
+    lib.getNumOpenCLDevices.restype = c_int
+    lib.getOpenCLDeviceName.argtypes = [c_int, c_char_p, c_size_t]
+    lib.setOpenCLDeviceEnabled.argtypes = [c_int, c_int]
+    lib.getOpenCLDeviceThroughput.argtypes = [c_int]
+    lib.getOpenCLDeviceThroughput.restype = c_double
+    lib.deconv_multidevice.argtypes = [c_int, c_size_t, c_size_t, c_size_t, c_size_t, array_4d_float, array_3d_float, array_4d_float, c_void_p]
+    
+    # statistics (see StatsUtility)
+    StatsUtility.setStatsArgtypes(lib)
+
+    # logging, progress and cancellation (see ProgressUtility)
+    ProgressUtility.setControlArgtypes(lib)
     
     print('gotarrayfire!!')
     
     return lib
-    
-    
\ No newline at end of file
+
+def alignedEmpty(lib, shape):
+    ''' allocate a float32 array aligned for zero copy (release with lib.freeHostBuffer(arr.ctypes.data_as(POINTER(c_float)))) '''
+    n=int(np.prod(shape))
+    buffer=lib.allocHostBuffer(n)
+    return npct.as_array(buffer, shape=shape)
+
+def deviceNames(lib):
+    ''' names of all OpenCL devices seen by the multi device scheduler '''
+    names=[]
+    for d in range(lib.getNumOpenCLDevices()):
+        name=create_string_buffer(256)
+        lib.getOpenCLDeviceName(d, name, 256)
+        names.append(name.value.decode())
+    return names
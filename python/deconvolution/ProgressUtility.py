@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Logging, progress and cancellation of the native engines (setLogLevel, setProgressCallback and setCancelled, 
+mklSetLogLevel... in libMKLFFTW), the same levels and codes in every library (see deconv.h, opencldeconv.h, 
+arrayfiredecon.h and MKLFFTW.h).
+
+    lib=YacuDecuUtility.getYacuDecu()
+    lib.setLogLevel(ProgressUtility.LOG_INFO)
+    ProgressUtility.setProgressCallback(lib, lambda i, n: print(i, 'of', n))
+    ret=lib.deconv_device(...)   # ProgressUtility.DECONV_CANCELLED if cancelled
+
+The callback runs on the thread of the deconvolution (the device worker threads for deconv_multidevice), returning
+True from it cancels that run.  lib.setCancelled(1) from any thread cancels running and later runs after their 
+current iteration until lib.setCancelled(0).
+"""
+
+from ctypes import *
+
+# log levels, errors (the default) go to stderr
+LOG_NONE=0
+LOG_ERROR=1
+LOG_INFO=2
+LOG_DEBUG=3
+
+# returned by the RL entry points when a run was cancelled, the estimate holds the last finished iteration
+DECONV_CANCELLED=-2000
+
+# int callback(int iteration, int iterations, void * user)
+ProgressCallback=CFUNCTYPE(c_int, c_int, c_int, c_void_p)
+
+def controlFunction(lib, name, prefix=''):
+    ''' lib.name, or lib.prefixName for a prefixed library (mklSetLogLevel) '''
+    return getattr(lib, prefix+name[0].upper()+name[1:] if prefix else name)
+
+def setControlArgtypes(lib, prefix=''):
+    ''' argtypes of the logging, progress and cancellation functions, prefix 'mkl' for libMKLFFTW '''
+    controlFunction(lib, 'setLogLevel', prefix).argtypes = [c_int]
+    controlFunction(lib, 'setProgressCallback', prefix).argtypes = [ProgressCallback, c_void_p]
+    controlFunction(lib, 'setCancelled', prefix).argtypes = [c_int]
+
+def setProgressCallback(lib, callback, prefix=''):
+    ''' callback(iteration, iterations), a true return cancels the run, None removes it '''
+    if callback is None:
+        wrapped=cast(None, ProgressCallback)
+    else:
+        wrapped=ProgressCallback(lambda iteration, iterations, user: 1 if callback(iteration, iterations) else 0)
+
+    controlFunction(lib, 'setProgressCallback', prefix)(wrapped, None)
+
+    # the library keeps the pointer, so keep the ctypes object alive with it
+    setattr(lib, '_'+prefix+'progressCallback', wrapped)
@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Statistics of the native engines (enableStats, resetStats and getStats, mklEnableStats... in libMKLFFTW), the 
+same levels and indices in every library (see deconv.h, opencldeconv.h, arrayfiredecon.h and MKLFFTW.h).
+
+    lib=YacuDecuUtility.getYacuDecu()
+    lib.enableStats(StatsUtility.STATS_PHASES)
+    ... deconv calls ...
+    print(StatsUtility.getStats(lib))
+"""
+
+from ctypes import *
+import numpy as np
+import numpy.ctypeslib as npct
+
+# levels, off (the default), counters and total time, and per phase times (synchronizes after every phase)
+STATS_OFF=0
+STATS_COUNTERS=1
+STATS_PHASES=2
+
+# names of the values in the order of the STATS_ indices
+statsNames=['plan_seconds', 'otf_seconds', 'fft_seconds', 'pointwise_seconds', 'transfer_seconds', 'total_seconds',
+            'calls', 'iterations', 'ffts', 'bytes_to_device', 'bytes_from_device', 'peak_bytes']
+
+def statsFunction(lib, name, prefix=''):
+    ''' lib.name, or lib.prefixName for a prefixed library (mklGetStats) '''
+    return getattr(lib, prefix+name[0].upper()+name[1:] if prefix else name)
+
+def setStatsArgtypes(lib, prefix=''):
+    ''' argtypes of the statistics functions, prefix 'mkl' for libMKLFFTW '''
+    statsFunction(lib, 'enableStats', prefix).argtypes = [c_int]
+    statsFunction(lib, 'getStats', prefix).argtypes = [npct.ndpointer(dtype=np.float64, ndim=1, flags='CONTIGUOUS'), c_int]
+    statsFunction(lib, 'getStats', prefix).restype = c_int
+
+def getStats(lib, prefix=''):
+    ''' the statistics since the last reset as a dict, keys from statsNames '''
+    values=np.zeros(len(statsNames))
+    n=statsFunction(lib, 'getStats', prefix)(values, len(values))
+    return dict(zip(statsNames[:n], values[:n].tolist()))
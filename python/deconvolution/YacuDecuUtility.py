@@ -14,6 +14,8 @@ https://github.com/koschink/PyYacuDecu
 from ctypes import *
 import numpy as np
 import numpy.ctypeslib as npct
+import ProgressUtility
+import StatsUtility
 
 def getYacuDecu():
     print('getYacuDecu')
@@ -22,10 +24,27 @@ def getYacuDecu():
     
     array_3d_float = npct.ndpointer(dtype=np.float32, ndim=3 , flags='CONTIGUOUS')
     
-    lib.deconv_device.argtypes = [c_int, c_int,c_int,c_int, array_3d_float, array_3d_float, array_3d_float, array_3d_float];
-    lib.conv_device.argtypes = [c_int,c_int,c_int, array_3d_float, array_3d_float, array_3d_float, c_int];
+    lib.deconv_device.argtypes = [c_int, c_size_t,c_size_t,c_size_t, array_3d_float, array_3d_float, array_3d_float, array_3d_float];
+    lib.conv_device.argtypes = [c_size_t,c_size_t,c_size_t, array_3d_float, array_3d_float, array_3d_float, c_int];
     lib.getTotalMem.restype=c_longlong
-    lib.removeSmallValues.argtypes = [array_3d_float, c_int]
+    # peak memory of deconv_device (mode 0, 1 with a normal), conv_device (2) and deconv_stream (3)
+    lib.getPeakMemory.argtypes = [c_size_t, c_size_t, c_size_t, c_int]
+    lib.getPeakMemory.restype=c_longlong
+    lib.removeSmallValues.argtypes = [array_3d_float, c_longlong]
+    lib.deconv_stream.argtypes = [c_int, c_size_t, c_size_t, c_size_t, array_3d_float, array_3d_float, array_3d_float, array_3d_float];
+    
+    # memory budget of deconv_stream, only in the CPU build (YacuDecuCPU)
+    if hasattr(lib, 'setMemoryBudget'):
+        lib.setMemoryBudget.argtypes = [c_longlong]
+        lib.setScratchDirectory.argtypes = [c_char_p]
+        lib.getStreamWorkSize.argtypes = [c_size_t, c_size_t, c_size_t]
+        lib.getStreamWorkSize.restype = c_longlong
+    
+    # statistics (see StatsUtility)
+    StatsUtility.setStatsArgtypes(lib)
+
+    # logging, progress and cancellation (see ProgressUtility)
+    ProgressUtility.setControlArgtypes(lib)
     
     print('gotYacuDecu!!')
     